@@ -13,7 +13,15 @@ in vec3 position_in_;
 // The scale of the background
 uniform vec3 scale_ = vec3(1.0);
 
-uniform mat4 mvp_;
+// Camera, shared by all the programs (c.f. msg::FrameUniforms)
+layout(std140) uniform FrameBlock {
+  mat4 mvp_;
+  mat4 mv_;
+  mat4 p_;
+  vec4 camera_eye_world_;
+  vec4 camera_up_world_;
+  vec4 camera_right_world_;
+};
 
 out vec4 color_ex_;
 out vec2 coords_;
@@ -2,28 +2,42 @@
 
 /**
  *
+ * One instance per billboard, the quad is a 4 vertex triangle strip built
+ * from gl_VertexID (c.f. msg::BillboardSet).
  *
  */
 
-// Can probably get rid of this matrix
-uniform mat4 mvp_;
-uniform mat4 inv_mv_;
+// Camera, shared by all the programs (c.f. msg::FrameUniforms)
+layout(std140) uniform FrameBlock {
+  mat4 mvp_;
+  mat4 mv_;
+  mat4 p_;
+  vec4 camera_eye_world_;
+  vec4 camera_up_world_;
+  vec4 camera_right_world_;
+};
 
 uniform vec4 color_ = vec4(1.0, 1.0, 0.0, 0.5);
 
+// Size of an unscaled quad
+uniform vec2 quad_size_ = vec2(0.1, 0.1);
+
 /**
  *
- * Input Attributes
+ * Input Attributes (per instance)
  *
  */
 
-// The vertex positions
-in vec3 position_in_;
+// Center of the billboard
+in vec2 position_in_;
+
+// Rotation, x scale and y scale
+in vec3 transform_in_;
 
-// Texture coordinates into the atlas.
-in vec2 tex_in_;
+// Texture rectangle in the atlas (u_0, v_0, u_1, v_1), v_1 at the top of the quad
+in vec4 tex_in_;
 
-// The vertex positions
+// The billboard color
 in vec4 color_in_;
 
 /**
@@ -43,8 +57,17 @@ out vec2 tex_;
 
 
 void main() {
+
+  // (0, 0), (1, 0), (0, 1), (1, 1)
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+  vec2 p = (corner - 0.5) * quad_size_ * transform_in_.yz;
+
+  float c = cos(transform_in_.x);
+  float s = sin(transform_in_.x);
+
   color_vert_ = color_in_;
   color_ex_ = color_;
-  tex_.xy = tex_in_.xy;
-  gl_Position = mvp_ * vec4(position_in_, 1.0);
-}
\ No newline at end of file
+  tex_ = mix(tex_in_.xy, tex_in_.zw, corner);
+  gl_Position = mvp_ * vec4(position_in_ + vec2(c * p.x - s * p.y, s * p.x + c * p.y), 0.0, 1.0);
+}
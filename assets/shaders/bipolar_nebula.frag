@@ -10,7 +10,12 @@ out vec4 color_out_;
 /**
  * Uniforms
  */
-uniform vec4 C_base = vec4(0.4f, 1.0f, 0.4f, 1.0f);
+// Per object (c.f. msg::ObjectUniforms)
+layout(std140) uniform ObjectBlock {
+  vec4 solid_color_;
+  vec3 offset_;
+  float radius_;
+};
 
 /**
  *
@@ -58,7 +63,7 @@ void main(){
   float distance_1 = length(center_1 - r.xy);
   float distance_2 = length(center_2 - r.xy);
 
-  color_out_.rgb = C_base.rgb;
+  color_out_.rgb = solid_color_.rgb;
 
   if(r_proj_length < 0.1){
     color_out_.rgb = vec3(0.9f, 0.9f, 1.0f);
@@ -92,7 +97,7 @@ void main(){
 //  color_out_ = texture(color_sampler_, tex_coords);
 
   float alpha = r_proj_length * r_proj_length;
-  color_out_ = vec4(C_base.xyz, alpha);
+  color_out_ = vec4(solid_color_.xyz, alpha);
 
   color_out_ = vec4(1.0f, 0.0f, 1.0f, 1.0f);
 
@@ -10,7 +10,12 @@ out vec4 color_out_;
 /**
  * Uniforms
  */
-uniform vec4 C_base = vec4(0.4f, 1.0f, 0.4f, 1.0f);
+// Per object (c.f. msg::ObjectUniforms)
+layout(std140) uniform ObjectBlock {
+  vec4 solid_color_;
+  vec3 offset_;
+  float radius_;
+};
 
 /**
  *
@@ -70,7 +75,7 @@ void main(){
 //  color_out_ = texture(color_sampler_, tex_coords);
 
   float alpha = color_out_.a * r_proj_length * r_proj_length;
-  color_out_ = vec4(C_base.xyz, alpha);
+  color_out_ = vec4(solid_color_.xyz, alpha);
 
 //  color_out_ = texture(color_sampler_, coord_);
 //  color_out_ = vec4(1.0, 1.0, 0.0, 0.5f);
@@ -1,7 +1,15 @@
 #version 330
 
 // Input
-uniform mat4 mvp_;
+// Camera, shared by all the programs (c.f. msg::FrameUniforms)
+layout(std140) uniform FrameBlock {
+  mat4 mvp_;
+  mat4 mv_;
+  mat4 p_;
+  vec4 camera_eye_world_;
+  vec4 camera_up_world_;
+  vec4 camera_right_world_;
+};
 uniform vec4 solid_color_ = vec4(1.0, 1.0, 0.0f, 1.0f);
 
 //  Attributes
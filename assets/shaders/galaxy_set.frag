@@ -1,7 +1,7 @@
 #version 330
 
 // Texture atlas
-uniform sampler2D atlas_;
+uniform sampler2DArray atlas_;
 
 // This is for foreground / background blending.
 uniform float global_alpha_ = 1.0f;
@@ -12,7 +12,7 @@ uniform float global_alpha_ = 1.0f;
  *
  */
 in vec4 color_ex;
-in vec2 tex_;
+in vec3 tex_;
 
 out vec4 color_out_;
 
@@ -0,0 +1,51 @@
+#version 330
+
+// http://leo.astronomy.cz/grlens/grl0.html
+
+// The unlensed image
+uniform sampler2D source_;
+
+// Deflection of the lens model at unit strength (pixels), sampled on a grid
+// centered on the output (c.f. DeflectionField in dm_lensing.h)
+uniform sampler2D field_;
+
+// Grid nodes and their spacing in pixels
+uniform vec2 field_size_ = vec2(513.0, 257.0);
+uniform float field_cell_ = 2.0;
+
+// Lens mass, the deflection is mass_^2 times the field
+uniform float mass_ = 0.0;
+
+uniform float alpha_ = 1.0;
+
+// Sizes in pixels of the lensed (output) and source images
+uniform vec2 result_size_ = vec2(1024.0, 512.0);
+uniform vec2 source_size_ = vec2(512.0, 512.0);
+
+// Top left corner of the source in the output (pixels)
+uniform vec2 source_offset_ = vec2(0.0);
+
+in vec2 corner_;
+
+out vec4 color_out_;
+
+void main() {
+
+  // Output pixel, y down from the top like the source image rows
+  vec2 pixel = vec2(corner_.x, 1.0 - corner_.y) * result_size_;
+
+  // The lens sits in the middle of the output, so does node (field_size_ - 1) / 2
+  vec2 d = pixel - 0.5 * result_size_;
+  vec2 node = d / field_cell_ + 0.5 * (field_size_ - 1.0);
+  vec2 alpha = texture(field_, (node + 0.5) / field_size_).rg;
+
+  // Where the light seen at pixel left the source
+  vec2 source_pixel = pixel - (source_offset_ + mass_ * mass_ * alpha);
+
+  if(any(lessThan(source_pixel, vec2(0.0))) || any(greaterThanEqual(source_pixel, source_size_))){
+    discard;
+  }
+
+  color_out_ = texture(source_, source_pixel / source_size_);
+  color_out_.a *= alpha_;
+}
@@ -0,0 +1,34 @@
+#version 330
+
+/**
+ *
+ * Quad for the gravitational lens, the warp is done per pixel in lens.frag
+ * (c.f. LensedImage in dm_scene_graph.h)
+ *
+ */
+
+// Camera, shared by all the programs (c.f. msg::FrameUniforms)
+layout(std140) uniform FrameBlock {
+  mat4 mvp_;
+  mat4 mv_;
+  mat4 p_;
+  vec4 camera_eye_world_;
+  vec4 camera_up_world_;
+  vec4 camera_right_world_;
+};
+
+// Size of the quad
+uniform vec2 quad_size_ = vec2(4.0, 2.0);
+
+// Center of the quad
+uniform vec3 offset_ = vec3(0.0);
+
+in vec3 position_in_;
+
+// (0, 0) at the bottom left of the quad, (1, 1) at the top right
+out vec2 corner_;
+
+void main() {
+  corner_ = position_in_.xy / quad_size_ + 0.5;
+  gl_Position = mvp_ * vec4(position_in_.xy + offset_.xy, 0.0, 1.0);
+}
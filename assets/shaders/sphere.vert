@@ -1,15 +1,22 @@
 #version 330
 
 // Input
-uniform mat4 mvp_;
-
-uniform vec4 solid_color_ = vec4(1.0, 0.0, 0.0, 1.0);
-uniform float radius_ = 1.0f;
-uniform vec3 offset_ = vec3(0.0);
-
-uniform vec3 camera_up_world_ = vec3(0.0, 1.0, 0.0);
-uniform vec3 camera_eye_world_ = vec3(0.0, 0.0, -1.0);
-uniform vec3 camera_right_world_ = vec3(1.0, 0.0, 0.0);
+// Camera, shared by all the programs (c.f. msg::FrameUniforms)
+layout(std140) uniform FrameBlock {
+  mat4 mvp_;
+  mat4 mv_;
+  mat4 p_;
+  vec4 camera_eye_world_;
+  vec4 camera_up_world_;
+  vec4 camera_right_world_;
+};
+
+// Per object (c.f. msg::ObjectUniforms)
+layout(std140) uniform ObjectBlock {
+  vec4 solid_color_;
+  vec3 offset_;
+  float radius_;
+};
 
 
 /**
@@ -38,7 +45,7 @@ void main() {
 #if 0
   vec3 world_position = position_in_ + offset_;
 #else
-  vec3 world_position = offset_ + camera_right_world_ * position_in_.x +  camera_up_world_ * position_in_.y;
+  vec3 world_position = offset_ + camera_right_world_.xyz * position_in_.x +  camera_up_world_.xyz * position_in_.y;
   eye_relative_.x = camera_eye_world_.x;
   eye_relative_.y = camera_eye_world_.y;
 #endif
@@ -1,13 +1,40 @@
 #version 330
-uniform mat4 p_;
-uniform mat4 mv_;
-uniform vec4 color_ = vec4(1.0, 1.0, 1.0, 1.0);
-uniform float z_offset_ = 0.0;
+// Camera, shared by all the programs (c.f. msg::FrameUniforms)
+layout(std140) uniform FrameBlock {
+  mat4 mvp_;
+  mat4 mv_;
+  mat4 p_;
+  vec4 camera_eye_world_;
+  vec4 camera_up_world_;
+  vec4 camera_right_world_;
+};
+
+// Orbit vertices, two (x, y) pairs per texel, shared by all sweeps
+uniform samplerBuffer vertices_;
+
+// Sweep i is drawn with base vertex i * vertex_count_ (c.f. Sweeps::render)
+uniform int vertex_count_;
+
+const int max_sweep_count = 256;
+
+struct Sweep {
+  vec4 color;
+  vec4 offset;    // z offset in x
+};
+
+layout(std140) uniform SweepBlock {
+  Sweep sweeps_[max_sweep_count];
+};
 
-in vec3 position;
 out vec4 color_ex;
 
 void main() {
-   color_ex = color_;
-   gl_Position = p_ * mv_ * vec4(position.x, position.y, position.z + z_offset_, 1.0);
+   int sweep = gl_VertexID / vertex_count_;
+   int vertex = gl_VertexID - sweep * vertex_count_;
+
+   vec4 pair = texelFetch(vertices_, vertex / 2);
+   vec2 position = ((vertex & 1) == 0) ? pair.xy : pair.zw;
+
+   color_ex = sweeps_[sweep].color;
+   gl_Position = p_ * mv_ * vec4(position.x, position.y, sweeps_[sweep].offset.x, 1.0);
 }
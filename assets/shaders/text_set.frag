@@ -0,0 +1,30 @@
+#version 330
+
+// Signed distance field glyphs, 0.5 is the edge
+uniform sampler2D glyphs_;
+
+// This is for foreground / background blending.
+uniform float global_alpha_ = 1.0f;
+
+/**
+ *
+ * Input from Vertex shader
+ *
+ */
+in vec2 tex_;
+in vec4 color_;
+
+out vec4 color_out_;
+
+
+void main() {
+
+  float d = texture(glyphs_, tex_).r;
+
+  // Anti-alias over about one screen pixel
+  float w = max(0.7 * fwidth(d), 1.0e-4);
+
+  float alpha = smoothstep(0.5 - w, 0.5 + w, d);
+
+  color_out_ = vec4(color_.rgb, color_.a * alpha * global_alpha_);
+}
@@ -0,0 +1,63 @@
+#version 330
+
+/**
+ *
+ * One instance per glyph, the quad is a 4 vertex triangle strip.
+ *
+ */
+
+// Camera, shared by all the programs (c.f. msg::FrameUniforms)
+layout(std140) uniform FrameBlock {
+  mat4 mvp_;
+  mat4 mv_;
+  mat4 p_;
+  vec4 camera_eye_world_;
+  vec4 camera_up_world_;
+  vec4 camera_right_world_;
+};
+
+/**
+ *
+ * Input Attributes (per instance)
+ *
+ */
+
+// Position of the string
+in vec3 anchor_in_;
+
+// Rotation of the string and size of the em square in world units
+in vec2 transform_in_;
+
+// Corners of the glyph quad relative to the anchor (x_0, y_0, x_1, y_1) [em]
+in vec4 quad_in_;
+
+// Texture coordinates into the glyph atlas (u_0, v_0, u_1, v_1)
+in vec4 tex_in_;
+
+in vec4 color_in_;
+
+/**
+ *
+ * Outputs to fragment Shader
+ *
+ */
+
+out vec2 tex_;
+out vec4 color_;
+
+
+void main() {
+
+  // (0, 0), (1, 0), (0, 1), (1, 1)
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+  vec2 p = transform_in_.y * mix(quad_in_.xy, quad_in_.zw, corner);
+
+  float c = cos(transform_in_.x);
+  float s = sin(transform_in_.x);
+
+  tex_ = mix(tex_in_.xy, tex_in_.zw, corner);
+  color_ = color_in_;
+
+  gl_Position = mvp_ * vec4(anchor_in_ + vec3(c * p.x - s * p.y, s * p.x + c * p.y, 0.0), 1.0);
+}
@@ -1,8 +1,8 @@
 /**
  *
  *
- *  Generate a fake absorption spectrum for the
- *  Dark Matter lab
+ *  Absorption spectrum for the Dark Matter lab,
+ *  synthesized from a line list (c.f. spectrum_synthesis.h)
  *
  */
 
@@ -10,9 +10,8 @@
 #define ABSORPTION_LINES
 
 #include <cmath>
-#include <ctime>
 #include <iostream>
-#include <random>
+#include <vector>
 
 #if WIN32 // Fucking windows
 #include <qwt_plot_curve.h>
@@ -26,8 +25,18 @@
 
 #endif
 
+#include "minmax_pyramid.h"
+#include "spectrum_synthesis.h"
 
-class absorption_lines : public QwtSyntheticPointData {
+
+/**
+ *
+ * The spectrum as Qwt sees it: one min/max pair per pixel column of the
+ * visible x-range, whatever the resolution of the spectrum. When there are
+ * fewer samples than columns it is interpolated instead.
+ *
+ */
+class absorption_lines : public QwtSeriesData<QPointF> {
 
 public:
 
@@ -38,113 +47,192 @@ public:
 
   // Scale: (5, 30, 250)
   float scale_ = 1.0f;
+
+  // Minus the measured velocity [km/s]
   float x_shift_ = 0.0f;
 
-  float _height = 1.0f;
+  // Pixel columns of the plot
+  int columns_ = 1000;
 
-  const static int signal_peaks = 4;
+  // Internal data
 
-#if 0
-  struct signal_peaks{
+  // Line list synthesis, one spectrum per measurement
+  mutable SpectrumSynthesizer synthesizer_;
+  mutable SpectrumSynthesizer::Spectrum spectrum_;
 
-    float sigma_ = 1.0f;
-    float mu_
+  // Extremes of spectrum_ at every power of two
+  mutable MinMaxPyramid pyramid_;
 
-  } peaks[signal_peaks];
-#endif
+  // Visible x-range, given by the plot (c.f. setRectOfInterest)
+  double x_min_ = 0.0;
+  double x_max_ = 0.0;
 
-  // Central peak at 0, Second peak on the right, Peak on the left, Large-scale peak
+  /**
+   * Points handed to Qwt, rebuilt only when the range, the columns or the
+   * spectrum change
+   */
+  mutable std::vector<QPointF> cache_points_;
 
-  float sigma_[signal_peaks] = {1.0f, 0.5f, 0.6f, 0.8f};
-  float separations_[signal_peaks] = {0.0f, 6.1f, -12.5f, 200.0f};
-  float signal_scale_[signal_peaks] = {1.5f, 1.5f, 1.5f, 1.5f};
+  mutable double cache_x_min_ = 0.0;
+  mutable double cache_x_max_ = 0.0;
+  mutable SpectrumSynthesizer::Spectrum cache_spectrum_;
 
-  // Internal data
+  absorption_lines(int columns = 1000)
+      : columns_(columns){
 
-  int random_seed_ = 4910;
-  std::uniform_real_distribution<> rand_;
+  }
 
-  int noise_samples_ = 2048;
-  float *random_noise_;
+  void set_x_shift(float shift){
+    x_shift_ = shift;
+  }
 
-  absorption_lines(size_t points_per_interval = 2000)
-      : QwtSyntheticPointData(points_per_interval),
-        rand_(-0.5f, 0.5f){
+  void set_scale(float scale){
+    scale_ = scale;
 
-    random_noise_ = new float[noise_samples_];
-    generate_noise();
+    // Until the plot says otherwise
+    x_min_ = -scale;
+    x_max_ = scale;
   }
 
-  ~absorption_lines(){
-    delete[] random_noise_;
+  void set_columns(int columns){
+    columns_ = std::max(columns, 1);
   }
 
   /**
-   * Generate a batch of random noise
+   * absorption_lines::spectrum
+   *
+   * @return The spectrum for the current measurement
    */
-  void generate_noise(){
-    // Initialize Random Number Generator
-#if 1
-    std::random_device rd;
-    std::mt19937 generator(rd());
-#else
-    std::mt19937 generator(random_seed_);
-    ++random_seed_;
-#endif
+  const std::vector<float> &spectrum() const{
+
+    SpectrumSynthesizer::Spectrum current = synthesizer_.spectrum(-x_shift_, has_signal_, noise_);
 
-    for(int i = 0; i < noise_samples_; ++i){
-      random_noise_[i] = (float) rand_(generator);
+    if(current != spectrum_){
+      spectrum_ = current;
+      pyramid_.build(spectrum_->data(), int(spectrum_->size()));
     }
 
+    return *spectrum_;
   }
 
-  double gauss(double x, float sigma, float mu) const{
-    using namespace std;
-    float sigma_sq = 2 * sigma * sigma;
-    float x_m_mu = float(x) - mu;
-    return exp(-x_m_mu * x_m_mu / sigma_sq) / (sigma * M_PI);
-  }
+  /**
+   * absorption_lines::interpolate
+   *
+   * @param x [km/s]
+   * @return The flux, the continuum past the grid
+   */
+  float interpolate(double x) const{
 
-  void set_x_shift(float shift){
-    x_shift_ = shift;
-    generate_noise();
-  }
+    const std::vector<float> &flux = *spectrum_;
 
-  void set_scale(float scale){
+    double u = (x - synthesizer_.x(0)) / synthesizer_.dx_;
+    int j = int(u);
 
-    scale_ = scale;
-    generate_noise();
+    if((u < 0.0) || (j >= int(flux.size()) - 1)){
+      return 1.0f;
+    }
+
+    float f = float(u - j);
+    return flux[j] + f * (flux[j + 1] - flux[j]);
   }
 
-  double y(double x) const{
+  /**
+   * absorption_lines::decimate
+   *
+   *   Two points per column, the extremes of the samples in it
+   */
+  void decimate() const{
+
+    using namespace std;
 
-    float y = _height; // We want absorption
+    cache_points_.resize(2 * columns_);
 
-    if(has_signal_){
-      // Add x-shift for measured signal
-      x += x_shift_;
+    double width = (x_max_ - x_min_) / columns_;
 
-      /**
-       * The signal peaks
-       */
+    for(int c = 0; c < columns_; ++c){
+      double x_0 = x_min_ + c * width;
+      double x_center = x_0 + 0.5 * width;
 
-      for(int i = 0; i < signal_peaks; ++i){
-        y -= signal_scale_[i] * gauss(x, sigma_[i], separations_[i]);
+      // Samples in [x_0, x_0 + width)
+      int i_0 = int(ceil((x_0 - synthesizer_.x(0)) / synthesizer_.dx_));
+      int i_1 = int(ceil((x_0 + width - synthesizer_.x(0)) / synthesizer_.dx_));
+
+      float lo, hi;
+
+      if((i_1 - i_0 < 2) || !pyramid_.range(i_0, i_1, lo, hi)){
+        lo = hi = interpolate(x_center);
       }
+
+      cache_points_[2 * c] = QPointF(x_center, lo);
+      cache_points_[2 * c + 1] = QPointF(x_center, hi);
     }
+  }
 
-    // Add some noise if it's enabled
-    if(noise_){
+  /**
+   * absorption_lines::update
+   *
+   *   Resolve the spectrum of the current measurement and decimate it if it
+   *   or the range changed. Once per replot, sample() only reads the points.
+   */
+  void update() const{
+
+    // Hit in the synthesizer unless the measurement changed
+    spectrum();
+
+    if((cache_points_.size() != size_t(2 * columns_)) || (cache_spectrum_ != spectrum_)
+       || (cache_x_min_ != x_min_) || (cache_x_max_ != x_max_)){
+
+      decimate();
+
+      cache_x_min_ = x_min_;
+      cache_x_max_ = x_max_;
+      cache_spectrum_ = spectrum_;
+    }
+  }
 
-      // We add 1 here to make sure we get a positive number
-      int sample = int(noise_samples_ * (fabs(x + scale_) / (2 * scale_)));
+  virtual size_t size() const{
+    return cache_points_.size();
+  }
 
-      // then we roll it over
-      sample %= noise_samples_;
+  /**
+   * absorption_lines::sample
+   *
+   * @param index
+   * @return
+   */
+  virtual QPointF sample(size_t index) const{
 
-      y += 0.1 * random_noise_[sample];
+    if(index >= cache_points_.size()){
+      return QPointF(0, 0);
     }
-    return y;
+
+    return cache_points_[index];
+  }
+
+  virtual QRectF boundingRect() const{
+
+    spectrum();
+
+    float lo = 0.0f;
+    float hi = 1.0f;
+    pyramid_.range(0, pyramid_.size(), lo, hi);
+
+    return QRectF(synthesizer_.x(0), lo, 2.0 * synthesizer_.x_range_, hi - lo);
+  }
+
+  /**
+   * absorption_lines::setRectOfInterest
+   *
+   *   Called by the plot with the axis ranges before every replot, which
+   *   is when the points are brought up to date
+   *
+   * @param rect
+   */
+  virtual void setRectOfInterest(const QRectF &rect){
+    x_min_ = rect.left();
+    x_max_ = rect.right();
+
+    update();
   }
 };
 
@@ -18,6 +18,10 @@ SOURCES += dm_gui.cpp \
 
 
 HEADERS  += dm_gui.h \
+         dm_lensing.h \
+         minmax_pyramid.h \
+         dm_simd.h \
+         spectrum_synthesis.h \
          dm_scene_graph.h
 
 FORMS    += dark_matter_lab.ui
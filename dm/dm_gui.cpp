@@ -157,9 +157,24 @@ void DarkMatterLab::setPlotScale(int scale_index){
   // Set the scale to
   this->plot_signal_->set_scale(scale);
   this->plot_rest_->set_scale(scale);
+
+  updatePlotColumns();
+
   ui->redshiftPlot->setAxisScale(ui->redshiftPlot->xBottom, -1.0 * scale, 1.0 * scale);
 }
 
+/**
+ *
+ * The spectra are decimated to one min/max pair per pixel column of the plot
+ *
+ */
+void DarkMatterLab::updatePlotColumns(){
+  int columns = ui->redshiftPlot->canvas()->width();
+
+  this->plot_signal_->set_columns(columns);
+  this->plot_rest_->set_columns(columns);
+}
+
 /**
  *
  * Set the velocity label and wavelength shift.
@@ -206,6 +221,16 @@ void DarkMatterLab::on_massSlider_valueChanged(int mass){
   ui->sceneWidget->setLensMass(mass);
 }
 
+/**
+ * Pick the mass distribution of the lens, the items are in the order of
+ * DarkMatterScene::setLensModel
+ *
+ * @param index
+ */
+void DarkMatterLab::on_lensModelBox_currentIndexChanged(int index){
+  ui->sceneWidget->setLensModel(index);
+}
+
 /**
  * Switching plot range using the range buttons
  *
@@ -327,6 +352,13 @@ void DarkMatterLab::on_velocityNotMeasurement(){
   update();
 }
 
+void DarkMatterLab::resizeEvent(QResizeEvent *event){
+  QWidget::resizeEvent(event);
+
+  // The layout has already resized the plot
+  updatePlotColumns();
+}
+
 void DarkMatterLab::timerEvent(QTimerEvent *){
   // Drive the animation in the SceneGraph
   ui->sceneWidget->updateAnimation();
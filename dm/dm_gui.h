@@ -1,6 +1,7 @@
 #ifndef DARK_MATTER_MAIN_H
 #define DARK_MATTER_MAIN_H
 
+#include <QResizeEvent>
 #include <QtWidgets/QAbstractButton>
 #include <QtWidgets/QBoxLayout>
 #include <QtWidgets/QMainWindow>
@@ -31,12 +32,23 @@ public:
 
   void setVelocity(float velocity, float scale);
 
+  /**
+   * Match the plot data to the width of the plot canvas
+   */
+  void updatePlotColumns();
+
+protected:
+
+  void resizeEvent(QResizeEvent *event);
+
 private slots:
 
   void on_exitButton_clicked();
 
   void on_lensingSimulationButton_toggled(bool checked);
 
+  void on_lensModelBox_currentIndexChanged(int index);
+
   void on_massSlider_valueChanged(int value);
 
   void on_rangeButtonGroup_buttonClicked(QAbstractButton *button);
@@ -0,0 +1,686 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Gravitational lens models and their deflection fields. The
+ * deflection of a model is computed once on a grid at unit strength and kept
+ * in a cache, the strength (the slider) only scales it. The GPU warps the
+ * galaxy by sampling the grid as a texture (c.f. lens.frag), the CPU side
+ * samples it bilinearly to shoot rays back to the source plane.
+ *
+ */
+
+
+#ifndef DM_LENSING_H
+#define DM_LENSING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dm_simd.h"
+#include "worker_pool.h"
+
+enum LensType{
+  LENS_POINT_MASS,
+  LENS_SIS,         // Singular isothermal sphere
+  LENS_NFW          // Navarro-Frenk-White halo
+};
+
+/**
+ *
+ * One mass in a lens. Positions are in pixels relative to the center of the
+ * lensed image, y down like the image rows.
+ *
+ */
+struct LensComponent{
+
+  LensType type_ = LENS_POINT_MASS;
+
+  float x_ = 0.0f;
+  float y_ = 0.0f;
+
+  // Share of the total strength
+  float weight_ = 1.0f;
+
+  // NFW scale radius [pixels]
+  float r_s_ = 100.0f;
+
+  LensComponent(){}
+
+  LensComponent(LensType type, float x, float y, float weight = 1.0f, float r_s = 100.0f)
+      : type_(type), x_(x), y_(y), weight_(weight), r_s_(r_s){
+
+  }
+
+  /**
+   * LensComponent::profile
+   *
+   * The deflection is d * profile(|d|) before normalization
+   *
+   * @param r Distance from the center [pixels]
+   * @return
+   */
+  float profile(float r) const{
+
+    using namespace std;
+
+    if(r < 1.0e-6f){
+      return 0.0f;
+    }
+
+    switch(type_){
+      case LENS_POINT_MASS:
+        return 1.0f / (r * r);
+
+      case LENS_SIS:
+        return 1.0f / r;
+
+      case LENS_NFW:{
+        // Bartelmann (1996), the projected mass inside x = r / r_s
+        float x = r / r_s_;
+        float h = log(0.5f * x);
+
+        if(x < 0.999f){
+          h += 2.0f / sqrt(1.0f - x * x) * atanh(sqrt((1.0f - x) / (1.0f + x)));
+        }else if(x > 1.001f){
+          h += 2.0f / sqrt(x * x - 1.0f) * atan(sqrt((x - 1.0f) / (x + 1.0f)));
+        }else{
+          h += 1.0f;
+        }
+
+        return h / (x * r);
+      }
+    }
+
+    return 0.0f;
+  }
+};
+
+/**
+ *
+ * A lens made of one or more components. At unit strength every component
+ * deflects by weight_ / norm_radius_ pixels at norm_radius_ from its center,
+ * which makes a single point mass deflect by exactly 1 / r.
+ *
+ */
+struct LensModel{
+
+  std::vector<LensComponent> components_;
+
+  // Radius where the profiles agree [pixels]
+  float norm_radius_ = 128.0f;
+
+  // Quantization of the key [pixels]
+  float quantum_ = 0.01f;
+
+  LensModel(){}
+
+  LensModel(const LensComponent &component){
+    components_.push_back(component);
+  }
+
+  /**
+   * LensModel::key
+   *
+   * @return Hash of the quantized parameters
+   */
+  long long key() const{
+
+    using namespace std;
+
+    unsigned long long h = 1469598103934665603ULL;
+
+    auto mix = [&h](long long v){
+      h ^= (unsigned long long) v;
+      h *= 1099511628211ULL;
+    };
+
+    mix(llround(norm_radius_ / quantum_));
+
+    for(const LensComponent &c : components_){
+      mix(c.type_);
+      mix(llround(c.x_ / quantum_));
+      mix(llround(c.y_ / quantum_));
+      mix(llround(c.weight_ / quantum_));
+      mix(c.type_ == LENS_NFW ? llround(c.r_s_ / quantum_) : 0);
+    }
+
+    return (long long) h;
+  }
+
+  /**
+   * LensModel::deflection
+   *
+   * @param x Offset from the image center [pixels]
+   * @param y
+   * @param ax Deflection at unit strength [pixels]
+   * @param ay
+   */
+  void deflection(float x, float y, float &ax, float &ay) const{
+
+    ax = 0.0f;
+    ay = 0.0f;
+
+    for(const LensComponent &c : components_){
+      float dx = x - c.x_;
+      float dy = y - c.y_;
+
+      float norm = 1.0f / (norm_radius_ * norm_radius_ * c.profile(norm_radius_));
+      float g = c.weight_ * norm * c.profile(std::sqrt(dx * dx + dy * dy));
+
+      ax += g * dx;
+      ay += g * dy;
+    }
+  }
+};
+
+/**
+ *
+ * Deflection of a model sampled on a grid covering the lensed image, node
+ * (0, 0) at the top left corner. The components are interleaved (ax, ay) so
+ * the grid uploads as an RG texture as is.
+ *
+ */
+struct DeflectionField{
+
+  long long key = 0;
+
+  int nx_ = 0;
+  int ny_ = 0;
+
+  // Position of node (0, 0) and the spacing [pixels]
+  float x0_ = 0.0f;
+  float y0_ = 0.0f;
+  float cell_ = 1.0f;
+
+  std::vector<float> alpha_;
+
+  /**
+   * DeflectionField::bytes
+   *
+   * @return Approximate memory used by the field
+   */
+  size_t bytes() const{
+    return sizeof(*this) + alpha_.capacity() * sizeof(float);
+  }
+
+  /**
+   * DeflectionField::sample
+   *
+   * Bilinear interpolation, outside the grid the edge is extended
+   *
+   * @param x Offset from the image center [pixels]
+   * @param y
+   * @param ax Deflection at unit strength [pixels]
+   * @param ay
+   */
+  void sample(float x, float y, float &ax, float &ay) const{
+
+    using namespace std;
+
+    float u = min(max((x - x0_) / cell_, 0.0f), float(nx_ - 1));
+    float v = min(max((y - y0_) / cell_, 0.0f), float(ny_ - 1));
+
+    int i = min(int(u), nx_ - 2);
+    int j = min(int(v), ny_ - 2);
+
+    float fx = u - i;
+    float fy = v - j;
+
+    // Both corners of a row are next to each other, (ax, ay, ax, ay)
+    const float *row_0 = &alpha_[2 * (j * nx_ + i)];
+    const float *row_1 = row_0 + 2 * nx_;
+
+#if DM_USE_SSE
+    __m128 r_0 = _mm_loadu_ps(row_0);
+    __m128 r_1 = _mm_loadu_ps(row_1);
+
+    __m128 c = _mm_add_ps(r_0, _mm_mul_ps(_mm_set1_ps(fy), _mm_sub_ps(r_1, r_0)));
+    c = _mm_mul_ps(c, _mm_set_ps(fx, fx, 1.0f - fx, 1.0f - fx));
+    c = _mm_add_ps(c, _mm_movehl_ps(c, c));
+
+    float out[4];
+    _mm_storeu_ps(out, c);
+
+    ax = out[0];
+    ay = out[1];
+#else
+    float c[4];
+
+    for(int k = 0; k < 4; ++k){
+      c[k] = row_0[k] + fy * (row_1[k] - row_0[k]);
+    }
+
+    ax = (1.0f - fx) * c[0] + fx * c[2];
+    ay = (1.0f - fx) * c[1] + fx * c[3];
+#endif
+  }
+};
+
+/**
+ *
+ * Fields keyed on LensModel::key, bounded by budget_bytes_ with the least
+ * recently used evicted first (c.f. OrbitCache in the Kepler lab)
+ *
+ */
+struct DeflectionCache{
+
+  size_t budget_bytes_ = 0;
+  size_t used_bytes_ = 0;
+
+  // Hit statistics
+  long hits_ = 0;
+  long misses_ = 0;
+
+  // Most recently used at the front
+  std::list<DeflectionField> entries_;
+  std::unordered_map<long long, std::list<DeflectionField>::iterator> index_;
+
+  DeflectionCache(size_t budget_bytes = 16 << 20) : budget_bytes_(budget_bytes){
+
+  }
+
+  /**
+   *
+   * DeflectionCache::find
+   *
+   * @param key
+   * @return The field (now the most recently used) or nullptr
+   */
+  const DeflectionField *find(long long key){
+
+    auto it = index_.find(key);
+
+    if(it == index_.end()){
+      ++misses_;
+      return nullptr;
+    }
+
+    ++hits_;
+
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &entries_.front();
+  }
+
+  /**
+   *
+   * DeflectionCache::insert
+   *
+   * Take ownership of the field and evict old ones until it fits the budget.
+   *
+   * @param field
+   * @return The cached field or nullptr if it is larger than the whole budget
+   */
+  const DeflectionField *insert(DeflectionField &field){
+
+    erase(field.key);
+
+    size_t bytes = field.bytes();
+
+    if(bytes > budget_bytes_){
+      return nullptr;
+    }
+
+    while(used_bytes_ + bytes > budget_bytes_){
+      erase(entries_.back().key);
+    }
+
+    entries_.push_front(DeflectionField());
+    std::swap(entries_.front(), field);
+
+    index_[entries_.front().key] = entries_.begin();
+    used_bytes_ += bytes;
+
+    return &entries_.front();
+  }
+
+  /**
+   * DeflectionCache::erase
+   *
+   * @param key
+   */
+  void erase(long long key){
+
+    auto it = index_.find(key);
+
+    if(it == index_.end()){
+      return;
+    }
+
+    used_bytes_ -= it->second->bytes();
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  void clear(){
+    entries_.clear();
+    index_.clear();
+    used_bytes_ = 0;
+  }
+};
+
+/**
+ * lens_presets
+ *
+ * The lenses of the lab, in the order of the model selector (c.f.
+ * DarkMatterScene::setLensModel). Offsets are in pixels of the lensed image.
+ *
+ * @return Point mass, isothermal sphere, NFW halo and a cluster
+ */
+inline std::vector<LensModel> lens_presets(){
+
+  std::vector<LensModel> models;
+
+  models.push_back(LensModel(LensComponent(LENS_POINT_MASS, 0.0f, 0.0f)));
+  models.push_back(LensModel(LensComponent(LENS_SIS, 0.0f, 0.0f)));
+  models.push_back(LensModel(LensComponent(LENS_NFW, 0.0f, 0.0f, 1.0f, 150.0f)));
+
+  // Cluster, a halo and a few member galaxies
+  LensModel cluster(LensComponent(LENS_NFW, 0.0f, 0.0f, 0.7f, 200.0f));
+  cluster.components_.push_back(LensComponent(LENS_SIS, -180.0f, 60.0f, 0.1f));
+  cluster.components_.push_back(LensComponent(LENS_SIS, 140.0f, -90.0f, 0.1f));
+  cluster.components_.push_back(LensComponent(LENS_SIS, 60.0f, 150.0f, 0.1f));
+  models.push_back(cluster);
+
+  return models;
+}
+
+/**
+ *
+ * Which background source each ray of the image plane lands on
+ *
+ */
+struct SourceMap{
+
+  int nx_ = 0;
+  int ny_ = 0;
+
+  // Source index per ray, -1 for none, rows from the top
+  std::vector<int> image_;
+
+  // Rays per source, the magnification is rays_ * step^2 / (pi r^2)
+  std::vector<int> rays_;
+};
+
+/**
+ *
+ * Computes and caches deflection fields for a fixed image size and traces
+ * rays through them. Work is split in rows handed out to the threads of a
+ * WorkerPool that lives as long as the engine.
+ *
+ */
+struct LensingEngine{
+
+  /**
+   * Settings
+   */
+
+  // Size of the lensed image [pixels]
+  int width_ = 1024;
+  int height_ = 512;
+
+  // Grid spacing [pixels]
+  float cell_ = 2.0f;
+
+  // Worker threads, 0 for one per core
+  int thread_count_ = 0;
+
+  /**
+   * Internal
+   */
+  DeflectionCache cache_;
+
+  // Threads besides the caller, made on first use (c.f. for_rows)
+  std::unique_ptr<WorkerPool> pool_;
+
+  /**
+   * LensingEngine::field
+   *
+   * @param model
+   * @return The deflection of the model at unit strength, computed on a miss
+   */
+  const DeflectionField *field(const LensModel &model){
+
+    using namespace std;
+
+    long long key = model.key();
+
+    const DeflectionField *cached = cache_.find(key);
+
+    if(cached){
+      return cached;
+    }
+
+    DeflectionField field;
+    field.key = key;
+    field.cell_ = cell_;
+    field.nx_ = int(ceil(width_ / cell_)) + 1;
+    field.ny_ = int(ceil(height_ / cell_)) + 1;
+    field.x0_ = -0.5f * (field.nx_ - 1) * cell_;
+    field.y0_ = -0.5f * (field.ny_ - 1) * cell_;
+    field.alpha_.resize(2 * field.nx_ * field.ny_);
+
+    DeflectionField *f = &field;
+
+    for_rows(field.ny_, [f, &model](int j){
+      float y = f->y0_ + j * f->cell_;
+      float *alpha = &f->alpha_[2 * j * f->nx_];
+
+      for(int i = 0; i < f->nx_; ++i){
+        model.deflection(f->x0_ + i * f->cell_, y, alpha[2 * i], alpha[2 * i + 1]);
+      }
+    });
+
+    return cache_.insert(field);
+  }
+
+  /**
+   * LensingEngine::shoot
+   *
+   * Trace rays from the image plane back to the source plane,
+   * beta = theta - strength * alpha(theta)
+   *
+   * @param field
+   * @param strength
+   * @param x Image positions, offsets from the center [pixels]
+   * @param y
+   * @param count
+   * @param beta_x Source positions [pixels]
+   * @param beta_y
+   */
+  void shoot(const DeflectionField &field, float strength,
+             const float *x, const float *y, int count,
+             float *beta_x, float *beta_y){
+
+    const int chunk = 4096;
+
+    for_rows((count + chunk - 1) / chunk, [&](int c){
+      int end = std::min(count, (c + 1) * chunk);
+
+      for(int i = c * chunk; i < end; ++i){
+        float ax, ay;
+        field.sample(x[i], y[i], ax, ay);
+
+        beta_x[i] = x[i] - strength * ax;
+        beta_y[i] = y[i] - strength * ay;
+      }
+    });
+  }
+
+  /**
+   * LensingEngine::map_sources
+   *
+   * Shoot one ray per step x step block of the lensed image and find the
+   * background source it lands on. The sources are binned on a grid in the
+   * source plane so each ray only tests its neighbours.
+   *
+   * @param field
+   * @param strength
+   * @param sources (x, y, radius) per source, in the same frame as the field
+   * @param source_count
+   * @param step Spacing of the rays [pixels]
+   * @param map
+   */
+  void map_sources(const DeflectionField &field, float strength,
+                   const float *sources, int source_count, int step,
+                   SourceMap &map){
+
+    using namespace std;
+
+    map.nx_ = width_ / step;
+    map.ny_ = height_ / step;
+    map.image_.assign(map.nx_ * map.ny_, -1);
+    map.rays_.assign(source_count, 0);
+
+    if(source_count == 0){
+      return;
+    }
+
+    /**
+     * Bin the sources, a bin is as large as the biggest source so a ray only
+     * has to look at the 3 x 3 bins around it
+     */
+    float x_min = sources[0], x_max = sources[0];
+    float y_min = sources[1], y_max = sources[1];
+    float bin = 1.0f;
+
+    for(int s = 0; s < source_count; ++s){
+      const float *src = &sources[3 * s];
+      x_min = min(x_min, src[0]);
+      x_max = max(x_max, src[0]);
+      y_min = min(y_min, src[1]);
+      y_max = max(y_max, src[1]);
+      bin = max(bin, src[2]);
+    }
+
+    int bx = int((x_max - x_min) / bin) + 1;
+    int by = int((y_max - y_min) / bin) + 1;
+
+    // Sources of bin b are bin_source[bin_start[b] ... bin_start[b + 1])
+    vector<int> bin_start(bx * by + 1, 0);
+    vector<int> bin_source(source_count);
+
+    auto bin_of = [&](const float *src){
+      return int((src[1] - y_min) / bin) * bx + int((src[0] - x_min) / bin);
+    };
+
+    for(int s = 0; s < source_count; ++s){
+      ++bin_start[bin_of(&sources[3 * s]) + 1];
+    }
+
+    for(int b = 0; b < bx * by; ++b){
+      bin_start[b + 1] += bin_start[b];
+    }
+
+    vector<int> fill(bin_start.begin(), bin_start.end() - 1);
+
+    for(int s = 0; s < source_count; ++s){
+      bin_source[fill[bin_of(&sources[3 * s])]++] = s;
+    }
+
+    /**
+     * Trace a row of rays at a time
+     */
+    for_rows(map.ny_, [&](int j){
+      float y = (j + 0.5f) * step - 0.5f * height_;
+
+      for(int i = 0; i < map.nx_; ++i){
+        float x = (i + 0.5f) * step - 0.5f * width_;
+
+        float ax, ay;
+        field.sample(x, y, ax, ay);
+
+        float beta_x = x - strength * ax;
+        float beta_y = y - strength * ay;
+
+        int cx = int(floor((beta_x - x_min) / bin));
+        int cy = int(floor((beta_y - y_min) / bin));
+
+        // Closest source containing the ray
+        int hit = -1;
+        float hit_dsq = 0.0f;
+
+        for(int ny = max(cy - 1, 0); ny <= min(cy + 1, by - 1); ++ny){
+          for(int nx = max(cx - 1, 0); nx <= min(cx + 1, bx - 1); ++nx){
+            int b = ny * bx + nx;
+
+            for(int k = bin_start[b]; k < bin_start[b + 1]; ++k){
+              const float *src = &sources[3 * bin_source[k]];
+
+              float dx = beta_x - src[0];
+              float dy = beta_y - src[1];
+              float dsq = dx * dx + dy * dy;
+
+              if((dsq < src[2] * src[2]) && ((hit < 0) || (dsq < hit_dsq))){
+                hit = bin_source[k];
+                hit_dsq = dsq;
+              }
+            }
+          }
+        }
+
+        map.image_[j * map.nx_ + i] = hit;
+      }
+    });
+
+    for(int hit : map.image_){
+      if(hit >= 0){
+        ++map.rays_[hit];
+      }
+    }
+  }
+
+  /**
+   * LensingEngine::for_rows
+   *
+   * Rows are handed out one at a time to the caller and the threads of
+   * pool_, which is only rebuilt when thread_count_ changes
+   *
+   * @param rows
+   * @param f Called with each row index
+   */
+  template <class F>
+  void for_rows(int rows, F f){
+
+    using namespace std;
+
+    int thread_count = thread_count_;
+
+    if(thread_count <= 0){
+      thread_count = max(1, int(thread::hardware_concurrency()));
+    }
+
+    if((thread_count <= 1) || (rows <= 1)){
+      for(int row = 0; row < rows; ++row){
+        f(row);
+      }
+      return;
+    }
+
+    if(!pool_ || (pool_->size() != thread_count - 1)){
+      pool_.reset(new WorkerPool(thread_count - 1));
+    }
+
+    atomic<int> next_row(0);
+
+    function<void()> job = [&next_row, &f, rows](){
+      for(int row = next_row++; row < rows; row = next_row++){
+        f(row);
+      }
+    };
+
+    pool_->run(job);
+  }
+};
+
+#endif // DM_LENSING_H
@@ -0,0 +1,226 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Headless check and benchmark for the lensing engine. For each
+ * lens preset the cached deflection field is compared with the exact
+ * LensModel::deflection through LensingEngine::shoot, and
+ * LensingEngine::map_sources is compared with testing every ray against
+ * every source. Reports the errors, mismatches and throughput.
+ *
+ * Usage: astrolabs_dm_lensing_bench [rays]
+ *
+ */
+
+#include "dm_lensing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Einstein radius of the point mass is sqrt(strength) [pixels]
+const float strength = 10000.0f;
+
+/**
+ *
+ * run_shoot
+ *
+ * Shoot random rays through the field and through the model. Rays within a
+ * few cells of a component center are skipped, the profiles are singular
+ * there and no grid resolves them.
+ *
+ * @param engine
+ * @param model
+ * @param count Number of rays
+ */
+void run_shoot(LensingEngine &engine, const LensModel &model, int count){
+
+  using namespace std;
+  using namespace std::chrono;
+
+  steady_clock::time_point start = steady_clock::now();
+  engine.cache_.clear();
+  const DeflectionField *field = engine.field(model);
+  double field_seconds = duration<double>(steady_clock::now() - start).count();
+
+  start = steady_clock::now();
+  bool hit = engine.field(model) == field;
+  double hit_seconds = duration<double>(steady_clock::now() - start).count();
+
+  mt19937 generator(1);
+  uniform_real_distribution<float> x_rand(-0.5f * engine.width_, 0.5f * engine.width_);
+  uniform_real_distribution<float> y_rand(-0.5f * engine.height_, 0.5f * engine.height_);
+
+  const float r_min = 4.0f * engine.cell_;
+
+  vector<float> x, y;
+
+  while(int(x.size()) < count){
+    float xi = x_rand(generator);
+    float yi = y_rand(generator);
+
+    bool near = false;
+
+    for(const LensComponent &c : model.components_){
+      near = near || ((xi - c.x_) * (xi - c.x_) + (yi - c.y_) * (yi - c.y_) < r_min * r_min);
+    }
+
+    if(!near){
+      x.push_back(xi);
+      y.push_back(yi);
+    }
+  }
+
+  vector<float> beta_x(count), beta_y(count);
+
+  start = steady_clock::now();
+  engine.shoot(*field, strength, x.data(), y.data(), count, beta_x.data(), beta_y.data());
+  double shoot_seconds = duration<double>(steady_clock::now() - start).count();
+
+  double error_max = 0.0;
+  double error_sq = 0.0;
+  double alpha_sq = 0.0;
+
+  start = steady_clock::now();
+
+  for(int i = 0; i < count; ++i){
+    float ax, ay;
+    model.deflection(x[i], y[i], ax, ay);
+
+    double dx = beta_x[i] - (x[i] - strength * ax);
+    double dy = beta_y[i] - (y[i] - strength * ay);
+    double error = sqrt(dx * dx + dy * dy);
+
+    error_max = max(error_max, error);
+    error_sq += error * error;
+    alpha_sq += strength * strength * (double(ax) * ax + double(ay) * ay);
+  }
+
+  double exact_seconds = duration<double>(steady_clock::now() - start).count();
+
+  cout << "  field " << field->nx_ << " x " << field->ny_ << ": " << fixed << setprecision(2)
+       << 1000.0 * field_seconds << " ms, cache " << (hit ? "hit " : "MISS ")
+       << setprecision(4) << 1000.0 * hit_seconds << " ms" << endl;
+
+  cout << "  shoot " << count << " rays: " << setprecision(1) << count / shoot_seconds / 1.0e6
+       << " M rays/s, exact " << count / exact_seconds / 1.0e6 << " M rays/s, error rms "
+       << setprecision(3) << sqrt(error_sq / count) << " px, max " << error_max
+       << " px (rms deflection " << setprecision(1) << sqrt(alpha_sq / count) << " px)" << endl;
+
+  cout.unsetf(ios::floatfield);
+}
+
+/**
+ *
+ * run_map_sources
+ *
+ * Map random background sources and check every ray against a search over
+ * all of them
+ *
+ * @param engine
+ * @param model
+ * @param source_count
+ * @param step Spacing of the rays [pixels]
+ */
+void run_map_sources(LensingEngine &engine, const LensModel &model, int source_count, int step){
+
+  using namespace std;
+  using namespace std::chrono;
+
+  const DeflectionField *field = engine.field(model);
+
+  // Sources over twice the image, the lens pulls in rays from further out
+  mt19937 generator(2);
+  uniform_real_distribution<float> x_rand(-engine.width_, engine.width_);
+  uniform_real_distribution<float> y_rand(-engine.height_, engine.height_);
+  uniform_real_distribution<float> r_rand(4.0f, 16.0f);
+
+  vector<float> sources(3 * source_count);
+
+  for(int s = 0; s < source_count; ++s){
+    sources[3 * s] = x_rand(generator);
+    sources[3 * s + 1] = y_rand(generator);
+    sources[3 * s + 2] = r_rand(generator);
+  }
+
+  SourceMap map;
+
+  steady_clock::time_point start = steady_clock::now();
+  engine.map_sources(*field, strength, sources.data(), source_count, step, map);
+  double map_seconds = duration<double>(steady_clock::now() - start).count();
+
+  int mismatch_count = 0;
+  int hit_count = 0;
+
+  start = steady_clock::now();
+
+  for(int j = 0; j < map.ny_; ++j){
+    float y = (j + 0.5f) * step - 0.5f * engine.height_;
+
+    for(int i = 0; i < map.nx_; ++i){
+      float x = (i + 0.5f) * step - 0.5f * engine.width_;
+
+      float beta_x, beta_y;
+      engine.shoot(*field, strength, &x, &y, 1, &beta_x, &beta_y);
+
+      int hit = -1;
+      float hit_dsq = 0.0f;
+
+      for(int s = 0; s < source_count; ++s){
+        const float *src = &sources[3 * s];
+
+        float dx = beta_x - src[0];
+        float dy = beta_y - src[1];
+        float dsq = dx * dx + dy * dy;
+
+        if((dsq < src[2] * src[2]) && ((hit < 0) || (dsq < hit_dsq))){
+          hit = s;
+          hit_dsq = dsq;
+        }
+      }
+
+      hit_count += (hit >= 0) ? 1 : 0;
+      mismatch_count += (hit != map.image_[j * map.nx_ + i]) ? 1 : 0;
+    }
+  }
+
+  double brute_seconds = duration<double>(steady_clock::now() - start).count();
+
+  cout << "  map_sources " << source_count << " sources, " << map.nx_ << " x " << map.ny_
+       << " rays: " << fixed << setprecision(2) << 1000.0 * map_seconds << " ms, all pairs "
+       << 1000.0 * brute_seconds << " ms, " << hit_count << " rays on a source, "
+       << mismatch_count << " mismatches" << endl;
+
+  cout.unsetf(ios::floatfield);
+}
+
+int main(int argc, char *argv[]){
+
+  using namespace std;
+
+  int rays = argc > 1 ? max(1, atoi(argv[1])) : 1000000;
+
+  const char *names[] = {"Point mass", "Isothermal sphere", "NFW halo", "Cluster"};
+
+  vector<LensModel> models = lens_presets();
+
+  LensingEngine engine;
+
+  cout << "Lensing benchmark: " << engine.width_ << " x " << engine.height_ << " image, "
+       << engine.cell_ << " px cells, strength " << strength << ", SSE " << DM_USE_SSE << endl;
+
+  for(size_t m = 0; m < models.size(); ++m){
+    cout << endl << names[m] << endl;
+
+    run_shoot(engine, models[m], rays);
+    run_map_sources(engine, models[m], 500, 2);
+  }
+
+  return 0;
+}
@@ -34,7 +34,7 @@ DarkMatterScene::DarkMatterScene(QWidget *parent)
       h2_region_(10),
       star_cluster_(20),
       cluster_background_(tex_unit_cluster_, 1024, 1024, 1),
-      lensing_(tex_unit_lensing_, tex_unit_legend_),
+      lensing_(tex_unit_lensing_, tex_unit_legend_, tex_unit_lensing_field_),
       dm_sprites_(N_dm_sprites_){
 
   setMouseTracking(true);
@@ -106,6 +106,9 @@ DarkMatterScene::DarkMatterScene(QWidget *parent)
 
 //  scenes_[0].add_body(new OrbitingObject(&sun_, "Sun", 601.2, 0.0f, 0.0f, 0.0f));
 
+  // The sun stays put
+  scenes_[0].root_.add_child(&sun_);
+
 #if 0
   // Node, Name, R_orbital (AU), V_orbial (km/s), Inclination, Eccentricity
   scenes_[0].add_body(new OrbitingObject(&mercury_, "Mercury", 0.387f, 47.87f, 7.01f, 0.20563f));
@@ -194,9 +197,13 @@ void DarkMatterScene::initializeGL(){
    * Initialize the scenegraph resources
    */
 
+  // Camera uniforms shared by all the programs
+  frame_.init_resources();
+
   // Measurement reticule
   reticule_.init_resources();
   reticule_.updatePosition(0.0, 0.0);
+  uploads_.schedule(&reticule_);
 
   // Solar System
   sun_.init_from_file(tex_unit_sun_, "assets/textures/sunmap.jpg");
@@ -341,7 +348,11 @@ void DarkMatterScene::cleanup(){
   dm_sprites_.cleanup();
   dm_sprites_program_.cleanup();
 
+  lensing_.cleanup();
+
   pathProgram_.cleanup();
+
+  frame_.cleanup();
 }
 
 /**
@@ -415,104 +426,64 @@ void DarkMatterScene::paintGL(){
 
   auto &camera = scenes_[scene_current_].camera_;
 
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glDisable(GL_DEPTH_TEST);
-
-  // Render background image first
-  if(scene_current_ == 2){
-    cluster_background_.render(screen_camera_);
-  }
-
-  if((scene_current_ == 2) && (lensing_enabled_)){
-    // Draw the Dark Matter sprites
-    glUseProgram(dm_sprites_program_.program_);
-    glUniformMatrix4fv(dm_sprites_program_.mvpHandle_, 1, GL_FALSE, screen_camera_.mvp);
-    dm_sprites_.render(camera);
-  }
+  uploads_.flush();
 
-  // Background image for the galaxy
-  if(scene_current_ == 1){
-    spiral_galaxy_.render(camera);
-  }
+  // Both cameras go up together, the queue binds them as needed
+  frame_.update(camera);
+  frame_.update(screen_camera_);
+  frame_.upload();
 
-  glEnable(GL_DEPTH_TEST);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   /**
-   * Draw the paths
+   * Queue this frame's draws
    */
-  glUseProgram(pathProgram_.program_);
-  glUniformMatrix4fv(pathProgram_.mvpHandle_, 1, GL_FALSE, camera.mvp);
-
-  if(!lensing_enabled_) {
-    for (OrbitingObject *object :  scenes_[scene_current_].bodies_) {
-      object->path.render(camera);
-    }
-  }
-
-
-#if 0
-  // Render each scene, we can potentially put all these
-  // nodes in an array and then loop over them...
+  queue_.clear();
 
-  if(scene_current_ == 0){
-    sun_.render(camera_);
-  }else if(scene_current_ == 2){
-    cluster_background_.render(camera_);
-    galaxies_.render(camera_);
+  // Background images first
+  if(scene_current_ == 2){
+    queue_.push(&cluster_background_, screen_camera_, msg::PASS_BACKGROUND);
 
     if(lensing_enabled_){
-      // The gravitational lens
-      lensing_.render(camera_);
+      // The Dark Matter sprites
+      msg::RenderState sprites_state;
+      sprites_state.pass = msg::PASS_BACKGROUND;
+      sprites_state.program = dm_sprites_program_.program_;
+      sprites_state.vao = dm_sprites_.vao;
+      queue_.push(&dm_sprites_, screen_camera_, sprites_state);
     }
   }
 
-  /**
-   * Draw the scene objects
-   */
-  // 0 - Solar system, 1 - Galaxy, 2 - Cluster
-  for(OrbitingObject *object :  scenes_[scene_current_].bodies_){
-    object->node_->render(camera_);
+  // Background image for the galaxy
+  if(scene_current_ == 1){
+    queue_.push(&spiral_galaxy_, camera, msg::PASS_BACKGROUND);
   }
-#else
-  if((scene_current_ < 3) && (!lensing_enabled_)){
 
-    if(scene_current_ == 0){
-      sun_.render(camera);
-    }
+  if(!lensing_enabled_){
+
+    // The paths all share one program
+    msg::RenderState path_state;
+    path_state.program = pathProgram_.program_;
 
-    // 0 - Solar system, 1 - Galaxy, 2 - Cluster
     for(OrbitingObject *object :  scenes_[scene_current_].bodies_){
-      object->node->render(camera);
+      path_state.vao = object->path.vao;
+      queue_.push(&object->path, camera, path_state);
     }
 
-  }
-
-
-  /**
-   * Draw Lensing simulation
-   */
-  if(scene_current_ == 2){
-//    galaxies_.render(camera);
-
-    if(lensing_enabled_){
-      glDisable(GL_DEPTH_TEST);
+    // 0 - Solar system, 1 - Galaxy, 2 - Cluster
+    queue_.traverse(&scenes_[scene_current_].root_, camera);
 
-      // The gravitational lens
-      lensing_.render(screen_camera_);
+    // Measurement reticule is last
+    queue_.push(&reticule_, screen_camera_, msg::PASS_OVERLAY);
 
-      glEnable(GL_DEPTH_TEST);
-    }
-  }
-#endif
-
-/**
-   * Measurement reticule is last
-   */
-  if(!lensing_enabled_){
+  }else if(scene_current_ == 2){
     // The gravitational lens
-    reticule_.render(screen_camera_);
+    queue_.push(&lensing_, screen_camera_, msg::PASS_OVERLAY);
   }
 
+  queue_.sort();
+  queue_.submit(&frame_);
+
   check_GL_error("DarkMatterScene::paintGL() exit");
 }
 
@@ -582,16 +553,11 @@ void DarkMatterScene::updateAnimation(){
    *
    */
 
+  // Children follow their bodies and the view order is sorted in paintGL
   for(OrbitingObject *object :  scenes_[scene_current_].bodies_){
     object->path.updateAttachedPositions(delta_time * tick_per_ms_);
-
-    // Update child node positions
-    object->node->updateChildren();
   }
 
-  // Sort by view order
-  scenes_[scene_current_].sort();
-
   update();
 }
 
@@ -630,6 +596,7 @@ bool DarkMatterScene::event(QEvent *event){
       reticule_.dot_active_ = false;
       // TODO: Why is it 0.36f and not 0.50f?
       reticule_.updatePosition(world_cs[0], world_cs[1] - 0.36f * reticule_.reticule_.quad_height_);
+      uploads_.schedule(&reticule_);
 //      reticule_.showObjectLabel(false);
       takeMeasurement();
     }
@@ -657,6 +624,7 @@ bool DarkMatterScene::event(QEvent *event){
       screen_camera_.unproject(e->x(), e->y(), -1.0f, world_f);
 
       reticule_.handleDrag(world_i[0], world_i[1], world_f[0], world_f[1]);
+      uploads_.schedule(&reticule_);
 
       float dist_sq = dx * dx + dy * dy;
 
@@ -14,11 +14,14 @@
 #include <iostream>
 #include <random>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // Include this before QtWidgets/QOpenGLWidget
 #include "scene_graph.h"
 
+#include "dm_lensing.h"
+
 #include <QTime>
 #include <QWidget>
 #include <QtWidgets/QOpenGLWidget>
@@ -156,6 +159,7 @@ struct ClusterGalaxies : public msg::Node {
 
   void render(Camera <float> &camera_){
     // Render the galaxies
+    atlas_.commit();
     glBindTexture(GL_TEXTURE_2D, atlas_.tex_);
     billboards_.render(camera_);
   }
@@ -163,30 +167,203 @@ struct ClusterGalaxies : public msg::Node {
 
 #endif
 
+/**
+ *
+ * An image seen through a lens. The warp is done in lens.frag from the
+ * deflection field of the lens model (c.f. dm_lensing.h) so changing the mass
+ * is just a uniform, the source is uploaded once.
+ *
+ */
+struct LensedImage : public msg::FlatShape {
+
+  /**
+   * Settings
+   */
+  std::string vert_shader = "./assets/shaders/lens.vert";
+  std::string frag_shader = "./assets/shaders/lens.frag";
+
+  // Lens mass, the deflection is mass_^2 times the field
+  float mass_ = 0.0f;
+
+  float alpha_ = 1.0f;
+
+  float quad_size_[2] = {4.0f, 2.0f};
+
+  // Size of the lensed image in pixels
+  float result_size_[2] = {1024.0f, 512.0f};
+
+  /**
+   * Internal
+   */
+  float source_size_[2] = {0.0f, 0.0f};
+  float source_offset_[2] = {0.0f, 0.0f};
+
+  // Program handle (c.f. msg::ProgramCache)
+  GLuint program_ = 0;
+
+  GLint positionHandle_ = -1;
+
+  GLint sourceHandle_ = -1;
+  GLint fieldHandle_ = -1;
+  GLint fieldSizeHandle_ = -1;
+  GLint fieldCellHandle_ = -1;
+  GLint massHandle_ = -1;
+  GLint alphaHandle_ = -1;
+  GLint quadSizeHandle_ = -1;
+  GLint resultSizeHandle_ = -1;
+  GLint sourceSizeHandle_ = -1;
+  GLint sourceOffsetHandle_ = -1;
+
+  // Source image
+  GLuint tex_ = 0;
+  int tex_unit_ = 0;
+
+  // Deflection field, owned by ClusterLensing
+  GLuint field_tex_ = 0;
+  int field_tex_unit_ = 0;
+  float field_size_[2] = {0.0f, 0.0f};
+  float field_cell_ = 1.0f;
+
+  LensedImage(int texture_unit, int field_texture_unit)
+      : tex_unit_(texture_unit),
+        field_tex_unit_(field_texture_unit){
+
+  }
+
+  /**
+   * LensedImage::init_resources
+   *
+   * @param source The unlensed image
+   * @param offset_h Horizontal offset of the source from the center of the result (pixels)
+   * @return
+   */
+  bool init_resources(const QImage &source, int offset_h){
+
+    check_GL_error("LensedImage::init_resources() entry");
+
+    program_ = msg::ProgramCache::acquire("LensedImage", vert_shader, frag_shader);
+
+    if(program_ == 0){
+      return false;
+    }
+
+    positionHandle_ = glGetAttribLocation(program_, "position_in_");
+    sourceHandle_ = glGetUniformLocation(program_, "source_");
+    fieldHandle_ = glGetUniformLocation(program_, "field_");
+    fieldSizeHandle_ = glGetUniformLocation(program_, "field_size_");
+    fieldCellHandle_ = glGetUniformLocation(program_, "field_cell_");
+    massHandle_ = glGetUniformLocation(program_, "mass_");
+    alphaHandle_ = glGetUniformLocation(program_, "alpha_");
+    quadSizeHandle_ = glGetUniformLocation(program_, "quad_size_");
+    resultSizeHandle_ = glGetUniformLocation(program_, "result_size_");
+    sourceSizeHandle_ = glGetUniformLocation(program_, "source_size_");
+    sourceOffsetHandle_ = glGetUniformLocation(program_, "source_offset_");
+
+    source_size_[0] = source.width();
+    source_size_[1] = source.height();
+
+    source_offset_[0] = offset_h + 0.5f * (result_size_[0] - source_size_[0]);
+    source_offset_[1] = 0.5f * (result_size_[1] - source_size_[1]);
+
+    /**
+     * Upload the source once, rows from the top like QImage
+     */
+    glGenTextures(1, &tex_);
+
+    glActiveTexture(GL_TEXTURE0 + tex_unit_);
+    glBindTexture(GL_TEXTURE_2D, tex_);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    const QImage img = source.convertToFormat(QImage::Format_RGBA8888);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.width(), img.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
+
+    /**
+     * Geometry
+     */
+    msg::FlatShape::init_resources();
+    msg::FlatShape::setup_array(positionHandle_);
+    msg::FlatShape::build_quad(quad_size_[0], quad_size_[1]);
+
+    return check_GL_error("LensedImage::init_resources() exit");
+  }
+
+  void cleanup(){
+    glDeleteTextures(1, &tex_);
+    msg::ProgramCache::release(program_);
+
+    msg::FlatShape::cleanup();
+  }
+
+  virtual void render(Camera <float> &camera){
+
+    glUseProgram(program_);
+
+    glActiveTexture(GL_TEXTURE0 + tex_unit_);
+    glBindTexture(GL_TEXTURE_2D, tex_);
+    glUniform1i(sourceHandle_, tex_unit_);
+
+    glActiveTexture(GL_TEXTURE0 + field_tex_unit_);
+    glBindTexture(GL_TEXTURE_2D, field_tex_);
+    glUniform1i(fieldHandle_, field_tex_unit_);
+    glUniform2fv(fieldSizeHandle_, 1, field_size_);
+    glUniform1f(fieldCellHandle_, field_cell_);
+
+    glUniform1f(massHandle_, mass_);
+    glUniform1f(alphaHandle_, alpha_);
+    glUniform2fv(quadSizeHandle_, 1, quad_size_);
+    glUniform2fv(resultSizeHandle_, 1, result_size_);
+    glUniform2fv(sourceSizeHandle_, 1, source_size_);
+    glUniform2fv(sourceOffsetHandle_, 1, source_offset_);
+
+    msg::FlatShape::bind();
+    msg::FlatShape::render(camera);
+
+    check_GL_error("LensedImage::render() exit");
+  }
+};
+
 /**
  *
  * Draw the galaxy, the lensing model and the legend
  *
  *
- * Need one texture atlas storing 3 tiles,
- * the legend, the galaxy image, lense target (lensed at specific time),
- * the lensed galaxy image
+ * The galaxy lensed by the true mass and the model (galaxy + contours)
+ * lensed by the user's mass are warped on the GPU (c.f. LensedImage),
+ * the legend is a tile in its own atlas.
+ *
+ * Both are warped by the same lens model. The deflection of every preset
+ * model is computed and uploaded in init_resources so switching between
+ * them only rebinds a texture.
  *
  *
  */
 struct ClusterLensing : public msg::Node {
 
-  ClusterLensing(int lensing_texture_unit, int legend_texture_unit)
+  ClusterLensing(int lensing_texture_unit, int legend_texture_unit, int field_texture_unit)
       : lensing_tex_unit_(lensing_texture_unit),
         legend_tex_unit_(legend_texture_unit),
-        lensing_billboards_(2),
-        lensing_atlas_(lensing_texture_unit, lensing_width_, lensing_height_, 2),
+        field_tex_unit_(field_texture_unit),
+        observed_(lensing_texture_unit, field_texture_unit),
+        model_(lensing_texture_unit, field_texture_unit),
         legend_billboards_(1),
         legend_atlas_(legend_texture_unit, legend_width_, legend_height_, 1){
 
-    lensing_billboards_.atlas_tex_unit_ = lensing_texture_unit;
-    lensing_billboards_.quad_width_ = lensing_quad_width_;
-    lensing_billboards_.quad_height_ = lensing_quad_height_;
+    for(LensedImage *lensed : {&observed_, &model_}){
+      lensed->quad_size_[0] = lensing_quad_width_;
+      lensed->quad_size_[1] = lensing_quad_height_;
+      lensed->result_size_[0] = lensing_width_;
+      lensed->result_size_[1] = lensing_height_;
+    }
+
+    engine_.width_ = lensing_width_;
+    engine_.height_ = lensing_height_;
+
+    // Lens models, offsets in pixels of the lensed image
+    models_ = lens_presets();
 
 
     legend_billboards_.atlas_tex_unit_ = legend_texture_unit;
@@ -202,15 +379,6 @@ struct ClusterLensing : public msg::Node {
      * Setup Geometry
      */
 
-    // Lensing stuff
-    lensing_billboards_.init_resources();
-    lensing_atlas_.init_resources();
-
-    for(int i = 0; i < 2; ++i){
-      lensing_atlas_.add_tile();
-      lensing_atlas_.get_tile_coordinates(i, lensing_billboards_.info_[i].tex);
-    }
-
     // Legend
     legend_billboards_.init_resources();
     legend_atlas_.init_resources();
@@ -220,16 +388,9 @@ struct ClusterLensing : public msg::Node {
     int tile_width = legend_atlas_.tile_width_;
     int tile_height = legend_atlas_.tile_width_;
 
-
-    // initialize an image we'll distort later
-    lensed_image_ = QImage(lensing_atlas_.tile_width_, lensing_atlas_.tile_height_, QImage::Format_RGBA8888);
-
     /**
      * Load the galaxies
      */
-    // Bind the atlas
-    lensing_atlas_.bind();
-
     // Read the galaxy image
     QImageReader reader(target_filename.c_str());
     const QImage img = reader.read();
@@ -342,28 +503,24 @@ struct ClusterLensing : public msg::Node {
                             Qt::AlignCenter | Qt::AlignBaseline,
                             "Dark Matter");
 
-    // TODO: Why is this broken??
-    //   lensing_atlas_.update_tile(1, galaxy_image.bits());
-
-    // Load the target to atlas 2
-    update_lens(0, M_true_, galaxy_image);
-
-    // Load the dynamic image
-    update_lens(1, M_, target_image_);
-
-#if 0
-    lensing_atlas_.save_atlas("lensing_atlas.png");
-#endif
-
-    lensing_billboards_.count_ = 2;
+    // Deflection fields of all the models
+    for(const LensModel &lens : models_){
+      if(!field_texture(lens)){
+        return false;
+      }
+    }
 
-    // Target Lensed Image
-    lensing_billboards_.info_[0].position[2] = 1.0f;
+    // The galaxy as seen through the true mass
+    if(!observed_.init_resources(galaxy_image, galaxy_offset_h_)){
+      return false;
+    }
+    observed_.mass_ = lens_scale_ * M_true_;
 
-    // Lensed Image
-    lensing_billboards_.info_[1].position[0] = 0.0f;
-    lensing_billboards_.info_[1].position[2] = 1.5f;
-    lensing_billboards_.upload_billboards();
+    // The model the user fits on top, only its mass changes
+    if(!model_.init_resources(target_image_, galaxy_offset_h_)){
+      return false;
+    }
+    model_.mass_ = lens_scale_ * M_;
 
     // Upload Legend
     legend_atlas_.bind();
@@ -384,89 +541,88 @@ struct ClusterLensing : public msg::Node {
 
   void cleanup(){
     legend_billboards_.cleanup();
-    lensing_billboards_.cleanup();
-
-    lensing_atlas_.cleanup();
     legend_atlas_.cleanup();
+
+    observed_.cleanup();
+    model_.cleanup();
+
+    for(auto &field : field_textures_){
+      glDeleteTextures(1, &field.second);
+    }
+    field_textures_.clear();
   }
 
   /**
+   * ClusterLensing::field_texture
    *
-   * Distort the image
+   * Upload the deflection field of a model unless it already is
    *
-   * @param tile_ix
-   * @param mass
+   * @param lens
+   * @return The texture or 0 if the field could not be computed
    */
-  void update_lens(int tile_ix, int mass, const QImage &source){
-
-    float alpha = 1.0f;
-
-    lensed_image_.fill(qRgba(0, 0, 0, 0));
+  GLuint field_texture(const LensModel &lens){
 
-    QPainter painter(&lensed_image_);
+    long long key = lens.key();
 
-#if 1
-    // http://leo.astronomy.cz/grlens/grl0.html
-    int source_image_height = source.height();
-    int source_image_width = source.width();
-
-    int result_image_height = lensed_image_.height();
-    int result_image_width = lensed_image_.width();
-
-    int lens_x = result_image_width / 2;
-    int lens_y = result_image_height / 2;
-
-    int source_offset_x = galaxy_offset_h_ + (result_image_width - source_image_width) / 2;
-//    int source_offset_x = (result_image_width - source_image_width)/2;
-    int source_offset_y = (result_image_height - source_image_height) / 2;
+    auto it = field_textures_.find(key);
 
-    mass *= 0.9;
+    if(it != field_textures_.end()){
+      return it->second;
+    }
 
-    for(int x = 0; x < result_image_width; ++x){
-      for(int y = 0; y < result_image_height; ++y){
+    const DeflectionField *field = engine_.field(lens);
 
-        float dx = x - lens_x;
-        float dy = y - lens_y;
+    if(!field){
+      return 0;
+    }
 
-        float dsq = dx * dx + dy * dy;
+    GLuint tex = 0;
+    glGenTextures(1, &tex);
 
-        QRgb pixel = 0;
+    glActiveTexture(GL_TEXTURE0 + field_tex_unit_);
+    glBindTexture(GL_TEXTURE_2D, tex);
 
-        if(dsq > 0){
-          float tmp3 = source_offset_x + dx * mass * mass / dsq;
-          float tmp4 = source_offset_y + dy * mass * mass / dsq;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-          if((y - tmp4 >= 0) && (x - tmp3 >= 0)
-             && (x - tmp3 < source_image_width)
-             && (y - tmp4 < source_image_height)){
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, field->nx_, field->ny_, 0, GL_RG, GL_FLOAT, field->alpha_.data());
 
-            pixel = source.pixel(x - tmp3, y - tmp4);
+    check_GL_error("ClusterLensing::field_texture() exit");
 
-            pixel = qRgba(qRed(pixel),
-                          qGreen(pixel),
-                          qBlue(pixel),
-                          alpha * qAlpha(pixel));
+    field_textures_[key] = tex;
 
-          }
-        }
-        lensed_image_.setPixel(x, y, pixel);
-      }
+    for(LensedImage *lensed : {&observed_, &model_}){
+      lensed->field_size_[0] = field->nx_;
+      lensed->field_size_[1] = field->ny_;
+      lensed->field_cell_ = field->cell_;
     }
 
-#else
-    painter.drawImage(target_image_.rect(), target_image_);
-#endif
-//    lensed_image_.save("lensed_image_.png");
-
-    lensing_atlas_.bind();
-    lensing_atlas_.update_tile(tile_ix, lensed_image_.bits());
+    return tex;
+  }
 
-//    lensing_atlas_.save_atlas("lensing_atlas.png");
+  /**
+   * ClusterLensing::setModel
+   *
+   *   The field is picked up on the next render (needs the GL context)
+   *
+   * @param index Index into models_
+   */
+  void setModel(int index){
+    model_index_ = std::max(0, std::min(index, int(models_.size()) - 1));
   }
 
+  /**
+   * ClusterLensing::setMass
+   *
+   *   Only a uniform changes, the warp is redone on the GPU next frame
+   *
+   * @param mass
+   */
   void setMass(int mass){
     M_ = mass;
-    update_lens(1, M_, target_image_);
+    model_.mass_ = lens_scale_ * M_;
   }
 
   /**
@@ -476,9 +632,17 @@ struct ClusterLensing : public msg::Node {
    */
   void render(Camera <float> &camera){
 
-    // Lensing stuff
-    lensing_atlas_.bind();
-    lensing_billboards_.render(camera);
+    // Upload the tiles changed since the last frame
+    legend_atlas_.commit();
+
+    // A hit for the presets, they are uploaded in init_resources
+    GLuint field_tex = field_texture(models_[model_index_]);
+    observed_.field_tex_ = field_tex;
+    model_.field_tex_ = field_tex;
+
+    // Lensing stuff, the model goes on top
+    observed_.render(camera);
+    model_.render(camera);
 
     // The legend
     legend_atlas_.bind();
@@ -525,10 +689,18 @@ struct ClusterLensing : public msg::Node {
    */
   int lensing_tex_unit_ = 0;
   int legend_tex_unit_ = 0;
+  int field_tex_unit_ = 0;
 
-  // Labels for the distances
-  msg::BillboardSet lensing_billboards_;
-  msg::ImageAtlas lensing_atlas_;
+  // Lens models, the deflection fields are cached by the engine and the
+  // uploaded textures here, both keyed on LensModel::key
+  LensingEngine engine_;
+  std::vector<LensModel> models_;
+  std::unordered_map<long long, GLuint> field_textures_;
+  int model_index_ = 0;
+
+  // The lensed galaxy and the user's model of it
+  LensedImage observed_;
+  LensedImage model_;
 
   // Labels for the distances
   msg::BillboardSet legend_billboards_;
@@ -537,13 +709,13 @@ struct ClusterLensing : public msg::Node {
   // Image with galaxy + red countours on top of it
   QImage target_image_;
 
-  // The distorted image we see
-  QImage lensed_image_;
-
   int M_max_ = 500;
   int M_true_ = 246;
   int M_ = 0;
 
+  // Lens mass per slider unit
+  float lens_scale_ = 0.9f;
+
   int galaxy_offset_h_ = -150;
 };
 
@@ -554,35 +726,24 @@ struct Reticule : public msg::Node {
 
   Reticule(int texture_unit)
       : tex_unit_(texture_unit),
+        glyphs_(texture_unit),
         reticule_(1),
-        reticule_label_(1){
+        reticule_label_(&glyphs_, 1, 48){
 
     reticule_.setPosition(0, 0, 0);
     reticule_label_.setPosition(1.0, 0, 0);
-    reticule_label_.atlas_tex_unit_ = texture_unit;
-
-    label_image_ = QImage(label_image_w_, label_image_h_, QImage::Format_RGBA8888);
 
+    reticule_label_.info_[0].size = label_size_;
+    std::copy(C_text_, C_text_ + 4, reticule_label_.info_[0].color);
+    std::copy(C_padding_, C_padding_ + 4, reticule_label_.info_[0].background);
   }
 
   virtual bool init_resources(){
 
     std::cout << "ClusterLensing::init_resources" << std::endl;
-    // Create the texture for the label
-    glGenTextures(1, &tex_);
-
-    glActiveTexture(GL_TEXTURE0 + tex_unit_);
-    glBindTexture(GL_TEXTURE_2D, tex_);
-    glPixelStorei(GL_PACK_ALIGNMENT, 4);
 
-    // These have to be after the load or it doesn't work.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, label_image_w_, label_image_h_,
-                 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    // Glyphs for the label
+    glyphs_.init_resources();
 
     /**
      * Setup Programs
@@ -609,16 +770,7 @@ struct Reticule : public msg::Node {
     reticule_.count_ = 1;
 
 
-    reticule_label_.frag_shader = label_frag_shader;
     reticule_label_.init_resources();
-    reticule_label_.quad_width_ = label_width_;
-    reticule_label_.quad_height_ = label_height_;
-
-    // The reticule has normalized texture coordinates.
-    reticule_label_.info_[0].tex[0] = 0.0;
-    reticule_label_.info_[0].tex[1] = 1.0;
-    reticule_label_.info_[0].tex[2] = 1.0;
-    reticule_label_.info_[0].tex[3] = 0.0;
     reticule_label_.count_ = 1;
 
     updateObjectLabel("Planetary Nebula");
@@ -629,8 +781,7 @@ struct Reticule : public msg::Node {
   void cleanup(){
     reticule_.cleanup();
     reticule_label_.cleanup();
-
-    glDeleteTextures(1, &tex_);
+    glyphs_.cleanup();
   }
 
   /**
@@ -639,42 +790,7 @@ struct Reticule : public msg::Node {
    * @param object_name
    */
   void updateObjectLabel(const char *object_name){
-
-    check_GL_error("Reticule::updateObjectLabel entry()");
-
-    // Create a label
-    glBindTexture(GL_TEXTURE_2D, tex_);
-    label_image_.fill(0);
-
-    if(object_name != nullptr){
-      QPainter painter(&label_image_);
-      QFont font = painter.font();
-      font.setPointSize(label_font_size_);
-      font.setWeight(QFont::DemiBold);
-      painter.setFont(font);
-
-      QPen pen(C_text_);
-
-      painter.setPen(pen);
-      painter.fillRect(label_image_.rect(), C_padding_);
-      painter.drawText(QRect(0, 0, label_image_w_, label_image_h_),
-                       Qt::AlignCenter | Qt::AlignBaseline,
-                       object_name);
-    }
-
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, label_image_w_, label_image_h_,
-                    GL_RGBA, GL_UNSIGNED_BYTE, label_image_.bits());
-
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    // Need to have this here otherwise the caller can change buffer while we are editing it
-    glFlush();
-
-#if 0
-    msg::ImageAtlas::save_atlas(tex_, label_image_w_, label_image_h_, "object_labels.png");
-    label_image_.save("object_label_img.png");
-#endif
-    check_GL_error("ExpansionLabWidget::updateDistanceLabel exit()");
+    reticule_label_.set_text(0, object_name != nullptr ? object_name : "");
   };
 
 
@@ -689,7 +805,8 @@ struct Reticule : public msg::Node {
 
   /**
    *
-   *  Set the selector position
+   *  Set the selector position, the reticule has to be scheduled for upload
+   *  afterwards (c.f. flush_upload)
    *
    * @param x world coordinates
    * @param y
@@ -701,11 +818,10 @@ struct Reticule : public msg::Node {
 
     reticule_.info_[0].position[0] = x;
     reticule_.info_[0].position[1] = y;
-    reticule_.upload_billboards();
 
     reticule_label_.info_[0].position[0] = x;
     reticule_label_.info_[0].position[1] = y + label_offset_;
-    reticule_label_.upload_billboards();
+    reticule_label_.update(0);
   }
 
   /**
@@ -750,6 +866,18 @@ struct Reticule : public msg::Node {
     return false;
   };
 
+  /**
+   * Reticule::flush_upload
+   *
+   *   Upload the reticule and its label, dragging moves them once per mouse
+   *   event but they are uploaded once per frame
+   *
+   * @return
+   */
+  virtual size_t flush_upload(){
+    return reticule_.flush_upload() + reticule_label_.flush_upload();
+  }
+
 
   /**
    * Render the reticule and its label
@@ -758,9 +886,6 @@ struct Reticule : public msg::Node {
    */
   void render(Camera <float> &camera){
 
-    // Bind the texture map for the label
-    glBindTexture(GL_TEXTURE_2D, tex_);
-
 //    // TODO: This is a bit redundant...
 //    glUseProgram(reticule_.program_);
 //
@@ -788,24 +913,15 @@ struct Reticule : public msg::Node {
 
   const char *vert_shader = "./assets/shaders/billboard_set.vert";
   const char *reticule_frag_shader = "assets/shaders/reticule.frag";
-  const char *label_frag_shader = "assets/shaders/billboard_set.frag";
-
-
-  // Label size in pixels / Texture Size
-  const static int label_image_w_ = 256;
-  const static int label_image_h_ = 64;
 
   float reticule_size_ = 0.25f;
-  float label_size_ = 0.8f * reticule_size_;
 
-  float label_width_ = 4.0f * label_size_;
-  float label_height_ = label_size_;
+  // Size of the label em square
+  float label_size_ = 0.25f * reticule_size_;
   float label_offset_ = reticule_size_;
 
-  int label_font_size_ = 16;
-
-  QColor C_padding_ = QColor(80, 80, 80, 80);
-  QColor C_text_ = QColor(10, 140, 20, 255);
+  float C_padding_[4] = {80 / 255.0f, 80 / 255.0f, 80 / 255.0f, 80 / 255.0f};
+  float C_text_[4] = {10 / 255.0f, 140 / 255.0f, 20 / 255.0f, 1.0f};
 
   float C_dot_active_[4] = {1.0f, 0.0f, 0.4f, 1.0f};
   float C_dot_passive_[4] = {0.0f, 0.4f, 1.0f, 1.0f};
@@ -823,26 +939,20 @@ struct Reticule : public msg::Node {
   GLuint reticule_program_;
   GLuint label_program_;
 
-  msg::BillboardSet reticule_;
-  msg::BillboardSet reticule_label_;
+  // Glyphs for the label
+  msg::GlyphAtlas glyphs_;
 
-  // OpenGL
-  GLuint tex_;
+  msg::BillboardSet reticule_;
+  msg::TextSet reticule_label_;
 
   GLuint reticulePositionHandle_;
   GLuint labelPositionHandle_;
 
   // Uniform handles
-  GLint reticuleMvpHandle_;
-  GLint labelMvpHandle_;
   GLint dotColorHandle_;
 
   GLint colorHandle_;
 
-
-  // Qt
-  QImage label_image_;
-
 };
 
 /**
@@ -1007,9 +1117,6 @@ struct OrbitingObject {
   // in km/s in the real world
   float orbital_velocity;
 
-  // Distance from camera
-  float z_distance;
-
   // Distance from center of screen for stabilizing the sort (note used)
   float screen_distance;
 
@@ -1106,8 +1213,6 @@ struct SpiralGalaxy : public msg::Billboard {
   GLuint positionHandle_;
 
   // Uniform handles
-  GLint mvpHandle_;
-
   GLint scaleHandle_;
   GLint radiusHandle_;
 
@@ -1143,7 +1248,6 @@ struct SpiralGalaxy : public msg::Billboard {
 
     positionHandle_ = glGetAttribLocation(program_, "position_in_");
 
-    mvpHandle_ = glGetUniformLocation(program_, "mvp_");
     radiusHandle_ = glGetUniformLocation(program_, "radius_");
     scaleHandle_ = glGetUniformLocation(program_, "scale_");
 
@@ -1185,9 +1289,6 @@ struct SpiralGalaxy : public msg::Billboard {
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width_, tex_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
     glGenerateMipmap(GL_TEXTURE_2D);
 
-    // Need to have this here otherwise the caller can change buffer while we are editing it
-    glFlush();
-
     return check_GL_error("SpiralGalaxy::init_resources() exit");
   }
 
@@ -1200,7 +1301,6 @@ struct SpiralGalaxy : public msg::Billboard {
   virtual void render(Camera <float> &camera){
 
     glUseProgram(program_);
-    glUniformMatrix4fv(mvpHandle_, 1, GL_FALSE, camera.mvp);
 
     glUniform1i(colorSamplerHandle_, tex_unit_);
     glUniform1f(radiusHandle_, radius);
@@ -1237,7 +1337,6 @@ struct SpiralGalaxy : public msg::FlatShape{
 
   // Position Attribute
   GLint positionHandle_ = 0;
-  GLint mvpHandle_ = 0;
 
   GLint backgroundHandle_ = 0;
   GLint backgroundAlpha_ = 0;
@@ -1289,7 +1388,6 @@ struct SpiralGalaxy : public msg::FlatShape{
 
     positionHandle_ = glGetAttribLocation(program_, "position_in_");
 
-    mvpHandle_ = glGetUniformLocation(program_, "mvp_");
     backgroundHandle_ = glGetUniformLocation(program_, "background_");
     backgroundAlpha_ = glGetUniformLocation(program_, "background_alpha_");
     backgroundScale_ = glGetUniformLocation(program_, "scale_");
@@ -1437,6 +1535,7 @@ struct StarCluster : public msg::Sprites {
 
   StarCluster(int star_count)
       : msg::Sprites(star_count){
+    pass_ = msg::PASS_TRANSPARENT;
   };
 
 
@@ -1496,14 +1595,29 @@ struct StarCluster : public msg::Sprites {
 
     // Dark Matter sprites
     glUseProgram(stars_program_.program_);
-    glUniformMatrix4fv(stars_program_.mvpHandle_, 1, GL_FALSE, camera.mvp);
-    glUniform3fv(stars_program_.offsetHandle_, 1, position);
+    glBindVertexArray(vao);
 
-    msg::Sprites::render(camera);
+    StarCluster::draw(camera);
 
     check_GL_error("StarCluster::render() exit");
   }
 
+  virtual void enqueue(msg::RenderQueue &queue, Camera <float> &camera){
+
+    msg::RenderState state;
+    state.pass = pass_;
+    state.program = stars_program_.program_;
+    state.vao = vao;
+
+    queue.push(this, camera, state);
+  }
+
+  virtual void draw(Camera <float> &camera){
+    glUniform3fv(stars_program_.offsetHandle_, 1, world_position());
+
+    msg::Sprites::draw(camera);
+  }
+
 
 };
 
@@ -1534,6 +1648,9 @@ struct HIIRegion : public StarCluster {
 
     // Set the random seed for the star cluster
     random_seed_ = 10331;
+
+    // The gas moves with the stars
+    add_child(&envelope_);
   }
 
   bool init_resources(){
@@ -1555,25 +1672,6 @@ struct HIIRegion : public StarCluster {
 
     StarCluster::cleanup();
   }
-
-  /**
-   * Update the position of the envelope
-   */
-  virtual void updateChildren(){
-    envelope_.setPosition(position[0], position[1], position[2]);
-  }
-
-  virtual void render(Camera <float> &camera_){
-    check_GL_error("HIIRegion::render() enter");
-
-
-    StarCluster::render(camera_);
-
-    // Now draw the gas layer outside
-    envelope_.render(camera_);
-
-    check_GL_error("HIIRegion::render() exit");
-  }
 };
 
 
@@ -1620,25 +1718,6 @@ struct ClusterGalaxy : public msg::ProceduralSphere {
 };
 
 
-/**
- *
- * Functional for the sorting
- *
- * @tparam T
- */
-template <class T>
-struct screen_distance_comparator {
-  bool operator()(const OrbitingObject *lhs, const OrbitingObject *rhs){
-    if (lhs->z_distance == rhs->z_distance){
-      // Not sure why...
-      return (lhs->orbital_radius < rhs->orbital_radius);
-      //return (lhs.screen_distance < rhs.screen_distance);
-    }else{
-      return (lhs->z_distance > rhs->z_distance);
-    }
-  }
-};
-
 /*
  * Stores information about a single scene like the solar system or the galaxy clusters
  */
@@ -1660,6 +1739,10 @@ struct Scene {
 
   void add_body(OrbitingObject *body){
     bodies_.push_back(body);
+
+    if(body->node != nullptr){
+      root_.add_child(body->node);
+    }
   }
 
   void setOrbitInclination(float initial, float final){
@@ -1720,33 +1803,15 @@ struct Scene {
     return true;
   }
 
-  /**
-   *
-   * Sort the objects by view order
-   *
-   */
-  void sort(){
-
-    float world_position[4];
-
-    // Update the z-position of each body
-    for(size_t i = 0; i < bodies_.size(); ++i){
-      vec4_by_mat4x4(camera_.mvp, bodies_[i]->node->position, world_position);
-      bodies_[i]->z_distance = world_position[2];// / world_position[3];
-//      body->screen_distance = pow(center_eye[0] / center_eye[3], 2.0) + pow(center_eye[1]/ center_eye[3], 2.0);
-    }
-
-    // Sort by the z position
-    screen_distance_comparator <float> cmp;
-    std::sort(bodies_.begin(), bodies_.end(), cmp);
-  }
-
   /**
    * Internal data
    */
   std::string _background_texture;
   std::vector <OrbitingObject *> bodies_;
 
+  // Every node drawn in the scene, the view order is left to the RenderQueue
+  msg::Group root_;
+
   // For the initial animation
   float inclination_final;
   float inclination_initial;
@@ -1869,9 +1934,20 @@ public:
    */
   void showLensing(bool enabled){
     lensing_enabled_ = enabled;
+    lensing_.setModel(lens_model_);
     setLensMass(0);
   }
 
+  /**
+   * Pick the lens model (0 point mass, 1 isothermal sphere, 2 NFW halo, 3 cluster)
+   * @param index
+   */
+  void setLensModel(int index){
+    lens_model_ = index;
+    lensing_.setModel(lens_model_);
+    update();
+  }
+
   /**
    * Set the mass of the dark matter lense
    * @param value
@@ -1954,6 +2030,7 @@ protected:
   const static int tex_unit_cluster_ = 6;
   const static int tex_unit_lensing_ = 8;
   const static int tex_unit_legend_ = 9;
+  const static int tex_unit_lensing_field_ = 10;
 
 
   /**
@@ -2033,6 +2110,15 @@ protected:
   // Program for drawing all paths
   msg::PathProgram pathProgram_;
 
+  // Nodes changed since the last frame, uploaded at the top of paintGL
+  msg::UploadScheduler uploads_;
+
+  // Camera blocks, one for each scene and one for the screen
+  msg::FrameUniforms frame_{scene_count_ + 1};
+
+  // Draws of the current frame, rebuilt in paintGL
+  msg::RenderQueue queue_;
+
   // Solar System
   msg::TexturedSphere sun_;
   msg::TexturedSphere mercury_;
@@ -2063,6 +2149,7 @@ protected:
   const static int scene_count_ = 3;
 
   bool lensing_enabled_ = false;
+  int lens_model_ = 0;
 
   Scene scenes_[scene_count_];
 
@@ -0,0 +1,78 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: SSE switch and the few vector math functions the lab needs
+ * (lens deflection sampling and the absorption spectrum)
+ *
+ */
+
+
+#ifndef DM_SIMD_H
+#define DM_SIMD_H
+
+// Can be forced off with -DDM_USE_SSE=0
+#ifndef DM_USE_SSE
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DM_USE_SSE 1
+#else
+#define DM_USE_SSE 0
+#endif
+#endif
+
+#if DM_USE_SSE
+#include <emmintrin.h>
+
+/**
+ * exp_ps
+ *
+ * exp() of four floats, relative error below 2e-7 (Cephes expf). Inputs
+ * below -87 flush to zero, which is all a Gaussian tail needs.
+ *
+ * @param x
+ * @return
+ */
+inline __m128 exp_ps(__m128 x){
+
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  __m128 underflow = _mm_cmplt_ps(x, _mm_set1_ps(-87.0f));
+
+  x = _mm_min_ps(x, _mm_set1_ps(88.0f));
+  x = _mm_max_ps(x, _mm_set1_ps(-87.0f));
+
+  // x = n ln(2) + r, |r| <= ln(2) / 2
+  __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+
+  // floor
+  __m128i n = _mm_cvttps_epi32(fx);
+  __m128 tmp = _mm_cvtepi32_ps(n);
+  __m128 mask = _mm_and_ps(_mm_cmpgt_ps(tmp, fx), one);
+  fx = _mm_sub_ps(tmp, mask);
+
+  x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+  x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+  __m128 x_sq = _mm_mul_ps(x, x);
+
+  __m128 y = _mm_set1_ps(1.9875691500e-4f);
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+  y = _mm_add_ps(_mm_mul_ps(y, x_sq), _mm_add_ps(x, one));
+
+  // 2^n
+  n = _mm_cvttps_epi32(fx);
+  n = _mm_add_epi32(n, _mm_set1_epi32(0x7f));
+  n = _mm_slli_epi32(n, 23);
+
+  y = _mm_mul_ps(y, _mm_castsi128_ps(n));
+
+  return _mm_andnot_ps(underflow, y);
+}
+#endif
+
+#endif // DM_SIMD_H
@@ -0,0 +1,118 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Minimum and maximum of a long series over any index range in
+ * O(log n). Used to decimate a spectrum to one min/max pair per pixel column
+ * of the plot, whatever its resolution.
+ *
+ */
+
+
+#ifndef MINMAX_PYRAMID_H
+#define MINMAX_PYRAMID_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+/**
+ *
+ * Level 0 holds the samples, entry a of level k the extremes of samples
+ * [a 2^k, (a + 1) 2^k) which are entries 2a and 2a + 1 of level k - 1.
+ *
+ */
+struct MinMaxPyramid{
+
+  std::vector<std::vector<float> > min_;
+  std::vector<std::vector<float> > max_;
+
+  /**
+   * MinMaxPyramid::build
+   *
+   * @param data
+   * @param count
+   */
+  void build(const float *data, int count){
+
+    using namespace std;
+
+    min_.assign(1, vector<float>(data, data + count));
+    max_.assign(1, vector<float>(data, data + count));
+
+    while(min_.back().size() > 1){
+      const vector<float> &lo = min_.back();
+      const vector<float> &hi = max_.back();
+
+      int n = int(lo.size());
+
+      vector<float> next_lo((n + 1) / 2);
+      vector<float> next_hi((n + 1) / 2);
+
+      for(int a = 0; a < n / 2; ++a){
+        next_lo[a] = min(lo[2 * a], lo[2 * a + 1]);
+        next_hi[a] = max(hi[2 * a], hi[2 * a + 1]);
+      }
+
+      // Odd one out
+      if(n & 1){
+        next_lo[n / 2] = lo[n - 1];
+        next_hi[n / 2] = hi[n - 1];
+      }
+
+      min_.push_back(next_lo);
+      max_.push_back(next_hi);
+    }
+  }
+
+  int size() const{
+    return min_.empty() ? 0 : int(min_[0].size());
+  }
+
+  /**
+   * MinMaxPyramid::range
+   *
+   * @param i_0 First sample
+   * @param i_1 One past the last sample
+   * @param lo
+   * @param hi
+   * @return false if the range is empty
+   */
+  bool range(int i_0, int i_1, float &lo, float &hi) const{
+
+    using namespace std;
+
+    i_0 = max(i_0, 0);
+    i_1 = min(i_1, size());
+
+    if(i_0 >= i_1){
+      return false;
+    }
+
+    lo = numeric_limits<float>::max();
+    hi = -numeric_limits<float>::max();
+
+    // Take the unpaired blocks at either end and go up a level
+    for(int k = 0; i_0 < i_1; ++k){
+      if(i_0 & 1){
+        lo = min(lo, min_[k][i_0]);
+        hi = max(hi, max_[k][i_0]);
+        ++i_0;
+      }
+
+      if(i_1 & 1){
+        --i_1;
+        lo = min(lo, min_[k][i_1]);
+        hi = max(hi, max_[k][i_1]);
+      }
+
+      i_0 >>= 1;
+      i_1 >>= 1;
+    }
+
+    return true;
+  }
+};
+
+#endif // MINMAX_PYRAMID_H
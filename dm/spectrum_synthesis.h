@@ -0,0 +1,501 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Synthetic absorption spectra from a rest frame line list. The
+ * lines are Doppler shifted by the measured velocity on a fine grid, the
+ * spectrum is convolved with the instrumental profile by FFT and noise is
+ * added. Spectra are kept per velocity so remeasuring an object is free.
+ *
+ */
+
+
+#ifndef SPECTRUM_SYNTHESIS_H
+#define SPECTRUM_SYNTHESIS_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dm_simd.h"
+
+/**
+ *
+ * Rest frame absorption lines
+ *
+ */
+struct LineList{
+
+  struct Line{
+    float lambda;   // Rest wavelength [nm]
+    float tau;      // Central optical depth
+    float b;        // Doppler parameter [km/s], 0 for the default
+  };
+
+  std::vector<Line> lines_;
+
+  /**
+   * LineList::load
+   *
+   * One line per row: wavelength [nm], central optical depth and optionally
+   * the Doppler parameter [km/s]. Rows starting with # are skipped.
+   *
+   * @param filename
+   * @return false if the file could not be read
+   */
+  bool load(const std::string &filename){
+
+    using namespace std;
+
+    ifstream in(filename.c_str());
+
+    if(!in){
+      return false;
+    }
+
+    lines_.clear();
+
+    string row;
+
+    while(getline(in, row)){
+      if(row.empty() || row[0] == '#'){
+        continue;
+      }
+
+      istringstream columns(row);
+
+      Line line = {0.0f, 0.0f, 0.0f};
+
+      if(columns >> line.lambda >> line.tau){
+        columns >> line.b;
+        lines_.push_back(line);
+      }
+    }
+
+    cout << "LineList::load " << filename << " " << lines_.size() << " lines" << endl;
+
+    return !lines_.empty();
+  }
+
+  /**
+   * LineList::load_default
+   *
+   * The strongest lines around Ca II H & K, used when there is no list file
+   * (c.f. LineList::add_forest)
+   */
+  void load_default(){
+    lines_ = {
+        {392.291f, 0.6f, 0.0f},   // Fe I
+        {392.792f, 0.6f, 0.0f},   // Fe I
+        {393.030f, 0.6f, 0.0f},   // Fe I
+        {393.366f, 4.0f, 0.0f},   // Ca II K
+        {394.401f, 1.0f, 0.0f},   // Al I
+        {396.152f, 1.0f, 0.0f},   // Al I
+        {396.847f, 3.0f, 0.0f},   // Ca II H
+        {397.007f, 1.5f, 0.0f},   // H epsilon
+        {400.524f, 0.5f, 0.0f},   // Fe I
+        {403.076f, 0.5f, 0.0f},   // Mn I
+        {403.307f, 0.4f, 0.0f},   // Mn I
+        {403.449f, 0.3f, 0.0f},   // Mn I
+        {404.581f, 0.8f, 0.0f}    // Fe I
+    };
+  }
+
+  /**
+   * LineList::add_forest
+   *
+   * Weak lines at random wavelengths, standing in for the thousands of weak
+   * metal lines of a real spectrum so the default list has structure at the
+   * narrow plot ranges too. Seeded so the forest is the same every run.
+   *
+   * @param lambda_min [nm]
+   * @param lambda_max [nm]
+   * @param per_nm Lines per nm
+   * @param seed
+   */
+  void add_forest(float lambda_min, float lambda_max, float per_nm, unsigned int seed = 7){
+
+    using namespace std;
+
+    mt19937 generator(seed);
+    uniform_real_distribution<float> lambda(lambda_min, lambda_max);
+    uniform_real_distribution<float> log_tau(log(0.02f), log(0.6f));
+    uniform_real_distribution<float> b(1.5f, 4.0f);
+
+    int count = int((lambda_max - lambda_min) * per_nm);
+
+    for(int i = 0; i < count; ++i){
+      Line line = {lambda(generator), exp(log_tau(generator)), b(generator)};
+      lines_.push_back(line);
+    }
+  }
+};
+
+/**
+ *
+ * Radix 2 complex FFT, the twiddles and bit reversal are computed once per
+ * size
+ *
+ */
+struct FFT{
+
+  typedef std::complex<float> complex_t;
+
+  int size_ = 0;
+
+  std::vector<complex_t> twiddle_;
+  std::vector<int> reverse_;
+
+  /**
+   * FFT::init
+   *
+   * @param size Power of two
+   */
+  void init(int size){
+
+    size_ = size;
+
+    twiddle_.resize(size / 2);
+
+    for(int k = 0; k < size / 2; ++k){
+      double phi = -2.0 * M_PI * k / size;
+      twiddle_[k] = complex_t(float(std::cos(phi)), float(std::sin(phi)));
+    }
+
+    int bits = 0;
+    while((1 << bits) < size){
+      ++bits;
+    }
+
+    reverse_.resize(size);
+
+    for(int i = 0; i < size; ++i){
+      int r = 0;
+      for(int b = 0; b < bits; ++b){
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      reverse_[i] = r;
+    }
+  }
+
+  /**
+   * FFT::transform
+   *
+   * In place, the inverse is not scaled by 1 / size
+   *
+   * @param data size_ values
+   * @param inverse
+   */
+  void transform(complex_t *data, bool inverse) const{
+
+    for(int i = 0; i < size_; ++i){
+      if(i < reverse_[i]){
+        std::swap(data[i], data[reverse_[i]]);
+      }
+    }
+
+    for(int len = 2; len <= size_; len <<= 1){
+      int half = len / 2;
+      int stride = size_ / len;
+
+      for(int i = 0; i < size_; i += len){
+        for(int k = 0; k < half; ++k){
+          complex_t w = twiddle_[k * stride];
+
+          if(inverse){
+            w = std::conj(w);
+          }
+
+          complex_t t = w * data[i + k + half];
+          data[i + k + half] = data[i + k] - t;
+          data[i + k] += t;
+        }
+      }
+    }
+  }
+};
+
+/**
+ *
+ * Normalized flux on a grid uniform in log wavelength, which makes the grid
+ * uniform in velocity: x = c ln(lambda / lambda_rest_) [km/s]. The plot's x
+ * axis is in the same units.
+ *
+ */
+struct SpectrumSynthesizer{
+
+  typedef std::shared_ptr<const std::vector<float> > Spectrum;
+
+  /**
+   * Settings
+   */
+
+  // Ca II H, the velocity zero point
+  float lambda_rest_ = 396.847f;
+
+  // Grid [km/s], wide enough for the widest plot range and the largest shift
+  float x_range_ = 6000.0f;
+  float dx_ = 0.25f;
+
+  // Resolving power of the spectrograph, lambda / FWHM
+  float resolution_ = 40000.0f;
+
+  // Doppler parameter of lines without one [km/s]
+  float b_default_ = 3.0f;
+
+  // Signal to noise of the continuum
+  float snr_ = 25.0f;
+
+  // Weak lines per nm added to the default list, a few of them fall in the
+  // narrowest plot range (50 km/s is 0.066 nm)
+  float forest_per_nm_ = 30.0f;
+
+  // Measurements closer than this share a spectrum [km/s]
+  float v_quantum_ = 0.01f;
+
+  size_t max_cached_ = 8;
+
+  std::string line_list_filename_ = "./assets/spectra/line_list.txt";
+
+  /**
+   * Internal
+   */
+  const float c_ = 299792.458f;   // [km/s]
+
+  LineList line_list_;
+
+  int n_ = 0;
+
+  FFT fft_;
+
+  // Transform of the instrumental profile
+  std::vector<FFT::complex_t> kernel_;
+
+  // Most recently used at the front
+  std::list<std::pair<long long, Spectrum> > cache_;
+
+  long hits_ = 0;
+  long misses_ = 0;
+
+  /**
+   * SpectrumSynthesizer::init
+   *
+   *   Load the lines and transform the instrumental profile
+   */
+  void init(){
+
+    using namespace std;
+
+    n_ = 2 * int(x_range_ / dx_) + 1;
+
+    if(!line_list_.load(line_list_filename_)){
+      line_list_.load_default();
+      line_list_.add_forest(lambda_rest_ * exp(-x_range_ / c_), lambda_rest_ * exp(x_range_ / c_), forest_per_nm_);
+    }
+
+    // Pad so the profile does not wrap around into the other end
+    float sigma_inst = c_ / resolution_ / 2.3548f;
+    int pad = int(ceil(6.0f * sigma_inst / dx_));
+
+    int size = 1;
+    while(size < n_ + 2 * pad){
+      size <<= 1;
+    }
+
+    fft_.init(size);
+
+    // Gaussian centered on 0, negative offsets wrap to the end
+    kernel_.assign(size, FFT::complex_t(0.0f, 0.0f));
+
+    float sum = 0.0f;
+
+    for(int i = -pad; i <= pad; ++i){
+      float d = i * dx_ / sigma_inst;
+      float w = exp(-0.5f * d * d);
+      kernel_[(i + size) % size] = w;
+      sum += w;
+    }
+
+    for(FFT::complex_t &k : kernel_){
+      k /= sum * size;
+    }
+
+    fft_.transform(kernel_.data(), false);
+
+    cache_.clear();
+  }
+
+  /**
+   * SpectrumSynthesizer::x
+   *
+   * @param i Grid index
+   * @return Velocity of the grid point [km/s]
+   */
+  float x(int i) const{
+    return i * dx_ - x_range_;
+  }
+
+  /**
+   * SpectrumSynthesizer::spectrum
+   *
+   * @param velocity Line of sight velocity [km/s]
+   * @param lines false for just the continuum
+   * @param noise
+   * @return The flux on the grid, synthesized unless cached
+   */
+  Spectrum spectrum(float velocity, bool lines, bool noise){
+
+    using namespace std;
+
+    if(n_ == 0){
+      init();
+    }
+
+    // Multiplied rather than shifted, the velocity can be negative
+    long long key = llround(velocity / v_quantum_) * 4 + (lines ? 2 : 0) + (noise ? 1 : 0);
+
+    for(auto it = cache_.begin(); it != cache_.end(); ++it){
+      if(it->first == key){
+        ++hits_;
+        cache_.splice(cache_.begin(), cache_, it);
+        return cache_.front().second;
+      }
+    }
+
+    ++misses_;
+
+    shared_ptr<vector<float> > flux(new vector<float>(n_, 1.0f));
+
+    if(lines){
+      synthesize(velocity, *flux);
+    }
+
+    if(noise){
+      add_noise(key, *flux);
+    }
+
+    cache_.push_front(make_pair(key, Spectrum(flux)));
+
+    if(cache_.size() > max_cached_){
+      cache_.pop_back();
+    }
+
+    return cache_.front().second;
+  }
+
+  /**
+   * SpectrumSynthesizer::synthesize
+   *
+   * @param velocity [km/s]
+   * @param flux
+   */
+  void synthesize(float velocity, std::vector<float> &flux) const{
+
+    using namespace std;
+
+    vector<float> tau(n_, 0.0f);
+
+    float shift = c_ * log1p(velocity / c_);
+
+    for(const LineList::Line &line : line_list_.lines_){
+
+      float center = c_ * log(line.lambda / lambda_rest_) + shift;
+      float b = (line.b > 0.0f) ? line.b : b_default_;
+
+      // Gaussian opacity profile, exp(-(x - center)^2 / b^2), cut at 5 b
+      int i_0 = max(0, int(ceil((center - 5.0f * b + x_range_) / dx_)));
+      int i_1 = min(n_ - 1, int(floor((center + 5.0f * b + x_range_) / dx_)));
+
+      float k = -1.0f / (b * b);
+      int i = i_0;
+
+#if DM_USE_SSE
+      __m128 k_4 = _mm_set1_ps(k);
+      __m128 tau_4 = _mm_set1_ps(line.tau);
+      __m128 step_4 = _mm_set_ps(3.0f * dx_, 2.0f * dx_, dx_, 0.0f);
+
+      for(; i + 4 <= i_1 + 1; i += 4){
+        __m128 d = _mm_add_ps(_mm_set1_ps(x(i) - center), step_4);
+        __m128 t = _mm_mul_ps(tau_4, exp_ps(_mm_mul_ps(_mm_mul_ps(d, d), k_4)));
+        _mm_storeu_ps(&tau[i], _mm_add_ps(_mm_loadu_ps(&tau[i]), t));
+      }
+#endif
+      for(; i <= i_1; ++i){
+        float d = x(i) - center;
+        tau[i] += line.tau * exp(d * d * k);
+      }
+    }
+
+    /**
+     * Absorbed fraction, 1 - exp(-tau), zero padded so the continuum
+     * stays flat past the ends after the convolution
+     */
+    vector<FFT::complex_t> absorbed(fft_.size_, FFT::complex_t(0.0f, 0.0f));
+
+    int i = 0;
+
+#if DM_USE_SSE
+    float a[4];
+
+    for(; i + 4 <= n_; i += 4){
+      __m128 t = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&tau[i]));
+      _mm_storeu_ps(a, _mm_sub_ps(_mm_set1_ps(1.0f), exp_ps(t)));
+
+      for(int k = 0; k < 4; ++k){
+        absorbed[i + k] = a[k];
+      }
+    }
+#endif
+    for(; i < n_; ++i){
+      absorbed[i] = 1.0f - exp(-tau[i]);
+    }
+
+    /**
+     * Instrumental broadening
+     */
+    fft_.transform(absorbed.data(), false);
+
+    for(int k = 0; k < fft_.size_; ++k){
+      absorbed[k] *= kernel_[k];
+    }
+
+    fft_.transform(absorbed.data(), true);
+
+    for(i = 0; i < n_; ++i){
+      flux[i] = 1.0f - absorbed[i].real();
+    }
+  }
+
+  /**
+   * SpectrumSynthesizer::add_noise
+   *
+   * Photon noise, seeded by the measurement so a cached spectrum and a
+   * recomputed one agree
+   *
+   * @param seed
+   * @param flux
+   */
+  void add_noise(long long seed, std::vector<float> &flux) const{
+
+    using namespace std;
+
+    mt19937 generator((unsigned int) (seed ^ (seed >> 32)));
+    normal_distribution<float> gauss(0.0f, 1.0f);
+
+    for(float &f : flux){
+      f += sqrt(max(f, 0.0f)) / snr_ * gauss(generator);
+    }
+  }
+};
+
+#endif // SPECTRUM_SYNTHESIS_H
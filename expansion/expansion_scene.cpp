@@ -35,8 +35,8 @@ ExpansionLabWidget::ExpansionLabWidget(QWidget *parent)
       max_background_image_count_(6),
       galaxies_(max_galaxies_, max_galaxy_image_count_, max_visible_,
                 tex_unit_galaxies_, tex_unit_distances_),
-      distance_labels_atlas_(tex_unit_distances_, label_image_w_, label_image_h_, max_selections_),
-      distance_labels_(max_selections_),
+      distance_glyphs_(tex_unit_distances_),
+      distance_labels_(&distance_glyphs_, max_selections_, 16),
       distance_connectors_(max_selections_),
       selection_boxes_(max_selections_),
       background_(tex_unit_background_, 1024, 1024, 6){
@@ -68,10 +68,10 @@ ExpansionLabWidget::ExpansionLabWidget(QWidget *parent)
 
   for(int i = 0; i < max_selections_; ++i){
     selections_[i].galaxy_id = 0;
-  }
 
-  // Temp image for label generation
-  label_image_ = QImage(label_image_w_, label_image_h_, QImage::Format_RGBA8888);
+    std::copy(C_text_, C_text_ + 4, distance_labels_.info_[i].color);
+    std::copy(C_padding_, C_padding_ + 4, distance_labels_.info_[i].background);
+  }
 }
 
 /**
@@ -82,6 +82,9 @@ ExpansionLabWidget::ExpansionLabWidget(QWidget *parent)
 void ExpansionLabWidget::cleanup(){
   galaxies_.cleanup();
   background_.cleanup();
+  distance_labels_.cleanup();
+  distance_glyphs_.cleanup();
+  frame_.cleanup();
 }
 
 /**
@@ -109,6 +112,9 @@ void ExpansionLabWidget::initializeGL(){
 //  glEnable(GL_DEPTH_TEST);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+  // Camera uniforms shared by all the programs
+  frame_.init_resources();
+
   /**
    * Initialize the galaxies (TODO: Move to settings)
    */
@@ -163,25 +169,17 @@ void ExpansionLabWidget::initializeGL(){
 
 //  std::cout << "Initialize Labels" << std::endl;
 
-  distance_labels_.atlas_tex_unit_ = tex_unit_distances_;
+  distance_glyphs_.init_resources();
+
   distance_labels_.global_opacity_ = 1.0f;
 
   // TODO: Move to settings
-  distance_labels_.quad_width_ =  2.0f * galaxies_.galaxy_size_;
-  distance_labels_.quad_height_ = 0.5f *  distance_labels_.quad_width_;
+  for(int i = 0; i < max_selections_; ++i){
+    distance_labels_.info_[i].size = label_size_ * galaxies_.galaxy_size_;
+  }
 
   distance_labels_.init_resources();
 
-  // TODO: Why are we setting the count here?
-  distance_labels_atlas_.count_ = max_selections_ - 1;
-  distance_labels_atlas_.init_resources();
-
-  for(int i = 0; i < max_selections_ - 1; ++i){
-    // Generate the texture coordinates
-    distance_labels_atlas_.get_tile_coordinates(i, distance_labels_.info_[i].tex);
-  }
-  distance_labels_.upload_billboards();
-
   // Distance lines
 //  std::cout << "Initialize Distance Lines" << std::endl;
   distance_connectors_.init_resources();
@@ -197,9 +195,10 @@ void ExpansionLabWidget::initializeGL(){
  */
 void ExpansionLabWidget::load_galaxies(QString base_path, int image_count){
 
-  // Initialize galaxy billboards
+  // Initialize galaxy billboards, only the ones on screen are uploaded
   galaxies_.init_resources();
   galaxies_.galaxies_atlas_.bind();
+  galaxies_.galaxies_.cull_camera_ = &camera_;
 
   // TODO: Move into galaxies_
   // Load the galaxy images
@@ -290,7 +289,6 @@ void ExpansionLabWidget::load_backgrounds(QString base_path, int image_count){
          << endl;
 //    break;
   }
-  glFlush();
 
 
   check_GL_error("ExpansionLabWidget::load_backgrounds() exit ");
@@ -321,6 +319,9 @@ void ExpansionLabWidget::resizeGL(int w, int h){
   camera_.init_model_view();
   camera_.look_at(center_, eye_, up_);
 
+  // A different set of galaxies is on screen
+  uploads_.schedule(&galaxies_);
+
   glViewport(0, 0, w, h);
 }
 
@@ -407,6 +408,7 @@ void ExpansionLabWidget::updateTime(){
         distance_labels_.info_[selection_ix - 1].position[i] = 0.5f * (galaxies_.galaxies_.info_[home_ix].position[i]
                                                       + galaxies_.galaxies_.info_[galaxy_ix].position[i]);
       }
+      distance_labels_.update(selection_ix - 1);
       ++distance_labels_.count_;
 
       // Add the line
@@ -420,11 +422,12 @@ void ExpansionLabWidget::updateTime(){
 //  cout<<"Selections count "<<selections_count_<<endl;
   selection_boxes_.count_ = selections_count_;
 
-  // Need to update the VBOs
-  selection_boxes_.upload_billboards();
-  distance_labels_.upload_billboards();
-
-  distance_connectors_.upload();
+  // Need to update the VBOs, this runs for every step of the time slider so
+  // the uploads wait for the next frame
+  uploads_.schedule(&galaxies_);
+  uploads_.schedule(&selection_boxes_);
+  uploads_.schedule(&distance_connectors_);
+  uploads_.schedule(&distance_labels_);
 
   emit time_updated(T_current_);
 
@@ -438,42 +441,7 @@ void ExpansionLabWidget::updateTime(){
  * @param distance
  */
 void ExpansionLabWidget::updateDistanceLabel(int index, float distance){
-
-  check_GL_error("ExpansionLabWidget::updateDistanceLabel entry()");
-
-  // Create a label
-  distance_labels_atlas_.bind();
-#if 0
-  QImage image_(label_image_w_, label_image_h_, QImage::Format_RGBA8888);
-
-  for(int x = 0; x < image_.width(); ++x){
-    for(int y = 0; y < image_.height(); ++y){
-      image_.setPixel(x, y, qRgba(0, 0, 0, 0));
-    }
-  }
-#else
-  label_image_.fill(0);
-
-#endif
-
-  QPainter painter(&label_image_);
-  QFont font = painter.font();
-  font.setPointSize(label_font_size_);
-  font.setWeight(QFont::DemiBold);
-  painter.setFont(font);
-
-  QPen pen(C_text_);
-
-  painter.setPen(pen);
-  painter.fillRect(label_image_.rect(), C_padding_);
-  painter.drawText(QRect(0, 0, label_image_w_, label_image_h_),
-                   Qt::AlignCenter | Qt::AlignBaseline,
-                   QString::number(distance, 'f', 2) + " Mpc");
-
-  distance_labels_atlas_.update_tile(index, label_image_.bits());
-//  distance_labels_atlas_.save_atlas("expansion_distance_labels.png");
-
-  check_GL_error("ExpansionLabWidget::updateDistanceLabel exit()");
+  distance_labels_.set_text(index, QString::number(distance, 'f', 2) + " Mpc");
 };
 
 /**
@@ -485,33 +453,45 @@ void ExpansionLabWidget::paintGL(){
 
 //  std::cout << "ExpansionLabWidget::paintGL" << std::endl;
 
+  uploads_.flush();
+
+  frame_.update(camera_);
+  frame_.upload();
+
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  /**
+   * Queue this frame's draws. Everything is flat and blended in painter's
+   * order without depth testing. The background fades out over the galaxies
+   * after the big bang, so it goes on top in the overlay pass.
+   */
+  queue_.clear();
+
   bool reticule_visible = (T_current_ > T_reticule_off);
 
   if(T_current_ > T_fade_i){
     // Draw galaxies
-    galaxies_.render(camera_);
+    queue_.push(&galaxies_, camera_, msg::PASS_BACKGROUND);
 
     if(reticule_visible){
-      distance_connectors_.render(camera_);
-    }
+      queue_.push(&distance_connectors_, camera_, msg::PASS_BACKGROUND);
 
-    if(reticule_visible){
       // Labels for any distance comparisons
-      glBindTexture(GL_TEXTURE_2D, distance_labels_atlas_.tex_);
-      distance_labels_.render(camera_);
+      queue_.push(&distance_labels_, camera_, msg::PASS_BACKGROUND);
 
       // The selection boxes
-      selection_boxes_.render(camera_);
+      queue_.push(&selection_boxes_, camera_, msg::PASS_BACKGROUND);
     }
   }
 
   // Draw the background
   if((T_current_ > T_big_bang) && (T_current_ < T_fade_f)){
-    background_.render(camera_);
+    queue_.push(&background_, camera_, msg::PASS_OVERLAY);
   }
 
+  queue_.sort();
+  queue_.submit(&frame_);
+
   check_GL_error("ExpansionLabWidget::paintGL() exit");
 }
 
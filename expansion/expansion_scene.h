@@ -92,12 +92,15 @@ struct GalaxySet : public msg::Node {
     // Texture coordinate: (top-left, bottom-right)
     float tex_rect[4] = {0.0f, 1.0f, 1.0f, 0.0f};
 
+    // Layer of galaxies_atlas_ holding the image
+    int layer = 0;
+
   } *galaxy_info_;
 
   /**
    * Stores images for the galaxies
    */
-  msg::ImageAtlas galaxies_atlas_;
+  msg::ImageArrayAtlas galaxies_atlas_;
   msg::BillboardSet galaxies_;
 
   /**
@@ -105,7 +108,7 @@ struct GalaxySet : public msg::Node {
    *
    *
    * @param max_galaxy_count      Maximum number of galaxies we can operate on
-   * @param max_image_count       The number of source galaxies
+   * @param max_image_count       The number of source galaxies (the atlas grows if more are loaded)
    * @param max_visible_galaxies  Maximum number of visible galaxies
    *
    * @param texture_unit
@@ -240,7 +243,7 @@ struct GalaxySet : public msg::Node {
       int map_ix = i;
 #endif
       // Generate the texture coordinates
-      galaxies_atlas_.get_tile_coordinates(map_ix, galaxy_info_[i].tex_rect);
+      galaxy_info_[i].layer = galaxies_atlas_.get_tile_coordinates(map_ix, galaxy_info_[i].tex_rect);
     }
   }
 
@@ -269,7 +272,7 @@ struct GalaxySet : public msg::Node {
     galaxies_.count_ = 0;
 
     for(int i = 0; (i < max_count_) && (galaxies_.count_ < galaxies_.capacity_); ++i){
-      // TODO: Check if the galaxy is enabled if its viewable on the screen
+      // Galaxies off the screen are culled when uploading (c.f. BillboardSet::cull_camera_)
 #if 0
       // Compute the coordinates
       galaxies_.info_[galaxies_.count_].position[0] = global_scale_ * galaxy_info_[i].x - eye_scaled_x;
@@ -303,11 +306,20 @@ struct GalaxySet : public msg::Node {
       for (int k = 0; k < 4; ++k) {
         galaxies_.info_[galaxies_.count_].tex[k] = galaxy_info_[i].tex_rect[k];
       }
+      galaxies_.info_[galaxies_.count_].layer = galaxy_info_[i].layer;
       ++galaxies_.count_;
     }
+  }
 
-    // Upload the data
-    galaxies_.upload_billboards();
+  /**
+   * GalaxySet::flush_upload
+   *
+   *   Upload the positions, once per frame (c.f. msg::UploadScheduler)
+   *
+   * @return
+   */
+  virtual size_t flush_upload(){
+    return galaxies_.flush_upload();
   }
 
   /**
@@ -378,7 +390,8 @@ struct GalaxySet : public msg::Node {
   void render(Camera<float>& camera_){
 
     // Render the galaxies
-    glBindTexture(GL_TEXTURE_2D, galaxies_atlas_.tex_);
+    galaxies_atlas_.commit();
+    galaxies_atlas_.bind();
     galaxies_.render(camera_);
   }
 };
@@ -517,11 +530,8 @@ public:
 
   const static int max_selections_ = 16;
 
-  // Label size in pixels
-  const static int label_image_w_ = 128;
-  const static int label_image_h_ = 64;
-
-  int label_font_size_ = 16;
+  // Size of the label em square relative to the galaxies
+  float label_size_ = 0.33f;
 
   // Selection Colors
   float C_select_home[4] = {1.0f, 1.0f, 0.0f, 1.0f};
@@ -531,10 +541,8 @@ public:
 
   int max_background_image_count_ = 0;
 
-  QColor C_padding_ = QColor(80, 80, 80, 80);
-//  QColor C_padding_ = Qt::transparent;
-  QColor C_text_ = QColor(10, 140, 20, 255);
-  QImage label_image_;
+  float C_padding_[4] = {80 / 255.0f, 80 / 255.0f, 80 / 255.0f, 80 / 255.0f};
+  float C_text_[4] = {10 / 255.0f, 140 / 255.0f, 20 / 255.0f, 1.0f};
 
   /**
    * Internal Settings
@@ -606,8 +614,8 @@ public:
   GalaxySet galaxies_;
 
   // Labels for the distances
-  msg::ImageAtlas distance_labels_atlas_;
-  msg::BillboardSet distance_labels_;
+  msg::GlyphAtlas distance_glyphs_;
+  msg::TextSet distance_labels_;
 
   // Lines that connect the galaxies
   msg::Geometry distance_connectors_;
@@ -615,6 +623,15 @@ public:
   // Selection boxes
   msg::BillboardSet selection_boxes_;
 
+  // Nodes changed since the last frame, uploaded at the top of paintGL
+  msg::UploadScheduler uploads_;
+
+  // Camera block bound once per frame
+  msg::FrameUniforms frame_;
+
+  // The draws of a frame (c.f. ExpansionLabWidget::paintGL)
+  msg::RenderQueue queue_;
+
   // Background
   msg::FullScreenImage background_;
 
@@ -236,6 +236,17 @@ inline bool compile_shader(GLenum shader_type, const char* name, const char* sou
   return GL_TRUE == result;
 }
 
+/**
+ * Uniform block binding points shared by all the programs. The blocks are
+ * assigned when a program is linked (c.f. build_program_from_source) so
+ * the programs don't have to look them up.
+ *
+ *  FrameBlock  - camera matrices and vectors, set once per frame
+ *  ObjectBlock - per object color, offset and radius
+ */
+const GLuint FRAME_BLOCK_BINDING = 0;
+const GLuint OBJECT_BLOCK_BINDING = 1;
+
 /**
  *
  * Build a GLSL program given the sources
@@ -302,6 +313,17 @@ inline bool build_program_from_source(GLuint program,
 
   check_GL_error("build_program_from_source: Linking");
 
+  // Shared uniform blocks
+  GLuint frame_block = glGetUniformBlockIndex(program, "FrameBlock");
+  if(frame_block != GL_INVALID_INDEX){
+    glUniformBlockBinding(program, frame_block, FRAME_BLOCK_BINDING);
+  }
+
+  GLuint object_block = glGetUniformBlockIndex(program, "ObjectBlock");
+  if(object_block != GL_INVALID_INDEX){
+    glUniformBlockBinding(program, object_block, OBJECT_BLOCK_BINDING);
+  }
+
   //Don't leak shaders either.
   glDetachShader(program, vert_shader);
   glDetachShader(program, frag_shader);
@@ -798,6 +820,10 @@ struct Camera{
   T inv_mv[16];
   T inv_mvp[16];
 
+  // View frustum planes (left, right, bottom, top, near, far) in world
+  // coordinates, normalized and pointing inwards: a x + b y + c z + d >= 0
+  T frustum[6][4];
+
   // Eye In Camera and World coordinates
   T eye[4];
 
@@ -1139,6 +1165,60 @@ struct Camera{
     vec4_by_mat4x4(inv_mv, eye_default_, eye_world);
     vec4_by_mat4x4(inv_mv, right_default_, right_world);
     vec4_by_mat4x4(inv_mv, up_default_, up_world);
+
+    generate_frustum();
+  }
+
+  /**
+   * Camera::generate_frustum
+   *
+   *   Extract the frustum planes from the rows of the MVP matrix
+   *   (Gribb & Hartmann)
+   */
+  void generate_frustum(){
+
+    for(int k = 0; k < 3; ++k){
+      for(int i = 0; i < 4; ++i){
+        T w = mvp[4 * i + 3];
+        T row = mvp[4 * i + k];
+
+        frustum[2 * k][i] = w + row;
+        frustum[2 * k + 1][i] = w - row;
+      }
+    }
+
+    for(int j = 0; j < 6; ++j){
+      T length = sqrt(frustum[j][0] * frustum[j][0]
+                           + frustum[j][1] * frustum[j][1]
+                           + frustum[j][2] * frustum[j][2]);
+
+      if(length > 0){
+        for(int i = 0; i < 4; ++i){
+          frustum[j][i] /= length;
+        }
+      }
+    }
+  }
+
+  /**
+   * Camera::sphere_visible
+   *
+   * @param center A 3-array in world coordinates
+   * @param radius
+   * @return False if the sphere is entirely outside of the view
+   */
+  bool sphere_visible(const T center[], T radius) const{
+
+    for(int j = 0; j < 6; ++j){
+      T distance = frustum[j][0] * center[0] + frustum[j][1] * center[1]
+                   + frustum[j][2] * center[2] + frustum[j][3];
+
+      if(distance < -radius){
+        return false;
+      }
+    }
+
+    return true;
   }
 
 
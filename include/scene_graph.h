@@ -21,21 +21,44 @@
 #ifndef ASTROLABS_SCENE_GRAPH_H
 #define ASTROLABS_SCENE_GRAPH_H
 
+#include <algorithm>
 #include <list>
+#include <map>
 #include <cmath>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <vector>
 
 #include "gl_util.hpp"
 
 // Image processing
+#include <QFontMetricsF>
 #include <QImage>
 #include <QImageReader>
 #include <QPainter>
 
 namespace msg{
 
+  struct RenderQueue;
+
+  /**
+   * Render passes, drawn in this order (c.f. RenderQueue)
+   */
+  enum RenderPass{
+    // Screen filling images, drawn in the order they were queued without depth testing
+    PASS_BACKGROUND = 0,
+
+    // Depth tested and sorted by GL state
+    PASS_OPAQUE = 1,
+
+    // Depth tested and drawn back to front
+    PASS_TRANSPARENT = 2,
+
+    // HUD elements, drawn in the order they were queued without depth testing
+    PASS_OVERLAY = 3
+  };
+
   /**
    *
    * Parent class for all MSG Nodes.
@@ -43,12 +66,33 @@ namespace msg{
    */
   struct Node{
 
-    // Transformation
+    // Transformation (relative to the parent)
     float position[4] = {0, 0, 0, 0};
 
     // Scaling (TODO:)
     float scale[3] = {1.0f, 1.0f, 1.0f};
 
+    /**
+     * Hierarchy
+     */
+    Node *parent_ = nullptr;
+    std::vector<Node*> children_;
+
+    // Position of the node in the world, cached by update_world()
+    float world_position_[4] = {0, 0, 0, 1.0f};
+    bool world_dirty_ = true;
+
+    // Skipped along with its children by a RenderQueue
+    bool visible_ = true;
+
+    // Bounding box relative to world_position(), nodes without bounds are never culled
+    bool bounded_ = false;
+    float bounds_min_[3] = {0, 0, 0};
+    float bounds_max_[3] = {0, 0, 0};
+
+    // Pass a RenderQueue draws this node in
+    int pass_ = PASS_OPAQUE;
+
     /**
      * Drawing Internals
      */
@@ -57,6 +101,7 @@ namespace msg{
       position[0] = x;
       position[1] = y;
       position[2] = z;
+      world_dirty_ = true;
     }
 
     Node(){
@@ -76,1789 +121,4312 @@ namespace msg{
       return false;
     };
 
-    // Update child node transforms if any
-    virtual void updateChildren(){
+    /**
+     * Node::add_child
+     *
+     *   The child moves with this node from now on
+     *
+     * @param child
+     */
+    void add_child(Node *child){
+
+      if(child->parent_ != nullptr){
+        child->parent_->remove_child(child);
+      }
+
+      child->parent_ = this;
+      child->world_dirty_ = true;
+      children_.push_back(child);
+    }
+
+    void remove_child(Node *child){
+
+      auto it = std::find(children_.begin(), children_.end(), child);
+
+      if(it != children_.end()){
+        children_.erase(it);
+        child->parent_ = nullptr;
+        child->world_dirty_ = true;
+      }
     }
 
     /**
+     * Node::update_world
      *
-     * Render the current node however you want.
+     *   Refresh the cached world position of this node and everything below
+     *   it. Only the nodes that moved, or whose parent moved, are recomputed.
      *
+     * @param parent_moved
      */
-    virtual void render(Camera<float>& camera) = 0;
+    void update_world(bool parent_moved = false){
 
-  };
+      if(world_dirty_ || parent_moved){
+        for(int i = 0; i < 3; ++i){
+          world_position_[i] = position[i];
+
+          if(parent_ != nullptr){
+            world_position_[i] += parent_->world_position_[i];
+          }
+        }
 
+        world_dirty_ = false;
+        parent_moved = true;
+      }
 
-  /**
-   *
-   * A single user-facing billboard. This should be
-   * used for complicated Billboards with custom
-   * programs (e.g. Planets)
-   *
-   *
-   */
-  struct Billboard : public Node{
+      for(Node *child : children_){
+        child->update_world(parent_moved);
+      }
+    }
 
-    float radius = 0.0;
-    float inclination_ = 0.0f;
+    void reset_bounds(){
+      bounded_ = false;
+    }
 
-    GLuint vao = 0;
-    GLuint vbo = 0;
+    /**
+     * Node::grow_bounds
+     *
+     * @param points x, y, z of the first point
+     * @param count Number of points
+     * @param stride Floats between consecutive points
+     */
+    void grow_bounds(const float *points, int count, int stride){
 
-    float vertices_[3][3];
+      for(int j = 0; j < count; ++j){
+        const float *point = points + j * stride;
 
-    Billboard(){
+        for(int i = 0; i < 3; ++i){
+          if(!bounded_ || (point[i] < bounds_min_[i])) bounds_min_[i] = point[i];
+          if(!bounded_ || (point[i] > bounds_max_[i])) bounds_max_[i] = point[i];
+        }
 
+        bounded_ = true;
+      }
     }
 
-    // http://stackoverflow.com/questions/21652546/what-is-the-role-of-glbindvertexarrays-vs-glbindbuffer-and-what-is-their-relatio
-    virtual bool init_resources(){
+    /**
+     * Node::in_view
+     *
+     * @param camera
+     * @return False if the bounds are entirely outside of the camera frustum
+     */
+    bool in_view(const Camera<float> &camera) const{
 
-      // Create the VBO and VAO indices
-      glGenVertexArrays(1, &vao);
-      glGenBuffers(1, &vbo);
+      if(!bounded_){
+        return true;
+      }
 
-//      radius = 1.0;
+      const float *p = world_position();
 
-      float half_a = std::sqrt(3.0) * radius;
+      float center[3];
+      float radius_sq = 0.0f;
 
-      const float vertices[3][3]{{-half_a, -radius,      0.0f},
-                                 {0.0f,   2.0f * radius, 0.0f},
-                                 {half_a,  -radius,      0.0f}};
+      for(int i = 0; i < 3; ++i){
+        float half = 0.5f * (bounds_max_[i] - bounds_min_[i]);
+        center[i] = p[i] + bounds_min_[i] + half;
+        radius_sq += half * half;
+      }
 
-      // Create the VAO
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-      glBindVertexArray(0);
+      return camera.sphere_visible(center, std::sqrt(radius_sq));
+    }
 
-      return check_GL_error("Sphere::init_resources() exit");
+    /**
+     * Node::world_position
+     *
+     *   Where to draw the node, nodes outside of a hierarchy are drawn at
+     *   their position
+     *
+     * @return A 3-array
+     */
+    const float* world_position() const{
+      return (parent_ != nullptr) ? world_position_ : position;
     }
 
-    virtual void cleanup(){
-      glDeleteBuffers(1, &vbo);
-      glDeleteVertexArrays(1, &vao);
+    // Queued in an UploadScheduler
+    bool upload_pending_ = false;
+
+    /**
+     * Push whatever changed to the GPU, called once per frame by an
+     * UploadScheduler.
+     *
+     * @return Number of bytes uploaded
+     */
+    virtual size_t flush_upload(){
+      return 0;
     }
 
     /**
      *
-     * Billboard::setup_array
+     * Render the current node however you want.
      *
-     * @param attributeIndex
      */
-    void setup_array(int attributeIndex){
+    virtual void render(Camera<float>& camera) = 0;
 
- //     std::cout<<"Attribute Index "<<attributeIndex<<std::endl;
+    /**
+     * Node::enqueue
+     *
+     *   Add the draws of this node (not its children) to a queue. By default
+     *   the node is drawn with render() and binds whatever it needs itself.
+     *
+     * @param queue
+     * @param camera
+     */
+    virtual void enqueue(RenderQueue &queue, Camera<float> &camera);
 
-      glBindVertexArray(vao);
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glVertexAttribPointer(attributeIndex, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    /**
+     * Draw with the state requested in enqueue() already bound
+     *
+     * @param camera
+     */
+    virtual void draw(Camera<float>& camera){
+      render(camera);
+    }
 
-      glEnableVertexAttribArray(attributeIndex);
+  };
 
-      check_GL_error("Billboard::init_attribute()");
+  /**
+   *
+   * Node without any geometry that only holds children, e.g. the root of
+   * a scene
+   *
+   */
+  struct Group : public Node{
+
+    virtual void cleanup(){
     }
 
     virtual void render(Camera<float>& camera){
+    }
 
-//      std::cout<<"Sphere::render() "<<radius<<std::endl;
-      glBindVertexArray(vao);
-      glDrawArrays(GL_TRIANGLES, 0, 3);
-
-//    glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, const_ix);
+    virtual void enqueue(RenderQueue &queue, Camera<float> &camera){
     }
   };
 
+
   /**
    *
-   *  This represents a flat shape, either a single triangle or a quad
+   * Vertex data that is rewritten every frame. The buffer is split into
+   * regions_ regions that are written round-robin, so the CPU fills one region
+   * while the GPU may still be drawing from the others and no upload has to
+   * wait for the draws of the previous frame.
+   *
+   * With ARB_buffer_storage the buffer is mapped once (persistent + coherent)
+   * and every region is guarded by a fence. Otherwise each region is mapped
+   * unsynchronized and the storage is orphaned whenever the ring wraps around.
+   *
+   * Nodes write straight into the pointer returned by map() and point their
+   * attributes at offset() afterwards.
    *
-   *  TODO: Another way to store this is we have a geometry generator class that loads data arrays
-   *  with whatever shape you want.  Maybe the template argument can
    */
-  struct FlatShape : public Node{
+  struct StreamBuffer{
 
-    const unsigned int const_ix[6] = {0, 1, 2, 2, 3, 1};
+    const static int regions_ = 3;
 
-    GLuint vao = 0;
-    GLuint vbo = 0;
+    GLenum target_ = GL_ARRAY_BUFFER;
+    GLuint buffer_ = 0;
 
-    int count_ = 0;
+    // Size of one region in bytes
+    GLsizeiptr region_size_ = 0;
 
-    FlatShape(){
+    // Region written by the last map(), i.e. the one being drawn
+    int region_ = 0;
 
-    }
+    // Start of the buffer if it is persistently mapped
+    char *persistent_ = nullptr;
 
-    bool init_resources(){
-      // Create the VBO and VAO indices
-      glGenVertexArrays(1, &vao);
-      glGenBuffers(1, &vbo);
-      return true;
-    }
+    // Region mapped by map() / map_range() without persistent mapping
+    bool mapped_ = false;
 
-    void cleanup(){
-      glDeleteBuffers(1, &vbo);
-      glDeleteVertexArrays(1, &vao);
-    }
+    GLsync fences_[regions_] = {nullptr, nullptr, nullptr};
 
     /**
+     * StreamBuffer::init_resources
      *
-     * Load the geometry for a quad into array `data`
-     *
-     * @param width
-     * @param height
-     * @param data
+     * @param target e.g. GL_ARRAY_BUFFER
+     * @param region_size Size in bytes of the largest upload, nothing is
+     *                    allocated if it is 0 (e.g. a Path drawn from a
+     *                    shared buffer) and map() returns nullptr
+     * @return
      */
-    static int generate_quad(float width, float height, float data[]){
+    bool init_resources(GLenum target, GLsizeiptr region_size){
 
-      const float vertices[4][3]{{-0.5f * width,  0.5f * height, 0.0f}, {0.5f * width,  0.5f * height, 0.0f},
-                                 {-0.5f * width, -0.5f * height, 0.0f}, {0.5f * width, -0.5f * height, 0.0f}};
+      target_ = target;
+      region_size_ = std::max(region_size, GLsizeiptr(0));
+      region_ = 0;
 
-      int offset = 0;
-      for(int j = 0; j < 4; ++j){
-        for(int i = 0; i < 3; ++i) {
-          data[offset++] = vertices[j][i];
-        }
+      // Zero sized buffer storage is GL_INVALID_VALUE
+      if(region_size_ == 0){
+        return true;
       }
 
-      return offset;
-    }
+      glGenBuffers(1, &buffer_);
+      glBindBuffer(target_, buffer_);
 
-    void build_quad(float width, float height){
+      if(GLEW_ARB_buffer_storage){
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
-      count_ = 6;
+        glBufferStorage(target_, regions_ * region_size_, nullptr, flags);
+        persistent_ = (char *) glMapBufferRange(target_, 0, regions_ * region_size_, flags);
 
-      float data[12];
+        if(persistent_ == nullptr){
+          // Immutable storage can't be orphaned, start over with a regular buffer
+          std::cerr<<"StreamBuffer::init_resources: persistent mapping failed"<<std::endl;
+          glDeleteBuffers(1, &buffer_);
+          glGenBuffers(1, &buffer_);
+          glBindBuffer(target_, buffer_);
+        }
+      }
 
-      generate_quad(width, height, data);
+      if(persistent_ == nullptr){
+        glBufferData(target_, regions_ * region_size_, nullptr, GL_STREAM_DRAW);
+      }
 
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
+      return check_GL_error("StreamBuffer::init_resources() exit");
+    }
 
-      glBindVertexArray(0);
+    /**
+     * StreamBuffer::offset
+     *
+     * @return Byte offset of the current region in buffer_
+     */
+    GLintptr offset() const{
+      return region_ * region_size_;
     }
 
-    void build_triangle(float radius){
+    /**
+     * StreamBuffer::map
+     *
+     *   Move on to the next region and map it for writing. The region that was
+     *   current until now gets a fence, all the draws that read from it have
+     *   been issued by the time the next frame is uploaded.
+     *
+     *   The buffer is left bound to target_, call unmap() when done writing.
+     *
+     * @param bytes How much will be written, at most region_size_
+     * @return Start of the region, nullptr if there is nothing to map
+     */
+    void *map(GLsizeiptr bytes){
 
-      count_ = 3;
+      if((bytes <= 0) || (bytes > region_size_)){
+        return nullptr;
+      }
 
-      float half_a = sqrt(3.0) * radius;
+      glBindBuffer(target_, buffer_);
 
-      const float vertices[3][3]{{-half_a, -radius,      0.0f},
-                                 {0.0f,   2.0f * radius, 0.0f},
-                                 {half_a,  -2 * radius,      0.0f}};
+      if(persistent_){
+        fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
-      // Create the VAO
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-      glFinish();
+        region_ = (region_ + 1) % regions_;
+        wait(region_);
 
-      glBindVertexArray(0);
+        return persistent_ + offset();
+      }
+
+      region_ = (region_ + 1) % regions_;
+
+      // Orphan, the draws from the old storage can go on undisturbed
+      if(region_ == 0){
+        glBufferData(target_, regions_ * region_size_, nullptr, GL_STREAM_DRAW);
+      }
+
+      return map_region(offset(), bytes, GL_MAP_INVALIDATE_RANGE_BIT);
     }
 
-    void setup_array(int positionHandle){
+    /**
+     * StreamBuffer::map_range
+     *
+     *   Map part of the current region without moving on. Only for bytes the
+     *   GPU isn't reading yet (e.g. appending past what is being drawn).
+     *
+     * @param first Byte offset within the region
+     * @param bytes
+     * @return
+     */
+    void *map_range(GLintptr first, GLsizeiptr bytes){
 
-      std::cout<<"FlatShape::setup_array positionHandle "<<positionHandle<<std::endl;
+      if((bytes <= 0) || (first + bytes > region_size_)){
+        return nullptr;
+      }
 
-      glBindVertexArray(vao);
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glVertexAttribPointer(positionHandle, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+      glBindBuffer(target_, buffer_);
 
-      glEnableVertexAttribArray(positionHandle);
+      if(persistent_){
+        return persistent_ + offset() + first;
+      }
 
-      check_GL_error("FlatShape::init_attribute()");
+      return map_region(offset() + first, bytes, 0);
     }
 
-    void bind(){
-      glBindVertexArray(vao);
+    /**
+     * StreamBuffer::unmap
+     *
+     *   Nothing to do for the persistent mapping, it is coherent
+     */
+    void unmap(){
+      if(mapped_){
+        glBindBuffer(target_, buffer_);
+        glUnmapBuffer(target_);
+        mapped_ = false;
+      }
     }
 
-    virtual void render(Camera<float>& camera){
-//      std::cout<<"FlatShape::render"<<std::endl;
+    void cleanup(){
 
-//      if(!enabled_){
-//        return;
-//      }
+      for(int i = 0; i < regions_; ++i){
+        if(fences_[i]){
+          glDeleteSync(fences_[i]);
+          fences_[i] = nullptr;
+        }
+      }
 
-      glDrawElements(GL_TRIANGLES, count_, GL_UNSIGNED_INT, const_ix);
+      // Deleting the buffer unmaps it
+      glDeleteBuffers(1, &buffer_);
+      persistent_ = nullptr;
+      mapped_ = false;
     }
 
-    virtual bool hitTest(float x, float y){
-      using namespace std;
+    void *map_region(GLintptr first, GLsizeiptr bytes, GLbitfield flags){
 
-      std::cout<<"FlatShape::hitTest : x= "<<x<<", y= "<<y<<endl;
+      void *ptr = glMapBufferRange(target_, first, bytes,
+                                   GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | flags);
+      mapped_ = (ptr != nullptr);
 
-      return false;
-    };
+      check_GL_error("StreamBuffer::map_region() exit");
+      return ptr;
+    }
 
-    virtual bool handleDrag(float x_i, float y_i, float x_f, float y_f){
-      return false;
-    };
+    /**
+     * StreamBuffer::wait
+     *
+     *   Block until the GPU is done with region ix. With three regions this
+     *   only stalls when the GPU is more than two frames behind.
+     *
+     * @param ix
+     */
+    void wait(int ix){
+
+      if(fences_[ix] == nullptr){
+        return;
+      }
+
+      GLenum status = glClientWaitSync(fences_[ix], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+
+      while(status == GL_TIMEOUT_EXPIRED){
+        status = glClientWaitSync(fences_[ix], 0, 1000000);
+      }
 
+      glDeleteSync(fences_[ix]);
+      fences_[ix] = nullptr;
+    }
 
   };
 
+
   /**
    *
-   * A line path
+   * Collects the nodes whose data changed and uploads each of them once, right
+   * before the frame is drawn. Code that changes a node schedules it instead of
+   * uploading right away, so a node touched many times between two frames
+   * (timer ticks, mouse moves, slider scrubbing) is uploaded only once.
    *
    */
-  struct Path : public Node{
+  struct UploadScheduler{
 
-    GLuint vao = 0;
-    GLuint vbo = 0;
+    std::vector<Node*> pending_;
 
-    // Maximum number of elements
-    int capacity_ = 0;
+    // Bytes uploaded by the last flush() and in total
+    size_t bytes_frame_ = 0;
+    size_t bytes_total_ = 0;
 
-    const static int stride_ = 3;
+    int frames_ = 0;
 
-    // Vertices for the path
-    float *data_ = nullptr;
+    /**
+     * UploadScheduler::schedule
+     *
+     * @param node Uploaded on the next flush(), once no matter how many calls
+     */
+    void schedule(Node *node){
+      if(!node->upload_pending_){
+        node->upload_pending_ = true;
+        pending_.push_back(node);
+      }
+    }
 
-    float *velocity_ = nullptr;
+    /**
+     * UploadScheduler::flush
+     *
+     *   Upload everything that was scheduled, call at the top of paintGL
+     *
+     * @return Number of bytes uploaded
+     */
+    size_t flush(){
 
-    // How many elements are in the path now
-    int size = 0;
+      bytes_frame_ = 0;
 
-    // How many should be drawn
-    int draw_size = 0;
+      for(Node *node : pending_){
+        node->upload_pending_ = false;
+        bytes_frame_ += node->flush_upload();
+      }
 
-    Path(int capacity) : capacity_(capacity){
-      init(capacity);
-    }
+      pending_.clear();
 
-    Path(){
+      bytes_total_ += bytes_frame_;
+      ++frames_;
 
+#if 0
+      std::cout<<"UploadScheduler::flush "<<bytes_frame_<<" bytes this frame, "
+               <<bytes_total_ / frames_<<" bytes per frame on average"<<std::endl;
+#endif
+      return bytes_frame_;
     }
+  };
 
-    void init(int capacity){
 
-      capacity_ = capacity;
-      data_ = new float[stride_ * capacity_];
-      velocity_ = new float[stride_ * capacity_];
+  /**
+   * Size of a uniform block padded to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, so
+   * consecutive blocks in one buffer can be bound with glBindBufferRange
+   *
+   * @param bytes
+   * @return
+   */
+  inline GLsizeiptr aligned_block_size(GLsizeiptr bytes){
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
 
-      for(int i = 0; i < stride_ * capacity_; ++i){
-        data_[i] = 0.0f;
-        velocity_[i] = 0.0f;
-      }
-    }
+    return ((bytes + alignment - 1) / alignment) * alignment;
+  }
 
+  /**
+   *
+   * Camera uniforms shared by every program (c.f. FRAME_BLOCK_BINDING). The lab
+   * updates the cameras it draws with once per frame, uploads them together
+   * and binds a camera before drawing the nodes that use it. The nodes don't
+   * set any camera uniforms themselves.
+   *
+   *   layout(std140) uniform FrameBlock {
+   *     mat4 mvp_;
+   *     mat4 mv_;
+   *     mat4 p_;
+   *     vec4 camera_eye_world_;
+   *     vec4 camera_up_world_;
+   *     vec4 camera_right_world_;
+   *   };
+   *
+   */
+  struct FrameUniforms{
 
-    ~Path(){
-      delete[] data_;
-      delete[] velocity_;
-    }
+    const static int block_floats_ = 3 * 16 + 3 * 4;
 
-    void clear(){
-      size = 0;
-      draw_size = 0;
-    }
+    GLuint ubo_ = 0;
 
-    /**
-     * Path::init_resources
-     *
-     *   It allocates storage and uploads whatever is in data_
-     *
-     * @return
-     */
-    virtual bool init_resources(){
+    // Maximum number of cameras in a frame
+    int capacity_ = 0;
 
-      // Create the VAO and the buffers
-      glGenVertexArrays(1, &vao);
-      glGenBuffers(1, &vbo);
+    // Bytes between consecutive blocks
+    GLsizeiptr slot_size_ = 0;
+
+    // The camera of each block
+    std::vector<const Camera<float>*> cameras_;
+
+    std::vector<float> staging_;
+
+    // Block bound to FRAME_BLOCK_BINDING, -1 for none
+    int bound_ = -1;
+
+    FrameUniforms(int max_cameras = 1) : capacity_(max_cameras){
 
-      // Initialize the storage (uplad
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, stride_ * capacity_ * sizeof(float), data_, GL_STATIC_DRAW);
-      return check_GL_error("path::init_resources()");
     }
 
     /**
-     * Path::setup_array
+     * FrameUniforms::init_resources
      *
-     * @param positionHandle
-     * @param colorHandle
+     * @return
      */
-    void setup_array(int positionHandle, int colorHandle){
-#if 0
-      std::cout<<"positionIndex "<<positionHandle<<" colorIndex "<<colorHandle<<std::endl;
-#endif
-      glBindVertexArray(vao);
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    bool init_resources(){
 
-      glVertexAttribPointer(positionHandle, 3, GL_FLOAT, GL_FALSE, 0 * sizeof(float), nullptr);
-      glEnableVertexAttribArray(positionHandle);
+      slot_size_ = aligned_block_size(block_floats_ * sizeof(float));
+      staging_.assign(capacity_ * slot_size_ / sizeof(float), 0.0f);
 
-//      glVertexAttribPointer(colorHandle , 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) (3 * sizeof(float)));
-//      glEnableVertexAttribArray(colorHandle);
+      glGenBuffers(1, &ubo_);
+      glBindBuffer(GL_UNIFORM_BUFFER, ubo_);
+      glBufferData(GL_UNIFORM_BUFFER, capacity_ * slot_size_, nullptr, GL_DYNAMIC_DRAW);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-      check_GL_error("path::init_attribute()");
+      return check_GL_error("FrameUniforms::init_resources() exit");
     }
 
-    void bind(){
-      glBindVertexArray(vao);
+    void cleanup(){
+      glDeleteBuffers(1, &ubo_);
+      cameras_.clear();
+      bound_ = -1;
     }
 
     /**
-     * Path::addPoint
+     * FrameUniforms::update
      *
-     * After adding the points you still need to specify draw_size;
+     *   Copy the camera into its block, the first update of a camera assigns
+     *   it a block
      *
-     * @param x
-     * @param y
-     * @param z
-     * @param v_x
-     * @param v_y
-     * @param v_z
-     * @return
+     * @param camera
      */
-    bool addPoint(float x, float y, float z,
-                  float v_x, float v_y, float v_z){
-
-      using namespace std;
+    void update(const Camera<float> &camera){
 
-//      std::cout<<" Path Vertices "<<x<<", "<<y<<", "<<z<<endl;
+      int ix = slot(camera);
 
-      int offset = stride_ * size;
+      if(ix < 0){
+        if((int) cameras_.size() >= capacity_){
+          std::cerr<<"FrameUniforms::update: No room for another camera, capacity = "<<capacity_<<std::endl;
+          return;
+        }
 
-      if(size >= capacity_){
-        cerr<<"Path::addPoint:: Not enough space"<<endl;
-        return false;
+        ix = (int) cameras_.size();
+        cameras_.push_back(&camera);
       }
 
-      // Position Data
-      data_[offset] = x;
-      data_[offset + 1] = y;
-      data_[offset + 2] = z;
-
-      // Velocity
-      velocity_[offset] = v_x;
-      velocity_[offset + 1] = v_y;
-      velocity_[offset + 2] = v_z;
+      float *block = &staging_[ix * slot_size_ / sizeof(float)];
 
-      size += 1;
+      std::copy(camera.mvp, camera.mvp + 16, block);
+      std::copy(camera.mv, camera.mv + 16, block + 16);
+      std::copy(camera.p, camera.p + 16, block + 32);
 
-      return true;
+      std::copy(camera.eye_world, camera.eye_world + 3, block + 48);
+      std::copy(camera.up_world, camera.up_world + 3, block + 52);
+      std::copy(camera.right_world, camera.right_world + 3, block + 56);
     }
 
     /**
+     * FrameUniforms::upload
      *
-     *
-     *
-     *
-     * @param t from 0 to 1.0
-     * @param position[] A 3-array with the interpolated position
+     *   Upload all the cameras, once per frame before anything is drawn
      */
-    int interpolate(const float t, float* position){
-
-      int ix = t * size;
-      int ix_next = (ix + 1) % size;
-
-      // TODO: Linearly interpolate between the two points
-
-      std::cout<<"interpolate t="<<t<<", ix = "<<ix<<", ix_next = "<<ix_next<<std::endl;
-
-      int offset = 3 * ix;
-//      int offset_next = 3 * ix_next;
+    void upload(){
 
-      for(int i = 0; i < 3; ++i){
-        position[i] = data_[offset + i];
+      if(cameras_.empty()){
+        return;
       }
 
-      return ix;
+      glBindBuffer(GL_UNIFORM_BUFFER, ubo_);
+      glBufferData(GL_UNIFORM_BUFFER, capacity_ * slot_size_, nullptr, GL_DYNAMIC_DRAW);
+      glBufferSubData(GL_UNIFORM_BUFFER, 0, cameras_.size() * slot_size_, staging_.data());
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+      bound_ = -1;
     }
 
     /**
-     * Path::upload
+     * FrameUniforms::bind
      *
-     * Upload the data
+     *   Draw with camera from now on, nothing happens if it is bound already
      *
+     * @param camera
      */
-    void upload(){
-      check_GL_error("path::upload() - entry");
+    void bind(const Camera<float> &camera){
 
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-//      check_GL_error("path::upload() - entry 1");
+      int ix = slot(camera);
 
-//      std::cout<<"Path::upload Uploading "<<stride_ * size * sizeof(float) <<" bytes"<<std::endl;
+      if((ix < 0) || (ix == bound_)){
+        return;
+      }
 
-      glBufferSubData(GL_ARRAY_BUFFER, 0, stride_ * size * sizeof(float), data_);
-      check_GL_error("path::upload() - exit");
+      glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, ubo_,
+                        ix * slot_size_, block_floats_ * sizeof(float));
+      bound_ = ix;
     }
 
-    /**
-     * Draw the path on screen
-     */
-    virtual void render(Camera<float>& camera_){
-      using namespace std;
+    int slot(const Camera<float> &camera) const{
 
-//      cout<<"Path::render "<<draw_size<<endl;
-      glBindVertexArray(vao);
-      glDrawArrays(GL_LINE_STRIP, 0, draw_size);
-      check_GL_error("path::render() - exit");
+      for(int i = 0; i < (int) cameras_.size(); ++i){
+        if(cameras_[i] == &camera){
+          return i;
+        }
+      }
+
+      return -1;
     }
+  };
 
-    /**
-     *
-     * Do a line - cylinder intersection
-     *
-     *
-     * @param x Screen coordinates in NDC (?)
-     * @param y
-     * @param radius size of pick region
-     * @param element_ix [out] The index of the hit vertex
-     *
-     * @return square of the distance to the closest point
-     */
-    float hitTest(float x, float y, float radius, const Camera<float>& camera_,
-                  int *element_ix, float element_position[],
-                  float element_velocity[]) {
+  /**
+   *
+   * Per object uniforms (c.f. OBJECT_BLOCK_BINDING). The blocks stay on the GPU
+   * and are only re-uploaded when they change. An object drawn several times a
+   * frame (e.g. at different offsets) uses one block per draw.
+   *
+   *   layout(std140) uniform ObjectBlock {
+   *     vec4 solid_color_;
+   *     vec3 offset_;
+   *     float radius_;
+   *   };
+   *
+   */
+  struct ObjectUniforms{
 
-      // TODO: This needs to interpolate between the nearest hits
+    const static int block_floats_ = 8;
 
-      float vert_world[4] {0.0f, 0.0f, 0.0f, 1.0f};
-      float vert_screen[4] {0.0f, 0.0f, 0.0f, 1.0f};
+    GLuint ubo_ = 0;
 
-      // We want the closest point to x, y so set the target radius as the initial threshold
-      // and with each hit we set the threshold to the new dr_sq since it will be smaller.
-      float r_sq_min = radius * radius;
+    int capacity_ = 1;
 
-      // Go through all of the points
-      int offset = 0;
+    // Bytes between consecutive blocks
+    GLsizeiptr slot_size_ = 0;
 
-      *element_ix = -1;
+    // What is in each block on the GPU
+    std::vector<float> blocks_;
+    std::vector<bool> valid_;
 
-      for (int j = 0; j < size; ++j){
+    ObjectUniforms(int capacity = 1) : capacity_(capacity){
 
-        for(int i = 0; i < 3; ++i){
-          vert_world[i] = data_[offset + i];
-        }
+    }
 
-        vec4_by_mat4x4(camera_.mvp, vert_world, vert_screen);
+    /**
+     * ObjectUniforms::init_resources
+     *
+     * @return
+     */
+    bool init_resources(){
 
-        float scale = 1.0f / vert_screen[3];
-        vert_screen[0] *= scale;
-        vert_screen[1] *= scale;
+      slot_size_ = aligned_block_size(block_floats_ * sizeof(float));
+      blocks_.assign(capacity_ * block_floats_, 0.0f);
+      valid_.assign(capacity_, false);
 
-        float dx = vert_screen[0] - x;
-        float dy = vert_screen[1] - y;
-        float dr_sq = dx * dx + dy * dy;
+      glGenBuffers(1, &ubo_);
+      glBindBuffer(GL_UNIFORM_BUFFER, ubo_);
+      glBufferData(GL_UNIFORM_BUFFER, capacity_ * slot_size_, nullptr, GL_DYNAMIC_DRAW);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-        if(dr_sq < r_sq_min){
-          r_sq_min = dr_sq;
-          *element_ix = j;
+      return check_GL_error("ObjectUniforms::init_resources() exit");
+    }
 
-          // We need the hit location
-          for(int i = 0; i < 3; ++i){
-            element_position[i] = vert_world[i];
-            element_velocity[i] = velocity_[offset + i];
-          }
+    void cleanup(){
+      glDeleteBuffers(1, &ubo_);
+    }
 
-        }
+    /**
+     * ObjectUniforms::update
+     *
+     * @param ix Block
+     * @param color
+     * @param offset A 3-array
+     * @param radius
+     */
+    void update(int ix, const float color[4], const float offset[3], float radius){
 
-        offset += 3;
+      const float block[block_floats_] = {color[0], color[1], color[2], color[3],
+                                          offset[0], offset[1], offset[2], radius};
 
-#if 0
-        if(j % 10 == 0){
-          std::cout << "Path::hitTest: j " << j << " " << vert_screen[0] << ", " << vert_screen[1]
+      float *current = &blocks_[ix * block_floats_];
 
-                    <<" dx "<<dx<<", dy "<<dy<<" dr_sq "<<dr_sq
-                    << std::endl;
-        }
+      if(valid_[ix] && std::equal(block, block + block_floats_, current)){
+        return;
       }
 
-      if(*element_ix >= 0){
-        std::cout<<"Path::hitTest Picking at "<<x<<", "<<y<<" resulted in pick " <<*element_ix<< std::endl;
-      }
-#else
-      }
-#endif
+      std::copy(block, block + block_floats_, current);
+      valid_[ix] = true;
 
-      return r_sq_min;
+      glBindBuffer(GL_UNIFORM_BUFFER, ubo_);
+      glBufferSubData(GL_UNIFORM_BUFFER, ix * slot_size_, sizeof(block), block);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 
-    /**
-     * Free OpenGL resources
-     */
-    void cleanup(){
-      glDeleteBuffers(1, &vbo);
-      glDeleteVertexArrays(1, &vao);
+    void bind(int ix = 0){
+      glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, ubo_,
+                        ix * slot_size_, block_floats_ * sizeof(float));
     }
   };
 
+
   /**
    *
-   * A set of Sprites
+   * GL state a RenderQueue binds before drawing an item. A program of 0 marks
+   * a node that binds its own state in render().
    *
    */
-  struct Sprites : public Node{
+  struct RenderState{
+    int pass = PASS_OPAQUE;
 
-    GLuint vao = 0;
-    GLuint vbo = 0;
-
-    // Maximum number of elements
-    int capacity_ = 0;
-    const static int stride_ = 8;
+    GLuint program = 0;
 
-    // Vertices for the path
-    float *data_;
+    GLenum texture_target = GL_TEXTURE_2D;
+    GLuint texture = 0;
+    int tex_unit = 0;
 
-    // How many points do we have
-    int size = 0;
+    GLuint vao = 0;
+  };
 
-    // How many are we drawing.
-    int draw_size = 0;
+  struct RenderItem{
+    Node *node = nullptr;
+    Camera<float> *camera = nullptr;
+    RenderState state;
 
-    Sprites(int capacity) : capacity_(capacity){
+    // Clip space depth of the node, for back to front sorting
+    float depth = 0.0f;
+  };
 
-      data_ = new float[stride_ * capacity_];
+  /**
+   *
+   * The draws of one frame. A lab walks its scene graph into the queue, sorts
+   * it and submits it:
+   *
+   *   - Background and overlay items are drawn in the order they were queued
+   *   - Opaque items are grouped by camera, program, texture and VAO
+   *   - Transparent items are drawn back to front
+   *
+   * While submitting, a program, texture or VAO is only bound when it differs
+   * from the one bound for the previous item.
+   *
+   */
+  struct RenderQueue{
 
-      for(int i = 0; i < stride_ * capacity_; ++i){
-        data_[i] = 0.0f;
-      }
-    }
+    std::vector<RenderItem> items_;
 
-    ~Sprites(){
-      delete[] data_;
+    // Bound while submitting
+    int pass_ = -1;
+    Camera<float> *camera_ = nullptr;
+    GLuint program_ = 0;
+    GLuint vao_ = 0;
+    std::vector<GLuint> textures_;
+
+    // Counters from the last submit
+    int draws_ = 0;
+    int state_changes_ = 0;
+
+    // Nodes outside of the view since the last clear()
+    int culled_ = 0;
+
+    void clear(){
+      items_.clear();
+      culled_ = 0;
     }
 
     /**
-     * Sprites::init_resources
+     * RenderQueue::traverse
      *
-     * @return
+     *   Update the world positions under root and queue every visible node
+     *
+     * @param root
+     * @param camera
      */
-    virtual bool init_resources(){
-      glGenVertexArrays(1, &vao);
-      glGenBuffers(1, &vbo);
+    void traverse(Node *root, Camera<float> &camera){
+      root->update_world();
+      collect(root, camera);
+    }
 
-      glBindVertexArray(vao);
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, stride_ * capacity_ * sizeof(float), 0, GL_STATIC_DRAW);
+    void collect(Node *node, Camera<float> &camera){
 
-      return check_GL_error("Path::init_resources() - exit");
-    }
+      if(!node->visible_){
+        return;
+      }
 
-    void clear(){
-      size = draw_size = 0;
+      node->enqueue(*this, camera);
+
+      for(Node *child : node->children_){
+        collect(child, camera);
+      }
     }
 
     /**
-     * Sprites::setup_array
+     * RenderQueue::push
      *
-     * @return
+     * @param node
+     * @param camera
+     * @param state
      */
-    void setup_array(int positionHandle, int sizeHandle, int colorHandle){
+    void push(Node *node, Camera<float> &camera, const RenderState &state){
 
-      glBindVertexArray(vao);
-
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-      glVertexAttribPointer(positionHandle, 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) 0);
+      if(!node->in_view(camera)){
+        ++culled_;
+        return;
+      }
 
-      glEnableVertexAttribArray(positionHandle);
+      RenderItem item;
+      item.node = node;
+      item.camera = &camera;
+      item.state = state;
 
-      // We've packed the normalized Temperature and normalized Irradiance into one 2 component attribute
-      glVertexAttribPointer(sizeHandle, 1, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) (3 * sizeof(float)));
-      glEnableVertexAttribArray(sizeHandle);
+      if(state.pass == PASS_TRANSPARENT){
+        const float *p = node->world_position();
+        const float world[4] = {p[0], p[1], p[2], 1.0f};
+        float clip[4];
 
-      // We've packed the normalized Temperature and normalized Irradiance into one 2 component attribute
-      glVertexAttribPointer(colorHandle , 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) (4 * sizeof(float)));
-      glEnableVertexAttribArray(colorHandle);
+        vec4_by_mat4x4(camera.mvp, world, clip);
+        item.depth = clip[2];
+      }
 
-      check_GL_error("Sprites::init_attribute() 4");
+      items_.push_back(item);
     }
 
-    /**
-     * Sprites::bind
-     *
-     * @return
-     */
-    void bind(){
-      glBindVertexArray(vao);
+    // Queue a node that binds its own state
+    void push(Node *node, Camera<float> &camera, int pass){
+      RenderState state;
+      state.pass = pass;
+      push(node, camera, state);
     }
 
     /**
-     * Sprites::addPoint
-     *
-     * @param radius Size of pixel
-     * @param r Color
-     *
-     * @return
+     * RenderQueue::sort
      */
-    bool addPoint(float x, float y, float z, float radius,
-                  float r, float g, float b, float a){
-
-      using namespace std;
-
-#if 0
-     std::cout<<" Sprites::addPoint Vertices "<<x<<", "<<y<<", "<<z
-              <<", "<<r<<", "<<g<<", "<<b<<", "<<a<<endl;
-#endif
-      int offset = stride_ * size;
-
-      if(size >= capacity_ ){
-        cerr<<"Sprites::addPoint: Not enough space to add vertex. capacity = "<<capacity_<<endl;
-        return false;
-      }
+    void sort(){
 
-      data_[offset] = x;
-      data_[offset + 1] = y;
-      data_[offset + 2] = z;
+      std::stable_sort(items_.begin(), items_.end(), [](const RenderItem &lhs, const RenderItem &rhs){
 
-      data_[offset + 3] = radius;
+        if(lhs.state.pass != rhs.state.pass){
+          return lhs.state.pass < rhs.state.pass;
+        }
 
-      data_[offset + 4] = r;
-      data_[offset + 5] = g;
-      data_[offset + 6] = b;
-      data_[offset + 7] = a;
+        switch(lhs.state.pass){
+          case PASS_OPAQUE:
+            if(lhs.camera != rhs.camera) return lhs.camera < rhs.camera;
+            if(lhs.state.program != rhs.state.program) return lhs.state.program < rhs.state.program;
+            if(lhs.state.texture != rhs.state.texture) return lhs.state.texture < rhs.state.texture;
+            return lhs.state.vao < rhs.state.vao;
 
-      size += 1;
+          case PASS_TRANSPARENT:
+            return lhs.depth > rhs.depth;
 
-      return true;
+          default:
+            // Queued order
+            return false;
+        }
+      });
     }
 
     /**
-     * Sprites::upload
+     * RenderQueue::submit
      *
-     * Upload the data
+     * @param frame Camera blocks for the items' cameras, may be null
      */
-    void upload(){
+    void submit(FrameUniforms *frame = nullptr){
+
+      pass_ = -1;
+      camera_ = nullptr;
+      draws_ = 0;
+      state_changes_ = 0;
+      forget_state();
+
+      for(RenderItem &item : items_){
+        const RenderState &state = item.state;
+
+        if(state.pass != pass_){
+          if((state.pass == PASS_OPAQUE) || (state.pass == PASS_TRANSPARENT)){
+            glEnable(GL_DEPTH_TEST);
+          }else{
+            glDisable(GL_DEPTH_TEST);
+          }
+          pass_ = state.pass;
+        }
 
-      check_GL_error("path::upload() - entry");
-//      std::cout<<"Sprites::addPoint Uploading Points "<<stride_ * size<<std::endl;
+        if(item.camera != camera_){
+          if(frame != nullptr){
+            frame->bind(*item.camera);
+          }
+          camera_ = item.camera;
+        }
 
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferSubData(GL_ARRAY_BUFFER, 0, stride_ * size * sizeof(float), data_);
+        // The node binds its own state
+        if(state.program == 0){
+          item.node->draw(*item.camera);
+          forget_state();
+          ++draws_;
+          continue;
+        }
 
-      check_GL_error("path::upload() - exit");
-    }
+        if(state.program != program_){
+          glUseProgram(state.program);
+          program_ = state.program;
+          ++state_changes_;
+        }
+
+        if(state.texture != 0){
+          if((int) textures_.size() <= state.tex_unit){
+            textures_.resize(state.tex_unit + 1, 0);
+          }
+
+          if(textures_[state.tex_unit] != state.texture){
+            glActiveTexture(GL_TEXTURE0 + state.tex_unit);
+            glBindTexture(state.texture_target, state.texture);
+            textures_[state.tex_unit] = state.texture;
+            ++state_changes_;
+          }
+        }
+
+        if(state.vao != vao_){
+          glBindVertexArray(state.vao);
+          vao_ = state.vao;
+          ++state_changes_;
+        }
+
+        item.node->draw(*item.camera);
+        ++draws_;
+      }
 
-    /**
-     * Draw the path on screen
-     */
-    virtual void render(Camera<float>& camera_){
 #if 0
-      std::cout<<"Sprites::render: Drawing points "<<draw_size<<" of "<<size<<std::endl;
+      std::cout<<"RenderQueue::submit "<<draws_<<" draws, "<<state_changes_<<" state changes, "
+               <<culled_<<" culled"<<std::endl;
 #endif
-      glBindVertexArray(vao);
-      glDrawArrays(GL_POINTS, 0, draw_size);
     }
 
-    /**
-     * Free OpenGL resources
-     */
-    void cleanup(){
-      glDeleteBuffers(1, &vbo);
-      glDeleteVertexArrays(1, &vao);
+    // Whatever a node bound itself is unknown to the queue
+    void forget_state(){
+      program_ = 0;
+      vao_ = 0;
+      std::fill(textures_.begin(), textures_.end(), 0);
     }
-
   };
 
+  inline void Node::enqueue(RenderQueue &queue, Camera<float> &camera){
+    queue.push(this, camera, pass_);
+  }
 
   /**
    *
-   *  A generic geometry class
+   * Programs shared by every node built from the same shaders, e.g. all the
+   * ProceduralSpheres with the same fragment shader use one program.
    *
    */
-  struct Geometry : public Node{
-
-    // Shaders
-    std::string vert_shader = "./assets/shaders/default.vert";
-    std::string frag_shader = "./assets/shaders/default.frag";
-
-    //
-    GLenum mode = GL_LINES;
-
-    // Geometry Vertex Array and Vertex Buffer
-    GLuint vao = 0;
-    GLuint vbo = 0;
-
-    // Program handle
-    GLuint program_;
+  struct ProgramCache{
 
-    // Position Attribute
-    GLint positionHandle_;
-    GLint colorHandle_;
+    struct Entry{
+      GLuint program;
+      int references;
+    };
 
-    GLint mvpHandle_;
-    GLint solidColorHandle_;
+    static std::map<std::string, Entry>& entries(){
+      static std::map<std::string, Entry> entries;
+      return entries;
+    }
 
     /**
-     * Data
+     * ProgramCache::acquire
+     *
+     * @param name
+     * @param vert_shader
+     * @param frag_shader
+     * @return The program or 0 if it failed to build
      */
+    static GLuint acquire(const char *name, const std::string &vert_shader, const std::string &frag_shader){
 
-    float defaultColor_[4] = {1.0f, 0.0f, 1.0f, 1.0f};
-
-    float *verts_;
-
-    // Number of vertices
-    int count_ = 0;
-
-    int capacity_ = 0;
-
-    // Size of array in elements (attributes_per_vertex_ * line_count)
-    int size_ = 0;
-
-    // 3-position and 3-color
-    const static int stride_ = 7;
+      const std::string key = vert_shader + "|" + frag_shader;
 
-    Geometry(int line_count)
-        : count_(0),
-          capacity_(2 * line_count),
-          size_(2 * stride_ * line_count){
+      auto it = entries().find(key);
 
-      std::cout<<"Creating Geometry object with size "<<size_<<std::endl;
+      if(it != entries().end()){
+        ++it->second.references;
+        return it->second.program;
+      }
 
-      verts_ = new float[size_];
+      GLuint program = glCreateProgram();
 
-      for(int i = 0; i < size_; ++i){
-        verts_[i] = 0.0f;
+      if(!build_program(program, name, vert_shader.c_str(), frag_shader.c_str())){
+        glDeleteProgram(program);
+        return 0;
       }
-    }
 
-    ~Geometry(){
-      delete[] verts_;
+      entries()[key] = {program, 1};
+
+      return program;
     }
 
     /**
+     * ProgramCache::release
      *
-     * Geometry::init_resources
+     *   The program is deleted along with its last user
      *
+     * @param program
      */
-    virtual bool init_resources(){
+    static void release(GLuint program){
 
-      std::cout<<"Geometry::init_resources"<<std::endl;
+      for(auto it = entries().begin(); it != entries().end(); ++it){
+        if(it->second.program == program){
+          if(--it->second.references == 0){
+            glDeleteProgram(program);
+            entries().erase(it);
+          }
+          return;
+        }
+      }
+    }
+  };
 
-      /**
-       * Build programs
-       */
-      program_ = glCreateProgram();
 
-      bool status = build_program(program_, "Geometry", vert_shader.c_str(), frag_shader.c_str());
-      if(!status){
-        return false;
-      }
+  /**
+   *
+   * A single user-facing billboard. This should be
+   * used for complicated Billboards with custom
+   * programs (e.g. Planets)
+   *
+   *
+   */
+  struct Billboard : public Node{
 
-      positionHandle_ = glGetAttribLocation(program_, "position_in_");
-      colorHandle_ = glGetAttribLocation(program_, "color_in_");
+    float radius = 0.0;
+    float inclination_ = 0.0f;
 
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
-      solidColorHandle_ = glGetUniformLocation(program_, "solid_color_");
+    GLuint vao = 0;
+    GLuint vbo = 0;
+
+    float vertices_[3][3];
+
+    // Color, offset and radius for the programs that use an ObjectBlock
+    ObjectUniforms object_;
+
+    Billboard(){
+
+    }
+
+    // http://stackoverflow.com/questions/21652546/what-is-the-role-of-glbindvertexarrays-vs-glbindbuffer-and-what-is-their-relatio
+    virtual bool init_resources(){
 
       // Create the VBO and VAO indices
       glGenVertexArrays(1, &vao);
       glGenBuffers(1, &vbo);
 
-      glBindVertexArray(vao);
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, size_ * sizeof(float), verts_, GL_STATIC_DRAW);
+//      radius = 1.0;
 
-      glVertexAttribPointer(positionHandle_, 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) 0);
-      glEnableVertexAttribArray(positionHandle_);
+      float half_a = std::sqrt(3.0) * radius;
 
-      if(colorHandle_ > 0){
-        glVertexAttribPointer(colorHandle_, 4, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) (3 * sizeof(float)));
-        glEnableVertexAttribArray(colorHandle_);
-      }
+      const float vertices[3][3]{{-half_a, -radius,      0.0f},
+                                 {0.0f,   2.0f * radius, 0.0f},
+                                 {half_a,  -radius,      0.0f}};
 
+      // Create the VAO
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
       glBindVertexArray(0);
 
-      return check_GL_error("Geometry::init_resources - exit");
-    }
+      // The triangle faces the camera so bound it in every direction
+      const float extent[2][3] = {{-2.0f * radius, -2.0f * radius, -2.0f * radius},
+                                  {2.0f * radius, 2.0f * radius, 2.0f * radius}};
+      reset_bounds();
+      grow_bounds(&extent[0][0], 2, 3);
 
-    void clear(){
-      count_ = 0;
+      object_.init_resources();
+
+      return check_GL_error("Sphere::init_resources() exit");
     }
 
-    void cleanup(){
-      glDeleteVertexArrays(1, &vao);
+    virtual void cleanup(){
       glDeleteBuffers(1, &vbo);
+      glDeleteVertexArrays(1, &vao);
+      object_.cleanup();
     }
 
     /**
-     * Gometry::addPoint
      *
-     * @param v A 3-array
+     * Billboard::setup_array
+     *
+     * @param attributeIndex
      */
-    void addPoint(float v[], float c[]){
+    void setup_array(int attributeIndex){
 
-      int offset = stride_ * count_;
+ //     std::cout<<"Attribute Index "<<attributeIndex<<std::endl;
 
-      for(int i = 0; i < 3; ++i){
-        verts_[offset++ ] = v[i];
-      }
-
-      for(int i = 0; i < 4; ++i){
-        verts_[offset++] = c[i];
-      }
-      ++count_;
-    }
-
-    /**
-     *
-     * Geometry::upload
-     *
-     */
-    void upload(){
-#if 0
-      std::cout<<"Geometry::upload "<<count_<<" lines or "
-               <<2 * stride_ * count_ * sizeof(float)<<" bytes"<<std::endl;
-#endif
+      glBindVertexArray(vao);
       glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferSubData(GL_ARRAY_BUFFER, 0, stride_ * count_ * sizeof(float), verts_);
-
-      check_GL_error("Geometry::upload exit ");
-    }
+      glVertexAttribPointer(attributeIndex, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    /**
-     *
-     * Geometry::init_resources
-     *
-     */
-    virtual void render(Camera<float>& camera_){
-//      std::cout<<"Geometry::render() "<<count_<<std::endl;
+      glEnableVertexAttribArray(attributeIndex);
 
-      glUseProgram(program_);
-      glUniformMatrix4fv(mvpHandle_, 1, GL_FALSE, camera_.mvp);
-      glUniform4fv(solidColorHandle_, 1, defaultColor_);
+      check_GL_error("Billboard::init_attribute()");
+    }
 
+    virtual void render(Camera<float>& camera){
 
+//      std::cout<<"Sphere::render() "<<radius<<std::endl;
       glBindVertexArray(vao);
-      glDrawArrays(GL_LINES, 0, count_);
+      Billboard::draw(camera);
+
+//    glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, const_ix);
     }
 
+    virtual void draw(Camera<float>& camera){
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
   };
 
   /**
-   *  Programs
+   *
+   *  This represents a flat shape, either a single triangle or a quad
+   *
+   *  TODO: Another way to store this is we have a geometry generator class that loads data arrays
+   *  with whatever shape you want.  Maybe the template argument can
    */
-  struct DefaultProgram{
+  struct FlatShape : public Node{
 
-    // Program handle
-    GLuint program_;
+    const unsigned int const_ix[6] = {0, 1, 2, 2, 3, 1};
 
-    // Position Attribute
-    GLuint positionHandle_;
-    GLuint colorHandle_;
+    GLuint vao = 0;
+    GLuint vbo = 0;
 
-    // Uniform handles
-    GLint mvpHandle_;
+    int count_ = 0;
 
-    DefaultProgram(){
+    FlatShape(){
 
     }
 
-    /**
-     * Initialize resources
-     */
     bool init_resources(){
-      program_ = glCreateProgram();
-
+      // Create the VBO and VAO indices
+      glGenVertexArrays(1, &vao);
+      glGenBuffers(1, &vbo);
       return true;
     }
 
     void cleanup(){
-      glDeleteProgram(program_);
+      glDeleteBuffers(1, &vbo);
+      glDeleteVertexArrays(1, &vao);
     }
 
-    bool build(){
+    /**
+     *
+     * Load the geometry for a quad into array `data`
+     *
+     * @param width
+     * @param height
+     * @param data
+     */
+    static int generate_quad(float width, float height, float data[]){
 
-      const char *vertexShaderSource =
-          "#version 330\n"
-              "uniform mat4 mvp_;\n"
-              "in vec3 position_in_;\n"
-              "in vec4 color_in_;\n"
-              "out vec4 color_ex;\n"
-              "void main() {\n"
-              "   color_ex = color_in_;\n"
-              "   gl_Position = p_ * mv_ * vec4(position_in_, 1.0);\n"
-              "}\n";
+      const float vertices[4][3]{{-0.5f * width,  0.5f * height, 0.0f}, {0.5f * width,  0.5f * height, 0.0f},
+                                 {-0.5f * width, -0.5f * height, 0.0f}, {0.5f * width, -0.5f * height, 0.0f}};
 
-      const char *fragmentShaderSource =
-          "#version 330\n"
-          "in vec4 color_ex;\n"
-              "out vec4 color_out_;\n"
-              "\n"
-              "void main() {\n"
-              "   color_out_ = color_ex;\n"
-              "}\n";
+      int offset = 0;
+      for(int j = 0; j < 4; ++j){
+        for(int i = 0; i < 3; ++i) {
+          data[offset++] = vertices[j][i];
+        }
+      }
 
-      check_GL_error("DefaultProgram::build() exit 0 ");
+      return offset;
+    }
 
+    void build_quad(float width, float height){
 
-      bool status = build_program_from_source(program_,
-                                              "default",
-                                              vertexShaderSource,
-                                              fragmentShaderSource);
-      if(!status){
-        return false;
-      }
+      count_ = 6;
 
-      positionHandle_ = glGetAttribLocation(program_, "position");
-      colorHandle_ = glGetAttribLocation(program_, "position");
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
+      float data[12];
 
-      return check_GL_error("DefaultProgram::build() exit");
-    }
+      generate_quad(width, height, data);
 
-  };
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
 
+      glBindVertexArray(0);
+    }
 
-  /**
-   * Program for drawing paths
-   */
-  struct PathProgram{
+    void build_triangle(float radius){
 
-    // Program handle
-    GLuint program_;
+      count_ = 3;
 
-    // Attributes
-    GLuint positionHandle_;
+      float half_a = sqrt(3.0) * radius;
 
-    // Uniform handles
-    GLint mvpHandle_;
-    GLint colorHandle_;
+      const float vertices[3][3]{{-half_a, -radius,      0.0f},
+                                 {0.0f,   2.0f * radius, 0.0f},
+                                 {half_a,  -2 * radius,      0.0f}};
 
-    /**
-     * Initialize resources
-     */
-    bool init_resources(){
-      program_ = glCreateProgram();
+      // Create the VAO
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-      return true;
+      glBindVertexArray(0);
     }
 
-    void cleanup(){
-      glDeleteProgram(program_);
+    void setup_array(int positionHandle){
+
+      std::cout<<"FlatShape::setup_array positionHandle "<<positionHandle<<std::endl;
+
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glVertexAttribPointer(positionHandle, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+      glEnableVertexAttribArray(positionHandle);
+
+      check_GL_error("FlatShape::init_attribute()");
     }
 
-    bool build(){
+    void bind(){
+      glBindVertexArray(vao);
+    }
 
-      const char *vertexShaderSource =
-          "#version 330\n"
-              "uniform mat4 mvp_;\n"
-              "uniform vec4 color_ = vec4(1.0, 1.0, 1.0, 1.0);\n"
-              "in vec3 position;\n"
-              "out vec4 color_ex;\n"
-              "void main() {\n"
-              "   color_ex = color_;\n"
-              "   gl_Position = mvp_ * vec4(position, 1.0);\n"
-              "}\n";
+    virtual void render(Camera<float>& camera){
+//      std::cout<<"FlatShape::render"<<std::endl;
 
-      const char *fragmentShaderSource =
-          "#version 330\n"
-              "in vec4 color_ex;\n"
-              "out vec4 color_out;\n"
-              "\n"
-              "void main() {\n"
-              "   color_out = color_ex;\n"
-              "}\n";
+//      if(!enabled_){
+//        return;
+//      }
 
+      glDrawElements(GL_TRIANGLES, count_, GL_UNSIGNED_INT, const_ix);
+    }
 
+    virtual bool hitTest(float x, float y){
+      using namespace std;
 
-      bool status = build_program_from_source(program_, "default",
-                                              vertexShaderSource,
-                                              fragmentShaderSource);
+      std::cout<<"FlatShape::hitTest : x= "<<x<<", y= "<<y<<endl;
 
-      if(!status){
-        return false;
-      }
+      return false;
+    };
 
-      positionHandle_ = glGetAttribLocation(program_, "position");
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
-      colorHandle_ = glGetUniformLocation(program_, "color_");
+    virtual bool handleDrag(float x_i, float y_i, float x_f, float y_f){
+      return false;
+    };
 
-      return check_GL_error("PathProgram::build() exit");
-    }
 
   };
 
-
   /**
-   * Draw a sphere on a triangle
+   *
+   * A line path
+   *
    */
-  struct SphereProgram{
+  struct Path : public Node{
 
-    // Shaders
-    std::string vert_shader = "./assets/shaders/sphere.vert";
-    std::string frag_shader = "./assets/shaders/sphere.frag";
+    GLuint vao = 0;
 
-    // Program handle
-    GLuint program_;
+    // Vertices are streamed, c.f. upload()
+    StreamBuffer stream_;
 
-    // Position Attribute
-    GLuint positionHandle_;
+    GLint positionHandle_ = -1;
 
-    // Uniform handles
-    GLint mvpHandle_;
+    // Drawing from someone else's buffer (c.f. setup_shared_array)
+    bool shared_ = false;
 
-    GLint colorHandle_;
-    GLint offsetHandle_;
-    GLint radiusHandle_;
+    // Maximum number of elements
+    int capacity_ = 0;
 
-    SphereProgram(){
+    const static int stride_ = 3;
 
-    }
+    // Vertices for the path
+    float *data_ = nullptr;
 
-    /**
-     * Initialize resources
-     */
-    bool init_resources(){
-      program_ = glCreateProgram();
+    float *velocity_ = nullptr;
 
-      return true;
-    }
+    // How many elements are in the path now
+    int size = 0;
 
-    void cleanup(){
-      glDeleteProgram(program_);
+    // How many should be drawn
+    int draw_size = 0;
+
+    Path(int capacity) : capacity_(capacity){
+      init(capacity);
     }
 
-    bool build(){
+    Path(){
 
-#if 0
-      const char *vert_source =
-          "#version 330\n"
-              "uniform mat4 mvp_;\n"
-              "uniform vec4 solid_color_ = vec4(1.0, 0.0, 1.0, 1.0);\n"
-              "uniform vec3 offset_ = vec3(0);\n"
-              "uniform float radius_ = 1.0f;\n"
-              "in vec3 position_;\n"
-              "out vec4 color_ex;\n"
-              "out vec2 coord_;\n"
-              "void main() {\n"
-              "   color_ex = solid_color_;\n"
-              "   coord_ = position_.xy / radius_;\n"
-              "   gl_Position = mvp_ * vec4(position_ + offset_, 1.0);\n"
-              "}\n";
+    }
 
-      const char *frag_source =
-          "#version 330\n"
-              "in vec2 coord_;\n"
-              "in vec4 color_ex;\n"
-              "out vec4 color_out;\n"
-              "\n"
-              "void main() {\n"
-              "float r = length(coord_);\n"
-              "if(r > 1.0){ discard; }\n"
-              "   color_out = color_ex;\n"
-              "}\n";
+    void init(int capacity){
 
-      bool status = build_program_from_source(program_, "sphere", vert_source, frag_source);
+      capacity_ = capacity;
+      data_ = new float[stride_ * capacity_];
+      velocity_ = new float[stride_ * capacity_];
 
-      if(!status){
-        return false;
+      for(int i = 0; i < stride_ * capacity_; ++i){
+        data_[i] = 0.0f;
+        velocity_[i] = 0.0f;
       }
+    }
 
-      positionHandle_ = glGetAttribLocation(program_, "position_");
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
-      colorHandle_ = glGetUniformLocation(program_, "solid_color_");
-      offsetHandle_ = glGetUniformLocation(program_, "offset_");
-      radiusHandle_ = glGetUniformLocation(program_, "radius_");
 
-#else
+    ~Path(){
+      delete[] data_;
+      delete[] velocity_;
+    }
 
-      bool status = build_program(program_, "SpriteProgram",
-                                  vert_shader.c_str(), frag_shader.c_str());
-      if(!status){
-        return false;
-      }
+    void clear(){
+      size = 0;
+      draw_size = 0;
+    }
 
-      positionHandle_ = glGetAttribLocation(program_, "position_in_");
-      colorHandle_ = glGetUniformLocation(program_, "solid_color_");
-      offsetHandle_ = glGetUniformLocation(program_, "offset_");
-      radiusHandle_ = glGetUniformLocation(program_, "radius_");
+    /**
+     * Path::init_resources
+     *
+     *   It allocates storage and uploads whatever is in data_
+     *
+     * @return
+     */
+    virtual bool init_resources(){
 
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
+      // Create the VAO and the buffers
+      glGenVertexArrays(1, &vao);
 
-      return check_GL_error("SpriteProgram::build() exit");
+      if(!stream_.init_resources(GL_ARRAY_BUFFER, stride_ * capacity_ * sizeof(float))){
+        return false;
+      }
 
-#endif
-      return check_GL_error("SphereProgram::build() exit");
+      // Initialize the storage
+      if(float *dst = (float *) stream_.map(stride_ * capacity_ * sizeof(float))){
+        std::copy(data_, data_ + stride_ * capacity_, dst);
+        stream_.unmap();
+      }
+
+      return check_GL_error("path::init_resources()");
     }
 
-  };
+    /**
+     * Path::setup_array
+     *
+     * @param positionHandle
+     * @param colorHandle
+     */
+    void setup_array(int positionHandle, int colorHandle){
+#if 0
+      std::cout<<"positionIndex "<<positionHandle<<" colorIndex "<<colorHandle<<std::endl;
+#endif
+      positionHandle_ = positionHandle;
+      shared_ = false;
 
+      point_arrays();
 
-  /**
-   *
-   * Program for lots of individual sprites
-   *
-   */
-  struct SpriteProgram{
+      glBindVertexArray(vao);
+      glEnableVertexAttribArray(positionHandle);
 
-    // Shaders
-    std::string vert_shader = "./assets/shaders/sprites.vert";
-    std::string frag_shader = "./assets/shaders/sprites.frag";
+//      glVertexAttribPointer(colorHandle , 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) (3 * sizeof(float)));
+//      glEnableVertexAttribArray(colorHandle);
 
-    // Program handle
-    GLuint program_;
+      check_GL_error("path::init_attribute()");
+    }
 
-    // Attributes
-    GLint positionHandle_;
-    GLint colorHandle_;
+    /**
+     * Path::point_arrays
+     *
+     *   Point the attributes at the region of stream_ that was written last
+     */
+    void point_arrays(){
 
-    // Size of sprite in pixels
-    GLint sizeHandle_;
+      if(shared_ || (positionHandle_ < 0)){
+        return;
+      }
 
-    // Uniform handles
-    GLint mvpHandle_;
-    GLint offsetHandle_;
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, stream_.buffer_);
+      glVertexAttribPointer(positionHandle_, 3, GL_FLOAT, GL_FALSE, 0 * sizeof(float), (void *) stream_.offset());
+    }
 
     /**
-     * Initialize resources
+     * Path::setup_shared_array
+     *
+     *   Draw the path from another buffer instead of stream_ (e.g. one the
+     *   positions are written to by a simulation). Each vertex is components
+     *   floats and the path starts at vertex first of the buffer.
+     *
+     * @param buffer
+     * @param positionHandle
+     * @param components 2 or 3
+     * @param first
      */
-    bool init_resources(){
-      program_ = glCreateProgram();
+    void setup_shared_array(GLuint buffer, int positionHandle, int components, int first){
 
-      return true;
+      shared_ = true;
+
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+      glVertexAttribPointer(positionHandle, components, GL_FLOAT, GL_FALSE, components * sizeof(float),
+                            (void *) (first * components * sizeof(float)));
+      glEnableVertexAttribArray(positionHandle);
+
+      check_GL_error("path::setup_shared_array()");
     }
 
-    void cleanup(){
-      glDeleteProgram(program_);
+    void bind(){
+      glBindVertexArray(vao);
     }
 
-    bool build(){
+    /**
+     * Path::addPoint
+     *
+     * After adding the points you still need to specify draw_size;
+     *
+     * @param x
+     * @param y
+     * @param z
+     * @param v_x
+     * @param v_y
+     * @param v_z
+     * @return
+     */
+    bool addPoint(float x, float y, float z,
+                  float v_x, float v_y, float v_z){
 
-      bool status = build_program(program_, "SpriteProgram",
-                                  vert_shader.c_str(), frag_shader.c_str());
-      if(!status){
+      using namespace std;
+
+//      std::cout<<" Path Vertices "<<x<<", "<<y<<", "<<z<<endl;
+
+      int offset = stride_ * size;
+
+      if(size >= capacity_){
+        cerr<<"Path::addPoint:: Not enough space"<<endl;
         return false;
       }
 
-      positionHandle_ = glGetAttribLocation(program_, "position_in_");
-      colorHandle_ = glGetAttribLocation(program_, "color_in_");
-      sizeHandle_ = glGetAttribLocation(program_, "size_in_");
-
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
-      offsetHandle_ = glGetUniformLocation(program_, "offset_");
+      // Position Data
+      data_[offset] = x;
+      data_[offset + 1] = y;
+      data_[offset + 2] = z;
 
-      return check_GL_error("SpriteProgram::build() exit");
-    }
+      // Velocity
+      velocity_[offset] = v_x;
+      velocity_[offset + 1] = v_y;
+      velocity_[offset + 2] = v_z;
 
-  };
+      size += 1;
 
-  /**
-   * Manages a tiled set of images. Each image tile is the same size.
-   *
-   */
-  struct ImageAtlas{
+      return true;
+    }
 
-    int tex_unit_ = 0;
+    /**
+     * Path::interpolate
+     *
+     * Linear interpolation along the path, the path is treated as a loop so
+     * the last point connects back to the first one.
+     *
+     * @param t from 0 to 1.0
+     * @param position[] A 3-array with the interpolated position
+     * @return index of the point before t, -1 if there is nothing to interpolate
+     */
+    int interpolate(const float t, float* position) const{
 
-    int tile_width_ = 0;
-    int tile_height_ = 0;
+      if((size <= 0) || (data_ == nullptr)){
+        return -1;
+      }
 
-    // Texture Size
-    int tex_width_ = 0;
-    int tex_height_ = 0;
+      float u = (t - std::floor(t)) * size;
 
-    // How many tiles in each dimension
-    int tiles_x_ = 0;
-    int tiles_y_ = 0;
+      int ix = std::min(size - 1, int(u));
+      int ix_next = (ix + 1) % size;
 
-    int capacity_ = 0;
+      float s = u - ix;
 
-    int count_ = 0;
+      int offset = stride_ * ix;
+      int offset_next = stride_ * ix_next;
 
-    const static int max_texture_width_ = 1024;
+      for(int i = 0; i < 3; ++i){
+        position[i] = (1.0f - s) * data_[offset + i] + s * data_[offset_next + i];
+      }
 
-    GLuint tex_;
+      return ix;
+    }
 
     /**
+     * Path::upload
      *
-     * Tiles are packaged tight. You are responsible for putting borders
+     * Upload the data into the next region of stream_
      *
-     * @param tex_unit  Texture unit to use
-     * @param width
-     * @param height
-     * @param layers
-     * @return
      */
-    ImageAtlas(int tex_unit, int tile_width, int tile_height, int capacity)
-        : tex_unit_(tex_unit),
-          tile_width_(tile_width), tile_height_(tile_height),
-          capacity_(capacity){
+    void upload(){
+      check_GL_error("path::upload() - entry");
 
-      // Compute maximum number of tiles we can do in the x direction
-      tiles_x_ = max_texture_width_ / float(tile_width);
+//      std::cout<<"Path::upload Uploading "<<stride_ * size * sizeof(float) <<" bytes"<<std::endl;
 
-      tiles_y_ = ceil(capacity / float(tiles_x_));
+      if(float *dst = (float *) stream_.map(stride_ * size * sizeof(float))){
+        std::copy(data_, data_ + stride_ * size, dst);
+        stream_.unmap();
+        point_arrays();
+      }
 
+      reset_bounds();
 
-      // TODO: HACK!!!
-      if(capacity == 1){
-        tiles_x_ = 1;
+      if(!shared_){
+        grow_bounds(data_, size, stride_);
       }
 
-      tex_width_ = tile_width * tiles_x_;
-      tex_height_ = tile_height * tiles_y_;
+      check_GL_error("path::upload() - exit");
+    }
 
-      std::cout<<"ImageAtlas::constructor:: "<<std::endl
-               <<"ImageAtlas:: Unit : "<<tex_unit_<<std::endl
-               <<"ImageAtlas:: Capacity : "<<capacity_<<"  tiles."<<std::endl
-               <<"ImageAtlas:: Tiles : "<<tiles_x_<<" x "<<tiles_y_<<std::endl
-               <<"ImageAtlas:: Size : "<<tile_width<<" x "<<tile_height<<std::endl
-               <<"ImageAtlas:: Texture : "<<tex_width_<<" x "<<tex_height_<<std::endl;
+    /**
+     * Path::flush_upload
+     *
+     * @return
+     */
+    virtual size_t flush_upload(){
+      upload();
+      return stride_ * size * sizeof(float);
     }
 
-    ImageAtlas(int tex_unit, int tile_width, int tile_height, int tiles_x, int tiles_y)
-        : tex_unit_(tex_unit),
-          tile_width_(tile_width), tile_height_(tile_height),
-          tex_width_(tiles_x * tile_width), tex_height_(tiles_y * tile_height),
-          tiles_x_(tiles_x), tiles_y_(tiles_y),
+    /**
+     * Path::upload_range
+     *
+     * Upload only the points [first, first + count) in place, e.g. after
+     * appending. The points must not be drawn yet (i.e. first >= draw_size).
+     *
+     * @param first
+     * @param count
+     */
+    void upload_range(int first, int count){
+
+      if(count <= 0){
+        return;
+      }
+
+      if(float *dst = (float *) stream_.map_range(stride_ * first * sizeof(float), stride_ * count * sizeof(float))){
+        std::copy(data_ + stride_ * first, data_ + stride_ * (first + count), dst);
+        stream_.unmap();
+      }
+
+      if(!shared_){
+        grow_bounds(data_ + stride_ * first, count, stride_);
+      }
+
+      check_GL_error("path::upload_range() - exit");
+    }
+
+    /**
+     * Draw the path on screen
+     */
+    virtual void render(Camera<float>& camera_){
+      using namespace std;
+
+//      cout<<"Path::render "<<draw_size<<endl;
+      glBindVertexArray(vao);
+      glDrawArrays(GL_LINE_STRIP, 0, draw_size);
+      check_GL_error("path::render() - exit");
+    }
+
+    /**
+     *
+     * Do a line - cylinder intersection
+     *
+     *
+     * @param x Screen coordinates in NDC (?)
+     * @param y
+     * @param radius size of pick region
+     * @param element_ix [out] The index of the hit vertex
+     *
+     * @return square of the distance to the closest point
+     */
+    float hitTest(float x, float y, float radius, const Camera<float>& camera_,
+                  int *element_ix, float element_position[],
+                  float element_velocity[]) {
+
+      // TODO: This needs to interpolate between the nearest hits
+
+      float vert_world[4] {0.0f, 0.0f, 0.0f, 1.0f};
+      float vert_screen[4] {0.0f, 0.0f, 0.0f, 1.0f};
+
+      // We want the closest point to x, y so set the target radius as the initial threshold
+      // and with each hit we set the threshold to the new dr_sq since it will be smaller.
+      float r_sq_min = radius * radius;
+
+      // Go through all of the points
+      int offset = 0;
+
+      *element_ix = -1;
+
+      for (int j = 0; j < size; ++j){
+
+        for(int i = 0; i < 3; ++i){
+          vert_world[i] = data_[offset + i];
+        }
+
+        vec4_by_mat4x4(camera_.mvp, vert_world, vert_screen);
+
+        float scale = 1.0f / vert_screen[3];
+        vert_screen[0] *= scale;
+        vert_screen[1] *= scale;
+
+        float dx = vert_screen[0] - x;
+        float dy = vert_screen[1] - y;
+        float dr_sq = dx * dx + dy * dy;
+
+        if(dr_sq < r_sq_min){
+          r_sq_min = dr_sq;
+          *element_ix = j;
+
+          // We need the hit location
+          for(int i = 0; i < 3; ++i){
+            element_position[i] = vert_world[i];
+            element_velocity[i] = velocity_[offset + i];
+          }
+
+        }
+
+        offset += 3;
+
+#if 0
+        if(j % 10 == 0){
+          std::cout << "Path::hitTest: j " << j << " " << vert_screen[0] << ", " << vert_screen[1]
+
+                    <<" dx "<<dx<<", dy "<<dy<<" dr_sq "<<dr_sq
+                    << std::endl;
+        }
+      }
+
+      if(*element_ix >= 0){
+        std::cout<<"Path::hitTest Picking at "<<x<<", "<<y<<" resulted in pick " <<*element_ix<< std::endl;
+      }
+#else
+      }
+#endif
+
+      return r_sq_min;
+    }
+
+    /**
+     * Free OpenGL resources
+     */
+    void cleanup(){
+      stream_.cleanup();
+      glDeleteVertexArrays(1, &vao);
+    }
+  };
+
+  /**
+   *
+   * A set of Sprites
+   *
+   */
+  struct Sprites : public Node{
+
+    GLuint vao = 0;
+
+    // Vertices are streamed, c.f. upload()
+    StreamBuffer stream_;
+
+    GLint positionHandle_ = -1;
+    GLint sizeHandle_ = -1;
+    GLint colorHandle_ = -1;
+
+    // Positions come from someone else's buffer (c.f. setup_shared_positions)
+    bool shared_positions_ = false;
+
+    // Maximum number of elements
+    int capacity_ = 0;
+    const static int stride_ = 8;
+
+    // Vertices for the path
+    float *data_;
+
+    // How many points do we have
+    int size = 0;
+
+    // How many are we drawing.
+    int draw_size = 0;
+
+    Sprites(int capacity) : capacity_(capacity){
+
+      data_ = new float[stride_ * capacity_];
+
+      for(int i = 0; i < stride_ * capacity_; ++i){
+        data_[i] = 0.0f;
+      }
+    }
+
+    ~Sprites(){
+      delete[] data_;
+    }
+
+    /**
+     * Sprites::init_resources
+     *
+     * @return
+     */
+    virtual bool init_resources(){
+      glGenVertexArrays(1, &vao);
+
+      if(!stream_.init_resources(GL_ARRAY_BUFFER, stride_ * capacity_ * sizeof(float))){
+        return false;
+      }
+
+      return check_GL_error("Path::init_resources() - exit");
+    }
+
+    void clear(){
+      size = draw_size = 0;
+    }
+
+    /**
+     * Sprites::setup_array
+     *
+     * @return
+     */
+    void setup_array(int positionHandle, int sizeHandle, int colorHandle){
+
+      positionHandle_ = positionHandle;
+      sizeHandle_ = sizeHandle;
+      colorHandle_ = colorHandle;
+      shared_positions_ = false;
+
+      point_arrays();
+
+      glBindVertexArray(vao);
+      glEnableVertexAttribArray(positionHandle);
+      glEnableVertexAttribArray(sizeHandle);
+      glEnableVertexAttribArray(colorHandle);
+
+      check_GL_error("Sprites::init_attribute() 4");
+    }
+
+    /**
+     * Sprites::point_arrays
+     *
+     *   Point the attributes at the region of stream_ that was written last
+     */
+    void point_arrays(){
+
+      const char *base = (const char *) stream_.offset();
+
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, stream_.buffer_);
+
+      if((positionHandle_ >= 0) && !shared_positions_){
+        glVertexAttribPointer(positionHandle_, 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), base);
+      }
+
+      // We've packed the normalized Temperature and normalized Irradiance into one 2 component attribute
+      if(sizeHandle_ >= 0){
+        glVertexAttribPointer(sizeHandle_, 1, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), base + 3 * sizeof(float));
+      }
+
+      if(colorHandle_ >= 0){
+        glVertexAttribPointer(colorHandle_ , 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), base + 4 * sizeof(float));
+      }
+    }
+
+    /**
+     * Sprites::setup_shared_positions
+     *
+     *   Take the sprite positions from another buffer, the size and color still
+     *   come from data_. Sprite i is at vertex first + i * step of the buffer,
+     *   each vertex being components floats.
+     *
+     * @param buffer
+     * @param positionHandle
+     * @param components 2 or 3
+     * @param first
+     * @param step
+     */
+    void setup_shared_positions(GLuint buffer, int positionHandle, int components, int first, int step){
+
+      shared_positions_ = true;
+
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+      glVertexAttribPointer(positionHandle, components, GL_FLOAT, GL_FALSE, step * components * sizeof(float),
+                            (void *) (first * components * sizeof(float)));
+      glEnableVertexAttribArray(positionHandle);
+
+      check_GL_error("Sprites::setup_shared_positions()");
+    }
+
+    /**
+     * Sprites::bind
+     *
+     * @return
+     */
+    void bind(){
+      glBindVertexArray(vao);
+    }
+
+    /**
+     * Sprites::addPoint
+     *
+     * @param radius Size of pixel
+     * @param r Color
+     *
+     * @return
+     */
+    bool addPoint(float x, float y, float z, float radius,
+                  float r, float g, float b, float a){
+
+      using namespace std;
+
+#if 0
+     std::cout<<" Sprites::addPoint Vertices "<<x<<", "<<y<<", "<<z
+              <<", "<<r<<", "<<g<<", "<<b<<", "<<a<<endl;
+#endif
+      int offset = stride_ * size;
+
+      if(size >= capacity_ ){
+        cerr<<"Sprites::addPoint: Not enough space to add vertex. capacity = "<<capacity_<<endl;
+        return false;
+      }
+
+      data_[offset] = x;
+      data_[offset + 1] = y;
+      data_[offset + 2] = z;
+
+      data_[offset + 3] = radius;
+
+      data_[offset + 4] = r;
+      data_[offset + 5] = g;
+      data_[offset + 6] = b;
+      data_[offset + 7] = a;
+
+      size += 1;
+
+      return true;
+    }
+
+    /**
+     * Sprites::upload
+     *
+     * Upload the data into the next region of stream_
+     */
+    void upload(){
+
+      check_GL_error("path::upload() - entry");
+//      std::cout<<"Sprites::addPoint Uploading Points "<<stride_ * size<<std::endl;
+
+      if(float *dst = (float *) stream_.map(stride_ * size * sizeof(float))){
+        std::copy(data_, data_ + stride_ * size, dst);
+        stream_.unmap();
+        point_arrays();
+      }
+
+      // Positions relative to the node (sprite sizes are in pixels and not included)
+      reset_bounds();
+
+      if(!shared_positions_){
+        grow_bounds(data_, size, stride_);
+      }
+
+      check_GL_error("path::upload() - exit");
+    }
+
+    /**
+     * Sprites::flush_upload
+     *
+     * @return
+     */
+    virtual size_t flush_upload(){
+      upload();
+      return stride_ * size * sizeof(float);
+    }
+
+    /**
+     * Sprites::upload_range
+     *
+     * Upload only the sprites [first, first + count) in place, they must not
+     * be drawn yet (i.e. first >= draw_size).
+     *
+     * @param first
+     * @param count
+     */
+    void upload_range(int first, int count){
+
+      if(count <= 0){
+        return;
+      }
+
+      if(float *dst = (float *) stream_.map_range(stride_ * first * sizeof(float), stride_ * count * sizeof(float))){
+        std::copy(data_ + stride_ * first, data_ + stride_ * (first + count), dst);
+        stream_.unmap();
+      }
+
+      if(!shared_positions_){
+        grow_bounds(data_ + stride_ * first, count, stride_);
+      }
+
+      check_GL_error("Sprites::upload_range() - exit");
+    }
+
+    /**
+     * Draw the path on screen
+     */
+    virtual void render(Camera<float>& camera_){
+#if 0
+      std::cout<<"Sprites::render: Drawing points "<<draw_size<<" of "<<size<<std::endl;
+#endif
+      glBindVertexArray(vao);
+      Sprites::draw(camera_);
+    }
+
+    virtual void draw(Camera<float>& camera_){
+      glDrawArrays(GL_POINTS, 0, draw_size);
+    }
+
+    /**
+     * Free OpenGL resources
+     */
+    void cleanup(){
+      stream_.cleanup();
+      glDeleteVertexArrays(1, &vao);
+    }
+
+  };
+
+
+  /**
+   *
+   *  A generic geometry class
+   *
+   */
+  struct Geometry : public Node{
+
+    // Shaders
+    std::string vert_shader = "./assets/shaders/default.vert";
+    std::string frag_shader = "./assets/shaders/default.frag";
+
+    //
+    GLenum mode = GL_LINES;
+
+    // Geometry Vertex Array and the streamed vertices
+    GLuint vao = 0;
+    StreamBuffer stream_;
+
+    // Program handle
+    GLuint program_;
+
+    // Position Attribute
+    GLint positionHandle_;
+    GLint colorHandle_;
+
+    GLint solidColorHandle_;
+
+    /**
+     * Data
+     */
+
+    float defaultColor_[4] = {1.0f, 0.0f, 1.0f, 1.0f};
+
+    float *verts_;
+
+    // Number of vertices
+    int count_ = 0;
+
+    int capacity_ = 0;
+
+    // Size of array in elements (attributes_per_vertex_ * line_count)
+    int size_ = 0;
+
+    // 3-position and 3-color
+    const static int stride_ = 7;
+
+    Geometry(int line_count)
+        : count_(0),
+          capacity_(2 * line_count),
+          size_(2 * stride_ * line_count){
+
+      std::cout<<"Creating Geometry object with size "<<size_<<std::endl;
+
+      verts_ = new float[size_];
+
+      for(int i = 0; i < size_; ++i){
+        verts_[i] = 0.0f;
+      }
+    }
+
+    ~Geometry(){
+      delete[] verts_;
+    }
+
+    /**
+     *
+     * Geometry::init_resources
+     *
+     */
+    virtual bool init_resources(){
+
+      std::cout<<"Geometry::init_resources"<<std::endl;
+
+      /**
+       * Build programs
+       */
+      program_ = glCreateProgram();
+
+      bool status = build_program(program_, "Geometry", vert_shader.c_str(), frag_shader.c_str());
+      if(!status){
+        return false;
+      }
+
+      positionHandle_ = glGetAttribLocation(program_, "position_in_");
+      colorHandle_ = glGetAttribLocation(program_, "color_in_");
+
+      solidColorHandle_ = glGetUniformLocation(program_, "solid_color_");
+
+      // Create the VBO and VAO indices
+      glGenVertexArrays(1, &vao);
+
+      if(!stream_.init_resources(GL_ARRAY_BUFFER, size_ * sizeof(float))){
+        return false;
+      }
+
+      point_arrays();
+
+      glBindVertexArray(vao);
+      glEnableVertexAttribArray(positionHandle_);
+
+      if(colorHandle_ > 0){
+        glEnableVertexAttribArray(colorHandle_);
+      }
+
+      glBindVertexArray(0);
+
+      return check_GL_error("Geometry::init_resources - exit");
+    }
+
+    /**
+     * Geometry::point_arrays
+     *
+     *   Point the attributes at the region of stream_ that was written last
+     */
+    void point_arrays(){
+
+      const char *base = (const char *) stream_.offset();
+
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, stream_.buffer_);
+
+      glVertexAttribPointer(positionHandle_, 3, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), base);
+
+      if(colorHandle_ > 0){
+        glVertexAttribPointer(colorHandle_, 4, GL_FLOAT, GL_FALSE, stride_ * sizeof(float), base + 3 * sizeof(float));
+      }
+
+      glBindVertexArray(0);
+    }
+
+    void clear(){
+      count_ = 0;
+    }
+
+    void cleanup(){
+      glDeleteVertexArrays(1, &vao);
+      stream_.cleanup();
+    }
+
+    /**
+     * Gometry::addPoint
+     *
+     * @param v A 3-array
+     */
+    void addPoint(float v[], float c[]){
+
+      int offset = stride_ * count_;
+
+      for(int i = 0; i < 3; ++i){
+        verts_[offset++ ] = v[i];
+      }
+
+      for(int i = 0; i < 4; ++i){
+        verts_[offset++] = c[i];
+      }
+      ++count_;
+    }
+
+    /**
+     *
+     * Geometry::upload
+     *
+     */
+    void upload(){
+#if 0
+      std::cout<<"Geometry::upload "<<count_<<" lines or "
+               <<2 * stride_ * count_ * sizeof(float)<<" bytes"<<std::endl;
+#endif
+      if(float *dst = (float *) stream_.map(stride_ * count_ * sizeof(float))){
+        std::copy(verts_, verts_ + stride_ * count_, dst);
+        stream_.unmap();
+        point_arrays();
+      }
+
+      check_GL_error("Geometry::upload exit ");
+    }
+
+    /**
+     * Geometry::flush_upload
+     *
+     * @return
+     */
+    virtual size_t flush_upload(){
+      upload();
+      return stride_ * count_ * sizeof(float);
+    }
+
+    /**
+     *
+     * Geometry::init_resources
+     *
+     */
+    virtual void render(Camera<float>& camera_){
+//      std::cout<<"Geometry::render() "<<count_<<std::endl;
+
+      glUseProgram(program_);
+      glUniform4fv(solidColorHandle_, 1, defaultColor_);
+
+
+      glBindVertexArray(vao);
+      glDrawArrays(GL_LINES, 0, count_);
+    }
+
+  };
+
+  /**
+   *  Programs
+   */
+  struct DefaultProgram{
+
+    // Program handle
+    GLuint program_;
+
+    // Position Attribute
+    GLuint positionHandle_;
+    GLuint colorHandle_;
+
+    DefaultProgram(){
+
+    }
+
+    /**
+     * Initialize resources
+     */
+    bool init_resources(){
+      program_ = glCreateProgram();
+
+      return true;
+    }
+
+    void cleanup(){
+      glDeleteProgram(program_);
+    }
+
+    bool build(){
+
+      const char *vertexShaderSource =
+          "#version 330\n"
+              "layout(std140) uniform FrameBlock {\n"
+              "  mat4 mvp_;\n"
+              "  mat4 mv_;\n"
+              "  mat4 p_;\n"
+              "  vec4 camera_eye_world_;\n"
+              "  vec4 camera_up_world_;\n"
+              "  vec4 camera_right_world_;\n"
+              "};\n"
+              "in vec3 position_in_;\n"
+              "in vec4 color_in_;\n"
+              "out vec4 color_ex;\n"
+              "void main() {\n"
+              "   color_ex = color_in_;\n"
+              "   gl_Position = p_ * mv_ * vec4(position_in_, 1.0);\n"
+              "}\n";
+
+      const char *fragmentShaderSource =
+          "#version 330\n"
+          "in vec4 color_ex;\n"
+              "out vec4 color_out_;\n"
+              "\n"
+              "void main() {\n"
+              "   color_out_ = color_ex;\n"
+              "}\n";
+
+      check_GL_error("DefaultProgram::build() exit 0 ");
+
+
+      bool status = build_program_from_source(program_,
+                                              "default",
+                                              vertexShaderSource,
+                                              fragmentShaderSource);
+      if(!status){
+        return false;
+      }
+
+      positionHandle_ = glGetAttribLocation(program_, "position");
+      colorHandle_ = glGetAttribLocation(program_, "position");
+
+      return check_GL_error("DefaultProgram::build() exit");
+    }
+
+  };
+
+
+  /**
+   * Program for drawing paths
+   */
+  struct PathProgram{
+
+    // Program handle
+    GLuint program_;
+
+    // Attributes
+    GLuint positionHandle_;
+
+    // Uniform handles
+    GLint colorHandle_;
+
+    /**
+     * Initialize resources
+     */
+    bool init_resources(){
+      program_ = glCreateProgram();
+
+      return true;
+    }
+
+    void cleanup(){
+      glDeleteProgram(program_);
+    }
+
+    bool build(){
+
+      const char *vertexShaderSource =
+          "#version 330\n"
+              "layout(std140) uniform FrameBlock {\n"
+              "  mat4 mvp_;\n"
+              "  mat4 mv_;\n"
+              "  mat4 p_;\n"
+              "  vec4 camera_eye_world_;\n"
+              "  vec4 camera_up_world_;\n"
+              "  vec4 camera_right_world_;\n"
+              "};\n"
+              "uniform vec4 color_ = vec4(1.0, 1.0, 1.0, 1.0);\n"
+              "in vec3 position;\n"
+              "out vec4 color_ex;\n"
+              "void main() {\n"
+              "   color_ex = color_;\n"
+              "   gl_Position = mvp_ * vec4(position, 1.0);\n"
+              "}\n";
+
+      const char *fragmentShaderSource =
+          "#version 330\n"
+              "in vec4 color_ex;\n"
+              "out vec4 color_out;\n"
+              "\n"
+              "void main() {\n"
+              "   color_out = color_ex;\n"
+              "}\n";
+
+
+
+      bool status = build_program_from_source(program_, "default",
+                                              vertexShaderSource,
+                                              fragmentShaderSource);
+
+      if(!status){
+        return false;
+      }
+
+      positionHandle_ = glGetAttribLocation(program_, "position");
+      colorHandle_ = glGetUniformLocation(program_, "color_");
+
+      return check_GL_error("PathProgram::build() exit");
+    }
+
+  };
+
+
+  /**
+   * Draw a sphere on a triangle
+   */
+  struct SphereProgram{
+
+    // Shaders
+    std::string vert_shader = "./assets/shaders/sphere.vert";
+    std::string frag_shader = "./assets/shaders/sphere.frag";
+
+    // Program handle
+    GLuint program_;
+
+    // Position Attribute
+    GLuint positionHandle_;
+
+    // The camera and the color, offset and radius come from uniform blocks
+    // (c.f. FrameUniforms, ObjectUniforms)
+
+    SphereProgram(){
+
+    }
+
+    /**
+     * Initialize resources
+     */
+    bool init_resources(){
+      program_ = glCreateProgram();
+
+      return true;
+    }
+
+    void cleanup(){
+      glDeleteProgram(program_);
+    }
+
+    bool build(){
+
+#if 0
+      const char *vert_source =
+          "#version 330\n"
+              "uniform mat4 mvp_;\n"
+              "uniform vec4 solid_color_ = vec4(1.0, 0.0, 1.0, 1.0);\n"
+              "uniform vec3 offset_ = vec3(0);\n"
+              "uniform float radius_ = 1.0f;\n"
+              "in vec3 position_;\n"
+              "out vec4 color_ex;\n"
+              "out vec2 coord_;\n"
+              "void main() {\n"
+              "   color_ex = solid_color_;\n"
+              "   coord_ = position_.xy / radius_;\n"
+              "   gl_Position = mvp_ * vec4(position_ + offset_, 1.0);\n"
+              "}\n";
+
+      const char *frag_source =
+          "#version 330\n"
+              "in vec2 coord_;\n"
+              "in vec4 color_ex;\n"
+              "out vec4 color_out;\n"
+              "\n"
+              "void main() {\n"
+              "float r = length(coord_);\n"
+              "if(r > 1.0){ discard; }\n"
+              "   color_out = color_ex;\n"
+              "}\n";
+
+      bool status = build_program_from_source(program_, "sphere", vert_source, frag_source);
+
+      if(!status){
+        return false;
+      }
+
+      positionHandle_ = glGetAttribLocation(program_, "position_");
+      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
+      colorHandle_ = glGetUniformLocation(program_, "solid_color_");
+      offsetHandle_ = glGetUniformLocation(program_, "offset_");
+      radiusHandle_ = glGetUniformLocation(program_, "radius_");
+
+#else
+
+      bool status = build_program(program_, "SpriteProgram",
+                                  vert_shader.c_str(), frag_shader.c_str());
+      if(!status){
+        return false;
+      }
+
+      positionHandle_ = glGetAttribLocation(program_, "position_in_");
+
+      return check_GL_error("SpriteProgram::build() exit");
+
+#endif
+      return check_GL_error("SphereProgram::build() exit");
+    }
+
+  };
+
+
+  /**
+   *
+   * Program for lots of individual sprites
+   *
+   */
+  struct SpriteProgram{
+
+    // Shaders
+    std::string vert_shader = "./assets/shaders/sprites.vert";
+    std::string frag_shader = "./assets/shaders/sprites.frag";
+
+    // Program handle
+    GLuint program_;
+
+    // Attributes
+    GLint positionHandle_;
+    GLint colorHandle_;
+
+    // Size of sprite in pixels
+    GLint sizeHandle_;
+
+    // Uniform handles
+    GLint offsetHandle_;
+
+    /**
+     * Initialize resources
+     */
+    bool init_resources(){
+      program_ = glCreateProgram();
+
+      return true;
+    }
+
+    void cleanup(){
+      glDeleteProgram(program_);
+    }
+
+    bool build(){
+
+      bool status = build_program(program_, "SpriteProgram",
+                                  vert_shader.c_str(), frag_shader.c_str());
+      if(!status){
+        return false;
+      }
+
+      positionHandle_ = glGetAttribLocation(program_, "position_in_");
+      colorHandle_ = glGetAttribLocation(program_, "color_in_");
+      sizeHandle_ = glGetAttribLocation(program_, "size_in_");
+
+      offsetHandle_ = glGetUniformLocation(program_, "offset_");
+
+      return check_GL_error("SpriteProgram::build() exit");
+    }
+
+  };
+
+  /**
+   * Manages a tiled set of images. Each image tile is the same size.
+   *
+   * Tile updates are staged in a pixel buffer object and copied into the texture
+   * by ImageAtlas::commit, which regenerates the mipmaps once for the whole batch.
+   * Renderers call commit before drawing so loading or re-drawing many tiles in
+   * a frame costs one mipmap rebuild.
+   *
+   */
+  struct ImageAtlas{
+
+    int tex_unit_ = 0;
+
+    int tile_width_ = 0;
+    int tile_height_ = 0;
+
+    // Texture Size
+    int tex_width_ = 0;
+    int tex_height_ = 0;
+
+    // How many tiles in each dimension
+    int tiles_x_ = 0;
+    int tiles_y_ = 0;
+
+    int capacity_ = 0;
+
+    int count_ = 0;
+
+    // Implementation limit (c.f. ImageAtlas::init_resources)
+    int max_texture_size_ = 0;
+
+    GLuint tex_;
+
+    // Staging buffer, tile i occupies bytes [i * tile_bytes(), (i + 1) * tile_bytes())
+    GLuint pbo_ = 0;
+
+    // Tiles staged in pbo_ that are not in the texture yet (c.f. ImageAtlas::commit)
+    std::vector<int> dirty_tiles_;
+    std::vector<bool> tile_dirty_;
+
+    /**
+     *
+     * Tiles are packaged tight. You are responsible for putting borders
+     *
+     * The tiles are arranged once the texture size limit is known (c.f.
+     * ImageAtlas::init_resources)
+     *
+     * @param tex_unit  Texture unit to use
+     * @param width
+     * @param height
+     * @param capacity Number of tiles
+     * @return
+     */
+    ImageAtlas(int tex_unit, int tile_width, int tile_height, int capacity)
+        : tex_unit_(tex_unit),
+          tile_width_(tile_width), tile_height_(tile_height),
+          capacity_(std::max(1, capacity)){
+
+      tile_dirty_.assign(capacity_, false);
+    }
+
+    ImageAtlas(int tex_unit, int tile_width, int tile_height, int tiles_x, int tiles_y)
+        : tex_unit_(tex_unit),
+          tile_width_(tile_width), tile_height_(tile_height),
+          tex_width_(tiles_x * tile_width), tex_height_(tiles_y * tile_height),
+          tiles_x_(tiles_x), tiles_y_(tiles_y),
           capacity_(tiles_x * tiles_y){
 
+      tile_dirty_.assign(capacity_, false);
+
+      std::cout<<"ImageAtlas::constructor:: "<<std::endl
+               <<"ImageAtlas:: Unit : "<<tex_unit_<<std::endl
+               <<"ImageAtlas:: Tiles : "<<tiles_x_<<" x "<<tiles_y_<<std::endl
+               <<"ImageAtlas:: Capacity : "<<capacity_<<"  tiles."<<std::endl
+               <<"ImageAtlas:: Size : "<<tile_width<<" x "<<tile_height<<std::endl
+               <<"ImageAtlas:: Texture : "<<tex_width_<<" x "<<tex_height_<<std::endl;
+    }
+
+    /**
+     * ImageAtlas::init_resources
+     *
+     * @return
+     */
+    virtual bool init_resources() {
+
+      glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size_);
+
+      if(tile_width_ > max_texture_size_ || tile_height_ > max_texture_size_){
+        std::cerr<<"ImageAtlas::init_resources: Tiles "<<tile_width_<<" x "<<tile_height_
+                 <<" larger than GL_MAX_TEXTURE_SIZE "<<max_texture_size_<<std::endl;
+        return false;
+      }
+
+      if(tiles_x_ == 0){
+        layout();
+      }else if(tex_width_ > max_texture_size_ || tex_height_ > max_texture_size_){
+        std::cerr<<"ImageAtlas::init_resources: Texture "<<tex_width_<<" x "<<tex_height_
+                 <<" larger than GL_MAX_TEXTURE_SIZE "<<max_texture_size_<<std::endl;
+        return false;
+      }
+
+      std::cout<<"ImageAtlas::init_resources "<<tiles_x_<<" x "<<tiles_y_<<" tiles of "
+               <<tile_width_<<" x "<<tile_height_<<", texture "<<tex_width_<<" x "<<tex_height_
+               <<" (max "<<max_texture_size_<<") on unit "<<tex_unit_<<std::endl;
+
+      // Create the textures we need
+      glGenTextures(1, &tex_);
+
+      glActiveTexture(GL_TEXTURE0 + tex_unit_);
+      glBindTexture(GL_TEXTURE_2D, tex_);
+      glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+      // These have to be after the load or it doesn't work.
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width_, tex_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+//      std::cout<<"Creating texture with size "<<tex_width_<<" x "<<tex_height_<<" on unit "<<tex_unit_<<std::endl;
+
+      clear();
+      glGenerateMipmap(GL_TEXTURE_2D);
+
+      glGenBuffers(1, &pbo_);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity_ * tile_bytes(), nullptr, GL_STREAM_DRAW);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      return check_GL_error("ImageAtlas::init_resources() exit");
+    }
+
+    /**
+     * ImageAtlas::layout
+     *
+     * Arrange capacity_ tiles in a roughly square texture within
+     * GL_MAX_TEXTURE_SIZE, capacity_ is cut down if they don't fit
+     */
+    void layout(){
+
+      using namespace std;
+
+      int tiles_x_max = max_texture_size_ / tile_width_;
+      int tiles_y_max = max_texture_size_ / tile_height_;
+
+      tiles_x_ = int(ceil(sqrt(capacity_ * tile_height_ / double(tile_width_))));
+      tiles_x_ = max(1, min(min(tiles_x_, capacity_), tiles_x_max));
+
+      tiles_y_ = (capacity_ + tiles_x_ - 1) / tiles_x_;
+
+      if(tiles_y_ > tiles_y_max){
+        tiles_y_ = tiles_y_max;
+
+        std::cerr<<"ImageAtlas::layout: Only "<<tiles_x_ * tiles_y_<<" of "<<capacity_
+                 <<" tiles fit in GL_MAX_TEXTURE_SIZE "<<max_texture_size_<<std::endl;
+
+        capacity_ = tiles_x_ * tiles_y_;
+        tile_dirty_.assign(capacity_, false);
+      }
+
+      tex_width_ = tile_width_ * tiles_x_;
+      tex_height_ = tile_height_ * tiles_y_;
+    }
+
+    /**
+     * ImageAtlas::clear
+     *
+     * Clear the base level to transparent by rendering into it, GL 3.3 has no
+     * glClearTexImage and this avoids a zero filled copy of the whole texture.
+     */
+    void clear(){
+
+      GLint framebuffer = 0;
+      GLfloat clear_color[4];
+      GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+      glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+      glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+
+      GLuint fbo = 0;
+      glGenFramebuffers(1, &fbo);
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+      glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_, 0);
+
+      glDisable(GL_SCISSOR_TEST);
+      glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+      glClear(GL_COLOR_BUFFER_BIT);
+
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+      glDeleteFramebuffers(1, &fbo);
+
+      glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+
+      if(scissor){
+        glEnable(GL_SCISSOR_TEST);
+      }
+    }
+
+    int tile_bytes() const {
+      return 4 * tile_width_ * tile_height_;
+    }
+
+    /**
+     * ImageAtlas::bind
+     *
+     */
+    void bind(){
+      glBindTexture(GL_TEXTURE_2D, tex_);
+    }
+
+    void cleanup() {
+      glDeleteTextures(1, &tex_);
+      glDeleteBuffers(1, &pbo_);
+
+      dirty_tiles_.clear();
+      tile_dirty_.assign(capacity_, false);
+    }
+
+    /**
+     * ImageAtlas::get_tile_coordinates
+     *
+     * Get the texture coordinates that reference the given tile
+     *
+     * @param index
+     * @param tex_uv  (u_0, v_0, u_1, v_1),
+     */
+    void get_tile_coordinates(int index, float tex_uv[]){
+
+      if(count_ <= 0){
+        std::cerr<<"ImageAtlas::get_tile_coordinates: No tiles"<<std::endl;
+        return;
+      }
+
+      // TODO: Factor out
+      float tex_dx = 1.0f / float(tiles_x_);
+      float tex_dy = 1.0f / float(tiles_y_);
+
+      int tile_index = index % count_;
+      int ix = tile_index % tiles_x_;
+      int iy = tile_index / tiles_x_;
+
+      tex_uv[0] = ix * tex_dx;
+      tex_uv[1] = (iy + 1) * tex_dy;
+
+      tex_uv[2] = (ix + 1) * tex_dx;
+      tex_uv[3] = iy * tex_dy;
+    }
+
+    /**
+     *
+     * ImageAtlas::add_tile
+     *
+     * @return Index of the new tile, -1 if the atlas is full
+     */
+    int add_tile(){
+
+      if(count_ >= capacity_){
+        std::cerr<<"ImageAtlas::add_tile: Can't add new tile because atlas is at capacity "<<count_<<"/"<<capacity_<<std::endl;
+        return -1;
+      }
+
+      int index = count_;
+      ++count_;
+
+      return index;
+    }
+
+    /**
+     * ImageAtlas::add_tile
+     *
+     * Add a new tile
+     *
+     * @param index
+     * @param buffer
+     * @return
+     */
+    int add_tile(const unsigned char *buffer){
+
+      int index = add_tile();
+
+ //     std::cout<<"ImageAtlas::add_tile "<<index<<std::endl;
+
+      if(index >= 0){
+        update_tile(index, buffer);
+      }
+
+      return index;
+    }
+
+    /**
+     * ImageAtlas::update_tile
+     *
+     *
+     * @param index
+     * @param buffer
+     * @return
+     */
+    bool update_tile(int index, const unsigned char *buffer){
+
+//      std::cout<<"ImageAtlas::update_tile "<<index<<std::endl;
+
+      if(index < 0 || index >= count_){
+        std::cerr<<"ImageAtlas::update_tile :  Index "<<index<<" out of range  "<<capacity_<<std::endl;
+        return false;
+      }
+
+      int tile_x = index % tiles_x_;
+      int tile_y = index / tiles_x_;
+
+      return upload_tile(tile_x, tile_y, buffer);
+    }
+
+
+    /**
+     *
+     * ImageAtlas::upload_tile
+     *
+     * Stage a tile in the pixel buffer, the buffer is copied so the caller can
+     * reuse it right away. The texture is updated by the next ImageAtlas::commit.
+     *
+     * @param tile_x
+     * @param tile_y
+     * @param buffer RGBA tile_width_ x tile_height_
+     */
+    bool upload_tile(int tile_x, int tile_y, const void *buffer){
+
+      check_GL_error("ImageAtlas::upload_tile() entry");
+
+  //    std::cout<<"ImageAtlas::Upload_tile "<<tile_x<<", "<<tile_y<<std::endl;
+
+      if(!((tile_x < tiles_x_) && (tile_y < tiles_y_))){
+
+        std::cerr<<" col or row is out of range "<<tile_x<<" of "<<tiles_x_
+                 <<" "<<tile_y<<" of "<<tiles_y_<<std::endl;
+        return false;
+      }
+
+      int index = tile_y * tiles_x_ + tile_x;
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+
+      // First tile of a batch, orphan the buffer so we don't wait for the last transfer
+      if(dirty_tiles_.empty()){
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity_ * tile_bytes(), nullptr, GL_STREAM_DRAW);
+      }
+
+      glBufferSubData(GL_PIXEL_UNPACK_BUFFER, index * tile_bytes(), tile_bytes(), buffer);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      if(!tile_dirty_[index]){
+        tile_dirty_[index] = true;
+        dirty_tiles_.push_back(index);
+      }
+
+      return check_GL_error("ImageAtlas::upload_tile() exit");
+    }
+
+    /**
+     *
+     * ImageAtlas::commit
+     *
+     * Copy the staged tiles into the texture and rebuild the mipmaps once. Does
+     * nothing when no tile has changed, call it once per frame before drawing.
+     *
+     */
+    void commit(){
+
+      if(dirty_tiles_.empty()){
+        return;
+      }
+
+      check_GL_error("ImageAtlas::commit() entry");
+
+      GLint active_texture = GL_TEXTURE0;
+      glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
+
+      glActiveTexture(GL_TEXTURE0 + tex_unit_);
+      glBindTexture(GL_TEXTURE_2D, tex_);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+
+      for(int index : dirty_tiles_){
+        int x = (index % tiles_x_) * tile_width_;
+        int y = (index / tiles_x_) * tile_height_;
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tile_width_, tile_height_,
+                        GL_RGBA, GL_UNSIGNED_BYTE, (void *) (size_t(index) * tile_bytes()));
+
+        tile_dirty_[index] = false;
+      }
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      glGenerateMipmap(GL_TEXTURE_2D);
+
+      glActiveTexture(active_texture);
+
+#if 0
+      std::cout<<"ImageAtlas::commit "<<dirty_tiles_.size()<<" tiles on unit "<<tex_unit_<<std::endl;
+#endif
+      dirty_tiles_.clear();
+
+      check_GL_error("ImageAtlas::commit() exit");
+    }
+
+    /**
+     *
+     */
+    void save_atlas(const char *filename) {
+
+      using namespace std;
+
+      commit();
+      ImageAtlas::save_atlas(tex_, tex_width_, tex_height_, filename);
+    }
+
+    static void save_atlas(GLuint tex, int width, int height, const char *filename) {
+      QImage img(width, height, QImage::Format_RGBA8888);
+
+      check_GL_error("ImageAtlas::save_atlas() entry");
+
+      glBindTexture(GL_TEXTURE_2D, tex);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
+
+      std::cout << "ImageAtlas::save_atlas - Writing image of size " << width << " by " << height
+                << " filename " << filename << std::endl;
+
+      img.save(filename);
+    }
+
+  };
+
+  /**
+   * Image tiles stored one per layer of a GL_TEXTURE_2D_ARRAY. Unlike ImageAtlas
+   * tiles don't share a texture so their mipmaps never bleed into each other,
+   * and the atlas grows by adding layers instead of running out of room.
+   *
+   * Each tile is addressed by its layer and the full (0, 1) UV square (c.f.
+   * ImageArrayAtlas::get_tile_coordinates), shaders sample it with a
+   * sampler2DArray. Updates are staged and committed like ImageAtlas.
+   *
+   * GL 3.3 only guarantees 256 layers, when more tiles are asked for than
+   * the implementation has layers they are packed several to a layer in a
+   * grid like ImageAtlas (c.f. ImageArrayAtlas::init_resources).
+   *
+   */
+  struct ImageArrayAtlas{
+
+    int tex_unit_ = 0;
+
+    int tile_width_ = 0;
+    int tile_height_ = 0;
+
+    // Allocated tiles and used tiles
+    int capacity_ = 0;
+    int count_ = 0;
+
+    // Allocated layers
+    int layers_ = 0;
+
+    // Tiles in each layer
+    int tiles_x_ = 1;
+    int tiles_y_ = 1;
+
+    // Implementation limits (c.f. ImageArrayAtlas::init_resources)
+    int max_texture_size_ = 0;
+    int max_layers_ = 0;
+
+    GLuint tex_ = 0;
+
+    // Staging buffer, tile i occupies bytes [i * tile_bytes(), (i + 1) * tile_bytes())
+    GLuint pbo_ = 0;
+
+    // Tiles staged in pbo_ that are not in the texture yet (c.f. ImageArrayAtlas::commit)
+    std::vector<int> dirty_tiles_;
+    std::vector<bool> tile_dirty_;
+
+    /**
+     *
+     * @param tex_unit  Texture unit to use
+     * @param tile_width
+     * @param tile_height
+     * @param capacity Initial number of tiles, more are added as needed
+     */
+    ImageArrayAtlas(int tex_unit, int tile_width, int tile_height, int capacity)
+        : tex_unit_(tex_unit),
+          tile_width_(tile_width), tile_height_(tile_height),
+          capacity_(std::max(1, capacity)){
+    }
+
+    /**
+     * ImageArrayAtlas::init_resources
+     *
+     * @return
+     */
+    bool init_resources(){
+
+      check_GL_error("ImageArrayAtlas::init_resources() entry");
+
+      glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size_);
+      glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers_);
+
+      if(tile_width_ > max_texture_size_ || tile_height_ > max_texture_size_){
+        std::cerr<<"ImageArrayAtlas::init_resources: Tiles "<<tile_width_<<" x "<<tile_height_
+                 <<" larger than GL_MAX_TEXTURE_SIZE "<<max_texture_size_<<std::endl;
+        return false;
+      }
+
+      // One tile per layer unless that would run out of layers
+      int per_layer = (capacity_ + max_layers_ - 1) / max_layers_;
+
+      tiles_x_ = std::max(1, std::min(per_layer, max_texture_size_ / tile_width_));
+      tiles_y_ = std::max(1, std::min((per_layer + tiles_x_ - 1) / tiles_x_, max_texture_size_ / tile_height_));
+
+      layers_ = std::min(max_layers_, (capacity_ + tiles_per_layer() - 1) / tiles_per_layer());
+      capacity_ = layers_ * tiles_per_layer();
+
+      std::cout<<"ImageArrayAtlas::init_resources "<<tile_width_<<" x "<<tile_height_<<", "
+               <<tiles_x_<<" x "<<tiles_y_<<" per layer, "<<layers_<<" layers"
+               <<" (max layers "<<max_layers_<<", max size "<<max_texture_size_<<") on unit "<<tex_unit_<<std::endl;
+
+      tex_ = allocate(layers_);
+
+      glGenBuffers(1, &pbo_);
+      allocate_staging();
+
+      return check_GL_error("ImageArrayAtlas::init_resources() exit");
+    }
+
+    void cleanup(){
+      glDeleteTextures(1, &tex_);
+      glDeleteBuffers(1, &pbo_);
+
+      dirty_tiles_.clear();
+      tile_dirty_.assign(capacity_, false);
+    }
+
+    void bind(){
+      glActiveTexture(GL_TEXTURE0 + tex_unit_);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, tex_);
+    }
+
+    int tile_bytes() const {
+      return 4 * tile_width_ * tile_height_;
+    }
+
+    int tiles_per_layer() const {
+      return tiles_x_ * tiles_y_;
+    }
+
+    int layer_width() const {
+      return tiles_x_ * tile_width_;
+    }
+
+    int layer_height() const {
+      return tiles_y_ * tile_height_;
+    }
+
+    /**
+     * ImageArrayAtlas::get_tile_coordinates
+     *
+     * @param index
+     * @param tex_uv (u_0, v_0, u_1, v_1)
+     * @return The layer holding the tile
+     */
+    int get_tile_coordinates(int index, float tex_uv[]) const {
+
+      tex_uv[0] = 0.0f;
+      tex_uv[1] = 1.0f;
+      tex_uv[2] = 1.0f;
+      tex_uv[3] = 0.0f;
+
+      if(count_ <= 0){
+        std::cerr<<"ImageArrayAtlas::get_tile_coordinates: No tiles"<<std::endl;
+        return 0;
+      }
+
+      int tile = index % count_;
+      int cell = tile % tiles_per_layer();
+
+      float tex_dx = 1.0f / float(tiles_x_);
+      float tex_dy = 1.0f / float(tiles_y_);
+
+      int ix = cell % tiles_x_;
+      int iy = cell / tiles_x_;
+
+      tex_uv[0] = ix * tex_dx;
+      tex_uv[1] = (iy + 1) * tex_dy;
+      tex_uv[2] = (ix + 1) * tex_dx;
+      tex_uv[3] = iy * tex_dy;
+
+      return tile / tiles_per_layer();
+    }
+
+    /**
+     * ImageArrayAtlas::add_tile
+     *
+     * @return Index of the new tile, -1 if the implementation is out of layers
+     */
+    int add_tile(){
+
+      if(count_ >= capacity_ && !grow(std::min(2 * layers_, max_layers_))){
+        std::cerr<<"ImageArrayAtlas::add_tile: Out of layers "<<count_<<"/"<<max_layers_<<std::endl;
+        return -1;
+      }
+
+      return count_++;
+    }
+
+    int add_tile(const unsigned char *buffer){
+
+      int index = add_tile();
+
+      if(index >= 0){
+        update_tile(index, buffer);
+      }
+
+      return index;
+    }
+
+    /**
+     * ImageArrayAtlas::update_tile
+     *
+     * Stage a tile, the texture is updated by the next ImageArrayAtlas::commit
+     *
+     * @param index
+     * @param buffer RGBA tile_width_ x tile_height_
+     * @return
+     */
+    bool update_tile(int index, const unsigned char *buffer){
+
+      if(index < 0 || index >= count_){
+        std::cerr<<"ImageArrayAtlas::update_tile :  Index "<<index<<" out of range  "<<count_<<std::endl;
+        return false;
+      }
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+
+      // First tile of a batch, orphan the buffer so we don't wait for the last transfer
+      if(dirty_tiles_.empty()){
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity_ * tile_bytes(), nullptr, GL_STREAM_DRAW);
+      }
+
+      glBufferSubData(GL_PIXEL_UNPACK_BUFFER, index * tile_bytes(), tile_bytes(), buffer);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      if(!tile_dirty_[index]){
+        tile_dirty_[index] = true;
+        dirty_tiles_.push_back(index);
+      }
+
+      return check_GL_error("ImageArrayAtlas::update_tile() exit");
+    }
+
+    /**
+     * ImageArrayAtlas::commit
+     *
+     * Copy the staged tiles into their layers and rebuild the mipmaps once
+     */
+    void commit(){
+
+      if(dirty_tiles_.empty()){
+        return;
+      }
+
+      GLint active_texture = GL_TEXTURE0;
+      glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
+
+      bind();
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+
+      for(int index : dirty_tiles_){
+        int cell = index % tiles_per_layer();
+        int x = (cell % tiles_x_) * tile_width_;
+        int y = (cell / tiles_x_) * tile_height_;
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, index / tiles_per_layer(), tile_width_, tile_height_, 1,
+                        GL_RGBA, GL_UNSIGNED_BYTE, (void *) (size_t(index) * tile_bytes()));
+
+        tile_dirty_[index] = false;
+      }
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+      glActiveTexture(active_texture);
+
+      dirty_tiles_.clear();
+
+      check_GL_error("ImageArrayAtlas::commit() exit");
+    }
+
+    /**
+     * ImageArrayAtlas::grow
+     *
+     * Reallocate with more layers and copy the existing ones over on the GPU
+     *
+     * @param layers
+     * @return
+     */
+    bool grow(int layers){
+
+      if(layers <= layers_){
+        return false;
+      }
+
+      check_GL_error("ImageArrayAtlas::grow() entry");
+
+      // Staged tiles are addressed by layer in pbo_
+      commit();
+
+      GLint active_texture = GL_TEXTURE0;
+      GLint read_framebuffer = 0;
+
+      glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
+      glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+
+      GLuint tex = allocate(layers);
+
+      GLuint fbo = 0;
+      glGenFramebuffers(1, &fbo);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+
+      int used_layers = (count_ + tiles_per_layer() - 1) / tiles_per_layer();
+
+      for(int layer = 0; layer < used_layers; ++layer){
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_, 0, layer);
+        glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, 0, 0, layer_width(), layer_height());
+      }
+
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+      glDeleteFramebuffers(1, &fbo);
+      glDeleteTextures(1, &tex_);
+
+      glActiveTexture(active_texture);
+
+      std::cout<<"ImageArrayAtlas::grow "<<layers_<<" -> "<<layers<<" layers"<<std::endl;
+
+      tex_ = tex;
+      layers_ = layers;
+      capacity_ = layers_ * tiles_per_layer();
+      allocate_staging();
+
+      return check_GL_error("ImageArrayAtlas::grow() exit");
+    }
+
+    /**
+     * Create a texture array with the given number of layers, it's left bound
+     * on tex_unit_
+     *
+     * @param layers
+     * @return
+     */
+    GLuint allocate(int layers){
+
+      GLuint tex = 0;
+
+      glGenTextures(1, &tex);
+      glActiveTexture(GL_TEXTURE0 + tex_unit_);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, layer_width(), layer_height(), layers, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+      return tex;
+    }
+
+    void allocate_staging(){
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity_ * tile_bytes(), nullptr, GL_STREAM_DRAW);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      tile_dirty_.assign(capacity_, false);
+    }
+
+    /**
+     * Write all the layers, top to bottom, into one image
+     *
+     * @param filename
+     */
+    void save_atlas(const char *filename) {
+
+      commit();
+
+      QImage img(layer_width(), layer_height() * layers_, QImage::Format_RGBA8888);
+
+      check_GL_error("ImageArrayAtlas::save_atlas() entry");
+
+      bind();
+      glPixelStorei(GL_PACK_ALIGNMENT, 4);
+      glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
+
+      std::cout << "ImageArrayAtlas::save_atlas - Writing " << layers_ << " layers to " << filename << std::endl;
+
+      img.save(filename);
+    }
+  };
+
+  /**
+   * Draw a full screen image
+   */
+  struct FullScreenImage : public FlatShape{
+
+    /**
+     * Settings
+     */
+
+    // Shaders
+    std::string vert_shader = "./assets/shaders/identity.vert";
+    std::string frag_shader = "./assets/shaders/background.frag";
+
+    /**
+     * Data
+     */
+    // Program handle
+    GLuint program_ = 0;
+
+    // Position Attribute
+    GLint positionHandle_ = 0;
+
+    GLint backgroundHandle_ = 0;
+    GLint backgroundAlpha_ = 0;
+    GLint backgroundTime_ = 0;
+    GLint backgroundScale_ = 0;
+
+    // Background texture
+    GLuint tex_ = 0;
+
+
+    /**
+     * Texture
+     */
+    int tex_unit_ = 0;
+
+    int tex_width_ = 0;
+    int tex_height_ = 0;
+    int layers_ = 0;
+
+    float alpha_ = 0.0f;
+    float time_ = 0.0f;
+
+    // Scale of quad
+    float scale_[3] = {1.0f, 1.0f, 1.0f};
+
+    FullScreenImage(int texture_unit, int tex_width, int tex_height, int tex_depth)
+        : tex_unit_(texture_unit), tex_width_(tex_width), tex_height_(tex_height),
+          layers_(tex_depth){
+
+    }
+
+    /**
+     *
+     * @return
+     */
+    bool init_resources(){
+
+      std::cout<<"FullScreenImage::init_resources"<<std::endl;
+
+      /**
+       * Build programs
+       */
+      program_ = glCreateProgram();
+
+      bool status = build_program(program_, "FullScreenImage",
+                                  vert_shader.c_str(), frag_shader.c_str());
+      if(!status){
+        return false;
+      }
+
+      positionHandle_ = glGetAttribLocation(program_, "position_in_");
 
+      backgroundHandle_ = glGetUniformLocation(program_, "background_");
+      backgroundAlpha_ = glGetUniformLocation(program_, "background_alpha_");
+      backgroundTime_ = glGetUniformLocation(program_, "background_time_");
+      backgroundScale_ = glGetUniformLocation(program_, "scale_");
 
-      std::cout<<"ImageAtlas::constructor:: "<<std::endl
-               <<"ImageAtlas:: Unit : "<<tex_unit_<<std::endl
-               <<"ImageAtlas:: Tiles : "<<tiles_x_<<" x "<<tiles_y_<<std::endl
-               <<"ImageAtlas:: Capacity : "<<capacity_<<"  tiles."<<std::endl
-               <<"ImageAtlas:: Size : "<<tile_width<<" x "<<tile_height<<std::endl
-               <<"ImageAtlas:: Texture : "<<tex_width_<<" x "<<tex_height_<<std::endl;
+      /**
+       * Initialize textures
+       */
+      // Create the textures we need
+      glGenTextures(1, &tex_);
+
+      glActiveTexture(GL_TEXTURE0 + tex_unit_);
+      glBindTexture(GL_TEXTURE_3D, tex_);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+      // These have to be after the load or it doesn't work.
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+      glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, tex_width_, tex_height_, layers_,
+                   0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+      /**
+       * Create geometry
+       */
+      FlatShape::init_resources();
+      FlatShape::setup_array(positionHandle_);
+      FlatShape::build_triangle(2.0);
+
+//      enable(true);
+
+      return check_GL_error("FullScreenImage::init_resources() exit");
+    }
+
+    /**
+     * FullScreenImage::cleanup
+     *
+     *  Free OpenGL resources
+     *
+     */
+    void cleanup(){
+      glDeleteProgram(program_);
+      glDeleteTextures(1, &tex_);
+    }
+
+    void setScaleFromAspect(float aspect){
+      scale_[0] = 1.0f;
+      scale_[1] = aspect;
+    }
+
+    /**
+     * FullScreenImage::load_image
+     *
+     * Load a slice into the 3d texture
+     *
+     */
+    void upload_slice(int layer, const void *buffer){
+
+      check_GL_error("FullScreenImage::upload_slice() entry");
+
+      if(layer > layers_){
+        std::cerr<<" FullScreenImage::upload_slice(): layer "<<layer<<" out of range "<<std::endl;
+        return;
+      }
+#if 0
+      std::cout<<"FullScreenImage::upload_slice(): Uploading image of size "<<tex_width_
+               <<", "<<tex_height_<<" on layer "<<layer+1<<" of "<<layers_<<std::endl;
+#endif
+      glBindTexture(GL_TEXTURE_3D, tex_);
+      glTexSubImage3D(GL_TEXTURE_3D, 0,
+                      0, 0, layer,
+                      tex_width_, tex_height_, 1,
+                      GL_RGBA, GL_UNSIGNED_BYTE, buffer);
+
+      glGenerateMipmap(GL_TEXTURE_3D);
+
+      check_GL_error("FullScreenImage::upload_slice() exit");
+    }
+
+    /**
+     * FullScreenImage::render
+     *
+     * @param camera
+     */
+    virtual void render(Camera<float>& camera){
+      // Draw
+      glUseProgram(program_);
+
+      glUniform1i(backgroundHandle_, tex_unit_);
+      glUniform1f(backgroundAlpha_, alpha_);
+      glUniform1f(backgroundTime_, time_);
+      glUniform3fv(backgroundScale_, 1, scale_);
+
+      FlatShape::bind();
+      FlatShape::render(camera);
+
+      check_GL_error("FullScreenImage::render()");
+    }
+  };
+
+  /**
+   *
+   * Responsible for displaying a set of textured quads (TODO: or triangles?)
+   * where each quad's texture is a tile from a texture atlas.
+   *
+   * Each quad is represented by 2 triangles and the quad has it's center at the origin.
+   * This can be used for drawing a whole bunch of galaxies or
+   * texture labels.
+
+   *
+   * There are essentially three potential ways for specifying the data for the quads.
+   *
+   *  1. Vertex and texture data completely and make any changes on the CPU
+   *  2. Fixed vertex and texture data + custom MV matrix for each billboard
+   *  3. Fixed vertex and texture data + individual components like rotation, scale, offset and have GLSL create matrices
+   *
+   *  Approach 1 would almost be simplest and will perform just fine in most cases.
+   *
+   *  Approach 2 seems sort of the best compromise but it's weird and tricky to submit matrices as attribute.
+   *
+   *  Approach 3 seems computationally wasteful but it should be a bit easier to code up.
+   *
+   *
+   * Doing Approach 3
+   *
+   * Each billboard is one instance record (position, rotation, scale, texture rectangle, layer
+   * and color) and the vertex shader expands it into a 4 vertex triangle strip from gl_VertexID,
+   * c.f. billboard_set.vert and galaxy_set.vert. Only count_ records are uploaded.
+   *
+   */
+
+  struct BillboardSet : public msg::Node {
+
+    // Quad dimensions
+    float quad_width_ = 0.1f;
+    float quad_height_ = 0.1f;
+
+    // Global transparancy of the billboards
+    float global_opacity_ = 1.0f;
+
+    // Maximum number of billboards
+    int capacity_ = 0;
+
+    // Floats per instance record (2 position, 3 rotation and scale, 4 texture, 1 layer, 4 color)
+    const static int attributes_per_board_ = 14;
+
+    // Attribute indices, the layer is for ImageArrayAtlas
+    const static int ix_position_ = 0;
+    const static int ix_transform_ = 2;
+    const static int ix_texture_ = 5;
+    const static int ix_layer_ = 9;
+    const static int ix_color_ = 10;
+
+    // Number of billboards in array
+    int count_ = 0;
+
+    int atlas_tex_unit_ = 0;
+
+    // TODO: This can be uploaded directly if we are a bit clever with offsets
+    struct s_billboard{
+      float position[3];
+      float rotation;
+      float scale[2];
+      float tex[4];
+      // Texture array layer (c.f. ImageArrayAtlas)
+      float layer = 0.0f;
+      float color[4] = {1.0f, 0.0f, 0.0f, 1.0f};
+
+      bool enabled;
+
+    } *info_;
+
+    // Size of the packed instance records in floats
+    int data_size_ = 0;
+
+    // Shaders
+    std::string vert_shader = "./assets/shaders/billboard_set.vert";
+    std::string frag_shader = "./assets/shaders/billboard_set.frag";
+
+    // Program handle
+    GLint program_;
+
+    // Attributes
+    GLint positionHandle_;
+    GLint transformHandle_;
+    GLint textureHandle_;
+    GLint layerHandle_;
+    GLint colorHandle_;
+
+    // Uniform handles, the camera comes from the FrameBlock
+    GLint samplerHandle_;
+    GLint opacityHandle_;
+    GLint quadSizeHandle_;
+
+    GLuint vao = 0;
+
+    // Instance records are packed straight into the mapped buffer
+    StreamBuffer stream_;
+
+    // Billboards outside of this camera's view are not uploaded (null uploads all)
+    const Camera<float> *cull_camera_ = nullptr;
+
+    // Number of billboards in stream_, i.e. drawn
+    int drawn_ = 0;
+
+    BillboardSet(int max_billboards)
+        : capacity_(max_billboards){
+
+      info_ = new s_billboard[max_billboards];
+
+      for(int i = 0; i < max_billboards; ++i){
+        info_[i].enabled = false;
+        info_[i].position[0] = 0.0f;
+        info_[i].position[1] = 0.0f;
+        info_[i].position[2] = 0.0f;
+        info_[i].rotation = 0.0f;
+        info_[i].scale[0] = 1.0f;
+        info_[i].scale[1] = 1.0f;
+      }
+
+      data_size_ = attributes_per_board_ * capacity_ ;
+    }
+
+    ~BillboardSet(){
+      delete[] info_;
+    }
+
+
+    /**
+     * BillboardSet init_resources
+     *
+     * @return
+     */
+    bool init_resources(){
+//      std::cout<<"BillboardSet::init_resources()"<<std::endl;
+
+      check_GL_error("BillboardSet::init_resources() entry");
+
+      program_ = glCreateProgram();
+
+      // Build programs
+      if(!build_program(program_, "BillboardSet", vert_shader.c_str(), frag_shader.c_str())){
+        return false;
+      }
+      check_GL_error("BillboardSet::init_resources() 1");
+
+ //     std::cout<<"program_ "<<program_<<std::endl;
+
+      // Per instance properties
+      positionHandle_ = glGetAttribLocation(program_, "position_in_");
+      transformHandle_ = glGetAttribLocation(program_, "transform_in_");
+      textureHandle_ = glGetAttribLocation(program_, "tex_in_");
+      layerHandle_ = glGetAttribLocation(program_, "layer_in_");
+      colorHandle_ = glGetAttribLocation(program_, "color_in_");
+
+      samplerHandle_ = glGetUniformLocation(program_, "atlas_");
+      opacityHandle_ = glGetUniformLocation(program_, "global_alpha_");
+      quadSizeHandle_ = glGetUniformLocation(program_, "quad_size_");
+
+      glGenVertexArrays(1, &vao);
+
+      if(!stream_.init_resources(GL_ARRAY_BUFFER, data_size_ * sizeof(float))){
+        return false;
+      }
+
+      point_arrays();
+
+      glBindVertexArray(vao);
+
+      const GLint handles[] = {positionHandle_, transformHandle_, textureHandle_, layerHandle_, colorHandle_};
+
+      for(int i = 0; i < 5; ++i){
+        if(handles[i] < 0){
+          continue;
+        }
+
+        glVertexAttribDivisor(handles[i], 1);
+        glEnableVertexAttribArray(handles[i]);
+      }
+
+      glBindVertexArray(0);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      return check_GL_error("BillboardSet::init_resources() exit");
     }
 
+
     /**
-     * ImageAtlas::init_resources
+     * BillboardSet::point_arrays
      *
-     * @return
+     *   Point the instance attributes at the region of stream_ that was
+     *   written last, the shaders may not use all of them
      */
-    virtual bool init_resources() {
-      std::cout<<"ImageAtlas::init_resources()"<<std::endl;
+    void point_arrays(){
 
-      // We want to clear the texture and this is sort of a hackish way to do so.
-      char *zero_buffer = new char[4 * tex_width_ * tex_height_];
+      const char *base = (const char *) stream_.offset();
+      int stride = sizeof(float) * attributes_per_board_;
 
-      for(int i = 0; i < 4 * tex_width_ * tex_height_; ++i){
-        zero_buffer[i] = 0;
-      }
+      const GLint handles[] = {positionHandle_, transformHandle_, textureHandle_, layerHandle_, colorHandle_};
+      const int sizes[] = {2, 3, 4, 1, 4};
+      const int offsets[] = {ix_position_, ix_transform_, ix_texture_, ix_layer_, ix_color_};
 
-      // Create the textures we need
-      glGenTextures(1, &tex_);
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, stream_.buffer_);
 
-      glActiveTexture(GL_TEXTURE0 + tex_unit_);
-      glBindTexture(GL_TEXTURE_2D, tex_);
-      glPixelStorei(GL_PACK_ALIGNMENT, 4);
+      for(int i = 0; i < 5; ++i){
+        if(handles[i] < 0){
+          continue;
+        }
 
-      // These have to be after the load or it doesn't work.
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glVertexAttribPointer(handles[i], sizes[i], GL_FLOAT, GL_FALSE, stride, base + offsets[i] * sizeof(float));
+      }
 
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width_, tex_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, zero_buffer);
+      glBindVertexArray(0);
+    }
 
-//      std::cout<<"Creating texture with size "<<tex_width_<<" x "<<tex_height_<<" on unit "<<tex_unit_<<std::endl;
+    void cleanup(){
+      glDeleteProgram(program_);
 
-      delete[] zero_buffer;
-      return true;
+      glDeleteVertexArrays(1, &vao);
+      stream_.cleanup();
     }
 
     /**
-     * ImageAtlas::bind
-     *
+     * Arrange all the billboards in a grid
      */
-    void bind(){
-      glBindTexture(GL_TEXTURE_2D, tex_);
-    }
+    void init_grid(int tiles_x){
+      // Random
+      float random_scale = 0.0f;
 
-    void cleanup() {
-      glDeleteTextures(1, &tex_);
+      // Initialize Random Number Generator
+      std::random_device rd;
+      std::mt19937 generator(rd());
+      std::uniform_real_distribution<> random(-random_scale, random_scale);
+
+//      const int default_tiles_x = 10;
+
+      int tiles_y = count_ / tiles_x;
+
+      // Initialize a grid
+      float dx = 2.0f / float(tiles_x);
+      float dy = 2.0f / float(tiles_y);
+      float dz = -0.0001f;
+
+      float dx_gap = 1.0f * dx;
+      float dy_gap = 0.0f;
+
+      for(int i = 0; i < count_; ++i){
+
+        int tile_ix = i % tiles_x;
+        int tile_iy = i / tiles_x;
+
+        float x = -2.0f + (dx+dx_gap) * tile_ix;
+        float y = -1.0f + (dy+dy_gap) * tile_iy;
+
+        info_[i].position[0] = x;// + random_scale * random(generator);
+        info_[i].position[1] = y;// + random_scale * random(generator);
+        info_[i].position[2] = dz * i;
+      }
+
+      // Generate and upload the billboards
+      upload_billboards();
     }
 
     /**
-     * ImageAtlas::get_tile_coordinates
      *
-     * Get the texture coordinates that reference the given tile
+     * Repack and upload the data. Texture coordinates and offsets are taken from the
+     * .info array of structs, one record per billboard, the vertex shader builds the quads.
+     * The records are written straight into the next region of stream_.
+     *
+     * For custom billboards populate the .info[] array of structs and then call this
+     * method.
+     *
+     * With a cull_camera_ only the billboards in its view are packed, .info[] keeps
+     * every billboard so indices (e.g. from hitSelect) are unchanged.
      *
-     * @param index
-     * @param tex_uv  (u_0, v_0, u_1, v_1),
      */
-    void get_tile_coordinates(int index, float tex_uv[]){
+    void upload_billboards(){
 
-      if(count_ <= 0){
-        std::cerr<<"ImageAtlas::get_tile_coordinates: No tiles"<<std::endl;
+      using namespace std;
+
+      check_GL_error("BillboardSet::upload_billboards() entry");
+#if 0
+      cout << "BillboardSet::upload_billboards "<< count_ << " with capacity "<<capacity_<<endl;
+#endif
+      drawn_ = 0;
+
+      float *instance_data = (float *) stream_.map(attributes_per_board_ * count_ * sizeof(float));
+
+      if(instance_data == nullptr){
         return;
       }
 
-      // TODO: Factor out
-      float tex_dx = 1.0f / float(tiles_x_);
-      float tex_dy = 1.0f / float(tiles_y_);
+      for(int i = 0; i < count_; ++i){
 
-      int tile_index = index % count_;
-      int ix = tile_index % tiles_x_;
-      int iy = tile_index / tiles_x_;
+        if((cull_camera_ != nullptr) && !billboard_visible(*cull_camera_, i)){
+          continue;
+        }
 
-      tex_uv[0] = ix * tex_dx;
-      tex_uv[1] = (iy + 1) * tex_dy;
+        float *record = instance_data + drawn_ * attributes_per_board_;
+        ++drawn_;
 
-      tex_uv[2] = (ix + 1) * tex_dx;
-      tex_uv[3] = iy * tex_dy;
+        // The z coordinate is not used, billboards are drawn in the z = 0 plane
+        record[ix_position_ + 0] = info_[i].position[0];
+        record[ix_position_ + 1] = info_[i].position[1];
+
+        record[ix_transform_ + 0] = info_[i].rotation;
+        record[ix_transform_ + 1] = info_[i].scale[0];
+        record[ix_transform_ + 2] = info_[i].scale[1];
+
+        for(int k = 0; k < 4; ++k){
+          record[ix_texture_ + k] = info_[i].tex[k];
+          record[ix_color_ + k] = info_[i].color[k];
+        }
+
+        record[ix_layer_] = info_[i].layer;
+      }
+
+      stream_.unmap();
+      point_arrays();
+
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      check_GL_error("BillboardSet::upload_data() exit");
     }
 
     /**
+     * BillboardSet::billboard_visible
      *
-     * ImageAtlas::add_tile
-     *
-     * @return
+     * @param camera
+     * @param ix
+     * @return False if the rotated quad of billboard ix is entirely outside of the view
      */
-    int add_tile(){
+    bool billboard_visible(const Camera<float> &camera, int ix) const{
 
-      if(count_ >= capacity_){
-        std::cerr<<"ImageAtlas::add_tile: Can't add new tile because atlas is at capacity "<<count_<<"/"<<capacity_<<std::endl;
-        throw 1;
-      }
+      float half_width = 0.5f * quad_width_ * info_[ix].scale[0];
+      float half_height = 0.5f * quad_height_ * info_[ix].scale[1];
 
-      int index = count_;
-      ++count_;
+      // Drawn in the z = 0 plane (c.f. billboard_set.vert)
+      const float center[3] = {info_[ix].position[0], info_[ix].position[1], 0.0f};
 
-      return index;
+      return camera.sphere_visible(center, std::sqrt(half_width * half_width + half_height * half_height));
     }
 
     /**
-     * ImageAtlas::add_tile
+     * BillboardSet::flush_upload
      *
-     * Add a new tile
-     *
-     * @param index
-     * @param buffer
      * @return
      */
-    int add_tile(const unsigned char *buffer){
+    virtual size_t flush_upload(){
+      upload_billboards();
+      return attributes_per_board_ * drawn_ * sizeof(float);
+    }
 
-      int index = add_tile();
+    /**
+     * Render BillboardSet
+     *
+     * @param camera_
+     */
+    virtual void render(Camera<float>& camera_){
+      check_GL_error("BillboardSet::render() enter");
+#if 0
+      std::cout<<"BillboardSet::render: "<<count_
+               <<" billboards using texture unit "<<atlas_tex_unit_
+               <<" samplerHandle_ "<<samplerHandle_<<std::endl;
+#endif
+      // Draw
+      glUseProgram(program_);
+      glBindVertexArray(vao);
 
- //     std::cout<<"ImageAtlas::add_tile "<<index<<std::endl;
+      glUniform1i(samplerHandle_, atlas_tex_unit_);
+      glUniform1f(opacityHandle_, global_opacity_);
+      glUniform2f(quadSizeHandle_, quad_width_, quad_height_);
 
-      update_tile(index, buffer);
+      glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, drawn_);
+      glBindVertexArray(0);
+      check_GL_error("BillboardSet::render() exit");
 
-      return index;
     }
 
     /**
-     * ImageAtlas::update_tile
      *
-     *
-     * @param index
-     * @param buffer
+     * @param world_x
+     * @param world_y
      * @return
      */
-    bool update_tile(int index, const unsigned char *buffer){
+    virtual bool hitTest(float world_x, float world_y){
+      using namespace std;
 
-//      std::cout<<"ImageAtlas::update_tile "<<index<<std::endl;
+      int hit_ix = -1;
 
-      if(index >= count_){
-        std::cerr<<"ImageAtlas::update_tile :  Index "<<index<<" out of range  "<<capacity_<<std::endl;
-        return false;
-      }
+      hit_ix = hitSelect(world_x, world_y);
 
-      int tile_x = index % tiles_x_;
-      int tile_y = index / tiles_x_;
+//      std::cout<<"BillboardSet::hitTest Hit Index "<<hit_ix<<std::endl;
 
-      return upload_tile(tile_x, tile_y, buffer);
-    }
+      return hit_ix >= 0;
+    };
 
 
-    /**
-     *
-     * @param col
-     * @param row
-     * @param width
-     * @param height
-     */
-    bool upload_tile(int tile_x, int tile_y, const void *buffer){
+    int hitSelect(float x, float y){
 
-      check_GL_error("ImageAtlas::upload_tile() entry");
+      using namespace std;
 
-  //    std::cout<<"ImageAtlas::Upload_tile "<<tile_x<<", "<<tile_y<<std::endl;
+      int hit_ix = -1;
 
-      if(!((tile_x < tiles_x_) && (tile_y < tiles_y_))){
+      float hit_radius_sq = quad_width_ * quad_width_
+                            + quad_height_ * quad_height_;
 
-        std::cerr<<" col or row is out of range "<<tile_x<<" of "<<tiles_x_
-                 <<" "<<tile_y<<" of "<<tiles_y_<<std::endl;
-        return false;
-      }
+      float r_sq_min = 2 * hit_radius_sq;
 
-      int x = tile_x * tile_width_;
-      int y = tile_y * tile_height_;
+      for(int i = 0; i < count_; ++i){
 
-      glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tile_width_, tile_height_,
-                      GL_RGBA, GL_UNSIGNED_BYTE, buffer);
-      // TODO: Following two lines probably have a negative effect on perf
+        float dx = (info_[i].position[0] - x);
+        float dy = (info_[i].position[1] - y);
 
-      // Need to have this here otherwise the caller can change buffer while we are editing it
-      glFlush();
-      glGenerateMipmap(GL_TEXTURE_2D);
+        float r_sq = dx*dx + dy*dy;
 
-//      std::cout<<"Uploading image of size "<<tile_width_<<", "<<tile_height_<<std::endl;
+        if(r_sq < r_sq_min){
+          r_sq_min = r_sq;
+          hit_ix = i;
+        }
+      }
 
-      return check_GL_error("ImageAtlas::upload_tile() exit");
+      return hit_ix;
     }
+  };
 
-    /**
-     *
-     */
-    void save_atlas(const char *filename) {
 
-      using namespace std;
+  /**
+   *
+   * Signed distance field glyphs (C. Green, "Improved Alpha-Tested Magnification
+   * for Vector Textures and Special Effects", SIGGRAPH 2007).
+   *
+   * Glyphs are rasterized by QPainter at scale_ times the atlas resolution and
+   * converted into a distance field with an exact Euclidean distance transform.
+   * 128 is the edge of the glyph, every step of 127/spread_px_ is one atlas pixel
+   * away from it. The font is built once per process (c.f. GlyphFont::shared)
+   * and each GL context uploads it into its own GlyphAtlas.
+   *
+   */
+  struct GlyphFont{
 
-      ImageAtlas::save_atlas(tex_, tex_width_, tex_height_, filename);
-    }
+    // Size of the em square in atlas pixels
+    const static int em_px_ = 32;
 
-    static void save_atlas(GLuint tex, int width, int height, const char *filename) {
-      QImage img(width, height, QImage::Format_RGBA8888);
+    // Every glyph gets a cell_px_ square, the pen sits origin_px_ from the left
+    // and baseline_px_ from the top of the cell
+    const static int cell_px_ = 48;
+    const static int origin_px_ = 8;
+    const static int baseline_px_ = 36;
 
-      check_GL_error("ImageAtlas::save_atlas() entry");
+    // Distance [atlas pixels] spanned by the field on either side of an edge
+    const static int spread_px_ = 4;
 
-      glBindTexture(GL_TEXTURE_2D, tex);
-      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-      glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.bits());
+    // Glyphs are rasterized this many times larger than the atlas
+    const static int scale_ = 4;
 
-      std::cout << "ImageAtlas::save_atlas - Writing image of size " << width << " by " << height
-                << " filename " << filename << std::endl;
+    // Atlas cells in a row
+    const static int cells_x_ = 21;
 
-      img.save(filename);
-    }
+    struct s_glyph{
+      // Texture coordinates (u_0, v_0, u_1, v_1) of the cell, v_0 is the bottom
+      float tex[4];
+      // Pen advance [em]
+      float advance;
+    };
 
-  };
+    // Glyph index by Latin-1 code, -1 if missing
+    int index_[256];
+    std::vector<s_glyph> glyphs_;
 
-  /**
-   * Draw a full screen image
-   */
-  struct FullScreenImage : public FlatShape{
+    // Solid glyph used for text backgrounds (samples the middle of a filled cell)
+    const static int solid_ = 0;
 
-    /**
-     * Settings
-     */
+    // Quad of every glyph relative to the pen (x_0, y_0, x_1, y_1) [em]
+    float quad_[4];
 
-    // Shaders
-    std::string vert_shader = "./assets/shaders/identity.vert";
-    std::string frag_shader = "./assets/shaders/background.frag";
+    // Distance between baselines and height above the baseline [em]
+    float line_height_ = 1.2f;
+    float ascent_ = 0.8f;
+
+    // Distance field
+    int width_ = 0;
+    int height_ = 0;
+    std::vector<unsigned char> pixels_;
 
     /**
-     * Data
+     * Font shared by all the atlases in the program, the first call builds it
      */
-    // Program handle
-    GLuint program_ = 0;
+    static const GlyphFont& shared(){
+      static GlyphFont font;
+      return font;
+    }
+
+    const s_glyph& glyph(int code) const {
+      int ix = (code >= 0 && code < 256) ? index_[code] : -1;
+      return glyphs_[ix < 0 ? index_[int('?')] : ix];
+    }
+
+    GlyphFont(){
+
+      // ASCII and the few Latin-1 symbols the labs need (degree, squared, cubed, micro)
+      std::vector<int> codes;
+      codes.push_back(-1);
+
+      for(int c = 32; c < 127; ++c){
+        codes.push_back(c);
+      }
+
+      const int latin_1[] = {0xb0, 0xb2, 0xb3, 0xb5};
+
+      for(int c : latin_1){
+        codes.push_back(c);
+      }
 
-    // Position Attribute
-    GLint positionHandle_ = 0;
+      const int count = codes.size();
+      const int cells_y = (count + cells_x_ - 1) / cells_x_;
 
-    GLint backgroundHandle_ = 0;
-    GLint backgroundAlpha_ = 0;
-    GLint backgroundTime_ = 0;
-    GLint backgroundScale_ = 0;
+      width_ = cells_x_ * cell_px_;
+      height_ = cells_y * cell_px_;
+      pixels_.assign(width_ * height_, 0);
 
-    // Background texture
-    GLuint tex_ = 0;
+      std::fill(index_, index_ + 256, -1);
+      glyphs_.resize(count);
 
+      QFont font;
+      font.setPixelSize(scale_ * em_px_);
+      font.setWeight(QFont::DemiBold);
 
-    /**
-     * Texture
-     */
-    int tex_unit_ = 0;
+      QFontMetricsF metrics(font);
 
-    int tex_width_ = 0;
-    int tex_height_ = 0;
-    int layers_ = 0;
+      const float em = scale_ * em_px_;
 
-    float alpha_ = 0.0f;
-    float time_ = 0.0f;
+      line_height_ = metrics.lineSpacing() / em;
+      ascent_ = metrics.ascent() / em;
 
-    // Scale of quad
-    float scale_[3] = {1.0f, 1.0f, 1.0f};
+      quad_[0] = -float(origin_px_) / em_px_;
+      quad_[1] = -float(cell_px_ - baseline_px_) / em_px_;
+      quad_[2] = float(cell_px_ - origin_px_) / em_px_;
+      quad_[3] = float(baseline_px_) / em_px_;
 
-    FullScreenImage(int texture_unit, int tex_width, int tex_height, int tex_depth)
-        : tex_unit_(texture_unit), tex_width_(tex_width), tex_height_(tex_height),
-          layers_(tex_depth){
+      const int hi = scale_ * cell_px_;
 
-    }
+      QImage image(hi, hi, QImage::Format_ARGB32);
 
-    /**
-     *
-     * @return
-     */
-    bool init_resources(){
+      // Squared distances to the nearest pixel inside/outside the glyph
+      std::vector<float> inside(hi * hi);
+      std::vector<float> outside(hi * hi);
 
-      std::cout<<"FullScreenImage::init_resources"<<std::endl;
+      for(int g = 0; g < count; ++g){
 
-      /**
-       * Build programs
-       */
-      program_ = glCreateProgram();
+        const int code = codes[g];
 
-      bool status = build_program(program_, "FullScreenImage",
-                                  vert_shader.c_str(), frag_shader.c_str());
-      if(!status){
-        return false;
-      }
+        if(code < 0){
+          image.fill(Qt::white);
+        }else{
+          image.fill(Qt::transparent);
 
-      positionHandle_ = glGetAttribLocation(program_, "position_in_");
+          QPainter painter(&image);
+          painter.setFont(font);
+          painter.setPen(Qt::white);
+          painter.drawText(QPointF(scale_ * origin_px_, scale_ * baseline_px_), QString(QChar(code)));
+          painter.end();
 
-      backgroundHandle_ = glGetUniformLocation(program_, "background_");
-      backgroundAlpha_ = glGetUniformLocation(program_, "background_alpha_");
-      backgroundTime_ = glGetUniformLocation(program_, "background_time_");
-      backgroundScale_ = glGetUniformLocation(program_, "scale_");
+          index_[code] = g;
+        }
 
-      /**
-       * Initialize textures
-       */
-      // Create the textures we need
-      glGenTextures(1, &tex_);
+        for(int y = 0; y < hi; ++y){
+          const QRgb *line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
 
-      glActiveTexture(GL_TEXTURE0 + tex_unit_);
-      glBindTexture(GL_TEXTURE_3D, tex_);
-      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+          for(int x = 0; x < hi; ++x){
+            const bool in = qAlpha(line[x]) > 127;
+            outside[y * hi + x] = in ? 1e20f : 0.0f;
+            inside[y * hi + x] = in ? 0.0f : 1e20f;
+          }
+        }
 
-      // These have to be after the load or it doesn't work.
-      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        distance_transform(&outside[0], hi, hi);
+        distance_transform(&inside[0], hi, hi);
 
-      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        // Sample the middle of every scale_ x scale_ block
+        const int cell_x = (g % cells_x_) * cell_px_;
+        const int cell_y = (g / cells_x_) * cell_px_;
 
-      glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, tex_width_, tex_height_, layers_,
-                   0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        for(int y = 0; y < cell_px_; ++y){
+          for(int x = 0; x < cell_px_; ++x){
 
-      /**
-       * Create geometry
-       */
-      FlatShape::init_resources();
-      FlatShape::setup_array(positionHandle_);
-      FlatShape::build_triangle(2.0);
+            const int p = (scale_ * y + scale_ / 2) * hi + scale_ * x + scale_ / 2;
 
-//      enable(true);
+            // Signed distance in atlas pixels, positive inside
+            const float d = (std::sqrt(outside[p]) - std::sqrt(inside[p])) / scale_;
 
-      return check_GL_error("FullScreenImage::init_resources() exit");
+            const float value = 128.0f + 127.0f * d / spread_px_;
+
+            pixels_[(cell_y + y) * width_ + cell_x + x] = (unsigned char) std::max(0.0f, std::min(255.0f, value));
+          }
+        }
+
+        s_glyph &glyph = glyphs_[g];
+
+        if(code < 0){
+          glyph.tex[0] = glyph.tex[2] = (cell_x + 0.5f * cell_px_) / width_;
+          glyph.tex[1] = glyph.tex[3] = (cell_y + 0.5f * cell_px_) / height_;
+          glyph.advance = 0.0f;
+        }else{
+          glyph.tex[0] = float(cell_x) / width_;
+          glyph.tex[1] = float(cell_y + cell_px_) / height_;
+          glyph.tex[2] = float(cell_x + cell_px_) / width_;
+          glyph.tex[3] = float(cell_y) / height_;
+          glyph.advance = metrics.width(QChar(code)) / em;
+        }
+      }
     }
 
     /**
-     * FullScreenImage::cleanup
-     *
-     *  Free OpenGL resources
+     * Squared Euclidean distance transform in place, Felzenszwalb & Huttenlocher
+     * "Distance Transforms of Sampled Functions" (2012). Pixels in the set are 0,
+     * the rest 1e20.
      *
+     * @param f
+     * @param width
+     * @param height
      */
-    void cleanup(){
-      glDeleteProgram(program_);
-      glDeleteTextures(1, &tex_);
-    }
+    static void distance_transform(float *f, int width, int height){
 
-    void setScaleFromAspect(float aspect){
-      scale_[0] = 1.0f;
-      scale_[1] = aspect;
+      const int n = std::max(width, height);
+
+      std::vector<double> column(n);
+      std::vector<double> d(n);
+      std::vector<double> z(n + 1);
+      std::vector<int> v(n);
+
+      for(int x = 0; x < width; ++x){
+        for(int y = 0; y < height; ++y){
+          column[y] = f[y * width + x];
+        }
+
+        distance_transform(&column[0], height, &d[0], &v[0], &z[0]);
+
+        for(int y = 0; y < height; ++y){
+          f[y * width + x] = d[y];
+        }
+      }
+
+      for(int y = 0; y < height; ++y){
+        for(int x = 0; x < width; ++x){
+          column[x] = f[y * width + x];
+        }
+
+        distance_transform(&column[0], width, &d[0], &v[0], &z[0]);
+
+        for(int x = 0; x < width; ++x){
+          f[y * width + x] = d[x];
+        }
+      }
     }
 
     /**
-     * FullScreenImage::load_image
-     *
-     * Load a slice into the 3d texture
-     *
+     * One dimensional pass: lower envelope of the parabolas rooted at f
      */
-    void upload_slice(int layer, const void *buffer){
+    static void distance_transform(const double *f, int n, double *d, int *v, double *z){
 
-      check_GL_error("FullScreenImage::upload_slice() entry");
+      int k = 0;
 
-      if(layer > layers_){
-        std::cerr<<" FullScreenImage::upload_slice(): layer "<<layer<<" out of range "<<std::endl;
-        return;
+      v[0] = 0;
+      z[0] = -1e20;
+      z[1] = 1e20;
+
+      for(int q = 1; q < n; ++q){
+
+        double s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+
+        while(s <= z[k]){
+          --k;
+          s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+        }
+
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = 1e20;
       }
-#if 0
-      std::cout<<"FullScreenImage::upload_slice(): Uploading image of size "<<tex_width_
-               <<", "<<tex_height_<<" on layer "<<layer+1<<" of "<<layers_<<std::endl;
-#endif
-      glBindTexture(GL_TEXTURE_3D, tex_);
-      glTexSubImage3D(GL_TEXTURE_3D, 0,
-                      0, 0, layer,
-                      tex_width_, tex_height_, 1,
-                      GL_RGBA, GL_UNSIGNED_BYTE, buffer);
 
-      glGenerateMipmap(GL_TEXTURE_3D);
+      k = 0;
 
-      // Need to have this here otherwise the caller can change buffer while we are editing it
-      glFlush();
+      for(int q = 0; q < n; ++q){
+        while(z[k + 1] < q){
+          ++k;
+        }
 
-      check_GL_error("FullScreenImage::upload_slice() exit");
+        d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+      }
+    }
+  };
+
+
+  /**
+   *
+   * GPU copy of the GlyphFont, one per GL context. Sampled with linear filtering
+   * and no mipmaps since the distance field does the anti-aliasing.
+   *
+   */
+  struct GlyphAtlas{
+
+    int tex_unit_ = 0;
+    GLuint tex_ = 0;
+
+    const GlyphFont *font_ = nullptr;
+
+    GlyphAtlas(int tex_unit)
+        : tex_unit_(tex_unit){
     }
 
     /**
-     * FullScreenImage::render
+     * GlyphAtlas::init_resources
      *
-     * @param camera
+     * @return
      */
-    virtual void render(Camera<float>& camera){
-      // Draw
-      glUseProgram(program_);
+    bool init_resources(){
 
-      glUniform1i(backgroundHandle_, tex_unit_);
-      glUniform1f(backgroundAlpha_, alpha_);
-      glUniform1f(backgroundTime_, time_);
-      glUniform3fv(backgroundScale_, 1, scale_);
+      check_GL_error("GlyphAtlas::init_resources() entry");
 
-      FlatShape::bind();
-      FlatShape::render(camera);
+      font_ = &GlyphFont::shared();
 
-      check_GL_error("FullScreenImage::render()");
+      glGenTextures(1, &tex_);
+      glActiveTexture(GL_TEXTURE0 + tex_unit_);
+      glBindTexture(GL_TEXTURE_2D, tex_);
+
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+      // Rows of a single channel texture are not 4 byte aligned
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, font_->width_, font_->height_, 0, GL_RED, GL_UNSIGNED_BYTE, &font_->pixels_[0]);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+      return check_GL_error("GlyphAtlas::init_resources() exit");
+    }
+
+    void bind(){
+      glActiveTexture(GL_TEXTURE0 + tex_unit_);
+      glBindTexture(GL_TEXTURE_2D, tex_);
+    }
+
+    void cleanup(){
+      glDeleteTextures(1, &tex_);
+      tex_ = 0;
     }
   };
 
-  /**
-   *
-   * Responsible for displaying a set of textured quads (TODO: or triangles?)
-   * where each quad's texture is a tile from a texture atlas.
-   *
-   * Each quad is represented by 2 triangles and the quad has it's center at the origin.
-   * This can be used for drawing a whole bunch of galaxies or
-   * texture labels.
 
+  /**
    *
-   * There are essentially three potential ways for specifying the data for the quads.
-   *
-   *  1. Vertex and texture data completely and make any changes on the CPU
-   *  2. Fixed vertex and texture data + custom MV matrix for each billboard
-   *  3. Fixed vertex and texture data + individual components like rotation, scale, offset and have GLSL create matrices
-   *
-   *  Approach 1 would almost be simplest and will perform just fine in most cases.
-   *
-   *  Approach 2 seems sort of the best compromise but it's weird and tricky to submit matrices as attribute.
-   *
-   *  Approach 3 seems computationally wasteful but it should be a bit easier to code up.
-   *
-   *
-   * Doing Approach 3
+   * Set of strings drawn from a GlyphAtlas. Every glyph is one instance of a
+   * 4 vertex quad, each string owns max_glyphs_ instances so changing a label
+   * only re-lays that string out and uploads its slot. A string that needs
+   * more instances grows the slots of all of them (c.f. TextSet::grow).
    *
-   * Inside the VBO the fixed data (vertex coordinates and texture coordinates) is interleaved as and the auxilary
-   * attribute array is appended at the end. This makes changing it easier. Example:
+   * Populate the .info_[] array (or use TextSet::set_text), mark the changed
+   * strings with TextSet::update and set count_. Layout and upload happen in
+   * TextSet::render so strings can be changed without a current GL context.
    *
-   *   v_0, v_1, t_0, t_1, ... v_n, ; dx_0, dx_0, dtheta_0, ds_0, dt_1
+   * Tabs split the lines of a string into columns, e.g. "A =\t1.00\t AU" over
+   * "t =\t365.25\t days". A column is as wide as its widest cell and the
+   * cells are right aligned in it, except for the last cell of a line which
+   * starts where its column starts.
    *
    */
+  struct TextSet : public Node {
 
-  struct BillboardSet : public msg::Node {
-
-    // Quad dimensions
-    float quad_width_ = 0.1f;
-    float quad_height_ = 0.1f;
-
-    // Global transparancy of the billboards
-    float global_opacity_ = 1.0f;
-
-    // Maximum number of billboards
-    int capacity_ = 0;
+    enum TextAlign{
+      // Block of lines centered on the position
+      TEXT_CENTER = 0,
+      // Position is the pen at the start of the first baseline
+      TEXT_LEFT
+    };
 
-    // Number of vertices for each billboard
-    const static int verts_per_board_ = 6;
+    // Floats per glyph instance: anchor (3), rotation and size (2), quad (4), texture (4), color (4)
+    const static int stride_ = 17;
 
-    // Element Stride for the static interleaved array (3 position, 2 texture, 4 color)
-    const static int attributes_per_vert_ =  9;
+    const static int ix_anchor_ = 0;
+    const static int ix_transform_ = 3;
+    const static int ix_quad_ = 5;
+    const static int ix_texture_ = 9;
+    const static int ix_color_ = 13;
 
-    // Attribute indices
-    const static int ix_position_ = 0;
-    const static int ix_texture_ = 3;
-    const static int ix_color_ = 5;
+    // Number of strings and glyph instances per string (including the background)
+    int capacity_;
+    int max_glyphs_;
 
-    // Number of billboards in array
+    // Strings drawn
     int count_ = 0;
 
-    int atlas_tex_unit_ = 0;
+    float global_opacity_ = 1.0f;
 
-    // TODO: This can be uploaded directly if we are a bit clever with offsets
-    struct s_billboard{
+    // Padding of the background box [em]
+    float padding_ = 0.25f;
+
+    struct s_text{
       float position[3];
       float rotation;
-      float scale[2];
-      float tex[4];
-      float color[4] = {1.0f, 0.0f, 0.0f, 1.0f};
-
-      bool enabled;
-
+      // Size of the em square in world units
+      float size;
+      float color[4];
+      // Box behind the text, skipped if transparent
+      float background[4];
+      int align;
+      QString text;
     } *info_;
 
-    // TODO: Would be better to use above struct directly since this is only used for upload
-    float *vertex_data_ = nullptr;
+    float *instance_data_;
 
-    int data_size_ = 0;
+    // Strings waiting for layout [first, last]
+    int dirty_first_;
+    int dirty_last_;
+
+    GlyphAtlas *atlas_;
 
     // Shaders
-    std::string vert_shader = "./assets/shaders/billboard_set.vert";
-    std::string frag_shader = "./assets/shaders/billboard_set.frag";
+    std::string vert_shader = "./assets/shaders/text_set.vert";
+    std::string frag_shader = "./assets/shaders/text_set.frag";
 
     // Program handle
     GLint program_;
 
     // Attributes
-    GLint positionHandle_;
+    GLint anchorHandle_;
+    GLint transformHandle_;
+    GLint quadHandle_;
     GLint textureHandle_;
     GLint colorHandle_;
 
-    // Uniform handles
-    GLint mvpHandle_;
+    // Uniform handles, the camera comes from the FrameBlock
     GLint samplerHandle_;
     GLint opacityHandle_;
 
     GLuint vao = 0;
     GLuint vbo = 0;
 
-    BillboardSet(int max_billboards)
-        : capacity_(max_billboards){
-
-      info_ = new s_billboard[max_billboards];
-
-      for(int i = 0; i < max_billboards; ++i){
-        info_[i].enabled = false;
-        info_[i].position[0] = 0.0f;
-        info_[i].position[1] = 0.0f;
-        info_[i].position[2] = 0.0f;
-        info_[i].rotation = 0.0f;
-        info_[i].scale[0] = 1.0f;
-        info_[i].scale[1] = 1.0f;
+    TextSet(GlyphAtlas *atlas, int max_strings, int max_glyphs = 32)
+        : capacity_(max_strings),
+          max_glyphs_(max_glyphs),
+          atlas_(atlas){
+
+      info_ = new s_text[capacity_];
+
+      for(int i = 0; i < capacity_; ++i){
+        s_text &t = info_[i];
+        t.position[0] = t.position[1] = t.position[2] = 0.0f;
+        t.rotation = 0.0f;
+        t.size = 0.1f;
+        t.color[0] = t.color[1] = t.color[2] = t.color[3] = 1.0f;
+        t.background[0] = t.background[1] = t.background[2] = t.background[3] = 0.0f;
+        t.align = TEXT_CENTER;
       }
 
-      data_size_ = attributes_per_vert_ * verts_per_board_ * capacity_ ;
-
-      vertex_data_ = new float[data_size_];
-
-      for(int i = 0; i < data_size_; ++i){
-        vertex_data_[i] = 0.0f;
-      }
+      instance_data_ = new float[stride_ * max_glyphs_ * capacity_]();
 
+      dirty_first_ = 0;
+      dirty_last_ = capacity_ - 1;
     }
 
-    ~BillboardSet(){
+    ~TextSet(){
       delete[] info_;
-      delete[] vertex_data_;
+      delete[] instance_data_;
     }
 
-
     /**
-     * BillboardSet init_resources
+     * TextSet init_resources
      *
      * @return
      */
     bool init_resources(){
-//      std::cout<<"BillboardSet::init_resources()"<<std::endl;
 
-      check_GL_error("BillboardSet::init_resources() entry");
+      check_GL_error("TextSet::init_resources() entry");
 
       program_ = glCreateProgram();
 
       // Build programs
-      if(!build_program(program_, "BillboardSet", vert_shader.c_str(), frag_shader.c_str())){
-        return false;
-      }
-      check_GL_error("BillboardSet::init_resources() 1");
-
- //     std::cout<<"program_ "<<program_<<std::endl;
+      if(!build_program(program_, "TextSet", vert_shader.c_str(), frag_shader.c_str())){
+        return false;
+      }
 
-      // Static properties
-      positionHandle_ = glGetAttribLocation(program_, "position_in_");
+      anchorHandle_ = glGetAttribLocation(program_, "anchor_in_");
+      transformHandle_ = glGetAttribLocation(program_, "transform_in_");
+      quadHandle_ = glGetAttribLocation(program_, "quad_in_");
       textureHandle_ = glGetAttribLocation(program_, "tex_in_");
       colorHandle_ = glGetAttribLocation(program_, "color_in_");
 
-      // TODO: Can we get rid of this ??
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
-      samplerHandle_ = glGetUniformLocation(program_, "atlas_");
+      samplerHandle_ = glGetUniformLocation(program_, "glyphs_");
       opacityHandle_ = glGetUniformLocation(program_, "global_alpha_");
 
       glGenVertexArrays(1, &vao);
@@ -1866,33 +4434,30 @@ namespace msg{
 
       glGenBuffers(1, &vbo);
       glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferData(GL_ARRAY_BUFFER, data_size_ * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
-
-      /**
-       * Static Data
-       */
-      int stride = sizeof(float) * attributes_per_vert_;
+      glBufferData(GL_ARRAY_BUFFER, stride_ * max_glyphs_ * capacity_ * sizeof(float), instance_data_, GL_DYNAMIC_DRAW);
 
-      glVertexAttribPointer(positionHandle_, 3, GL_FLOAT, GL_FALSE, stride, (void *) (ix_position_ * sizeof(float)));
-      glEnableVertexAttribArray(positionHandle_);
+      const GLint handles[] = {anchorHandle_, transformHandle_, quadHandle_, textureHandle_, colorHandle_};
+      const int sizes[] = {3, 2, 4, 4, 4};
+      const int offsets[] = {ix_anchor_, ix_transform_, ix_quad_, ix_texture_, ix_color_};
 
-      if(textureHandle_ > 0){
-        glVertexAttribPointer(textureHandle_, 2, GL_FLOAT, GL_FALSE, stride, (void *) (ix_texture_ * sizeof(float)));
-        glEnableVertexAttribArray(textureHandle_);
-      }
+      for(int i = 0; i < 5; ++i){
+        if(handles[i] < 0){
+          continue;
+        }
 
-      if(colorHandle_ > 0){
-        glVertexAttribPointer(colorHandle_, 4, GL_FLOAT, GL_FALSE, stride, (void *) (ix_color_ * sizeof(float)));
-        glEnableVertexAttribArray(colorHandle_);
+        glVertexAttribPointer(handles[i], sizes[i], GL_FLOAT, GL_FALSE, stride_ * sizeof(float), (void *) (offsets[i] * sizeof(float)));
+        glVertexAttribDivisor(handles[i], 1);
+        glEnableVertexAttribArray(handles[i]);
       }
 
-
       glBindVertexArray(0);
       glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-      return check_GL_error("BillboardSet::init_resources() exit");
-    }
+      // Everything is laid out on the first render
+      update();
 
+      return check_GL_error("TextSet::init_resources() exit");
+    }
 
     void cleanup(){
       glDeleteProgram(program_);
@@ -1902,243 +4467,326 @@ namespace msg{
     }
 
     /**
-     * Arrange all the billboards in a grid
+     * Replace the text of a string
+     *
+     * @param ix
+     * @param text
      */
-    void init_grid(int tiles_x){
-      // Random
-      float random_scale = 0.0f;
+    void set_text(int ix, const QString &text){
+      info_[ix].text = text;
+      update(ix);
+    }
 
-      // Initialize Random Number Generator
-      std::random_device rd;
-      std::mt19937 generator(rd());
-      std::uniform_real_distribution<> random(-random_scale, random_scale);
+    /**
+     * Mark string ix for layout and upload in the next render
+     *
+     * @param ix
+     */
+    void update(int ix){
+      dirty_first_ = std::min(dirty_first_, ix);
+      dirty_last_ = std::max(dirty_last_, ix);
+    }
 
-//      const int default_tiles_x = 10;
+    /**
+     * Mark all the strings for layout and upload in the next render
+     */
+    void update(){
+      dirty_first_ = 0;
+      dirty_last_ = capacity_ - 1;
+    }
 
-      int tiles_y = count_ / tiles_x;
+    /**
+     * Lay out string ix into its instance slot, unused instances are zeroed
+     * (degenerate quads).
+     *
+     * @param ix
+     */
+    void layout(int ix){
 
-      // Initialize a grid
-      float dx = 2.0f / float(tiles_x);
-      float dy = 2.0f / float(tiles_y);
-      float dz = -0.0001f;
+      const GlyphFont &font = *atlas_->font_;
+      const s_text &t = info_[ix];
 
-      float dx_gap = 1.0f * dx;
-      float dy_gap = 0.0f;
+      float *slot = instance_data_ + ix * max_glyphs_ * stride_;
+      std::fill(slot, slot + max_glyphs_ * stride_, 0.0f);
 
-      for(int i = 0; i < count_; ++i){
+      const QString &text = t.text;
 
-        int tile_ix = i % tiles_x;
-        int tile_iy = i / tiles_x;
+      if(text.isEmpty()){
+        return;
+      }
 
-        float x = -2.0f + (dx+dx_gap) * tile_ix;
-        float y = -1.0f + (dy+dy_gap) * tile_iy;
+      /**
+       * Column widths from the cells followed by a tab, then the extent of
+       * the block of lines [em]
+       */
+      std::vector<float> columns;
 
-        info_[i].position[0] = x;// + random_scale * random(generator);
-        info_[i].position[1] = y;// + random_scale * random(generator);
-        info_[i].position[2] = dz * i;
+      for(int i = 0, column = 0; i <= text.size(); ++column){
+        int end;
+        float cell_width = measure(text, i, end);
+
+        if(end < text.size() && text[end] == QChar('\t')){
+          if(int(columns.size()) <= column){
+            columns.resize(column + 1, 0.0f);
+          }
+          columns[column] = std::max(columns[column], cell_width);
+        }else{
+          column = -1;
+        }
+
+        i = end + 1;
       }
 
-      // Generate and upload the billboards
-      upload_billboards();
-    }
+      float width = 0.0f;
+      int lines = 1;
 
-    /**
-     *
-     * Repack and upload the data. Texture coordinates and offsets are taken from the
-     * .info array of structs. Offsets are used to compute the vertices for the quads.
-     *
-     * For custom billboards populate the .info[] array of structs and then call this
-     * method.
-     *
-     */
-    void upload_billboards(){
+      for(int i = 0, column = 0; i <= text.size(); ++column){
+        int end;
+        float cell_width = measure(text, i, end);
 
-      using namespace std;
+        if(end == text.size() || text[end] == QChar('\n')){
+          float start = 0.0f;
 
-      check_GL_error("BillboardSet::upload_billboards() entry");
-#if 0
-      cout << "BillboardSet::upload_billboards "<< count_ << " with capacity "<<capacity_<<endl;
-#endif
-      // Vertices for the galaxy billboards
-      // TODO: HACK
-      //float data[attributes_per_vert_ * verts_per_board_ * 1024];
+          for(int c = 0; c < column; ++c){
+            start += columns[c];
+          }
 
-      int offset = 0;
+          width = std::max(width, start + cell_width);
+          lines += (end < text.size()) ? 1 : 0;
+          column = -1;
+        }
 
-      for(int i = 0; i < count_; ++i){
+        i = end + 1;
+      }
 
-        // Data that is the same for all vertices in the bill-board (color, ?) TODO: Remove this I think.
-        const float data_quad[4] = {info_[i].color[0], info_[i].color[1], info_[i].color[2], info_[i].color[3]};
+      const float height = lines * font.line_height_;
 
-        // Texture coordinates
-        float tex_u_0 = info_[i].tex[0];
-        float tex_v_0 = info_[i].tex[1];
-        float tex_u_1 = info_[i].tex[2];
-        float tex_v_1 = info_[i].tex[3];
+      // Pen at the start of the first baseline, top left of the block
+      float x_0 = 0.0f;
+      float top = font.ascent_;
 
-#if 0
-        // Positions for the 4 corners of the quad
-        const float offset_x = info_[i].position[0];
-        const float x_right = 0.5f * quad_width_ * info_[i].scale[0] + offset_x;
-        const float x_left = -0.5f * quad_width_ * info_[i].scale[0] + offset_x;
-
-        const float offset_y = info_[i].position[1];
-        const float y_top =  0.5f * quad_height_ * info_[i].scale[1] + offset_y;
-        const float y_bottom = -0.5f * quad_height_ * info_[i].scale[1] + offset_y;
-
-        // Vertex and Texture data for the quad
-        const float data_vert[verts_per_board_][5]{{x_left,  y_top,  0.0f, tex_u_0, tex_v_1},
-                                                   {x_right, y_top,  0.0f, tex_u_1, tex_v_1},
-                                                   {x_left,  y_bottom, 0.0f, tex_u_0, tex_v_0},
-                                                   {x_right, y_top,  0.0f, tex_u_1, tex_v_1},
-                                                   {x_left,  y_bottom, 0.0f, tex_u_0, tex_v_0},
-                                                   {x_right, y_bottom, 0.0f, tex_u_1, tex_v_0}};
-#else
-        // Rotation "matrix"
-        float sin_t = sin(info_[i].rotation);
-        float cos_t = cos(info_[i].rotation);
-
-        // Positions for the 4 corners of the quad
-        const float offset_x = info_[i].position[0];
-        const float x_right = 0.5f * quad_width_ * info_[i].scale[0];
-        const float x_left = -0.5f * quad_width_ * info_[i].scale[0];
-
-        const float offset_y = info_[i].position[1];
-        const float y_top =  0.5f * quad_height_ * info_[i].scale[1];
-        const float y_bottom = -0.5f * quad_height_ * info_[i].scale[1];
-
-        // Rotate Quad
-        const float x_rt = cos_t * x_right - sin_t * y_top + offset_x;
-        const float y_rt = sin_t * x_right + cos_t * y_top + offset_y;
-
-        const float x_rb = cos_t * x_right - sin_t * y_bottom + offset_x;
-        const float y_rb = sin_t * x_right + cos_t * y_bottom + offset_y;
-
-        const float x_lt = cos_t * x_left - sin_t * y_top + offset_x;
-        const float y_lt = sin_t * x_left + cos_t * y_top + offset_y;
-
-        const float x_lb = cos_t * x_left - sin_t * y_bottom + offset_x;
-        const float y_lb = sin_t * x_left + cos_t * y_bottom + offset_y;
-
-        // Vertex and Texture data for the quad
-        const float data_vert[verts_per_board_][5]{{x_lt,  y_lt,  0.0f, tex_u_0, tex_v_1},
-                                                   {x_rt, y_rt,  0.0f, tex_u_1, tex_v_1},
-                                                   {x_lb,  y_lb, 0.0f, tex_u_0, tex_v_0},
-                                                   {x_rt, y_rt,  0.0f, tex_u_1, tex_v_1},
-                                                   {x_lb,  y_lb, 0.0f, tex_u_0, tex_v_0},
-                                                   {x_rb, y_rb, 0.0f, tex_u_1, tex_v_0}};
-#endif
+      if(t.align == TEXT_CENTER){
+        x_0 = -0.5f * width;
+        top = 0.5f * height;
+      }
 
-#if 0
-        cout << " Adding quad " << setw(4) << ix << " x " << setw(4) << iy << " at" << endl;
-          for(int j = 0; j < verts_per_board_; j++){
-              cout<<"Vertex "<<setw(2)<< j;
-
-            // Per-vertex data
-            for(int i = 0; i < 5; i++){
-              cout<<setw(6)<<data_vert[j][i];
-            }
-
-            // Per-vertex data
-            for(int i = 0; i < 3; i++){
-              cout<<setw(6)<<data_quad[i];
-            }
-            cout<<endl;
-          }
-#endif
+      float baseline = top - font.ascent_;
 
-        // Load the triangle data
-        for(int j = 0; j < verts_per_board_; j++){
+      int n = 0;
 
-          // Per-vertex data
-          for(int i = 0; i < 5; i++){
-            vertex_data_[offset++] = data_vert[j][i];
-          }
+      if(t.background[3] > 0.0f){
+        const float quad[4] = {x_0 - padding_, top - height - padding_, x_0 + width + padding_, top + padding_};
+        write_instance(slot, t, quad, font.glyphs_[GlyphFont::solid_].tex, t.background);
+        ++n;
+      }
+
+      float pen = x_0;
+
+      // Start of the current column
+      float column_x = x_0;
+      int column = 0;
+
+      for(int i = 0; i < text.size() && n < max_glyphs_; ++i){
+
+        // Place each cell at its column
+        if((i == 0) || (text[i - 1] == QChar('\t')) || (text[i - 1] == QChar('\n'))){
+          int end;
+          float cell_width = measure(text, i, end);
 
-          // Per-quad data
-          for(int i = 0; i < 4; i++){
-            vertex_data_[offset++] = data_quad[i];
+          pen = column_x;
+
+          if(end < text.size() && text[end] == QChar('\t')){
+            pen += columns[column] - cell_width;
           }
         }
+
+        if(text[i] == QChar('\n')){
+          column_x = x_0;
+          column = 0;
+          baseline -= font.line_height_;
+          continue;
+        }
+
+        if(text[i] == QChar('\t')){
+          column_x += columns[column++];
+          continue;
+        }
+
+        const GlyphFont::s_glyph &glyph = font.glyph(text[i].unicode());
+
+        if(text[i] != QChar(' ')){
+          const float quad[4] = {pen + font.quad_[0], baseline + font.quad_[1],
+                                 pen + font.quad_[2], baseline + font.quad_[3]};
+
+          write_instance(slot + n * stride_, t, quad, glyph.tex, t.color);
+          ++n;
+        }
+
+        pen += glyph.advance;
       }
+    }
 
-      glBindBuffer(GL_ARRAY_BUFFER, vbo);
-      glBufferSubData(GL_ARRAY_BUFFER, 0, attributes_per_vert_ * verts_per_board_ * capacity_* sizeof(float), vertex_data_);
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
-      check_GL_error("BillboardSet::upload_data() exit");
+    /**
+     * TextSet::glyph_count
+     *
+     * @param ix
+     * @return Instances string ix is laid out in, including the background
+     */
+    int glyph_count(int ix) const{
+
+      const s_text &t = info_[ix];
+
+      if(t.text.isEmpty()){
+        return 0;
+      }
+
+      int n = (t.background[3] > 0.0f) ? 1 : 0;
+
+      for(int i = 0; i < t.text.size(); ++i){
+        if(t.text[i] != QChar(' ') && t.text[i] != QChar('\t') && t.text[i] != QChar('\n')){
+          ++n;
+        }
+      }
+
+      return n;
     }
 
     /**
-     * Render BillboardSet
+     * TextSet::grow
      *
-     * @param camera_
+     *   Room for max_glyphs instances per string. Every slot moves so all the
+     *   strings are laid out and uploaded again.
+     *
+     * @param max_glyphs
      */
-    virtual void render(Camera<float>& camera_){
-      check_GL_error("BillboardSet::render() enter");
-#if 0
-      std::cout<<"BillboardSet::render: "<<count_
-               <<" billboards using texture unit "<<atlas_tex_unit_
-               <<" samplerHandle_ "<<samplerHandle_<<std::endl;
-#endif
-      // Draw
-      glUseProgram(program_);
-      glBindVertexArray(vao);
+    void grow(int max_glyphs){
 
-      glUniformMatrix4fv(mvpHandle_, 1, GL_FALSE, camera_.mvp);
-      glUniform1i(samplerHandle_, atlas_tex_unit_);
-      glUniform1f(opacityHandle_, global_opacity_);
+      delete[] instance_data_;
 
-      glDrawArrays(GL_TRIANGLES, 0,  6 * count_);
-//      glDrawArrays(GL_POINTS, 0,  6 * count_);
-      glBindVertexArray(0);
-      check_GL_error("BillboardSet::render() exit");
+      max_glyphs_ = max_glyphs;
+      instance_data_ = new float[stride_ * max_glyphs_ * capacity_]();
+
+      if(vbo){
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, stride_ * max_glyphs_ * capacity_ * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      }
 
+      update();
     }
 
     /**
+     * Advance of the cell starting at i [em]
      *
-     * @param world_x
-     * @param world_y
+     * @param text
+     * @param i
+     * @param end (output) Index of the tab or newline ending the cell, or text.size()
      * @return
      */
-    virtual bool hitTest(float world_x, float world_y){
-      using namespace std;
+    float measure(const QString &text, int i, int &end) const{
 
-      int hit_ix = -1;
+      const GlyphFont &font = *atlas_->font_;
 
-      hit_ix = hitSelect(world_x, world_y);
+      float width = 0.0f;
 
-//      std::cout<<"BillboardSet::hitTest Hit Index "<<hit_ix<<std::endl;
+      for(end = i; end < text.size(); ++end){
+        if(text[end] == QChar('\t') || text[end] == QChar('\n')){
+          break;
+        }
 
-      return hit_ix >= 0;
-    };
+        width += font.glyph(text[end].unicode()).advance;
+      }
 
+      return width;
+    }
 
-    int hitSelect(float x, float y){
+    static void write_instance(float *data, const s_text &t, const float quad[4], const float tex[4], const float color[4]){
 
-      using namespace std;
+      data[ix_anchor_ + 0] = t.position[0];
+      data[ix_anchor_ + 1] = t.position[1];
+      data[ix_anchor_ + 2] = t.position[2];
 
-      int hit_ix = -1;
+      data[ix_transform_ + 0] = t.rotation;
+      data[ix_transform_ + 1] = t.size;
 
-      float hit_radius_sq = quad_width_ * quad_width_
-                            + quad_height_ * quad_height_;
+      for(int i = 0; i < 4; ++i){
+        data[ix_quad_ + i] = quad[i];
+        data[ix_texture_ + i] = tex[i];
+        data[ix_color_ + i] = color[i];
+      }
+    }
 
-      float r_sq_min = 2 * hit_radius_sq;
+    /**
+     * TextSet::flush_upload
+     *
+     *   Lay out and upload the strings that changed, only the dirty range of
+     *   slots is sent
+     *
+     * @return
+     */
+    virtual size_t flush_upload(){
 
-      for(int i = 0; i < count_; ++i){
+      if(dirty_first_ > dirty_last_){
+        return 0;
+      }
 
-        float dx = (info_[i].position[0] - x);
-        float dy = (info_[i].position[1] - y);
+      // Strings that don't fit would lose their last glyphs
+      int max_glyphs = max_glyphs_;
 
-        float r_sq = dx*dx + dy*dy;
+      for(int i = dirty_first_; i <= dirty_last_; ++i){
+        max_glyphs = std::max(max_glyphs, glyph_count(i));
+      }
 
-        if(r_sq < r_sq_min){
-          r_sq_min = r_sq;
-          hit_ix = i;
-        }
+      if(max_glyphs > max_glyphs_){
+        grow(std::max(max_glyphs, 2 * max_glyphs_));
       }
 
-      return hit_ix;
+      for(int i = dirty_first_; i <= dirty_last_; ++i){
+        layout(i);
+      }
+
+      const int slot_size = max_glyphs_ * stride_;
+      size_t bytes = (dirty_last_ - dirty_first_ + 1) * slot_size * sizeof(float);
+
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glBufferSubData(GL_ARRAY_BUFFER, dirty_first_ * slot_size * sizeof(float), bytes,
+                      instance_data_ + dirty_first_ * slot_size);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      dirty_first_ = capacity_;
+      dirty_last_ = -1;
+
+      return bytes;
+    }
+
+    /**
+     * Render TextSet
+     *
+     * @param camera_
+     */
+    virtual void render(Camera<float>& camera_){
+
+      check_GL_error("TextSet::render() enter");
+
+      // Anything that wasn't flushed by a scheduler
+      flush_upload();
+
+      if(count_ < 1){
+        return;
+      }
+
+      glUseProgram(program_);
+      glBindVertexArray(vao);
+
+      atlas_->bind();
+
+      glUniform1i(samplerHandle_, atlas_->tex_unit_);
+      glUniform1f(opacityHandle_, global_opacity_);
+
+      glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count_ * max_glyphs_);
+
+      glBindVertexArray(0);
+      check_GL_error("TextSet::render() exit");
     }
   };
 
@@ -2184,21 +4832,15 @@ namespace msg{
     // Position Attribute
     GLuint positionHandle_;
 
-    // Uniform handles
-    GLint mvpHandle_;
-
-    GLint solidColorHandle_;
-    GLint offsetHandle_;
-    GLint radiusHandle_;
-
-
-    // camera up world
-    GLint cameraUpHandle_;
-    GLint cameraEyeHandle_;
-    GLint cameraRightHandle_;
+    // Uniform handles, the camera and object come from uniform blocks
+    GLint colorSamplerHandle_;
 
+    float color_[4] = {1.0f, 1.0f, 1.0f, 1.0f};
 
-    GLint colorSamplerHandle_;
+    TexturedSphere(){
+      // The limb is anti-aliased with alpha
+      pass_ = PASS_TRANSPARENT;
+    }
 
     virtual bool init_resources() {
 //      std::cout<<"TexturedSphere::init_resources()"<<std::endl;
@@ -2207,29 +4849,18 @@ namespace msg{
       Billboard::init_resources();
 
       /**
-       * Build programs
+       * Build programs, shared by all the TexturedSpheres
        */
-      program_ = glCreateProgram();
+      program_ = ProgramCache::acquire("TextureSphereProgram", vert_shader, frag_shader);
 
-      if(!build_program(program_, "TextureSphereProgram",
-                        vert_shader.c_str(), frag_shader.c_str())){
+      if(program_ == 0){
         return false;
       }
 
       positionHandle_ = glGetAttribLocation(program_, "position_in_");
 
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
-
-      solidColorHandle_ = glGetUniformLocation(program_, "solid_color_");
-      radiusHandle_ = glGetUniformLocation(program_, "radius_");
-      offsetHandle_ = glGetUniformLocation(program_, "offset_");
-
       colorSamplerHandle_ = glGetUniformLocation(program_, "color_sampler_");
 
-      cameraUpHandle_ = glGetUniformLocation(program_, "camera_up_world_");
-      cameraEyeHandle_ = glGetUniformLocation(program_, "camera_eye_world_");
-      cameraRightHandle_ = glGetUniformLocation(program_, "camera_right_world_");
-
       setup_array(positionHandle_);
 
       /**
@@ -2254,7 +4885,7 @@ namespace msg{
 
     void cleanup() {
       glDeleteTextures(1, &tex_);
-      glDeleteProgram(program_);
+      ProgramCache::release(program_);
 
       Billboard::cleanup();
     }
@@ -2286,9 +4917,6 @@ namespace msg{
 
       glGenerateMipmap(GL_TEXTURE_2D);
 
-      // Need to have this here otherwise the caller can change buffer while we are editing it
-      glFlush();
-
       check_GL_error("TexturedSphere::init_from_file - exit");
       return true;
     }
@@ -2297,18 +4925,31 @@ namespace msg{
 //      std::cout<<"TexturedSphere::render() "<<radius<<std::endl;
 
       glUseProgram(program_);
-      glUniformMatrix4fv(mvpHandle_, 1, GL_FALSE, camera.mvp);
+      glBindVertexArray(vao);
+
+      TexturedSphere::draw(camera);
+    }
+
+    virtual void enqueue(RenderQueue &queue, Camera<float> &camera){
+
+      RenderState state;
+      state.pass = pass_;
+      state.program = program_;
+      state.texture = tex_;
+      state.tex_unit = tex_unit_;
+      state.vao = vao;
+
+      queue.push(this, camera, state);
+    }
 
-      glUniform3fv(cameraEyeHandle_, 1, camera.eye_world);
-      glUniform3fv(cameraUpHandle_, 1, camera.up_world);
-      glUniform3fv(cameraRightHandle_, 1, camera.right_world);
+    virtual void draw(Camera<float>& camera){
 
       glUniform1i(colorSamplerHandle_, tex_unit_);
-      glUniform1f(radiusHandle_, radius);
-      glUniform3fv(offsetHandle_, 1, position);
 
-      Billboard::render(camera);
+      object_.update(0, color_, world_position(), radius);
+      object_.bind();
 
+      Billboard::draw(camera);
     }
 
   };
@@ -2346,20 +4987,14 @@ namespace msg{
     // Position Attribute
     GLuint positionHandle_;
 
-    // Uniform handles
-    GLint mvpHandle_;
-
-    // World view
-    GLint cameraUpHandle_;
-    GLint cameraEyeHandle_;
-    GLint cameraRightHandle_;
-
-    GLint colorHandle_;
-    GLint offsetHandle_;
-    GLint radiusHandle_;
+    // The camera, color, offset and radius come from uniform blocks
 
     GLint colorSamplerHandle_;
 
+    ProceduralSphere(){
+      // Soft edged clouds and nebulae
+      pass_ = PASS_TRANSPARENT;
+    }
 
     virtual bool init_resources() {
       check_GL_error("ProceduralSphere::init_resources() entry");
@@ -2367,34 +5002,23 @@ namespace msg{
       Billboard::init_resources();
 
       /**
-       * Build programs
+       * Build programs, shared by the spheres with the same shaders
        */
-      program_ = glCreateProgram();
+      program_ = ProgramCache::acquire("ProceduralSphereProgram", vert_shader, frag_shader);
 
-      if(!build_program(program_, "ProceduralSphereProgram",
-                        vert_shader.c_str(), frag_shader.c_str())){
+      if(program_ == 0){
         return false;
       }
 
       positionHandle_ = glGetAttribLocation(program_, "position_in_");
 
-      mvpHandle_ = glGetUniformLocation(program_, "mvp_");
-
-      cameraUpHandle_ = glGetUniformLocation(program_, "camera_up_world_");
-      cameraEyeHandle_ = glGetUniformLocation(program_, "camera_eye_world_");
-      cameraRightHandle_ = glGetUniformLocation(program_, "camera_right_world_");
-
-      colorHandle_ = glGetUniformLocation(program_, "C_base");
-      radiusHandle_ = glGetUniformLocation(program_, "radius_");
-      offsetHandle_ = glGetUniformLocation(program_, "offset_");
-
       setup_array(positionHandle_);
 
       return check_GL_error("TexturedSphere::init_resources() exit");
     }
 
     void cleanup() {
-      glDeleteProgram(program_);
+      ProgramCache::release(program_);
 
       Billboard::cleanup();
     }
@@ -2406,19 +5030,29 @@ namespace msg{
       check_GL_error("ProceduralSphere::render() enter");
 #endif
       glUseProgram(program_);
-      glUniformMatrix4fv(mvpHandle_, 1, GL_FALSE, camera.mvp);
-
-      glUniform3fv(cameraEyeHandle_, 1, camera.eye_world);
-      glUniform3fv(cameraUpHandle_, 1, camera.up_world);
-      glUniform3fv(cameraRightHandle_, 1, camera.right_world);
+      glBindVertexArray(vao);
 
-      glUniform1f(radiusHandle_, radius);
-      glUniform3fv(offsetHandle_, 1, position);
-      glUniform4fv(colorHandle_, 1, color_);
+      ProceduralSphere::draw(camera);
 
       check_GL_error("ProceduralSphere::render() exit");
+    }
+
+    virtual void enqueue(RenderQueue &queue, Camera<float> &camera){
+
+      RenderState state;
+      state.pass = pass_;
+      state.program = program_;
+      state.vao = vao;
+
+      queue.push(this, camera, state);
+    }
+
+    virtual void draw(Camera<float>& camera){
+
+      object_.update(0, color_, world_position(), radius);
+      object_.bind();
 
-      Billboard::render(camera);
+      Billboard::draw(camera);
     }
 
   };
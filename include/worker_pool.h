@@ -0,0 +1,128 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Pool of worker threads shared by the lab engines. No Qt or
+ * OpenGL dependencies.
+ *
+ */
+
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ *
+ * Threads that stay alive between jobs. Starting new threads for every job
+ * costs about as much as the N-body forces of a few hundred bodies or a
+ * small lensing field. WorkerPool::run hands the same job to every thread,
+ * the job splits the work up itself (c.f. NBody and LensingEngine).
+ *
+ */
+struct WorkerPool{
+
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+
+  // Job of the current run, valid while running_ > 0
+  const std::function<void()> *job_ = nullptr;
+
+  // Incremented for every run so each thread takes each job once
+  long generation_ = 0;
+
+  int running_ = 0;
+
+  bool stop_ = false;
+
+  explicit WorkerPool(int size){
+    for(int i = 0; i < size; ++i){
+      threads_.push_back(std::thread([this](){ loop(); }));
+    }
+  }
+
+  ~WorkerPool(){
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+
+    start_.notify_all();
+
+    for(std::thread &t : threads_){
+      t.join();
+    }
+  }
+
+  int size() const{
+    return int(threads_.size());
+  }
+
+  /**
+   * WorkerPool::run
+   *
+   * Run job on all the threads and the caller, returns once they are done
+   *
+   * @param job
+   */
+  void run(const std::function<void()> &job){
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &job;
+      running_ = size();
+      ++generation_;
+    }
+
+    start_.notify_all();
+
+    job();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this](){ return running_ == 0; });
+    job_ = nullptr;
+  }
+
+private:
+
+  void loop(){
+
+    long generation = 0;
+
+    for(;;){
+      const std::function<void()> *job;
+
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&](){ return stop_ || (generation_ != generation); });
+
+        if(stop_){
+          return;
+        }
+
+        generation = generation_;
+        job = job_;
+      }
+
+      (*job)();
+
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      if(--running_ == 0){
+        done_.notify_one();
+      }
+    }
+  }
+};
+
+#endif // WORKER_POOL_H
@@ -20,10 +20,18 @@ INCLUDEPATH += ../include \
 
 SOURCES += kepler_scene_graph.cpp \
            kepler_gui.cpp \
+           kepler_atlas_widget.cpp \
            ../contrib/src/glew.cpp
 
 
-HEADERS  += kepler_scene_graph.h \
+HEADERS  += kepler_orbit.h \
+            kepler_orbit_cache.h \
+            kepler_orbit_worker.h \
+            kepler_orbit_batch.h \
+            kepler_nbody.h \
+            kepler_orbit_atlas.h \
+            kepler_atlas_widget.h \
+            kepler_scene_graph.h \
             kepler_gui.h
 
 FORMS    += kepler.ui
@@ -0,0 +1,270 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Orbit map window
+ *
+ */
+
+#include "kepler_atlas_widget.h"
+
+#include <cmath>
+
+#include <QCloseEvent>
+#include <QMouseEvent>
+#include <QPainter>
+
+KeplerAtlasWidget::KeplerAtlasWidget(QWidget *parent)
+    : QWidget(parent, Qt::Window),
+      atlas_(180, 90){
+
+  ready_ = false;
+
+  setWindowTitle("Orbit Map");
+  setMinimumSize(480, 360);
+
+  mode_box_ = new QComboBox(this);
+  mode_box_->addItem("Orbit Type");
+  mode_box_->addItem("Period");
+  mode_box_->addItem("Eccentricity");
+  mode_box_->move(margin_left_, 5);
+
+  connect(mode_box_, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+          [this](int){
+            buildImage();
+            update();
+          });
+}
+
+KeplerAtlasWidget::~KeplerAtlasWidget(){
+
+  atlas_.cancel_ = true;
+
+  if(thread_.joinable()){
+    thread_.join();
+  }
+}
+
+void KeplerAtlasWidget::setLaunch(float angle_degrees, float velocity){
+
+  angle_ = angle_degrees;
+  velocity_ = velocity;
+
+  update();
+}
+
+/**
+ * A new range invalidates the atlas, it is recomputed right away if the
+ * window is showing and otherwise the next time it is shown. The velocity
+ * axis cannot change under a running computation so that one is cancelled
+ * and restarted when it stops.
+ */
+void KeplerAtlasWidget::setVelocityMax(float v_max){
+
+  if(computing_){
+    pending_v_max_ = v_max;
+    atlas_.cancel_ = true;
+    return;
+  }
+
+  if(v_max == atlas_.v_max_){
+    return;
+  }
+
+  atlas_.v_max_ = v_max;
+  ready_ = false;
+
+  if(isVisible()){
+    startCompute();
+  }
+}
+
+/**
+ * The atlas is computed the first time the window is shown and again after
+ * the velocity range changed while it was hidden
+ */
+void KeplerAtlasWidget::showEvent(QShowEvent *){
+
+  if(!ready_ && !computing_){
+    startCompute();
+  }
+}
+
+void KeplerAtlasWidget::closeEvent(QCloseEvent *event){
+  emit closed();
+  event->accept();
+}
+
+/**
+ *
+ * KeplerAtlasWidget::startCompute
+ *
+ * Compute the atlas on a worker thread (which spreads it over all cores) and
+ * poll for the result from the GUI thread.
+ *
+ */
+void KeplerAtlasWidget::startCompute(){
+
+  computing_ = true;
+  atlas_.cancel_ = false;
+
+  thread_ = std::thread([this](){
+    atlas_.compute();
+    ready_ = true;
+  });
+
+  timer_id_ = startTimer(50);
+}
+
+void KeplerAtlasWidget::timerEvent(QTimerEvent *){
+
+  if(!ready_){
+    return;
+  }
+
+  killTimer(timer_id_);
+  thread_.join();
+  computing_ = false;
+
+  if(pending_v_max_ > 0.0f){
+    atlas_.v_max_ = pending_v_max_;
+    pending_v_max_ = 0.0f;
+    ready_ = false;
+    startCompute();
+    return;
+  }
+
+  buildImage();
+  update();
+}
+
+/**
+ *
+ * KeplerAtlasWidget::buildImage
+ *
+ * Color the atlas for the selected mode, one pixel per launch
+ *
+ */
+void KeplerAtlasWidget::buildImage(){
+
+  using namespace std;
+
+  if(!ready_ || computing_){
+    return;
+  }
+
+  image_ = QImage(atlas_.theta_count_, atlas_.v_count_, QImage::Format_RGB32);
+
+  // Periods are shown on a log scale between 0.1 and 100 years
+  const float log_period_min = -1.0f;
+  const float log_period_max = 2.0f;
+
+  int mode = mode_box_->currentIndex();
+
+  for(int iy = 0; iy < atlas_.v_count_; ++iy){
+
+    // Row 0 of the image is the top (largest velocity)
+    QRgb *line = reinterpret_cast<QRgb *>(image_.scanLine(atlas_.v_count_ - 1 - iy));
+
+    for(int ix = 0; ix < atlas_.theta_count_; ++ix){
+
+      int i = iy * atlas_.theta_count_ + ix;
+      int outcome = atlas_.outcome_[i];
+
+      QColor color(40, 40, 40);
+
+      if(mode == MAP_OUTCOME){
+        switch(outcome){
+          case ORBIT_CLOSED:
+            color = QColor(60, 160, 255);
+            break;
+          case ORBIT_COLLISION:
+            color = QColor(255, 120, 0);
+            break;
+          case ORBIT_ESCAPED:
+            color = QColor(200, 0, 200);
+            break;
+          default:
+            color = QColor(120, 120, 120);
+        }
+      }else if(mode == MAP_PERIOD){
+        if(outcome == ORBIT_CLOSED){
+          float s = (log10(max(1e-3f, atlas_.period_[i])) - log_period_min) / (log_period_max - log_period_min);
+          s = min(1.0f, max(0.0f, s));
+          color = QColor::fromHsvF(0.66 * (1.0 - s), 0.9, 1.0);
+        }
+      }else{
+        float s = min(1.0f, max(0.0f, atlas_.eccentricity_[i]));
+        color = QColor::fromHsvF(0.66 * (1.0 - s), 0.9, outcome == ORBIT_CLOSED ? 1.0 : 0.5);
+      }
+
+      line[ix] = color.rgb();
+    }
+  }
+}
+
+QRect KeplerAtlasWidget::mapRect() const{
+  return QRect(margin_left_, margin_top_,
+               width() - margin_left_ - margin_right_,
+               height() - margin_top_ - margin_bottom_);
+}
+
+void KeplerAtlasWidget::paintEvent(QPaintEvent *){
+
+  QPainter painter(this);
+  painter.fillRect(rect(), Qt::black);
+
+  QRect map = mapRect();
+
+  painter.setPen(Qt::white);
+
+  if(image_.isNull()){
+    painter.drawText(map, Qt::AlignCenter, "Computing orbits...");
+    return;
+  }
+
+  painter.drawImage(map, image_);
+
+  // Axes
+  painter.drawText(QRect(map.left(), map.bottom() + 5, map.width(), margin_bottom_ - 5),
+                   Qt::AlignHCenter | Qt::AlignTop, "Launch Angle [degrees]");
+
+  for(int angle = 0; angle <= 360; angle += 90){
+    int x = map.left() + int(map.width() * (angle - atlas_.theta_min_) / (atlas_.theta_max_ - atlas_.theta_min_));
+    painter.drawText(QRect(x - 20, map.bottom() + 2, 40, 15), Qt::AlignCenter, QString::number(angle));
+  }
+
+  for(int v = 0; v <= int(atlas_.v_max_); v += 10){
+    int y = map.bottom() - int(map.height() * (v - atlas_.v_min_) / (atlas_.v_max_ - atlas_.v_min_));
+    painter.drawText(QRect(0, y - 8, margin_left_ - 5, 16), Qt::AlignRight | Qt::AlignVCenter,
+                     QString::number(v) + " km/s");
+  }
+
+  // Current launch
+  float angle = std::fmod(angle_ + 360.0f, 360.0f);
+
+  int x = map.left() + int(map.width() * (angle - atlas_.theta_min_) / (atlas_.theta_max_ - atlas_.theta_min_));
+  int y = map.bottom() - int(map.height() * (velocity_ - atlas_.v_min_) / (atlas_.v_max_ - atlas_.v_min_));
+
+  painter.setPen(QPen(Qt::white, 2));
+  painter.drawLine(x - 8, y, x + 8, y);
+  painter.drawLine(x, y - 8, x, y + 8);
+}
+
+/**
+ * Pick the launch under the mouse
+ */
+void KeplerAtlasWidget::mousePressEvent(QMouseEvent *event){
+
+  QRect map = mapRect();
+
+  if(!map.contains(event->pos())){
+    return;
+  }
+
+  float angle = atlas_.theta_min_ + (atlas_.theta_max_ - atlas_.theta_min_) * (event->x() - map.left()) / map.width();
+  float velocity = atlas_.v_min_ + (atlas_.v_max_ - atlas_.v_min_) * (map.bottom() - event->y()) / map.height();
+
+  emit launch_selected(angle, velocity);
+}
@@ -0,0 +1,105 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Orbit map window. Shows the outcome of every launch over
+ * launch angle and velocity as a heat map (orbit type, period or
+ * eccentricity), clicking on the map picks that launch.
+ *
+ */
+
+
+#ifndef KEPLER_ATLAS_WIDGET_H
+#define KEPLER_ATLAS_WIDGET_H
+
+#include <atomic>
+#include <thread>
+
+#include <QImage>
+#include <QtWidgets/QComboBox>
+#include <QtWidgets/QWidget>
+
+#include "kepler_orbit_atlas.h"
+
+class KeplerAtlasWidget : public QWidget {
+Q_OBJECT
+
+public:
+  explicit KeplerAtlasWidget(QWidget *parent = 0);
+
+  ~KeplerAtlasWidget();
+
+  /**
+   * Move the marker for the current launch
+   *
+   * @param angle_degrees
+   * @param velocity [km/s]
+   */
+  void setLaunch(float angle_degrees, float velocity);
+
+  /**
+   * Velocity range of the map, recomputes the atlas if it changes
+   *
+   * @param v_max [km/s]
+   */
+  void setVelocityMax(float v_max);
+
+signals:
+  void launch_selected(float angle_degrees, float velocity);
+
+  void closed();
+
+protected:
+  void showEvent(QShowEvent *event);
+
+  void closeEvent(QCloseEvent *event);
+
+  void paintEvent(QPaintEvent *event);
+
+  void mousePressEvent(QMouseEvent *event);
+
+  void timerEvent(QTimerEvent *event);
+
+private:
+  void startCompute();
+
+  void buildImage();
+
+  QRect mapRect() const;
+
+private:
+
+  // What the heat map shows
+  enum MapMode{
+    MAP_OUTCOME = 0,
+    MAP_PERIOD,
+    MAP_ECCENTRICITY
+  };
+
+  OrbitAtlas atlas_;
+
+  // The atlas is computed off the GUI thread
+  std::thread thread_;
+  std::atomic<bool> ready_;
+  bool computing_ = false;
+
+  // Velocity range requested while computing, 0 for none [km/s]
+  float pending_v_max_ = 0.0f;
+  int timer_id_ = 0;
+
+  QImage image_;
+  QComboBox *mode_box_ = nullptr;
+
+  // Current launch
+  float angle_ = 0.0f;
+  float velocity_ = 0.0f;
+
+  // Margins around the map for the axes [pixels]
+  const int margin_left_ = 60;
+  const int margin_bottom_ = 40;
+  const int margin_top_ = 40;
+  const int margin_right_ = 10;
+};
+
+#endif // KEPLER_ATLAS_WIDGET_H
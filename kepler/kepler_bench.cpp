@@ -0,0 +1,481 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Headless benchmark for the Kepler lab orbit integrator.
+ * Runs Orbit::calculate_orbit over a sweep of launch angles and velocities
+ * and reports throughput and energy conservation so integrator changes can
+ * be compared between releases without going through the GUI. Every
+ * integrator policy is run with its default number of sub-steps, followed
+ * by the adaptive Dormand-Prince mode and the analytic conic mode. The
+ * analytic mode is cross-checked against the adaptive integrator.
+ *
+ * Finally the orbit atlas grid is timed with the batched SIMD integrator
+ * against one Orbit::calculate_orbit call per grid point, and the N-body
+ * mode's Barnes-Hut forces are compared with direct summation.
+ *
+ * Usage: astrolabs_kepler_bench [repeats]
+ *
+ */
+
+#include "kepler_orbit.h"
+#include "kepler_nbody.h"
+#include "kepler_orbit_atlas.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+/**
+ * Orbit::calculate_orbit modes
+ */
+enum BenchMode{
+  BENCH_FIXED = 0,
+  BENCH_ADAPTIVE,
+  BENCH_ANALYTIC
+};
+
+/**
+ * Results for a single launch configuration
+ */
+struct BenchResult {
+
+  float theta_degrees = 0.0f;
+  float velocity = 0.0f;
+
+  int element_count = 0;
+  long sub_steps = 0;
+
+  double seconds = 0.0;
+
+  // max |E_i - E_0| / |E_0| over the orbit
+  double energy_drift = 0.0;
+
+  bool closed = false;
+  bool collision = false;
+  bool escaped = false;
+
+  // max distance to the reference orbit over the common elements [AU]
+  double reference_error = 0.0;
+};
+
+/**
+ *
+ * Compute the relative energy drift over all computed elements
+ *
+ * @param orbit
+ * @return
+ */
+template <class OrbitType>
+double energy_drift(const OrbitType &orbit){
+
+  using namespace std;
+
+  if(orbit.element_count_ <= 0){
+    return 0.0;
+  }
+
+  double E_0 = orbit.energy(0);
+  double drift = 0.0;
+
+  for(int i = 1; i < orbit.element_count_; ++i){
+    drift = max(drift, fabs(double(orbit.energy(i)) - E_0));
+  }
+
+  return drift / max(fabs(E_0), 1e-12);
+}
+
+/**
+ *
+ * Largest distance between matching elements of two orbits
+ *
+ * @param orbit
+ * @param reference
+ * @return
+ */
+template <class OrbitType>
+double position_error(const OrbitType &orbit, const OrbitType &reference){
+
+  using namespace std;
+
+  double error = 0.0;
+
+  for(int i = 0; i < min(orbit.element_count_, reference.element_count_); ++i){
+    double dx = orbit.elements_->x(i) - reference.elements_->x(i);
+    double dy = orbit.elements_->y(i) - reference.elements_->y(i);
+    error = max(error, sqrt(dx * dx + dy * dy));
+  }
+
+  return error;
+}
+
+/**
+ *
+ * Time a single launch configuration
+ *
+ * @param orbit
+ * @param theta_degrees
+ * @param velocity [km/s]
+ * @param repeats
+ * @return
+ */
+template <class OrbitType>
+BenchResult run_case(OrbitType &orbit, float theta_degrees, float velocity, int repeats){
+
+  using namespace std;
+  using namespace std::chrono;
+
+  BenchResult result;
+  result.theta_degrees = theta_degrees;
+  result.velocity = velocity;
+
+  float theta = float(M_PI * theta_degrees / 180.0);
+
+  steady_clock::time_point start = steady_clock::now();
+
+  for(int i = 0; i < repeats; ++i){
+    orbit.calculate_orbit(theta, velocity);
+  }
+
+  result.seconds = duration<double>(steady_clock::now() - start).count() / repeats;
+
+  result.element_count = orbit.element_count_;
+  result.sub_steps = orbit.sub_step_count_;
+  result.closed = orbit.closed_;
+  result.collision = orbit.collision_;
+  result.escaped = orbit.escaped_;
+  result.energy_drift = energy_drift(orbit);
+
+  return result;
+}
+
+/**
+ *
+ * Run the full launch sweep with one integrator policy and print the results
+ *
+ * @param repeats
+ * @param mode Fixed steps with the policy, adaptive or analytic
+ */
+template <class Integrator>
+void run_sweep(int repeats, BenchMode mode = BENCH_FIXED){
+
+  using namespace std;
+
+  // Sweep, matches the ranges allowed by the GUI (c.f. KeplerScene::v_max_)
+  const float theta_min = 0.0f;
+  const float theta_max = 360.0f;
+  const float theta_step = 30.0f;
+
+  const float v_min = 10.0f;
+  const float v_max = 45.0f;
+  const float v_step = 5.0f;
+
+  Orbit<float, Integrator> orbit;
+  orbit.adaptive_ = (mode == BENCH_ADAPTIVE);
+  orbit.analytic_ = (mode == BENCH_ANALYTIC);
+
+  // Analytic orbits are checked against the adaptive integrator
+  Orbit<float, Integrator> reference;
+  reference.adaptive_ = true;
+
+  const char *name = mode == BENCH_ANALYTIC ? "Conic" :
+                     (mode == BENCH_ADAPTIVE ? DormandPrince45<float>::name() : Integrator::name());
+
+  if(mode == BENCH_ANALYTIC){
+    cout << endl << name << ": analytic, one Kepler equation solution per sub-step" << endl;
+  }else if(mode == BENCH_ADAPTIVE){
+    cout << endl << name << ": adaptive, rtol " << orbit.rtol_ << ", "
+         << DormandPrince45<float>::force_evaluations << " force evaluations per sub-step" << endl;
+  }else{
+    cout << endl << name << ": " << orbit.sub_steps_ << " sub-steps per step, "
+         << Integrator::force_evaluations << " force evaluations per sub-step" << endl;
+  }
+
+  cout << setw(8) << "theta" << setw(8) << "v"
+       << setw(10) << "steps" << setw(12) << "sub-steps"
+       << setw(12) << "ms" << setw(14) << "steps/s"
+       << setw(12) << "ns/sub" << setw(14) << "dE/E"
+       << setw(10) << "state" << endl;
+
+  long total_steps = 0;
+  long total_sub_steps = 0;
+  double total_seconds = 0.0;
+  double max_drift_closed = 0.0;
+  double max_reference_error = 0.0;
+  int closed_count = 0;
+  int state_mismatch_count = 0;
+
+  cout << fixed;
+
+  for(float theta = theta_min; theta < theta_max; theta += theta_step){
+    for(float v = v_min; v <= v_max; v += v_step){
+
+      BenchResult r = run_case(orbit, theta, v, repeats);
+
+      if(mode == BENCH_ANALYTIC){
+        reference.calculate_orbit(float(M_PI * theta / 180.0), v);
+
+        r.reference_error = position_error(orbit, reference);
+        max_reference_error = max(max_reference_error, r.reference_error);
+
+        if((r.closed != reference.closed_) || (r.collision != reference.collision_) ||
+           (r.escaped != reference.escaped_)){
+          ++state_mismatch_count;
+        }
+      }
+
+      const char *state = r.collision ? "crash" : (r.closed ? "closed" : (r.escaped ? "escaped" : "open"));
+
+      cout << setprecision(1) << setw(8) << r.theta_degrees << setw(8) << r.velocity
+           << setw(10) << r.element_count << setw(12) << r.sub_steps
+           << setprecision(3) << setw(12) << 1000.0 * r.seconds
+           << setprecision(0) << setw(14) << r.element_count / r.seconds
+           << setprecision(2) << setw(12) << 1e9 * r.seconds / max(1L, r.sub_steps)
+           << scientific << setprecision(3) << setw(14) << r.energy_drift << fixed
+           << setw(10) << state << endl;
+
+      total_steps += r.element_count;
+      total_sub_steps += r.sub_steps;
+      total_seconds += r.seconds;
+
+      if(r.closed){
+        max_drift_closed = max(max_drift_closed, r.energy_drift);
+        ++closed_count;
+      }
+    }
+  }
+
+  cout << endl
+       << name << " total time      : " << setprecision(3) << 1000.0 * total_seconds << " ms" << endl
+       << name << " steps/s         : " << setprecision(0) << total_steps / total_seconds << endl
+       << name << " ns per sub-step : " << setprecision(2)
+       << 1e9 * total_seconds / max(1L, total_sub_steps) << endl
+       << name << " max dE/E closed : " << scientific << setprecision(3) << max_drift_closed
+       << " (" << closed_count << " closed orbits)" << endl;
+
+  if(mode == BENCH_ANALYTIC){
+    cout << name << " max |dr| vs " << DormandPrince45<float>::name() << " : " << max_reference_error << " AU, "
+         << state_mismatch_count << " termination mismatches" << endl;
+  }
+
+  cout.unsetf(ios::floatfield);
+}
+
+/**
+ *
+ * Time the orbit atlas: batched on one thread, batched on all cores and
+ * one scalar calculate_orbit per grid point.
+ *
+ * @param theta_count
+ * @param v_count
+ */
+void run_atlas(int theta_count, int v_count){
+
+  using namespace std;
+  using namespace std::chrono;
+
+  OrbitAtlas atlas(theta_count, v_count);
+
+  cout << endl << "Atlas: " << theta_count << " x " << v_count << " launches, "
+       << OrbitAtlas::Batch::lanes_ << " lanes per batch, SSE " << KEPLER_USE_SSE << endl;
+
+  steady_clock::time_point start = steady_clock::now();
+  atlas.compute(1);
+  double batch_seconds = duration<double>(steady_clock::now() - start).count();
+
+  int thread_count = max(1, int(thread::hardware_concurrency()));
+
+  // Not repeated on a single core
+  double threaded_seconds = 0.0;
+
+  if(thread_count > 1){
+    start = steady_clock::now();
+    atlas.compute(thread_count);
+    threaded_seconds = duration<double>(steady_clock::now() - start).count();
+  }
+
+  // Same grid, same integrator, step limit and termination rules (collision
+  // checked every sub-step, closure on the upward zero of (r - r_0) . v_0),
+  // one orbit at a time. The outcomes should all match.
+  Orbit<float, Yoshida4<float> > orbit(atlas.steps_max_);
+  orbit.view_bound_ = atlas.view_bound_;
+
+  int mismatch_count = 0;
+
+  start = steady_clock::now();
+
+  for(int iy = 0; iy < v_count; ++iy){
+    for(int ix = 0; ix < theta_count; ++ix){
+      orbit.calculate_orbit(float(M_PI * atlas.theta(ix) / 180.0), atlas.velocity(iy));
+
+      int outcome = orbit.collision_ ? ORBIT_COLLISION :
+                    (orbit.closed_ ? ORBIT_CLOSED : (orbit.escaped_ ? ORBIT_ESCAPED : ORBIT_UNRESOLVED));
+
+      if(outcome != atlas.outcome_[iy * theta_count + ix]){
+        ++mismatch_count;
+      }
+    }
+  }
+
+  double scalar_seconds = duration<double>(steady_clock::now() - start).count();
+
+  int count = theta_count * v_count;
+
+  cout << fixed << setprecision(3)
+       << "Atlas batched, 1 thread   : " << 1000.0 * batch_seconds << " ms ("
+       << setprecision(0) << count / batch_seconds << " orbits/s)" << endl;
+
+  if(thread_count > 1){
+    cout << setprecision(3)
+         << "Atlas batched, " << thread_count << " threads  : " << 1000.0 * threaded_seconds << " ms ("
+         << setprecision(0) << count / threaded_seconds << " orbits/s)" << endl;
+  }
+
+  cout << setprecision(3)
+       << "Atlas scalar calculate_orbit: " << 1000.0 * scalar_seconds << " ms ("
+       << setprecision(0) << count / scalar_seconds << " orbits/s), "
+       << mismatch_count << " outcome mismatches" << endl;
+
+  cout.unsetf(ios::floatfield);
+}
+
+/**
+ *
+ * run_nbody
+ *
+ * Time one force evaluation of an asteroid ring with the Barnes-Hut tree
+ * and with direct summation, then integrate the ring for a season and
+ * report the energy drift.
+ *
+ * @param count Number of bodies
+ */
+void run_nbody(int count){
+
+  using namespace std;
+  using namespace std::chrono;
+
+  // Heavy asteroids so the mutual forces are not lost in the Sun's
+  NBody<double, Yoshida4<double> > nbody;
+  nbody.add_ring(count, 1.6, 3.2, 1e-6);
+
+  int n = nbody.size();
+  int evaluations = max(1, 16384 / n);
+
+  vector<double> a_tree(2 * n), a_direct(2 * n);
+
+  steady_clock::time_point start = steady_clock::now();
+  for(int i = 0; i < evaluations; ++i){
+    nbody.accelerations(nbody.r_.data(), a_tree.data());
+  }
+  double tree_seconds = duration<double>(steady_clock::now() - start).count() / evaluations;
+
+  double theta = nbody.theta_;
+  nbody.theta_ = 0.0;
+
+  start = steady_clock::now();
+  for(int i = 0; i < evaluations; ++i){
+    nbody.accelerations(nbody.r_.data(), a_direct.data());
+  }
+  double direct_seconds = duration<double>(steady_clock::now() - start).count() / evaluations;
+
+  nbody.theta_ = theta;
+
+  // Error of the mutual part only, the Sun's pull is the same in both
+  nbody.central_mass_ = 0.0;
+  nbody.accelerations(nbody.r_.data(), a_tree.data());
+  nbody.theta_ = 0.0;
+  nbody.accelerations(nbody.r_.data(), a_direct.data());
+  nbody.theta_ = theta;
+  nbody.central_mass_ = 1.0;
+
+  // Relative to the rms acceleration, single bodies can have almost no net pull
+  double error_sq = 0.0;
+  double a_sq = 0.0;
+
+  for(int i = 0; i < 2 * n; ++i){
+    error_sq += (a_tree[i] - a_direct[i]) * (a_tree[i] - a_direct[i]);
+    a_sq += a_direct[i] * a_direct[i];
+  }
+
+  double E_0 = nbody.energy();
+  nbody.advance(0.25, 1.0 / 365.25);
+  double drift = fabs((nbody.energy() - E_0) / E_0);
+
+  cout << "N-body " << setw(5) << n << " bodies: tree " << fixed << setprecision(3)
+       << 1000.0 * tree_seconds << " ms, direct " << 1000.0 * direct_seconds
+       << " ms per evaluation, " << scientific << setprecision(2)
+       << sqrt(error_sq / a_sq) << " rms relative error (mutual), "
+       << drift << " energy drift over 0.25 yr" << endl;
+
+  cout.unsetf(ios::floatfield);
+}
+
+/**
+ *
+ * run_binary
+ *
+ * An isolated equal mass binary one AU apart has a period of exactly one
+ * year, integrate it for ten and report how far it is from where it started
+ * and the energy drift.
+ *
+ * @param steps_per_year
+ */
+void run_binary(int steps_per_year){
+
+  using namespace std;
+
+  NBody<double, Yoshida4<double> > nbody;
+  // No softening, it would lengthen the period
+  nbody.central_mass_ = 0.0;
+  nbody.softening_sq_ = 0.0;
+  nbody.add_binary(0.0, 0.0, 0.5, 0.5, 1.0);
+
+  double x_0 = nbody.r_[2] - nbody.r_[0];
+  double y_0 = nbody.r_[3] - nbody.r_[1];
+
+  double E_0 = nbody.energy();
+  nbody.advance(10.0, 1.0 / steps_per_year);
+
+  double dx = nbody.r_[2] - nbody.r_[0] - x_0;
+  double dy = nbody.r_[3] - nbody.r_[1] - y_0;
+
+  cout << "Binary " << setw(4) << steps_per_year << " steps/yr: " << scientific << setprecision(2)
+       << sqrt(dx * dx + dy * dy) << " AU from the start after 10 periods, "
+       << fabs((nbody.energy() - E_0) / E_0) << " energy drift" << endl;
+
+  cout.unsetf(ios::floatfield);
+}
+
+int main(int argc, char *argv[]){
+
+  using namespace std;
+
+  int repeats = argc > 1 ? max(1, atoi(argv[1])) : 3;
+
+  cout << "Kepler orbit benchmark: " << repeats << " repeats per configuration" << endl;
+
+  run_sweep<VelocityVerlet<float> >(repeats);
+  run_sweep<Yoshida4<float> >(repeats);
+  run_sweep<RungeKutta4<float> >(repeats);
+  run_sweep<Yoshida4<float> >(repeats, BENCH_ADAPTIVE);
+  run_sweep<Yoshida4<float> >(repeats, BENCH_ANALYTIC);
+
+  run_atlas(180, 90);
+
+  cout << endl;
+
+  for(int count = 256; count <= 4096; count *= 4){
+    run_nbody(count);
+  }
+
+  cout << endl;
+
+  run_binary(100);
+  run_binary(365);
+
+  return 0;
+}
@@ -13,6 +13,7 @@
 #include <QtWidgets/QApplication>
 
 #include "ui_kepler.h"
+#include "kepler_atlas_widget.h"
 #include "kepler_scene_graph.h"
 
 
@@ -69,6 +70,8 @@ KeplerLab::KeplerLab(QWidget *parent)
   ui->exitButton->setFont(font);
   ui->circleButton->setFont(font);
   ui->rulerButton->setFont(font);
+  ui->orbitMapButton->setFont(font);
+  ui->nbodyButton->setFont(font);
 
   // Fine-adjustment buttons
   ui->angleLabel->setFont(font);
@@ -84,6 +87,16 @@ KeplerLab::KeplerLab(QWidget *parent)
   ui->velocityPlusButton->setFont(font);
   ui->velocityUnitsLabel->setFont(font);
 
+  // Orbit map, computed the first time it is shown
+  atlas_widget_ = new KeplerAtlasWidget(this);
+  atlas_widget_->setVelocityMax(ui->sceneWidget->getVelocityMax());
+  atlas_widget_->setLaunch(ui->angleSpinBox->value(), ui->velocitySpinBox->value());
+
+  connect(atlas_widget_, &KeplerAtlasWidget::launch_selected, this, &KeplerLab::onOrbitMapLaunchSelected);
+  connect(atlas_widget_, &KeplerAtlasWidget::closed, [this](){
+    ui->orbitMapButton->setChecked(false);
+  });
+
   // We are animating at 60fps
   startTimer(16);
 
@@ -99,6 +112,7 @@ KeplerLab::~KeplerLab(){
  */
 void KeplerLab::on_angleSpinBox_valueChanged(double angle_degrees){
   ui->sceneWidget->setLaunchAngle(angle_degrees);
+  atlas_widget_->setLaunch(angle_degrees, ui->velocitySpinBox->value());
 }
 
 /**
@@ -109,6 +123,7 @@ void KeplerLab::on_angleSpinBox_valueChanged(double angle_degrees){
 void KeplerLab::on_velocitySpinBox_valueChanged(double value){
 //  std::cout<<"on_velocitySpinBox_valueChanged "<<value<<std::endl;
   ui->sceneWidget->setLaunchVelocity(value);
+  atlas_widget_->setLaunch(ui->angleSpinBox->value(), value);
 }
 
 /**
@@ -138,6 +153,8 @@ void KeplerLab::onVectorArrowChanged(float velocity, float angle){
 
   ui->angleSpinBox->setValue(angle_deg);
   ui->angleSpinBox->blockSignals(false);
+
+  atlas_widget_->setLaunch(angle_deg, velocity);
 }
 
 /**
@@ -279,6 +296,39 @@ void KeplerLab::on_rulerButton_toggled(bool checked){
   ui->sceneWidget->showRuler(checked);
 }
 
+void KeplerLab::on_orbitMapButton_toggled(bool checked){
+  atlas_widget_->setVisible(checked);
+}
+
+/**
+ * The next launch also brings a moon and an asteroid belt (c.f.
+ * KeplerScene::setNBodyMode)
+ */
+void KeplerLab::on_nbodyButton_toggled(bool checked){
+  ui->sceneWidget->setNBodyMode(checked);
+}
+
+/**
+ * Fires when a launch is picked on the orbit map, ignored while an orbit is
+ * running (the spin boxes are disabled then).
+ *
+ * @param angle_degrees
+ * @param velocity [km/s]
+ */
+void KeplerLab::onOrbitMapLaunchSelected(float angle_degrees, float velocity){
+
+  if(ui->sceneWidget->isValid()){
+    return;
+  }
+
+  if(angle_degrees > ui->angleSpinBox->maximum()){
+    angle_degrees -= 360.0f;
+  }
+
+  ui->angleSpinBox->setValue(angle_degrees);
+  ui->velocitySpinBox->setValue(velocity);
+}
+
 /**
  * Fires when the Run / Clear button is pressed
  */
@@ -311,7 +361,8 @@ void KeplerLab::synchronizeInterface(){
   if(ui->sceneWidget->isValid()){
     ui->runClearButton->setText("New Orbit");
 
-    if(ui->sceneWidget->isCrashed()){
+    // Sweeps need the precomputed orbit, N-body systems are only stepped
+    if(ui->sceneWidget->isCrashed() || ui->sceneWidget->isNBodyMode()){
       ui->sweepButton->setDisabled(true);
     }else{
       ui->sweepButton->setDisabled(false);
@@ -324,6 +375,7 @@ void KeplerLab::synchronizeInterface(){
     ui->velocityPlusButton->setDisabled(true);
     ui->angleMinusButton->setDisabled(true);
     ui->anglePlusButton->setDisabled(true);
+    ui->nbodyButton->setDisabled(true);
 
   }else{
     ui->runClearButton->setText("Launch");
@@ -336,6 +388,7 @@ void KeplerLab::synchronizeInterface(){
     ui->velocityPlusButton->setDisabled(false);
     ui->angleMinusButton->setDisabled(false);
     ui->anglePlusButton->setDisabled(false);
+    ui->nbodyButton->setDisabled(false);
   }
 }
 
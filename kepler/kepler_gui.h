@@ -21,6 +21,8 @@ namespace Ui {
   class KeplerLab;
 }
 
+class KeplerAtlasWidget;
+
 class KeplerLab : public QWidget {
 Q_OBJECT
 
@@ -70,6 +72,12 @@ private slots:
 
   void on_rulerButton_toggled(bool checked);
 
+  void on_orbitMapButton_toggled(bool checked);
+
+  void on_nbodyButton_toggled(bool checked);
+
+  void onOrbitMapLaunchSelected(float angle_degrees, float velocity);
+
 
   /**
    * Misc
@@ -85,6 +93,9 @@ private:
 private:
   //QTime time_;
   Ui::KeplerLab *ui;
+
+  // Orbit map window
+  KeplerAtlasWidget *atlas_widget_ = nullptr;
 };
 
 #endif // KEPLER_MAIN_H
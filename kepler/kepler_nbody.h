@@ -0,0 +1,732 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: N-body mode for the Kepler lab. Many bodies (a planet and its
+ * moon, asteroid swarms, binary stars) attract each other as well as the
+ * Sun. The mutual forces are approximated with a Barnes-Hut tree and
+ * evaluated on all cores, the bodies are advanced with the same symplectic
+ * integrator policies as Orbit. Like kepler_orbit.h this has no Qt or OpenGL
+ * dependencies.
+ *
+ */
+
+
+#ifndef KEPLER_NBODY_H
+#define KEPLER_NBODY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "kepler_orbit.h"
+#include "worker_pool.h"
+
+/**
+ *
+ * Barnes-Hut quadtree. Cells far enough away (size / distance < theta) act
+ * as a single point mass at their center of mass, which brings the cost of
+ * the forces on all bodies down from O(N^2) to O(N log N).
+ *
+ *  J. Barnes and P. Hut, Nature 324 (1986) 446
+ *
+ */
+template <class T>
+struct BarnesHutTree{
+
+  struct Node{
+
+    // Cell
+    T x_min;
+    T y_min;
+    T size;
+
+    // Mass and center of mass of everything in the cell
+    T m;
+    T x_cm;
+    T y_cm;
+
+    // First of the 4 children (they are consecutive), -1 for leaves
+    int child;
+
+    // First body in a leaf, -1 if empty (c.f. next_)
+    int body;
+  };
+
+  // Bodies closer than this are not split any further and share a leaf
+  const static int depth_max_ = 40;
+
+  // Root is node 0, children always come after their parent
+  std::vector<Node> nodes_;
+
+  // Next body in the same leaf, -1 at the end
+  std::vector<int> next_;
+
+  /**
+   *
+   * BarnesHutTree::build
+   *
+   * @param r Positions, x, y pairs
+   * @param m Masses
+   * @param n Number of bodies
+   */
+  void build(const T r[], const T m[], const int n){
+
+    using namespace std;
+
+    nodes_.clear();
+    next_.assign(n, -1);
+
+    if(n == 0){
+      return;
+    }
+
+    // Bounding square
+    T x_min = r[0], x_max = r[0];
+    T y_min = r[1], y_max = r[1];
+
+    for(int i = 1; i < n; ++i){
+      x_min = min(x_min, r[2 * i]);
+      x_max = max(x_max, r[2 * i]);
+      y_min = min(y_min, r[2 * i + 1]);
+      y_max = max(y_max, r[2 * i + 1]);
+    }
+
+    // Pad a little so bodies on the upper edge fall inside
+    T size = T(1.0001) * max(max(x_max - x_min, y_max - y_min), T(1e-6));
+
+    nodes_.reserve(2 * n + 1);
+    nodes_.push_back(make_node(x_min, y_min, size));
+
+    for(int i = 0; i < n; ++i){
+      insert(i, r);
+    }
+
+    // Children come after their parents so one backwards pass sums the masses
+    for(int k = int(nodes_.size()) - 1; k >= 0; --k){
+
+      Node &node = nodes_[k];
+
+      T m_sum = T(0);
+      T x_sum = T(0);
+      T y_sum = T(0);
+
+      if(node.child < 0){
+        for(int b = node.body; b >= 0; b = next_[b]){
+          m_sum += m[b];
+          x_sum += m[b] * r[2 * b];
+          y_sum += m[b] * r[2 * b + 1];
+        }
+      }else{
+        for(int c = node.child; c < node.child + 4; ++c){
+          m_sum += nodes_[c].m;
+          x_sum += nodes_[c].m * nodes_[c].x_cm;
+          y_sum += nodes_[c].m * nodes_[c].y_cm;
+        }
+      }
+
+      node.m = m_sum;
+
+      if(m_sum > T(0)){
+        node.x_cm = x_sum / m_sum;
+        node.y_cm = y_sum / m_sum;
+      }
+    }
+  }
+
+  /**
+   *
+   * BarnesHutTree::accelerate
+   *
+   * Add the acceleration on body i from all the other bodies to a[]
+   *
+   * @param i
+   * @param r Positions the tree was built with
+   * @param m Masses the tree was built with
+   * @param G
+   * @param softening_sq Plummer softening length squared
+   * @param theta Opening angle
+   * @param a (output) x, y
+   */
+  void accelerate(const int i, const T r[], const T m[], const T G, const T softening_sq,
+                  const T theta, T a[]) const{
+
+    if(nodes_.empty()){
+      return;
+    }
+
+    const T x = r[2 * i];
+    const T y = r[2 * i + 1];
+    const T theta_sq = theta * theta;
+
+    T a_x = T(0);
+    T a_y = T(0);
+
+    // Each visit replaces one node by at most 4
+    int stack[3 * depth_max_ + 8];
+    int top = 0;
+
+    stack[top++] = 0;
+
+    while(top > 0){
+
+      const Node &node = nodes_[stack[--top]];
+
+      if(node.m <= T(0)){
+        continue;
+      }
+
+      if(node.child < 0){
+        // Leaves are summed directly
+        for(int b = node.body; b >= 0; b = next_[b]){
+          if(b != i){
+            add_pair(x, y, r[2 * b], r[2 * b + 1], m[b], softening_sq, a_x, a_y);
+          }
+        }
+        continue;
+      }
+
+      T dx = node.x_cm - x;
+      T dy = node.y_cm - y;
+      T d_sq = dx * dx + dy * dy;
+
+      bool inside = (x >= node.x_min) && (x < node.x_min + node.size) &&
+                    (y >= node.y_min) && (y < node.y_min + node.size);
+
+      if(!inside && (node.size * node.size < theta_sq * d_sq)){
+        add_pair(x, y, node.x_cm, node.y_cm, node.m, softening_sq, a_x, a_y);
+      }else{
+        for(int c = node.child; c < node.child + 4; ++c){
+          stack[top++] = c;
+        }
+      }
+    }
+
+    a[0] += G * a_x;
+    a[1] += G * a_y;
+  }
+
+  /**
+   * Softened pull of mass m at (x_j, y_j) on (x, y), without G
+   */
+  static inline void add_pair(const T x, const T y, const T x_j, const T y_j, const T m,
+                              const T softening_sq, T &a_x, T &a_y){
+    T dx = x_j - x;
+    T dy = y_j - y;
+    T d_sq = dx * dx + dy * dy + softening_sq;
+    T inv_d = T(1) / std::sqrt(d_sq);
+    T scale = m * inv_d * inv_d * inv_d;
+
+    a_x += dx * scale;
+    a_y += dy * scale;
+  }
+
+private:
+
+  static Node make_node(const T x_min, const T y_min, const T size){
+    Node node = {x_min, y_min, size, T(0), T(0), T(0), -1, -1};
+    return node;
+  }
+
+  inline int quadrant(const Node &node, const T x, const T y) const{
+    T half = T(0.5) * node.size;
+    return int(x >= node.x_min + half) + 2 * int(y >= node.y_min + half);
+  }
+
+  /**
+   * BarnesHutTree::insert
+   *
+   * Walk down to the leaf for body b, splitting occupied leaves on the way
+   */
+  void insert(const int b, const T r[]){
+
+    const T x = r[2 * b];
+    const T y = r[2 * b + 1];
+
+    int k = 0;
+    int depth = 0;
+
+    while(true){
+
+      if(nodes_[k].child >= 0){
+        k = nodes_[k].child + quadrant(nodes_[k], x, y);
+        ++depth;
+        continue;
+      }
+
+      if(nodes_[k].body < 0){
+        nodes_[k].body = b;
+        next_[b] = -1;
+        return;
+      }
+
+      if(depth >= depth_max_){
+        next_[b] = nodes_[k].body;
+        nodes_[k].body = b;
+        return;
+      }
+
+      // Split the leaf and move its body down, then keep going
+      int old = nodes_[k].body;
+
+      T half = T(0.5) * nodes_[k].size;
+      T x_min = nodes_[k].x_min;
+      T y_min = nodes_[k].y_min;
+
+      nodes_[k].child = int(nodes_.size());
+      nodes_[k].body = -1;
+
+      for(int q = 0; q < 4; ++q){
+        nodes_.push_back(make_node(x_min + (q % 2) * half, y_min + (q / 2) * half, half));
+      }
+
+      int c = nodes_[k].child + quadrant(nodes_[k], r[2 * old], r[2 * old + 1]);
+      nodes_[c].body = old;
+      next_[old] = -1;
+    }
+  }
+};
+
+/**
+ *
+ * A set of bodies in the plane around an (optional) fixed Sun at the origin.
+ * Units are the same as Orbit: AU, years and solar masses.
+ *
+ * The Integrator must be one of the symplectic policies that take the number
+ * of components (VelocityVerlet or Yoshida4). Positions, velocities and
+ * accelerations are stored as x, y pairs so the whole system is advanced by
+ * one Integrator::step over 2 N components.
+ *
+ */
+template <class T, class Integrator = VelocityVerlet<T> >
+struct NBody{
+
+  // Gravitational Constant
+  T G_ = T(4 * M_PI * M_PI);
+
+  // Fixed point mass at the origin [solar masses], 0 for none (e.g. binaries)
+  T central_mass_ = T(1);
+
+  // Bodies that get this close to the central mass are removed [AU^2]
+  T R_sun_sq_ = T(0.01);
+
+  // Plummer softening length squared, keeps close encounters finite [AU^2]
+  T softening_sq_ = T(1e-6);
+
+  // Barnes-Hut opening angle, smaller is more accurate
+  T theta_ = T(0.5);
+
+  // Up to this many bodies the forces are summed directly
+  int direct_max_ = 64;
+
+  // Threads for the forces, 0 for one per core
+  int thread_count_ = 0;
+
+  // Bodies per work item, below two of them everything runs on the caller
+  int chunk_size_ = 128;
+
+  /**
+   * Bodies
+   */
+  std::vector<T> r_;
+  std::vector<T> v_;
+  std::vector<T> a_;
+  std::vector<T> m_;
+
+  // Bodies are removed by swapping in the last one, id_ follows them around
+  std::vector<int> id_;
+
+  int id_next_ = 0;
+
+  T t_ = T(0);
+
+  // The accelerations in a_ belong to r_
+  bool forces_valid_ = false;
+
+  // Statistics
+  long force_evaluations_ = 0;
+  int collision_count_ = 0;
+
+  BarnesHutTree<T> tree_;
+
+  // Created on the first evaluation that needs more than one thread
+  std::unique_ptr<WorkerPool> pool_;
+
+  int size() const{
+    return int(m_.size());
+  }
+
+  void clear(){
+    r_.clear();
+    v_.clear();
+    a_.clear();
+    m_.clear();
+    id_.clear();
+
+    id_next_ = 0;
+    t_ = T(0);
+    forces_valid_ = false;
+    force_evaluations_ = 0;
+    collision_count_ = 0;
+  }
+
+  /**
+   *
+   * NBody::add_body
+   *
+   * @return id of the body (c.f. NBody::find)
+   */
+  int add_body(const T x, const T y, const T v_x, const T v_y, const T m){
+
+    r_.push_back(x);
+    r_.push_back(y);
+    v_.push_back(v_x);
+    v_.push_back(v_y);
+    a_.push_back(T(0));
+    a_.push_back(T(0));
+    m_.push_back(m);
+    id_.push_back(id_next_);
+
+    forces_valid_ = false;
+
+    return id_next_++;
+  }
+
+  /**
+   *
+   * NBody::add_circular
+   *
+   * Add a body on a circular orbit (counter clockwise) around another body
+   * or around the central mass.
+   *
+   * @param x Position [AU]
+   * @param y
+   * @param m
+   * @param host_id Body to orbit, -1 for the central mass
+   * @return id of the body
+   */
+  int add_circular(const T x, const T y, const T m, const int host_id = -1){
+
+    T x_h = T(0), y_h = T(0), v_x_h = T(0), v_y_h = T(0);
+    T m_h = central_mass_;
+
+    int host = find(host_id);
+
+    if(host >= 0){
+      x_h = r_[2 * host];
+      y_h = r_[2 * host + 1];
+      v_x_h = v_[2 * host];
+      v_y_h = v_[2 * host + 1];
+      m_h = m_[host];
+    }
+
+    T dx = x - x_h;
+    T dy = y - y_h;
+    T d = std::sqrt(dx * dx + dy * dy);
+    T v = std::sqrt(G_ * (m_h + m) / d);
+
+    return add_body(x, y, v_x_h - v * dy / d, v_y_h + v * dx / d, m);
+  }
+
+  /**
+   *
+   * NBody::add_ring
+   *
+   * Asteroid swarm, count bodies on circular orbits around the central mass
+   * spread uniformly between r_min and r_max.
+   *
+   * @param count
+   * @param r_min [AU]
+   * @param r_max [AU]
+   * @param m Mass of each body
+   * @param seed
+   */
+  void add_ring(const int count, const T r_min, const T r_max, const T m, const unsigned seed = 1){
+
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> radius(r_min, r_max);
+    std::uniform_real_distribution<double> phase(0.0, 2.0 * M_PI);
+
+    for(int i = 0; i < count; ++i){
+      double r = radius(generator);
+      double angle = phase(generator);
+
+      add_circular(T(r * std::cos(angle)), T(r * std::sin(angle)), m);
+    }
+  }
+
+  /**
+   *
+   * NBody::add_binary
+   *
+   * Two bodies on circular orbits around their common center of mass at
+   * (x, y), which moves with the circular velocity around the central mass
+   * if there is one.
+   *
+   * @param x Center of mass [AU]
+   * @param y
+   * @param m_1
+   * @param m_2
+   * @param separation [AU]
+   */
+  void add_binary(const T x, const T y, const T m_1, const T m_2, const T separation){
+
+    T M = m_1 + m_2;
+    T v = std::sqrt(G_ * M / separation);
+
+    T v_x_cm = T(0), v_y_cm = T(0);
+    T d = std::sqrt(x * x + y * y);
+
+    if((central_mass_ > T(0)) && (d > T(0))){
+      T v_cm = std::sqrt(G_ * (central_mass_ + M) / d);
+      v_x_cm = -v_cm * y / d;
+      v_y_cm = v_cm * x / d;
+    }
+
+    add_body(x - separation * m_2 / M, y, v_x_cm, v_y_cm - v * m_2 / M, m_1);
+    add_body(x + separation * m_1 / M, y, v_x_cm, v_y_cm + v * m_1 / M, m_2);
+  }
+
+  /**
+   * NBody::find
+   *
+   * @return index of the body with this id, -1 if it was removed
+   */
+  int find(const int id) const{
+
+    for(int i = 0; i < size(); ++i){
+      if(id_[i] == id){
+        return i;
+      }
+    }
+
+    return -1;
+  }
+
+  /**
+   *
+   * NBody::accelerations
+   *
+   * Accelerations from the central mass and all the other bodies. The
+   * central mass uses the same kernel as Orbit, the mutual forces are summed
+   * directly for small systems and with the tree otherwise.
+   *
+   * @param r Positions of all bodies
+   * @param a (output)
+   */
+  void accelerations(const T r[], T a[]){
+
+    int n = size();
+
+    ++force_evaluations_;
+
+    const PointMassForce<T> sun = {G_ * central_mass_};
+
+    bool direct = (n <= direct_max_) || (theta_ <= T(0));
+
+    if(!direct){
+      tree_.build(r, m_.data(), n);
+    }
+
+    const T *m = m_.data();
+
+    for_each_chunk([&](int first, int last){
+      for(int i = first; i < last; ++i){
+
+        if(central_mass_ > T(0)){
+          sun(r + 2 * i, a + 2 * i);
+        }else{
+          a[2 * i] = T(0);
+          a[2 * i + 1] = T(0);
+        }
+
+        if(direct){
+          T a_x = T(0), a_y = T(0);
+
+          for(int j = 0; j < n; ++j){
+            if(j != i){
+              BarnesHutTree<T>::add_pair(r[2 * i], r[2 * i + 1], r[2 * j], r[2 * j + 1], m[j],
+                                         softening_sq_, a_x, a_y);
+            }
+          }
+
+          a[2 * i] += G_ * a_x;
+          a[2 * i + 1] += G_ * a_y;
+        }else{
+          tree_.accelerate(i, r, m, G_, softening_sq_, theta_, a + 2 * i);
+        }
+      }
+    });
+  }
+
+  /**
+   *
+   * NBody::step
+   *
+   * Advance all bodies by dt, then remove the ones that fell into the
+   * central mass.
+   *
+   * @param dt [years]
+   */
+  void step(const T dt){
+
+    if(size() == 0){
+      return;
+    }
+
+    auto force = [this](const T r[], T a[]){
+      accelerations(r, a);
+    };
+
+    if(!forces_valid_){
+      force(r_.data(), a_.data());
+      forces_valid_ = true;
+    }
+
+    Integrator::step(r_.data(), v_.data(), a_.data(), dt, force, 2 * size());
+    t_ += dt;
+
+    if(central_mass_ > T(0)){
+      remove_collisions();
+    }
+  }
+
+  /**
+   *
+   * NBody::advance
+   *
+   * Advance by dt in steps no longer than dt_max
+   *
+   * @return number of steps taken
+   */
+  int advance(const T dt, const T dt_max){
+
+    int steps = std::max(1, int(std::ceil(dt / dt_max)));
+
+    for(int i = 0; i < steps; ++i){
+      step(dt / steps);
+    }
+
+    return steps;
+  }
+
+  /**
+   *
+   * NBody::energy
+   *
+   * Total energy, O(N^2) so only for checking the integration
+   *
+   * @return kinetic + potential energy [M_sun AU^2 yr^-2]
+   */
+  double energy() const{
+
+    double E = 0.0;
+
+    for(int i = 0; i < size(); ++i){
+
+      double x = r_[2 * i];
+      double y = r_[2 * i + 1];
+
+      E += 0.5 * m_[i] * (double(v_[2 * i]) * v_[2 * i] + double(v_[2 * i + 1]) * v_[2 * i + 1]);
+
+      if(central_mass_ > T(0)){
+        E -= G_ * central_mass_ * m_[i] / std::sqrt(x * x + y * y);
+      }
+
+      for(int j = i + 1; j < size(); ++j){
+        double dx = r_[2 * j] - x;
+        double dy = r_[2 * j + 1] - y;
+        E -= G_ * m_[i] * m_[j] / std::sqrt(dx * dx + dy * dy + softening_sq_);
+      }
+    }
+
+    return E;
+  }
+
+private:
+
+  /**
+   * NBody::for_each_chunk
+   *
+   * Run work(first, last) over all bodies in chunks, handed out the same way
+   * as in OrbitAtlas::compute but to the threads of pool_
+   */
+  template <class Work>
+  void for_each_chunk(const Work &work){
+
+    using namespace std;
+
+    int n = size();
+    int chunk_count = (n + chunk_size_ - 1) / chunk_size_;
+
+    int thread_count = thread_count_ > 0 ? thread_count_ : int(thread::hardware_concurrency());
+    thread_count = max(1, thread_count);
+
+    if(min(thread_count, chunk_count) <= 1){
+      work(0, n);
+      return;
+    }
+
+    // The calling thread helps too. The pool is sized for the cores and not
+    // the chunks so it survives bodies being removed, spare threads find no
+    // chunks left.
+    if(!pool_ || (pool_->size() != thread_count - 1)){
+      pool_.reset(new WorkerPool(thread_count - 1));
+    }
+
+    atomic<int> next_chunk(0);
+
+    function<void()> run = [&](){
+      for(int chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++){
+        work(chunk * chunk_size_, min(n, (chunk + 1) * chunk_size_));
+      }
+    };
+
+    pool_->run(run);
+  }
+
+  /**
+   * NBody::remove_collisions
+   */
+  void remove_collisions(){
+
+    for(int i = size() - 1; i >= 0; --i){
+
+      T x = r_[2 * i];
+      T y = r_[2 * i + 1];
+
+      if(x * x + y * y >= R_sun_sq_){
+        continue;
+      }
+
+      int last = size() - 1;
+
+      for(int k = 0; k < 2; ++k){
+        r_[2 * i + k] = r_[2 * last + k];
+        v_[2 * i + k] = v_[2 * last + k];
+        a_[2 * i + k] = a_[2 * last + k];
+      }
+
+      m_[i] = m_[last];
+      id_[i] = id_[last];
+
+      r_.resize(2 * last);
+      v_.resize(2 * last);
+      a_.resize(2 * last);
+      m_.resize(last);
+      id_.resize(last);
+
+      // The accelerations of the others still include the removed body
+      forces_valid_ = false;
+      ++collision_count_;
+    }
+  }
+};
+
+#endif // KEPLER_NBODY_H
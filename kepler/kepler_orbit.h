@@ -0,0 +1,1676 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: The orbit integrator for the Kepler lab. This header has no
+ * Qt or OpenGL dependencies so it can be used by the benchmark and other
+ * headless tools as well as by the scene graph.
+ *
+ */
+
+
+#ifndef KEPLER_ORBIT_H
+#define KEPLER_ORBIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+
+#ifndef M_PI
+#define M_PI 3.14159265359
+#endif
+
+/**
+ * Gravitational acceleration towards a point mass at the origin. This is the
+ * force kernel that the integrator policies below call, it is kept small so
+ * the compiler can inline it into the step.
+ */
+template <class T>
+struct PointMassForce{
+
+  T G;
+
+  inline void operator()(const T r[], T a[]) const{
+
+    T r_sq = r[0] * r[0] + r[1] * r[1];
+    T inv_r = T(1) / std::sqrt(r_sq);
+    T scale = G * inv_r * inv_r * inv_r;
+
+    a[0] = -r[0] * scale;
+    a[1] = -r[1] * scale;
+  }
+};
+
+/**
+ *
+ * Integrator policies for Orbit. Each policy advances the position r and
+ * velocity v by dt. On entry a[] holds the acceleration at r and on exit it
+ * holds the acceleration at the new r so it can be reused by the next step.
+ *
+ *  - VelocityVerlet : 2nd order symplectic, 1 force evaluation per step
+ *  - Yoshida4       : 4th order symplectic, 3 force evaluations per step
+ *  - RungeKutta4    : 4th order (not symplectic), 4 force evaluations per step
+ *
+ * default_sub_steps is the number of sub-steps per output step (1 day). The
+ * 4th order schemes conserve energy better than the original 10 sub-step
+ * Verlet integrator with 2-3 sub-steps (c.f. astrolabs_kepler_bench). Over the
+ * GUI launch range RK4 with 2 sub-steps (8 force evaluations per day) takes
+ * about half the time of Yoshida4 with 3 (9 per day, but a longer step) and
+ * has the lowest energy error, so the lab integrates the launches without a
+ * conic (radial ones) with it. Yoshida4 with 2 sub-steps is 5x less accurate. The symplectic schemes remain the
+ * choice for long runs (NBody) where RK4 drifts.
+ *
+ * The symplectic schemes also take the number of components so they can
+ * advance many bodies at once (c.f. NBody), the force then fills a[] for all
+ * of them.
+ *
+ */
+template <class T>
+struct VelocityVerlet{
+
+  const static int order = 2;
+  const static int force_evaluations = 1;
+  const static int default_sub_steps = 10;
+
+  static const char *name(){
+    return "Verlet";
+  }
+
+  template <class Force>
+  static inline void step(T r[], T v[], T a[], const T dt, const Force &force, const int size = 2){
+
+    for(int i = 0; i < size; ++i){
+      v[i] += T(0.5) * dt * a[i];
+      r[i] += dt * v[i];
+    }
+
+    force(r, a);
+
+    for(int i = 0; i < size; ++i){
+      v[i] += T(0.5) * dt * a[i];
+    }
+  }
+};
+
+/**
+ * Yoshida's 4th order scheme built as a triple composition of velocity Verlet
+ * steps with weights w_1, w_0, w_1.
+ *
+ *  H. Yoshida, Physics Letters A 150 (1990) 262
+ */
+template <class T>
+struct Yoshida4{
+
+  const static int order = 4;
+  const static int force_evaluations = 3;
+  const static int default_sub_steps = 3;
+
+  static const char *name(){
+    return "Yoshida4";
+  }
+
+  template <class Force>
+  static inline void step(T r[], T v[], T a[], const T dt, const Force &force, const int size = 2){
+
+    // w_1 = 1 / (2 - 2^(1/3)), w_0 = -2^(1/3) w_1
+    const T w_1 = T(1.3512071919596576);
+    const T w_0 = T(-1.7024143839193153);
+
+    VelocityVerlet<T>::step(r, v, a, w_1 * dt, force, size);
+    VelocityVerlet<T>::step(r, v, a, w_0 * dt, force, size);
+    VelocityVerlet<T>::step(r, v, a, w_1 * dt, force, size);
+  }
+};
+
+/**
+ * Classic Runge-Kutta 4. Not symplectic so energy drifts secularly, which does
+ * not matter over the single period of a lab orbit. The lab falls back to it
+ * when the analytic mode has no conic (c.f. Orbit::calculate_orbit).
+ */
+template <class T>
+struct RungeKutta4{
+
+  const static int order = 4;
+  const static int force_evaluations = 4;
+  const static int default_sub_steps = 2;
+
+  static const char *name(){
+    return "RK4";
+  }
+
+  template <class Force>
+  static inline void step(T r[], T v[], T a[], const T dt, const Force &force){
+
+    const T half_dt = T(0.5) * dt;
+
+    T r_k[2];
+    T v_2[2], v_3[2], v_4[2];
+    T a_2[2], a_3[2], a_4[2];
+
+    for(int i = 0; i < 2; ++i){
+      r_k[i] = r[i] + half_dt * v[i];
+      v_2[i] = v[i] + half_dt * a[i];
+    }
+    force(r_k, a_2);
+
+    for(int i = 0; i < 2; ++i){
+      r_k[i] = r[i] + half_dt * v_2[i];
+      v_3[i] = v[i] + half_dt * a_2[i];
+    }
+    force(r_k, a_3);
+
+    for(int i = 0; i < 2; ++i){
+      r_k[i] = r[i] + dt * v_3[i];
+      v_4[i] = v[i] + dt * a_3[i];
+    }
+    force(r_k, a_4);
+
+    const T dt_6 = dt / T(6);
+
+    for(int i = 0; i < 2; ++i){
+      r[i] += dt_6 * (v[i] + T(2) * (v_2[i] + v_3[i]) + v_4[i]);
+      v[i] += dt_6 * (a[i] + T(2) * (a_2[i] + a_3[i]) + a_4[i]);
+    }
+
+    force(r, a);
+  }
+};
+
+/**
+ *
+ * Dormand-Prince 5(4) embedded Runge-Kutta pair used by the adaptive mode of
+ * Orbit. The 5th order solution is propagated and the difference to the
+ * embedded 4th order solution is used as the error estimate. The last stage
+ * is evaluated at the new position (FSAL) so a_out[] can be reused as the
+ * first stage of the next step.
+ *
+ *  J. R. Dormand, P. J. Prince, J. Comp. Appl. Math. 6 (1980) 19
+ */
+template <class T>
+struct DormandPrince45{
+
+  const static int order = 5;
+  const static int force_evaluations = 6;
+
+  static const char *name(){
+    return "DP45";
+  }
+
+  /**
+   *
+   * DormandPrince45::step
+   *
+   * @param r, v, a  State at the start of the step (a is the acceleration at r)
+   * @param dt
+   * @param force
+   * @param r_out, v_out, a_out (output) State at the end of the step
+   * @param atol Absolute error tolerance
+   * @param rtol Relative error tolerance
+   * @return The error norm, the step should be accepted if this is <= 1
+   */
+  template <class Force>
+  static inline T step(const T r[], const T v[], const T a[], const T dt, const Force &force,
+                       T r_out[], T v_out[], T a_out[], const T atol, const T rtol){
+
+    using namespace std;
+
+    // Stage derivatives, k_r[s] = dr/dt = velocity, k_v[s] = dv/dt = acceleration
+    T k_r[7][2];
+    T k_v[7][2];
+
+    T r_s[2];
+
+    const T c[7][6] = {{T(0)},
+                       {T(1.0 / 5.0)},
+                       {T(3.0 / 40.0), T(9.0 / 40.0)},
+                       {T(44.0 / 45.0), T(-56.0 / 15.0), T(32.0 / 9.0)},
+                       {T(19372.0 / 6561.0), T(-25360.0 / 2187.0), T(64448.0 / 6561.0), T(-212.0 / 729.0)},
+                       {T(9017.0 / 3168.0), T(-355.0 / 33.0), T(46732.0 / 5247.0), T(49.0 / 176.0),
+                        T(-5103.0 / 18656.0)},
+                       {T(35.0 / 384.0), T(0), T(500.0 / 1113.0), T(125.0 / 192.0), T(-2187.0 / 6784.0),
+                        T(11.0 / 84.0)}};
+
+    // Difference between the 5th and 4th order weights
+    const T e[7] = {T(71.0 / 57600.0), T(0), T(-71.0 / 16695.0), T(71.0 / 1920.0),
+                    T(-17253.0 / 339200.0), T(22.0 / 525.0), T(-1.0 / 40.0)};
+
+    for(int i = 0; i < 2; ++i){
+      k_r[0][i] = v[i];
+      k_v[0][i] = a[i];
+    }
+
+    for(int s = 1; s < 7; ++s){
+
+      for(int i = 0; i < 2; ++i){
+        T dr = T(0);
+        T dv = T(0);
+
+        for(int j = 0; j < s; ++j){
+          dr += c[s][j] * k_r[j][i];
+          dv += c[s][j] * k_v[j][i];
+        }
+
+        r_s[i] = r[i] + dt * dr;
+        k_r[s][i] = v[i] + dt * dv;
+      }
+
+      force(r_s, k_v[s]);
+    }
+
+    // The last stage is the 5th order solution (FSAL)
+    T error = T(0);
+
+    for(int i = 0; i < 2; ++i){
+      r_out[i] = r_s[i];
+      v_out[i] = k_r[6][i];
+      a_out[i] = k_v[6][i];
+
+      T err_r = T(0);
+      T err_v = T(0);
+
+      for(int s = 0; s < 7; ++s){
+        err_r += e[s] * k_r[s][i];
+        err_v += e[s] * k_v[s][i];
+      }
+
+      T scale_r = atol + rtol * max(fabs(r[i]), fabs(r_out[i]));
+      T scale_v = atol + rtol * max(fabs(v[i]), fabs(v_out[i]));
+
+      error = max(error, max(fabs(dt * err_r) / scale_r, fabs(dt * err_v) / scale_v));
+    }
+
+    return error;
+  }
+};
+
+/**
+ *
+ * Cubic Hermite interpolation between (p_0, m_0) and (p_1, m_1) where m is
+ * the time derivative of p and h the time between the two points.
+ *
+ * @param s Fraction of the interval [0, 1]
+ * @param h
+ * @return
+ */
+template <class T>
+inline T hermite_interpolate(const T s, const T h, const T p_0, const T m_0, const T p_1, const T m_1){
+
+  T s_sq = s * s;
+  T s_cu = s_sq * s;
+
+  T h_00 = T(2) * s_cu - T(3) * s_sq + T(1);
+  T h_10 = s_cu - T(2) * s_sq + s;
+  T h_01 = T(3) * s_sq - T(2) * s_cu;
+  T h_11 = s_cu - s_sq;
+
+  return h_00 * p_0 + h * (h_10 * m_0 + h_11 * m_1) + h_01 * p_1;
+}
+
+/**
+ *
+ * Closed form two-body orbit. The conic section is computed once from the
+ * launch state, positions at any time then come from Kepler's equation
+ * (elliptic), its hyperbolic form, or Barker's equation (parabolic). This is
+ * always done in double precision since Kepler's equation loses too much in
+ * float for eccentricities close to 1.
+ *
+ * The true anomaly nu is measured in the direction of motion so retrograde
+ * orbits are handled by sign_.
+ */
+struct ConicOrbit{
+
+  // Eccentricities this close to 1 are treated as parabolas
+  double parabolic_tolerance_ = 1e-6;
+
+  double mu_ = 0.0;
+
+  // Semi-latus rectum and eccentricity
+  double p_ = 0.0;
+  double e_ = 0.0;
+
+  // Semi-major axis (> 0 for hyperbolas as well), 0 for parabolas
+  double a_ = 0.0;
+
+  // Mean motion
+  double n_ = 0.0;
+
+  // Argument of the periapsis
+  double omega_ = 0.0;
+  double cos_omega_ = 1.0;
+  double sin_omega_ = 0.0;
+
+  // +1 for counter-clockwise motion, -1 for clockwise
+  double sign_ = 1.0;
+
+  // True and mean anomaly at t = 0
+  double nu_0_ = 0.0;
+  double M_0_ = 0.0;
+
+  // Time of the last anomaly returned by ConicOrbit::state
+  mutable double t_anomaly_ = 0.0;
+
+  // d(anomaly)/dM and d^2(anomaly)/dM^2 of the last anomaly returned by ConicOrbit::state
+  mutable double rate_anomaly_ = 1.0;
+  mutable double curvature_anomaly_ = 0.0;
+
+  /**
+   *
+   * ConicOrbit::init
+   *
+   * @param mu G * M
+   * @param r Position at t = 0
+   * @param v Velocity at t = 0
+   * @return false if the orbit is (close to) radial, there is no conic to speak of
+   */
+  bool init(const double mu, const double r[], const double v[]){
+
+    using namespace std;
+
+    mu_ = mu;
+
+    double r_mag = sqrt(r[0] * r[0] + r[1] * r[1]);
+    double v_sq = v[0] * v[0] + v[1] * v[1];
+    double r_dot_v = r[0] * v[0] + r[1] * v[1];
+
+    // Specific angular momentum (z component)
+    double h = r[0] * v[1] - r[1] * v[0];
+
+    p_ = h * h / mu_;
+
+    if(p_ < 1e-9 * r_mag){
+      return false;
+    }
+
+    sign_ = h >= 0.0 ? 1.0 : -1.0;
+
+    // Eccentricity vector
+    double e_x = ((v_sq - mu_ / r_mag) * r[0] - r_dot_v * v[0]) / mu_;
+    double e_y = ((v_sq - mu_ / r_mag) * r[1] - r_dot_v * v[1]) / mu_;
+
+    e_ = sqrt(e_x * e_x + e_y * e_y);
+
+    // Circular orbits have no periapsis, put it at the start
+    omega_ = e_ > 1e-12 ? atan2(e_y, e_x) : atan2(r[1], r[0]);
+    cos_omega_ = cos(omega_);
+    sin_omega_ = sin(omega_);
+
+    nu_0_ = wrap(sign_ * (atan2(r[1], r[0]) - omega_));
+
+    if(is_parabolic()){
+      a_ = 0.0;
+      n_ = 2.0 * sqrt(mu_ / (p_ * p_ * p_));
+    }else{
+      a_ = p_ / fabs(1.0 - e_ * e_);
+      n_ = sqrt(mu_ / (a_ * a_ * a_));
+    }
+
+    M_0_ = mean_anomaly(nu_0_);
+
+    return true;
+  }
+
+  bool is_parabolic() const{
+    return std::fabs(e_ - 1.0) < parabolic_tolerance_;
+  }
+
+  bool is_bound() const{
+    return (e_ < 1.0) && !is_parabolic();
+  }
+
+  /**
+   * @return Orbital period, only valid for bound orbits
+   */
+  double period() const{
+    return 2.0 * M_PI / n_;
+  }
+
+  /**
+   * @return Closest approach to the center
+   */
+  double periapsis() const{
+    return p_ / (1.0 + e_);
+  }
+
+  /**
+   *
+   * ConicOrbit::mean_anomaly
+   *
+   * @param nu True anomaly in (-pi, pi]
+   * @return Mean anomaly (Barker's D + D^3/3 for parabolas)
+   */
+  double mean_anomaly(const double nu) const{
+
+    using namespace std;
+
+    if(is_parabolic()){
+      double D = tan(0.5 * nu);
+      return D + D * D * D / 3.0;
+    }else if(e_ < 1.0){
+      double E = 2.0 * atan2(sqrt(1.0 - e_) * sin(0.5 * nu), sqrt(1.0 + e_) * cos(0.5 * nu));
+      return E - e_ * sin(E);
+    }
+
+    double H = 2.0 * atanh(sqrt((e_ - 1.0) / (e_ + 1.0)) * tan(0.5 * nu));
+    return e_ * sinh(H) - H;
+  }
+
+  /**
+   *
+   * ConicOrbit::solve_kepler
+   *
+   * Solve Kepler's equation for the eccentric anomaly E (elliptic), the
+   * hyperbolic anomaly H, or Barker's D (parabolic).
+   *
+   * sin and cos (sinh and cosh) of the anomaly come out of the iteration as
+   * well. Once the Newton steps are small they are rotated by the step
+   * rather than evaluated again, so a warm started solve costs one sin and
+   * one cos (one exp).
+   *
+   * Newton converges quadratically, the error left after a step dE is about
+   * f'' dE^2 / (2 f'). The iteration stops once that is below 1e-12, far
+   * below the float elements, instead of taking one more step to see it.
+   * Elliptic steps that would leave the bracket around the root are
+   * replaced by bisection, so e close to 1 converges too.
+   *
+   * @param M Mean anomaly
+   * @param guess Anomaly to start Newton's method from, typically the previous sample
+   * @param use_guess
+   * @param s (output) sin E or sinh H, not set for parabolas
+   * @param c (output) cos E or cosh H, not set for parabolas
+   * @return
+   */
+  double solve_kepler(const double M, double guess, const bool use_guess, double &s, double &c) const{
+
+    using namespace std;
+
+    if(is_parabolic()){
+      // Barker's equation has a closed form solution
+      double A = 1.5 * M;
+      double B = cbrt(A + sqrt(A * A + 1.0));
+      return B - 1.0 / B;
+    }else if(e_ < 1.0){
+
+      double E = guess;
+
+      if(!use_guess){
+        // Starting guess from Danby, Newton converges for all e < 1 from here
+        double M_wrapped = wrap(M);
+        E = M + 0.85 * e_ * (sin(M_wrapped) >= 0.0 ? 1.0 : -1.0);
+      }
+
+      // The root is always within e of M, Newton can overshoot it when e is
+      // close to 1 so the bracket is narrowed as we go and bisected instead
+      double lo = M - e_ - 1e-9;
+      double hi = M + e_ + 1e-9;
+
+      s = sin(E);
+      c = cos(E);
+
+      for(int i = 0; i < 100; ++i){
+        double f = E - e_ * s - M;
+
+        if(f > 0.0){
+          hi = E;
+        }else{
+          lo = E;
+        }
+
+        double E_next = E - f / (1.0 - e_ * c);
+        bool newton = (E_next >= lo) && (E_next <= hi);
+
+        if(!newton){
+          E_next = 0.5 * (lo + hi);
+        }
+
+        double dE = E - E_next;
+        E = E_next;
+
+        if(fabs(dE) < 1e-3){
+          // Rotate by -dE, the truncation error is below dE^4 / 24
+          double cos_dE = 1.0 - 0.5 * dE * dE;
+          double sin_dE = dE * (1.0 - dE * dE * (1.0 / 6.0));
+          double s_next = s * cos_dE - c * sin_dE;
+
+          c = c * cos_dE + s * sin_dE;
+          s = s_next;
+        }else{
+          s = sin(E);
+          c = cos(E);
+        }
+
+        if(newton && (0.5 * e_ * (fabs(s) + fabs(dE)) * dE * dE <= 1e-12 * (1.0 - e_ * c))){
+          break;
+        }
+      }
+
+      return E;
+    }
+
+    double H = use_guess ? guess : (M >= 0.0 ? 1.0 : -1.0) * log(2.0 * fabs(M) / e_ + 1.8);
+
+    for(int i = 0; i < 50; ++i){
+      double exp_H = exp(H);
+
+      s = 0.5 * (exp_H - 1.0 / exp_H);
+      c = 0.5 * (exp_H + 1.0 / exp_H);
+
+      double dH = (e_ * s - H - M) / (e_ * c - 1.0);
+      H -= dH;
+
+      if(0.5 * e_ * (fabs(s) + c * fabs(dH)) * dH * dH <= 1e-12 * (e_ * c - 1.0)){
+        exp_H = exp(H);
+
+        s = 0.5 * (exp_H - 1.0 / exp_H);
+        c = 0.5 * (exp_H + 1.0 / exp_H);
+        break;
+      }
+    }
+
+    return H;
+  }
+
+  /**
+   *
+   * ConicOrbit::time_to_anomaly
+   *
+   * @param nu
+   * @return First time >= 0 at which the orbit reaches the true anomaly nu,
+   * negative if it never does (unbound orbits moving away)
+   */
+  double time_to_anomaly(const double nu) const{
+
+    double dt = (mean_anomaly(nu) - M_0_) / n_;
+
+    if(is_bound()){
+      double T = period();
+      dt = std::fmod(dt, T);
+
+      if(dt < 0.0){
+        dt += T;
+      }
+    }
+
+    return dt;
+  }
+
+  /**
+   *
+   * ConicOrbit::state
+   *
+   * The position is computed in the perifocal frame straight from the
+   * anomaly so the only trigonometry per sample is in Kepler's equation.
+   *
+   * @param t Time since launch
+   * @param r (output) Position
+   * @param v (output) Velocity
+   * @param anomaly (input/output) Anomaly of the previous sample, replaced by this one
+   * @param use_guess Start Kepler's equation from anomaly
+   */
+  void state(const double t, double r[], double v[], double &anomaly, const bool use_guess) const{
+
+    using namespace std;
+
+    double M = M_0_ + n_ * t;
+
+    if(use_guess){
+      // Step the guess forward with the first two derivatives of the anomaly,
+      // near a sharp periapsis the second one is only trusted while small
+      double dM = n_ * (t - t_anomaly_);
+      double step = 0.5 * dM * curvature_anomaly_;
+
+      if(fabs(step) < 0.5 * rate_anomaly_){
+        anomaly += dM * (rate_anomaly_ + step);
+      }else{
+        anomaly += dM * rate_anomaly_;
+      }
+
+      // The elliptic anomaly is always within e of M
+      if(e_ < 1.0){
+        anomaly = min(M + e_, max(M - e_, anomaly));
+      }
+    }
+
+    double s = 0.0;
+    double c = 1.0;
+
+    anomaly = solve_kepler(M, anomaly, use_guess, s, c);
+    t_anomaly_ = t;
+
+    // Same as anomaly_rate(anomaly), from the sin and cos we already have
+    if(is_parabolic()){
+      rate_anomaly_ = anomaly_rate(anomaly);
+      curvature_anomaly_ = -2.0 * anomaly * rate_anomaly_ * rate_anomaly_ * rate_anomaly_;
+    }else if(e_ < 1.0){
+      rate_anomaly_ = 1.0 / (1.0 - e_ * c);
+      curvature_anomaly_ = -e_ * s * rate_anomaly_ * rate_anomaly_ * rate_anomaly_;
+    }else{
+      rate_anomaly_ = 1.0 / (e_ * c - 1.0);
+      curvature_anomaly_ = -e_ * s * rate_anomaly_ * rate_anomaly_ * rate_anomaly_;
+    }
+
+    double x, y, v_x, v_y;
+    double rate = rate_anomaly_ * n_;
+
+    if(is_parabolic()){
+      x = 0.5 * p_ * (1.0 - anomaly * anomaly);
+      y = p_ * anomaly;
+      v_x = -p_ * anomaly * rate;
+      v_y = p_ * rate;
+    }else if(e_ < 1.0){
+      double b = a_ * sqrt(1.0 - e_ * e_);
+      double cos_E = c;
+      double sin_E = s;
+
+      x = a_ * (cos_E - e_);
+      y = b * sin_E;
+      v_x = -a_ * sin_E * rate;
+      v_y = b * cos_E * rate;
+    }else{
+      double b = a_ * sqrt(e_ * e_ - 1.0);
+      double cosh_H = c;
+      double sinh_H = s;
+
+      x = a_ * (e_ - cosh_H);
+      y = b * sinh_H;
+      v_x = -a_ * sinh_H * rate;
+      v_y = b * cosh_H * rate;
+    }
+
+    // Perifocal to the lab frame
+    y *= sign_;
+    v_y *= sign_;
+
+    r[0] = cos_omega_ * x - sin_omega_ * y;
+    r[1] = sin_omega_ * x + cos_omega_ * y;
+
+    v[0] = cos_omega_ * v_x - sin_omega_ * v_y;
+    v[1] = sin_omega_ * v_x + cos_omega_ * v_y;
+  }
+
+  /**
+   * @return d(anomaly)/dM
+   */
+  double anomaly_rate(const double anomaly) const{
+
+    using namespace std;
+
+    if(is_parabolic()){
+      return 1.0 / (1.0 + anomaly * anomaly);
+    }else if(e_ < 1.0){
+      return 1.0 / (1.0 - e_ * cos(anomaly));
+    }
+
+    return 1.0 / (e_ * cosh(anomaly) - 1.0);
+  }
+
+  /**
+   * Wrap an angle to (-pi, pi]
+   */
+  static double wrap(double angle){
+
+    using namespace std;
+
+    angle = fmod(angle + M_PI, 2.0 * M_PI);
+
+    if(angle <= 0.0){
+      angle += 2.0 * M_PI;
+    }
+
+    return angle - M_PI;
+  }
+};
+
+/**
+ *
+ * Orbit elements stored as a structure of arrays. The integrator writes the
+ * elements straight into here and the scene draws the path, markers and
+ * sweeps from position_ directly, so the positions are laid out the way the
+ * vertex buffer wants them: x, y pairs with slot 0 holding the origin (the
+ * center of the sweeps) and element i in slot i + 1.
+ *
+ */
+template <class T>
+struct OrbitBuffer{
+
+  // Maximum number of elements
+  int capacity_ = 0;
+
+  // x, y pairs, capacity_ + 1 slots (c.f. above)
+  T *position_ = nullptr;
+
+  // v_x, v_y pairs, capacity_ slots
+  T *velocity_ = nullptr;
+
+  T *t_ = nullptr;
+  T *theta_ = nullptr;
+  T *r_ = nullptr;
+
+  OrbitBuffer(int capacity = 0){
+    init(capacity);
+  }
+
+  OrbitBuffer(const OrbitBuffer &) = delete;
+  OrbitBuffer &operator=(const OrbitBuffer &) = delete;
+
+  ~OrbitBuffer(){
+    release();
+  }
+
+  void init(int capacity){
+
+    release();
+
+    capacity_ = capacity;
+
+    position_ = new T[2 * (capacity_ + 1)];
+    velocity_ = new T[2 * capacity_];
+    t_ = new T[capacity_];
+    theta_ = new T[capacity_];
+    r_ = new T[capacity_];
+
+    position_[0] = T(0);
+    position_[1] = T(0);
+  }
+
+  void release(){
+    delete[] position_;
+    delete[] velocity_;
+    delete[] t_;
+    delete[] theta_;
+    delete[] r_;
+
+    position_ = velocity_ = t_ = theta_ = r_ = nullptr;
+    capacity_ = 0;
+  }
+
+  inline void set(int i, T t, T x, T y, T v_x, T v_y, T theta){
+    position_[2 * i + 2] = x;
+    position_[2 * i + 3] = y;
+    velocity_[2 * i] = v_x;
+    velocity_[2 * i + 1] = v_y;
+    t_[i] = t;
+    theta_[i] = theta;
+    r_[i] = std::sqrt(x * x + y * y);
+  }
+
+  inline T x(int i) const{
+    return position_[2 * i + 2];
+  }
+
+  inline T y(int i) const{
+    return position_[2 * i + 3];
+  }
+
+  inline T v_x(int i) const{
+    return velocity_[2 * i];
+  }
+
+  inline T v_y(int i) const{
+    return velocity_[2 * i + 1];
+  }
+
+  inline T t(int i) const{
+    return t_[i];
+  }
+};
+
+/**
+ * Computes an orbital path around a central mass...
+ *
+ * The integration scheme is chosen at compile time with the Integrator
+ * policy (VelocityVerlet, Yoshida4 or RungeKutta4).
+ *
+ * If adaptive_ is set the Integrator is not used. Instead the orbit is
+ * integrated with an error controlled Dormand-Prince 5(4) step and the
+ * termination conditions are located by root-finding (c.f.
+ * Orbit::calculate_orbit_adaptive). The output elements are still one per
+ * dt_ in both modes.
+ *
+ * If analytic_ is set the elements are sampled from the closed form conic
+ * (c.f. ConicOrbit) instead, the numeric modes remain as the cross-check.
+ * Radial launches have no conic and go to the adaptive or fixed step mode.
+ */
+template <class T, class Integrator = VelocityVerlet<T> >
+struct Orbit{
+
+  // Size of the sun
+  float R_sun_sq_ = 0.01f;
+
+  /*
+   * Orbit States
+   */
+  bool closed_ = false;
+  bool collision_ = false;
+
+  // Unbound orbit that left the view (c.f. view_bound_)
+  bool escaped_ = false;
+
+  // Total energy >= 0, the orbit will never come back
+  bool unbound_ = false;
+
+  // Figuring out when the orbit actually closes is annoying because
+  // both CW and CCW should work and a few corner cases 90 degree.
+  // The numeric modes close the orbit when (r - r_0) . v_0 goes from
+  // negative to positive, which only happens once per revolution, back at
+  // the launch point (c.f. Orbit::test_terminate, the closure event of
+  // Orbit::calculate_orbit_adaptive and OrbitBatch). A distance to start
+  // test misses returns once the error after a long period exceeds its
+  // tolerance.
+
+  // A sub-step went inside the sun, close passes are fast enough to fall
+  // between two steps
+  bool grazed_sun_ = false;
+
+
+  /**
+   *  We are using units such that:
+   *    [L] = 1 AU
+   *    [M] = Solar Mass
+   *    [t] = 1 year
+   *
+   * then
+   *
+   *     G = 4 * pi * pi AU^3 yr^{-2} M^-1
+   *
+   * A perfectly circular orbit with R = 1 AU, centered on the Sun requires
+   *
+   *  v = sqrt(G)
+   *    = 2 * PI AU/yr
+   *    = 6.283185 AU/yr
+   *    = 29.80565 km/s
+   *
+   * but we want the circle velocity to be 30km/s so our kps_in_AU_year
+   * is slightly faked from
+   *
+   *  1 km/s = 0.210805 AU/year
+   *
+   */
+
+  // Gravitational Constant
+  T G_ = T(4 * M_PI * M_PI);
+
+  // fudged velocity conversion from km/s to AU/year ( / 30
+  T velocity_scale_ = T(2.0 * M_PI / 30.0);
+
+  // Simulation step size is 1 day
+  T dt_ = T(1.0 / 365.25);
+
+  // Unbound orbits are stopped when |x| or |y| goes past this [AU]
+  T view_bound_ = T(3.0);
+
+  // Sample the closed form solution instead of integrating
+  bool analytic_ = false;
+
+  // Conic section of the last analytic orbit
+  ConicOrbit conic_;
+
+  /**
+   * Adaptive mode settings
+   */
+  bool adaptive_ = false;
+
+  // Error tolerance per step
+  T atol_ = T(1e-9);
+  T rtol_ = T(1e-7);
+
+  // Step size limits
+  T dt_min_ = T(1e-8);
+  T dt_max_ = T(8.0 / 365.25);
+
+  // One element by value, c.f. Orbit::element (the elements themselves live in elements_)
+  struct OrbitPiece {
+
+    T t;
+    T x;
+    T y;
+
+    T theta;
+    T r;
+    T area;
+
+    T v_x;
+    T v_y;
+
+    void set(float t_in, float x_in, float y_in, float v_x_in, float v_y_in, float theta_in, float area_in){
+      t = t_in;
+      x = x_in;
+      y = y_in;
+      theta = theta_in;
+      r = sqrt(x * x + y * y);
+
+      v_x = v_x_in;
+      v_y = v_y_in;
+    }
+
+    std::ostream& operator<<(std::ostream& os){
+      os<<t<<" "<<x<<" "<<y<<" "<<theta<<" "<<v_x<<" "<<v_y<<" "<<" "<<r<<std::endl;
+      return os;
+    }
+  };
+
+  // Written by the integrator, possibly shared with other orbits (c.f. Orbit::use_buffer)
+  OrbitBuffer<T> *elements_ = nullptr;
+
+  int element_count_ = 0;
+
+  // These are set in the constructor!
+  int steps_max_ = 0;
+  int sub_steps_ = 0;
+
+  T t_ = T(0);
+  T t_max_ = T(0);
+
+  // Closed orbits: time to get back to the start, the element after the
+  // last one is element 0 again at this time (c.f. Orbit::time_interpolate)
+  T period_ = T(0);
+
+  // Number of integrator sub-steps taken by the last calculate_orbit
+  long sub_step_count_ = 0;
+
+  /**
+   * Progress reporting, c.f. Orbit::report_progress
+   */
+
+  // Called when elements [first, first + count) are ready, every progress_chunk_ elements. Return false to stop
+  std::function<bool(int first, int count)> progress_;
+  int progress_chunk_ = 256;
+
+  // Elements already passed to progress_
+  int progress_count_ = 0;
+
+  // The last calculate_orbit was stopped by progress_
+  bool cancelled_ = false;
+
+  // Storage for elements_ unless another buffer is used
+  OrbitBuffer<T> own_elements_;
+
+  Orbit(int steps_max = 100000, int sub_steps = Integrator::default_sub_steps)
+      : steps_max_(steps_max), sub_steps_(sub_steps), own_elements_(steps_max){
+
+    elements_ = &own_elements_;
+  }
+
+  /**
+   *
+   * Orbit::use_buffer
+   *
+   * Write the elements into another buffer (e.g. one that is drawn from
+   * directly) instead of the orbit's own, the capacity follows the buffer.
+   *
+   * @param buffer
+   */
+  void use_buffer(OrbitBuffer<T> *buffer){
+    elements_ = buffer;
+    steps_max_ = buffer->capacity_;
+  }
+
+  OrbitPiece element(int i) const{
+    OrbitPiece e;
+    e.set(elements_->t(i), elements_->x(i), elements_->y(i),
+          elements_->v_x(i), elements_->v_y(i), elements_->theta_[i], 0.0f);
+    return e;
+  }
+
+  void set_element(int i, const OrbitPiece &e){
+    elements_->set(i, e.t, e.x, e.y, e.v_x, e.v_y, e.theta);
+  }
+
+  inline void calculate_force(const T r[], T a[]) const{
+    PointMassForce<T> force = {G_};
+    force(r, a);
+  }
+
+  /**
+   *
+   * Orbit::calculate_orbit
+   *
+   *
+   * @param theta_launch_0 initial angle in radians
+   * @param v_0 [km/s]
+   *
+   * @return true if the orbit closes
+   */
+
+  void calculate_orbit(float theta_launch_0, float v_0) {
+
+    using namespace std;
+
+    progress_count_ = 0;
+    cancelled_ = false;
+
+    // Radial launches have no conic, those go to the integrator
+    if(analytic_ && calculate_orbit_analytic(theta_launch_0, v_0)){
+      return;
+    }
+
+    if(adaptive_){
+      calculate_orbit_adaptive(theta_launch_0, v_0);
+      return;
+    }
+
+    const int nd = 2;
+
+    // Clear state
+    closed_ = false;
+    collision_ = false;
+    escaped_ = false;
+    grazed_sun_ = false;
+
+    T a[nd] = {0.0, 0.0};
+    T v[nd] = {v_0 * velocity_scale_ * cos(theta_launch_0),
+               v_0 * velocity_scale_ * sin(theta_launch_0)};
+    T r[nd] = {0.0, 1.0};
+
+    element_count_ = 0;
+    sub_step_count_ = 0;
+    t_ = T(0);
+
+    T dt_substep = dt_ / float(sub_steps_);
+
+#if 0
+    bool cw_direction = (theta_launch_0 <= 90) || (theta_launch_0 >= 270);
+
+    std::cout<<"Orbit::calculate_orbit: Launching with V_0 = "<<v_0
+             <<" and theta = "<<theta_launch_0
+             <<" clockwise "<<cw_direction
+             <<" dt_ "<<dt_
+             <<" dt_substep "<<dt_substep
+             << " sub_steps_ "<<sub_steps_
+             << " steps_max_ "<<steps_max_
+             <<std::endl;
+#endif
+
+    const PointMassForce<T> force = {G_};
+
+    unbound_ = specific_energy(r, v) >= T(0);
+
+    // The integrators expect a[] to hold the acceleration at r
+    force(r, a);
+
+    for (int step = 0; element_count_ < steps_max_; ++step) {
+
+      // Store the state at the start of the step
+      T theta = atan2(r[1], r[0]);
+      elements_->set(element_count_, t_, r[0], r[1], v[0], v[1], theta);
+
+      for(int sub_step = 0; sub_step < sub_steps_; ++sub_step){
+        Integrator::step(r, v, a, dt_substep, force);
+        t_ += dt_substep;
+
+        grazed_sun_ = grazed_sun_ || (r[0] * r[0] + r[1] * r[1] < R_sun_sq_);
+      }
+
+      sub_step_count_ += sub_steps_;
+
+      if(test_terminate(element_count_)){
+        // If the distance from the start is less than one step size then the orbit closes
+        break;
+      }
+      element_count_++;
+
+      if(!report_progress()){
+        break;
+      }
+    }
+
+    t_max_ = elements_->t(max(0, element_count_ - 1));
+
+    // The element that closed the orbit was not kept, it is element 0 again
+    period_ = closed_ ? element_count_ * dt_ : T(0);
+  }
+
+  /**
+   *
+   * Orbit::calculate_orbit_analytic
+   *
+   * Sample the orbit from the conic section through the launch state, each
+   * element costs one solution of Kepler's equation. The termination times
+   * are known up front: one period for bound orbits and the crossing of the
+   * solar radius if the periapsis is inside the sun. Unbound orbits stop
+   * once they leave the view, same as the numeric modes.
+   *
+   * @param theta_launch_0 initial angle in radians
+   * @param v_0 [km/s]
+   * @return false if the launch is radial and the orbit has to be integrated
+   */
+  bool calculate_orbit_analytic(float theta_launch_0, float v_0){
+
+    using namespace std;
+
+    const double r[2] = {0.0, 1.0};
+    const double v[2] = {double(v_0) * velocity_scale_ * cos(double(theta_launch_0)),
+                         double(v_0) * velocity_scale_ * sin(double(theta_launch_0))};
+
+    if(!conic_.init(G_, r, v)){
+      return false;
+    }
+
+    closed_ = false;
+    collision_ = false;
+    escaped_ = false;
+    grazed_sun_ = false;
+    period_ = T(0);
+
+    unbound_ = !conic_.is_bound();
+
+    element_count_ = 0;
+    sub_step_count_ = 0;
+    t_ = T(0);
+
+    // Stop at the end of the first period or when the orbit hits the sun
+    double t_end = conic_.is_bound() ? conic_.period() : HUGE_VAL;
+
+    double R_sun = sqrt(double(R_sun_sq_));
+    double t_collision = -1.0;
+
+    if(conic_.periapsis() < R_sun){
+      double cos_nu = min(1.0, max(-1.0, (conic_.p_ / R_sun - 1.0) / conic_.e_));
+
+      // Inbound crossing of the solar surface
+      t_collision = conic_.time_to_anomaly(-acos(cos_nu));
+
+      if(t_collision >= 0.0 && t_collision <= t_end){
+        t_end = t_collision;
+      }else{
+        t_collision = -1.0;
+      }
+    }
+
+    double r_k[2], v_k[2];
+    double anomaly = 0.0;
+
+    while(element_count_ < steps_max_){
+
+      double t = element_count_ * double(dt_);
+
+      if(t >= t_end){
+        break;
+      }
+
+      conic_.state(t, r_k, v_k, anomaly, element_count_ > 0);
+      ++sub_step_count_;
+
+      // Unbound orbits are done once they leave the view
+      if(unbound_ && ((fabs(r_k[0]) > view_bound_) || (fabs(r_k[1]) > view_bound_))){
+        escaped_ = true;
+        break;
+      }
+
+      elements_->set(element_count_, t, r_k[0], r_k[1], v_k[0], v_k[1], atan2(r_k[1], r_k[0]));
+      ++element_count_;
+
+      if(!report_progress()){
+        break;
+      }
+    }
+
+    // Stopped by progress_, the orbit is incomplete
+    if(cancelled_){
+      t_max_ = T(0);
+      return true;
+    }
+
+    if(!escaped_ && (element_count_ < steps_max_)){
+      collision_ = t_collision >= 0.0;
+      closed_ = !collision_ && conic_.is_bound();
+    }
+
+    period_ = closed_ ? T(conic_.period()) : T(0);
+
+    t_max_ = elements_->t(max(0, element_count_ - 1));
+
+    return true;
+  }
+
+  /**
+   *
+   * Orbit::calculate_orbit_adaptive
+   *
+   * Integrate with an error controlled step size. Steps are long near
+   * aphelion and short near perihelion. The output elements are sampled
+   * every dt_ by Hermite interpolation of the accepted steps.
+   *
+   * Termination events are found by bisection on the interpolant within the
+   * step where the event function changes sign:
+   *
+   *  - collision : |r|^2 - R_sun^2 goes negative
+   *  - closure   : (r - r_0) . v_0 goes from negative to positive, this only
+   *                happens when the orbit comes back through the start point
+   *  - escape    : max(|x|, |y|) - view_bound_ goes positive on an unbound orbit
+   *
+   * @param theta_launch_0 initial angle in radians
+   * @param v_0 [km/s]
+   */
+  void calculate_orbit_adaptive(float theta_launch_0, float v_0){
+
+    using namespace std;
+
+    closed_ = false;
+    collision_ = false;
+    escaped_ = false;
+    period_ = T(0);
+
+    const PointMassForce<T> force = {G_};
+
+    T r[2] = {T(0), T(1)};
+    T v[2] = {T(v_0 * velocity_scale_ * cos(theta_launch_0)),
+              T(v_0 * velocity_scale_ * sin(theta_launch_0))};
+    T a[2];
+    force(r, a);
+
+    const T r_0[2] = {r[0], r[1]};
+    const T v_0_launch[2] = {v[0], v[1]};
+
+    unbound_ = specific_energy(r, v) >= T(0);
+
+    T r_new[2], v_new[2], a_new[2];
+
+    element_count_ = 0;
+    sub_step_count_ = 0;
+    t_ = T(0);
+
+    // First guess, the controller settles on a better step within a few steps
+    T dt = dt_;
+
+    // Guard against a step size that never gets accepted
+    const long attempts_max = 100L * steps_max_;
+
+    bool terminate = false;
+
+    while(!terminate && (element_count_ < steps_max_) && (sub_step_count_ < attempts_max)){
+
+      T error = DormandPrince45<T>::step(r, v, a, dt, force, r_new, v_new, a_new, atol_, rtol_);
+      ++sub_step_count_;
+
+      // Standard step size controller for a 5th order method
+      T factor = error > T(0) ? T(0.9) * T(pow(double(error), -0.2)) : T(5);
+      factor = min(T(5), max(T(0.2), factor));
+
+      if((error > T(1)) && (dt > dt_min_)){
+        dt = max(dt_min_, dt * factor);
+        continue;
+      }
+
+      /**
+       * Accepted step [t_, t_ + dt], look for events
+       */
+      T s_end = T(1);
+
+      // Collision with the sun, the step started outside
+      T g_0;
+      T g_1 = r_new[0] * r_new[0] + r_new[1] * r_new[1] - T(R_sun_sq_);
+
+      if(g_1 < T(0)){
+        s_end = find_event(EVENT_COLLISION, r, v, a, r_new, v_new, a_new, dt, r_0, v_0_launch);
+        collision_ = true;
+        terminate = true;
+      }
+
+      // Returned to the start
+      if(!terminate){
+        g_0 = (r[0] - r_0[0]) * v_0_launch[0] + (r[1] - r_0[1]) * v_0_launch[1];
+        g_1 = (r_new[0] - r_0[0]) * v_0_launch[0] + (r_new[1] - r_0[1]) * v_0_launch[1];
+
+        if((g_0 < T(0)) && (g_1 >= T(0))){
+          s_end = find_event(EVENT_CLOSURE, r, v, a, r_new, v_new, a_new, dt, r_0, v_0_launch);
+          closed_ = true;
+          terminate = true;
+          period_ = t_ + s_end * dt;
+        }
+      }
+
+      // Left the view and not coming back
+      if(!terminate && unbound_){
+        g_1 = max(fabs(r_new[0]), fabs(r_new[1])) - view_bound_;
+
+        if(g_1 > T(0)){
+          s_end = find_event(EVENT_ESCAPE, r, v, a, r_new, v_new, a_new, dt, r_0, v_0_launch);
+          escaped_ = true;
+          terminate = true;
+        }
+      }
+
+      /**
+       * Sample the output elements in [t_, t_ + s_end * dt]
+       */
+      T t_end = t_ + s_end * dt;
+
+      while(element_count_ < steps_max_){
+
+        T t_sample = element_count_ * dt_;
+
+        // Events end the orbit before the sample at the event time
+        if((t_sample > t_end) || (terminate && (t_sample >= t_end))){
+          break;
+        }
+
+        T r_s[2], v_s[2];
+        interpolate_state((t_sample - t_) / dt, dt, r, v, a, r_new, v_new, a_new, r_s, v_s);
+
+        elements_->set(element_count_, t_sample, r_s[0], r_s[1], v_s[0], v_s[1], atan2(r_s[1], r_s[0]));
+        ++element_count_;
+      }
+
+      if(!report_progress()){
+        break;
+      }
+
+      // Advance
+      t_ += dt;
+
+      for(int i = 0; i < 2; ++i){
+        r[i] = r_new[i];
+        v[i] = v_new[i];
+        a[i] = a_new[i];
+      }
+
+      dt = min(dt_max_, max(dt_min_, dt * factor));
+    }
+
+    t_max_ = elements_->t(max(0, element_count_ - 1));
+  }
+
+  /**
+   *
+   * Orbit::report_progress
+   *
+   * Pass the elements computed since the last report to progress_ once there
+   * are at least progress_chunk_ of them (or any at all if flush is set).
+   *
+   * @param flush
+   * @return false if the calculation should stop
+   */
+  bool report_progress(bool flush = false){
+
+    int count = element_count_ - progress_count_;
+
+    if(!progress_ || (count <= 0) || (!flush && (count < progress_chunk_))){
+      return true;
+    }
+
+    int first = progress_count_;
+    progress_count_ = element_count_;
+
+    cancelled_ = !progress_(first, count);
+
+    return !cancelled_;
+  }
+
+  /**
+   *
+   * Orbit::copy_settings
+   *
+   * Copy the mode and the tolerances (but not the results) from another orbit
+   *
+   * @param other
+   */
+  void copy_settings(const Orbit &other){
+    analytic_ = other.analytic_;
+    adaptive_ = other.adaptive_;
+    atol_ = other.atol_;
+    rtol_ = other.rtol_;
+    dt_min_ = other.dt_min_;
+    dt_max_ = other.dt_max_;
+    view_bound_ = other.view_bound_;
+    sub_steps_ = other.sub_steps_;
+    dt_ = other.dt_;
+  }
+
+  /**
+   * Events located by Orbit::find_event
+   */
+  enum OrbitEvent{
+    EVENT_COLLISION = 0,
+    EVENT_CLOSURE,
+    EVENT_ESCAPE
+  };
+
+  /**
+   *
+   * Orbit::find_event
+   *
+   * Bisect the interpolated step for the zero of the event function. The
+   * caller guarantees that the event function changes sign over the step.
+   *
+   * @return fraction of the step [0, 1] where the event happens
+   */
+  T find_event(const OrbitEvent event,
+               const T r[], const T v[], const T a[],
+               const T r_new[], const T v_new[], const T a_new[],
+               const T dt, const T r_0[], const T v_0[]) const{
+
+    using namespace std;
+
+    T s_lo = T(0);
+    T s_hi = T(1);
+
+    for(int i = 0; i < 30; ++i){
+
+      T s = T(0.5) * (s_lo + s_hi);
+
+      T r_s[2], v_s[2];
+      interpolate_state(s, dt, r, v, a, r_new, v_new, a_new, r_s, v_s);
+
+      bool past = false;
+
+      if(event == EVENT_COLLISION){
+        past = r_s[0] * r_s[0] + r_s[1] * r_s[1] < T(R_sun_sq_);
+      }else if(event == EVENT_CLOSURE){
+        past = (r_s[0] - r_0[0]) * v_0[0] + (r_s[1] - r_0[1]) * v_0[1] >= T(0);
+      }else{
+        past = max(fabs(r_s[0]), fabs(r_s[1])) > view_bound_;
+      }
+
+      if(past){
+        s_hi = s;
+      }else{
+        s_lo = s;
+      }
+    }
+
+    return s_hi;
+  }
+
+  /**
+   *
+   * Orbit::interpolate_state
+   *
+   * Hermite interpolation of position (from velocity) and velocity (from
+   * acceleration) within a step.
+   *
+   * @param s fraction of the step [0, 1]
+   */
+  static void interpolate_state(const T s, const T dt,
+                                const T r[], const T v[], const T a[],
+                                const T r_new[], const T v_new[], const T a_new[],
+                                T r_out[], T v_out[]){
+    for(int i = 0; i < 2; ++i){
+      r_out[i] = hermite_interpolate(s, dt, r[i], v[i], r_new[i], v_new[i]);
+      v_out[i] = hermite_interpolate(s, dt, v[i], a[i], v_new[i], a_new[i]);
+    }
+  }
+
+  /**
+   * Orbit::specific_energy
+   *
+   * @return kinetic + potential energy per unit mass [AU^2 yr^-2]
+   */
+  T specific_energy(const T r[], const T v[]) const{
+    return T(0.5) * (v[0] * v[0] + v[1] * v[1]) - G_ / std::sqrt(r[0] * r[0] + r[1] * r[1]);
+  }
+
+  /**
+   *
+   * Orbit::test_terminate
+   *
+   * Distance from start
+   * @param r
+   * @return true if the simulaton
+   */
+  bool test_terminate(const int element_ix){
+
+    float x = elements_->x(element_ix);
+    float y = elements_->y(element_ix);
+
+    // Check if we hit the earth
+    float dr_sq_center =  x * x + y * y;
+
+    // If planet impacted
+    collision_ = (dr_sq_center < R_sun_sq_) || grazed_sun_;
+
+    // Check if we finished the orbit, (r - r_0) . v_0 crossed zero upwards
+    if(element_ix > 0){
+      float v_x_0 = elements_->v_x(0);
+      float v_y_0 = elements_->v_y(0);
+
+      float g_0 = (elements_->x(element_ix - 1) - elements_->x(0)) * v_x_0
+                  + (elements_->y(element_ix - 1) - elements_->y(0)) * v_y_0;
+      float g_1 = (x - elements_->x(0)) * v_x_0 + (y - elements_->y(0)) * v_y_0;
+
+      closed_ = (g_0 < 0.0f) && (g_1 >= 0.0f);
+    }
+
+    // Unbound orbits stop once they leave the view
+    escaped_ = unbound_ && ((fabs(x) > view_bound_) || (fabs(y) > view_bound_));
+
+    return collision_ || closed_ || escaped_;
+  }
+
+  /**
+   *
+   * Orbit::energy
+   *
+   * Specific orbital energy (per unit mass) of an element, used to
+   * measure how well the integrator conserves energy.
+   *
+   * @param element_ix
+   * @return kinetic + potential energy [AU^2 yr^-2]
+   */
+  T energy(const int element_ix) const{
+    const T r[2] = {elements_->x(element_ix), elements_->y(element_ix)};
+    const T v[2] = {elements_->v_x(element_ix), elements_->v_y(element_ix)};
+    return specific_energy(r, v);
+  }
+
+  /**
+   *
+   * Orbit::locate
+   *
+   * Index of the last element at or before t. The elements are one per dt_
+   * in every mode so the index is computed directly and only checked against
+   * the element times, anything else falls back to a binary search.
+   *
+   * @param t [years]
+   * @return element index, -1 if there are no elements
+   */
+  int locate(const T t) const{
+
+    using namespace std;
+
+    if(element_count_ <= 0){
+      return -1;
+    }
+
+    int i = min(element_count_ - 1, max(0, int(t / dt_)));
+
+    // Off by one from rounding
+    if((i > 0) && (elements_->t(i) > t)){
+      --i;
+    }else if((i + 1 < element_count_) && (elements_->t(i + 1) <= t)){
+      ++i;
+    }
+
+    // Not sampled one per dt_ after all
+    if(((i > 0) && (elements_->t(i) > t)) || ((i + 1 < element_count_) && (elements_->t(i + 1) <= t))){
+      const T *t_begin = elements_->t_;
+      i = max(0, int(upper_bound(t_begin, t_begin + element_count_, t) - t_begin) - 1);
+    }
+
+    return i;
+  }
+
+  /**
+   *
+   * Orbit::time_interpolate
+   *
+   * Position (and velocity) at time t_target, Hermite interpolated between
+   * the two elements around it with the stored velocities (and accelerations
+   * from the force for the velocity). Closed orbits repeat with period_,
+   * other orbits stay at the last element.
+   *
+   * @param t_target [years]
+   * @param position (output) x, y
+   * @param velocity (output, optional) v_x, v_y
+   * @return index of the element at or before t_target
+   */
+  int time_interpolate(const T t_target, T *position, T *velocity = nullptr) const{
+
+    using namespace std;
+
+    if(element_count_ <= 0){
+      return -1;
+    }
+
+    T t = max(T(0), t_target);
+
+    if(closed_ && (period_ > T(0))){
+      t = fmod(t, period_);
+    }
+
+    int i = locate(t);
+    int j = i + 1;
+
+    T t_0 = elements_->t(i);
+    T t_1 = t_0;
+
+    if(j < element_count_){
+      t_1 = elements_->t(j);
+    }else if(closed_){
+      // Past the last element the orbit returns to element 0
+      j = 0;
+      t_1 = period_;
+    }
+
+    const T r_0[2] = {elements_->x(i), elements_->y(i)};
+    const T v_0[2] = {elements_->v_x(i), elements_->v_y(i)};
+
+    T h = t_1 - t_0;
+
+    if(h <= T(0)){
+      position[0] = r_0[0];
+      position[1] = r_0[1];
+
+      if(velocity){
+        velocity[0] = v_0[0];
+        velocity[1] = v_0[1];
+      }
+
+      return i;
+    }
+
+    const T r_1[2] = {elements_->x(j), elements_->y(j)};
+    const T v_1[2] = {elements_->v_x(j), elements_->v_y(j)};
+
+    T s = min(T(1), max(T(0), (t - t_0) / h));
+
+    for(int k = 0; k < 2; ++k){
+      position[k] = hermite_interpolate(s, h, r_0[k], v_0[k], r_1[k], v_1[k]);
+    }
+
+    if(velocity){
+      T a_0[2], a_1[2];
+      calculate_force(r_0, a_0);
+      calculate_force(r_1, a_1);
+
+      for(int k = 0; k < 2; ++k){
+        velocity[k] = hermite_interpolate(s, h, v_0[k], a_0[k], v_1[k], a_1[k]);
+      }
+    }
+
+    return i;
+  }
+};
+
+#endif // KEPLER_ORBIT_H
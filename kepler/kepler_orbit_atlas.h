@@ -0,0 +1,157 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Orbit atlas, the outcome of every launch over a grid of launch
+ * angles and velocities. Rows of the grid are integrated with OrbitBatch and
+ * spread over all cores.
+ *
+ */
+
+
+#ifndef KEPLER_ORBIT_ATLAS_H
+#define KEPLER_ORBIT_ATLAS_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "kepler_orbit_batch.h"
+
+/**
+ *
+ * Grid of launches, theta along x and velocity along y. Each row has one
+ * velocity so all the lanes in a batch have the same energy and (if bound)
+ * the same period, which keeps batches from waiting on a single long orbit.
+ *
+ */
+struct OrbitAtlas{
+
+  typedef OrbitBatch<4> Batch;
+
+  /**
+   * Grid
+   */
+  int theta_count_ = 0;
+  int v_count_ = 0;
+
+  float theta_min_ = 0.0f;    // [degrees]
+  float theta_max_ = 360.0f;
+  float v_min_ = 0.0f;        // [km/s]
+  float v_max_ = 45.0f;
+
+  // Passed on to the batches
+  float view_bound_ = 3.0f;
+  int steps_max_ = 36525;
+
+  /**
+   * Results, theta_count_ * v_count_ row major with v_min_ in row 0
+   */
+  std::vector<int> outcome_;
+  std::vector<float> period_;        // [years] closed orbits only
+  std::vector<float> eccentricity_;
+
+  // Total steps over all batches, for throughput numbers
+  std::atomic<long> step_count_;
+
+  // Set to stop the computation early (e.g. from another thread)
+  std::atomic<bool> cancel_;
+
+  OrbitAtlas(int theta_count = 360, int v_count = 180)
+      : theta_count_(theta_count), v_count_(v_count){
+    step_count_ = 0;
+    cancel_ = false;
+  }
+
+  float theta(int ix) const{
+    return theta_min_ + (theta_max_ - theta_min_) * (ix + 0.5f) / theta_count_;
+  }
+
+  float velocity(int iy) const{
+    return v_min_ + (v_max_ - v_min_) * (iy + 0.5f) / v_count_;
+  }
+
+  /**
+   *
+   * OrbitAtlas::compute
+   *
+   * @param thread_count Number of worker threads, 0 for one per core
+   * @return false if cancelled
+   */
+  bool compute(int thread_count = 0){
+
+    using namespace std;
+
+    int size = theta_count_ * v_count_;
+
+    outcome_.assign(size, ORBIT_UNRESOLVED);
+    period_.assign(size, 0.0f);
+    eccentricity_.assign(size, 0.0f);
+
+    step_count_ = 0;
+
+    if(thread_count <= 0){
+      thread_count = max(1, int(thread::hardware_concurrency()));
+    }
+
+    // Rows are handed out one at a time, the rows close to escape velocity
+    // take much longer than the others
+    atomic<int> next_row(0);
+
+    vector<thread> threads;
+
+    for(int i = 0; i < thread_count; ++i){
+      threads.push_back(thread([this, &next_row](){
+        for(int row = next_row++; (row < v_count_) && !cancel_; row = next_row++){
+          compute_row(row);
+        }
+      }));
+    }
+
+    for(thread &t : threads){
+      t.join();
+    }
+
+    return !cancel_;
+  }
+
+  /**
+   * OrbitAtlas::compute_row
+   *
+   * @param iy
+   */
+  void compute_row(int iy){
+
+    Batch batch;
+    batch.view_bound_ = view_bound_;
+    batch.steps_max_ = steps_max_;
+
+    float theta_lanes[Batch::lanes_];
+    float v_lanes[Batch::lanes_];
+
+    for(int ix_0 = 0; ix_0 < theta_count_; ix_0 += Batch::lanes_){
+
+      // Pad the last batch by repeating the last launch
+      for(int k = 0; k < Batch::lanes_; ++k){
+        int ix = std::min(ix_0 + k, theta_count_ - 1);
+        theta_lanes[k] = float(M_PI * theta(ix) / 180.0);
+        v_lanes[k] = velocity(iy);
+      }
+
+      batch.integrate(theta_lanes, v_lanes);
+      step_count_ += batch.step_count_;
+
+      for(int k = 0; (k < Batch::lanes_) && (ix_0 + k < theta_count_); ++k){
+        int i = iy * theta_count_ + ix_0 + k;
+
+        outcome_[i] = batch.outcome_[k];
+        period_[i] = batch.outcome_[k] == ORBIT_CLOSED ? batch.t_end_[k] : 0.0f;
+        eccentricity_[i] = batch.eccentricity_[k];
+      }
+    }
+  }
+};
+
+#endif // KEPLER_ORBIT_ATLAS_H
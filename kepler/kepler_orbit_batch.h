@@ -0,0 +1,434 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Batched orbit integration for parameter sweeps. Many launches
+ * are advanced together in structure-of-arrays form, four lanes per SSE
+ * register. Only the outcome of each orbit is kept (type, period and
+ * eccentricity), not the path, which is what the orbit atlas needs.
+ *
+ */
+
+
+#ifndef KEPLER_ORBIT_BATCH_H
+#define KEPLER_ORBIT_BATCH_H
+
+#include <cmath>
+
+#include "kepler_orbit.h"
+
+// Can be forced off with -DKEPLER_USE_SSE=0
+#ifndef KEPLER_USE_SSE
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KEPLER_USE_SSE 1
+#else
+#define KEPLER_USE_SSE 0
+#endif
+#endif
+
+#if KEPLER_USE_SSE
+#include <emmintrin.h>
+#endif
+
+/**
+ *
+ * Four floats processed together. This is a thin wrapper around an SSE
+ * register with a scalar fallback for other platforms, masks are all bits set
+ * (true) or clear (false) per lane.
+ *
+ */
+struct float4{
+
+#if KEPLER_USE_SSE
+  __m128 v;
+
+  float4(){}
+  float4(__m128 v_in) : v(v_in){}
+  float4(float s) : v(_mm_set1_ps(s)){}
+
+  static float4 load(const float *p){ return _mm_loadu_ps(p); }
+  void store(float *p) const{ _mm_storeu_ps(p, v); }
+
+  friend float4 operator+(float4 a, float4 b){ return _mm_add_ps(a.v, b.v); }
+  friend float4 operator-(float4 a, float4 b){ return _mm_sub_ps(a.v, b.v); }
+  friend float4 operator*(float4 a, float4 b){ return _mm_mul_ps(a.v, b.v); }
+  friend float4 operator/(float4 a, float4 b){ return _mm_div_ps(a.v, b.v); }
+
+  friend float4 operator<(float4 a, float4 b){ return _mm_cmplt_ps(a.v, b.v); }
+  friend float4 operator>(float4 a, float4 b){ return _mm_cmpgt_ps(a.v, b.v); }
+  friend float4 operator>=(float4 a, float4 b){ return _mm_cmpge_ps(a.v, b.v); }
+
+  friend float4 operator&(float4 a, float4 b){ return _mm_and_ps(a.v, b.v); }
+  friend float4 operator|(float4 a, float4 b){ return _mm_or_ps(a.v, b.v); }
+
+  // a & ~b
+  friend float4 and_not(float4 a, float4 b){ return _mm_andnot_ps(b.v, a.v); }
+
+  friend float4 sqrt(float4 a){ return _mm_sqrt_ps(a.v); }
+  friend float4 abs(float4 a){ return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+  friend float4 min(float4 a, float4 b){ return _mm_min_ps(a.v, b.v); }
+  friend float4 max(float4 a, float4 b){ return _mm_max_ps(a.v, b.v); }
+
+  // mask ? a : b
+  friend float4 select(float4 mask, float4 a, float4 b){
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+  }
+
+  friend bool any(float4 mask){ return _mm_movemask_ps(mask.v) != 0; }
+#else
+  float v[4];
+
+  float4(){}
+  float4(float s){ v[0] = v[1] = v[2] = v[3] = s; }
+
+  static float4 load(const float *p){ float4 r; for(int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+  void store(float *p) const{ for(int i = 0; i < 4; ++i) p[i] = v[i]; }
+
+  // Masks use 1.0 / 0.0 in the scalar version
+  #define KEPLER_FLOAT4_OP(op, expr) \
+    friend float4 op(float4 a, float4 b){ float4 r; for(int i = 0; i < 4; ++i) r.v[i] = expr; return r; }
+
+  KEPLER_FLOAT4_OP(operator+, a.v[i] + b.v[i])
+  KEPLER_FLOAT4_OP(operator-, a.v[i] - b.v[i])
+  KEPLER_FLOAT4_OP(operator*, a.v[i] * b.v[i])
+  KEPLER_FLOAT4_OP(operator/, a.v[i] / b.v[i])
+  KEPLER_FLOAT4_OP(operator<, a.v[i] < b.v[i] ? 1.0f : 0.0f)
+  KEPLER_FLOAT4_OP(operator>, a.v[i] > b.v[i] ? 1.0f : 0.0f)
+  KEPLER_FLOAT4_OP(operator>=, a.v[i] >= b.v[i] ? 1.0f : 0.0f)
+  KEPLER_FLOAT4_OP(operator&, (a.v[i] != 0.0f) && (b.v[i] != 0.0f) ? 1.0f : 0.0f)
+  KEPLER_FLOAT4_OP(operator|, (a.v[i] != 0.0f) || (b.v[i] != 0.0f) ? 1.0f : 0.0f)
+  KEPLER_FLOAT4_OP(and_not, (a.v[i] != 0.0f) && (b.v[i] == 0.0f) ? 1.0f : 0.0f)
+  KEPLER_FLOAT4_OP(min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+  KEPLER_FLOAT4_OP(max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+
+  #undef KEPLER_FLOAT4_OP
+
+  friend float4 sqrt(float4 a){ float4 r; for(int i = 0; i < 4; ++i) r.v[i] = std::sqrt(a.v[i]); return r; }
+  friend float4 abs(float4 a){ float4 r; for(int i = 0; i < 4; ++i) r.v[i] = std::fabs(a.v[i]); return r; }
+
+  friend float4 select(float4 mask, float4 a, float4 b){
+    float4 r; for(int i = 0; i < 4; ++i) r.v[i] = mask.v[i] != 0.0f ? a.v[i] : b.v[i]; return r;
+  }
+
+  friend bool any(float4 mask){
+    return (mask.v[0] != 0.0f) || (mask.v[1] != 0.0f) || (mask.v[2] != 0.0f) || (mask.v[3] != 0.0f);
+  }
+#endif
+};
+
+/**
+ * Outcome of a batched orbit
+ */
+enum OrbitOutcome{
+  ORBIT_UNRESOLVED = 0, // Did not close, crash or escape within steps_max_
+  ORBIT_CLOSED,
+  ORBIT_COLLISION,
+  ORBIT_ESCAPED
+};
+
+/**
+ *
+ * OrbitBatch integrates lanes_ launches at once with Yoshida's 4th order
+ * scheme, using the same units, time step and termination rules as Orbit.
+ * Lanes that terminate are frozen (their time step goes to zero) while the
+ * others continue, the batch finishes once every lane has terminated.
+ *
+ * Closure is detected when (r - r_0) . v_0 changes sign from negative to
+ * positive, i.e. the orbit passes back through the launch point, and the
+ * period is interpolated within the step.
+ *
+ * @param V Number of float4 registers per batch (lanes_ = 4 V)
+ */
+template <int V = 4>
+struct OrbitBatch{
+
+  const static int lanes_ = 4 * V;
+
+  /**
+   * Settings, same meaning as in Orbit
+   */
+  float G_ = float(4.0 * M_PI * M_PI);
+  float velocity_scale_ = float(2.0 * M_PI / 30.0);
+  float dt_ = float(1.0 / 365.25);
+  float R_sun_sq_ = 0.01f;
+  float view_bound_ = 3.0f;
+
+  int sub_steps_ = Yoshida4<float>::default_sub_steps;
+
+  // Give up on orbits that take longer than this many steps (days)
+  int steps_max_ = 36525;
+
+  /**
+   * Per lane state
+   */
+  float4 x_[V], y_[V];
+  float4 v_x_[V], v_y_[V];
+  float4 a_x_[V], a_y_[V];
+
+  // Launch velocity, the launch point is (0, 1)
+  float4 v_x_0_[V], v_y_0_[V];
+
+  // Energy >= 0
+  float4 unbound_[V];
+
+  // Still integrating
+  float4 active_[V];
+
+  // Closure event function (r - r_0) . v_0 at the end of the last step
+  float4 g_[V];
+
+  float4 r_sq_min_[V], r_sq_max_[V];
+
+  // A sub-step went inside the sun (c.f. Orbit::grazed_sun_)
+  float4 grazed_[V];
+
+  /**
+   * Results
+   */
+  int outcome_[lanes_];
+
+  // Time of closure, collision or escape [years]
+  float t_end_[lanes_];
+
+  float eccentricity_[lanes_];
+
+  // Number of steps until every lane was done
+  int step_count_ = 0;
+
+  /**
+   *
+   * OrbitBatch::integrate
+   *
+   * @param theta Launch angles [radians] (lanes_ of them)
+   * @param v Launch velocities [km/s] (lanes_ of them)
+   */
+  void integrate(const float theta[], const float v[]){
+
+    using namespace std;
+
+    launch(theta, v);
+
+    const float w_1 = 1.3512071919596576f;
+    const float w_0 = -1.7024143839193153f;
+
+    float dt_sub = dt_ / float(sub_steps_);
+
+    float t_end[lanes_];
+    int outcome[lanes_];
+
+    for(int i = 0; i < lanes_; ++i){
+      t_end[i] = 0.0f;
+      outcome[i] = ORBIT_UNRESOLVED;
+    }
+
+    step_count_ = 0;
+
+    for(int step = 0; step < steps_max_; ++step){
+
+      for(int j = 0; j < V; ++j){
+
+        // Frozen lanes don't move
+        float4 dt = select(active_[j], float4(dt_sub), float4(0.0f));
+
+        for(int sub_step = 0; sub_step < sub_steps_; ++sub_step){
+          verlet(j, dt * float4(w_1));
+          verlet(j, dt * float4(w_0));
+          verlet(j, dt * float4(w_1));
+
+          grazed_[j] = grazed_[j] | ((x_[j] * x_[j] + y_[j] * y_[j]) < float4(R_sun_sq_));
+        }
+      }
+
+      ++step_count_;
+
+      if(!terminate(float(step + 1) * dt_, t_end, outcome)){
+        break;
+      }
+    }
+
+    for(int j = 0; j < V; ++j){
+
+      float r_min[4], r_max[4];
+      sqrt(r_sq_min_[j]).store(r_min);
+      sqrt(r_sq_max_[j]).store(r_max);
+
+      for(int k = 0; k < 4; ++k){
+        int i = 4 * j + k;
+
+        outcome_[i] = outcome[i];
+        t_end_[i] = t_end[i];
+
+        // Closed orbits get the eccentricity from their extent, the others
+        // from the launch invariants
+        if(outcome[i] == ORBIT_CLOSED){
+          eccentricity_[i] = (r_max[k] - r_min[k]) / (r_max[k] + r_min[k]);
+        }else{
+          eccentricity_[i] = launch_eccentricity(theta[i], v[i]);
+        }
+      }
+    }
+  }
+
+  /**
+   * OrbitBatch::launch
+   *
+   * Set up the lanes for new launches
+   */
+  void launch(const float theta[], const float v[]){
+
+    using namespace std;
+
+    for(int j = 0; j < V; ++j){
+
+      float v_x[4], v_y[4], unbound[4];
+
+      for(int k = 0; k < 4; ++k){
+        int i = 4 * j + k;
+
+        v_x[k] = v[i] * velocity_scale_ * cos(theta[i]);
+        v_y[k] = v[i] * velocity_scale_ * sin(theta[i]);
+
+        unbound[k] = (0.5f * (v_x[k] * v_x[k] + v_y[k] * v_y[k]) - G_) >= 0.0f ? 1.0f : 0.0f;
+      }
+
+      x_[j] = float4(0.0f);
+      y_[j] = float4(1.0f);
+      v_x_[j] = v_x_0_[j] = float4::load(v_x);
+      v_y_[j] = v_y_0_[j] = float4::load(v_y);
+
+      unbound_[j] = float4::load(unbound) > float4(0.5f);
+      active_[j] = float4(1.0f) > float4(0.0f);
+
+      g_[j] = float4(0.0f);
+      grazed_[j] = float4(0.0f) > float4(1.0f);
+      r_sq_min_[j] = float4(1.0f);
+      r_sq_max_[j] = float4(1.0f);
+
+      force(j);
+    }
+  }
+
+  /**
+   * OrbitBatch::force
+   *
+   * Acceleration for register j
+   */
+  inline void force(int j){
+    float4 r_sq = x_[j] * x_[j] + y_[j] * y_[j];
+    float4 s = float4(-G_) / (r_sq * sqrt(r_sq));
+
+    a_x_[j] = s * x_[j];
+    a_y_[j] = s * y_[j];
+  }
+
+  /**
+   * OrbitBatch::verlet
+   *
+   * One velocity Verlet step for register j
+   */
+  inline void verlet(int j, float4 dt){
+
+    float4 half_dt = float4(0.5f) * dt;
+
+    v_x_[j] = v_x_[j] + half_dt * a_x_[j];
+    v_y_[j] = v_y_[j] + half_dt * a_y_[j];
+
+    x_[j] = x_[j] + dt * v_x_[j];
+    y_[j] = y_[j] + dt * v_y_[j];
+
+    force(j);
+
+    v_x_[j] = v_x_[j] + half_dt * a_x_[j];
+    v_y_[j] = v_y_[j] + half_dt * a_y_[j];
+  }
+
+  /**
+   *
+   * OrbitBatch::terminate
+   *
+   * Check the termination conditions at the end of a step and freeze the
+   * lanes that are done.
+   *
+   * @param t Time at the end of the step
+   * @return true if any lane is still active
+   */
+  bool terminate(float t, float t_end[], int outcome[]){
+
+    bool running = false;
+
+    for(int j = 0; j < V; ++j){
+
+      float4 r_sq = x_[j] * x_[j] + y_[j] * y_[j];
+
+      r_sq_min_[j] = select(active_[j], min(r_sq_min_[j], r_sq), r_sq_min_[j]);
+      r_sq_max_[j] = select(active_[j], max(r_sq_max_[j], r_sq), r_sq_max_[j]);
+
+      float4 collision = active_[j] & ((r_sq < float4(R_sun_sq_)) | grazed_[j]);
+
+      float4 g = x_[j] * v_x_0_[j] + (y_[j] - float4(1.0f)) * v_y_0_[j];
+      float4 closed = and_not(active_[j] & (g_[j] < float4(0.0f)) & (g >= float4(0.0f)), collision);
+
+      float4 escaped = and_not(active_[j] & unbound_[j] &
+                               ((abs(x_[j]) > float4(view_bound_)) | (abs(y_[j]) > float4(view_bound_))),
+                               collision);
+
+      // Fraction of the step where g crosses zero
+      float4 s = g_[j] / (g_[j] - g);
+
+      g_[j] = g;
+
+      float4 done = collision | closed | escaped;
+
+      if(any(done)){
+
+        float c[4], cl[4], e[4], s_l[4];
+        collision.store(c);
+        closed.store(cl);
+        escaped.store(e);
+        s.store(s_l);
+
+        for(int k = 0; k < 4; ++k){
+          int i = 4 * j + k;
+
+          if(c[k] != 0.0f){
+            outcome[i] = ORBIT_COLLISION;
+            t_end[i] = t;
+          }else if(cl[k] != 0.0f){
+            outcome[i] = ORBIT_CLOSED;
+            t_end[i] = t - dt_ * (1.0f - s_l[k]);
+          }else if(e[k] != 0.0f){
+            outcome[i] = ORBIT_ESCAPED;
+            t_end[i] = t;
+          }
+        }
+
+        active_[j] = and_not(active_[j], done);
+      }
+
+      running = running || any(active_[j]);
+    }
+
+    return running;
+  }
+
+  /**
+   * OrbitBatch::launch_eccentricity
+   *
+   * e = sqrt(1 + 2 E h^2 / mu^2) from the launch energy and angular momentum
+   */
+  float launch_eccentricity(float theta, float v) const{
+
+    using namespace std;
+
+    double v_x = v * velocity_scale_ * cos(theta);
+    double v_y = v * velocity_scale_ * sin(theta);
+
+    double E = 0.5 * (v_x * v_x + v_y * v_y) - G_;
+    double h = -v_x;
+
+    return float(sqrt(max(0.0, 1.0 + 2.0 * E * h * h / (double(G_) * G_))));
+  }
+};
+
+#endif // KEPLER_ORBIT_BATCH_H
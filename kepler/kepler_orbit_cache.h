@@ -0,0 +1,196 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Least recently used cache of computed orbits and the geometry
+ * built from them. Students tend to toggle between a few launch settings so
+ * revisiting one skips both the integration and the geometry rebuild.
+ *
+ */
+
+
+#ifndef KEPLER_ORBIT_CACHE_H
+#define KEPLER_ORBIT_CACHE_H
+
+#include <cmath>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "kepler_orbit.h"
+
+/**
+ * Everything KeplerScene::runSimulation produces for one launch
+ */
+template <class OrbitType>
+struct OrbitCacheEntry{
+
+  long long key = 0;
+
+  /**
+   * Orbit
+   */
+  std::vector<typename OrbitType::OrbitPiece> elements_;
+
+  bool closed_ = false;
+  bool collision_ = false;
+  bool escaped_ = false;
+
+  float t_max_ = 0.0f;
+  float period_ = 0.0f;
+
+  /**
+   * Geometry, the path, markers and sweep vertices are drawn from the
+   * elements directly so only the sweep area prefix sums and index remain
+   */
+  std::vector<float> sweep_area_;
+  std::vector<unsigned int> sweep_index_;
+
+  /**
+   * OrbitCacheEntry::bytes
+   *
+   * @return Approximate memory used by the entry
+   */
+  size_t bytes() const{
+    return sizeof(*this)
+           + elements_.capacity() * sizeof(typename OrbitType::OrbitPiece)
+           + sweep_area_.capacity() * sizeof(float)
+           + sweep_index_.capacity() * sizeof(unsigned int);
+  }
+};
+
+/**
+ *
+ * Orbits keyed on the launch angle and velocity quantized to below the
+ * resolution of the GUI controls. The cache is bounded by budget_bytes_, the
+ * least recently used entries are evicted first.
+ *
+ */
+template <class OrbitType>
+struct OrbitCache{
+
+  typedef OrbitCacheEntry<OrbitType> Entry;
+
+  // Quantization of the key, the spin boxes go down to 0.01
+  float theta_quantum_ = 0.001f;   // [degrees]
+  float v_quantum_ = 0.001f;       // [km/s]
+
+  size_t budget_bytes_ = 0;
+  size_t used_bytes_ = 0;
+
+  // Hit statistics
+  long hits_ = 0;
+  long misses_ = 0;
+
+  // Most recently used at the front
+  std::list<Entry> entries_;
+  std::unordered_map<long long, typename std::list<Entry>::iterator> index_;
+
+  OrbitCache(size_t budget_bytes = 16 << 20) : budget_bytes_(budget_bytes){
+
+  }
+
+  /**
+   *
+   * OrbitCache::key
+   *
+   * @param theta_launch [radians]
+   * @param v_launch [km/s]
+   * @return
+   */
+  long long key(float theta_launch, float v_launch) const{
+
+    using namespace std;
+
+    long long theta_q = llround(180.0 * theta_launch / M_PI / theta_quantum_);
+    long long v_q = llround(v_launch / v_quantum_);
+
+    return (long long) (((unsigned long long) theta_q << 32) ^ ((unsigned long long) v_q & 0xffffffffULL));
+  }
+
+  /**
+   *
+   * OrbitCache::find
+   *
+   * @param key
+   * @return The entry (now the most recently used) or nullptr
+   */
+  const Entry *find(long long key){
+
+    auto it = index_.find(key);
+
+    if(it == index_.end()){
+      ++misses_;
+      return nullptr;
+    }
+
+    ++hits_;
+
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &entries_.front();
+  }
+
+  /**
+   *
+   * OrbitCache::insert
+   *
+   * Take ownership of the entry and evict old ones until it fits the budget.
+   * Entries larger than the whole budget are not kept.
+   *
+   * @param entry
+   */
+  void insert(Entry &entry){
+
+    erase(entry.key);
+
+    size_t bytes = entry.bytes();
+
+    if(bytes > budget_bytes_){
+      return;
+    }
+
+    while(used_bytes_ + bytes > budget_bytes_){
+      erase(entries_.back().key);
+    }
+
+    entries_.push_front(Entry());
+    std::swap(entries_.front(), entry);
+
+    index_[entries_.front().key] = entries_.begin();
+    used_bytes_ += bytes;
+  }
+
+  /**
+   * OrbitCache::erase
+   *
+   * @param key
+   */
+  void erase(long long key){
+
+    auto it = index_.find(key);
+
+    if(it == index_.end()){
+      return;
+    }
+
+    used_bytes_ -= it->second->bytes();
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  /**
+   * OrbitCache::clear
+   *
+   * Drop everything, e.g. when the integrator settings change
+   */
+  void clear(){
+    entries_.clear();
+    index_.clear();
+    used_bytes_ = 0;
+  }
+};
+
+#endif // KEPLER_ORBIT_CACHE_H
@@ -0,0 +1,195 @@
+/**
+ *
+ * Author: Stou Sandalski <sandalski@astro.umn.edu>
+ * License: Apache 2.0
+ *
+ * Description: Computes orbits on a background thread. Elements are handed
+ * over in chunks as the integration progresses so the GUI can start drawing
+ * and animating the orbit right away instead of waiting for it to finish.
+ * The worker can write straight into the receiving orbit's buffer so handing
+ * over a chunk is just a count.
+ *
+ */
+
+
+#ifndef KEPLER_ORBIT_WORKER_H
+#define KEPLER_ORBIT_WORKER_H
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "kepler_orbit.h"
+
+/**
+ *
+ * Runs OrbitType::calculate_orbit on its own thread. The GUI thread starts a
+ * calculation with OrbitWorker::start and collects the elements with
+ * OrbitWorker::receive, everything else in here belongs to the worker.
+ *
+ */
+template <class OrbitType>
+struct OrbitWorker{
+
+  // Orbit integrated by the worker thread
+  OrbitType orbit_;
+
+  std::thread thread_;
+
+  // Set to stop the running calculation
+  std::atomic<bool> cancel_;
+
+  /**
+   * Shared with the GUI thread, guarded by mutex_
+   */
+  std::mutex mutex_;
+
+  // Elements [0, ready_count_) are computed
+  int ready_count_ = 0;
+
+  // Calculation finished, the flags below are valid
+  bool done_ = false;
+
+  bool closed_ = false;
+  bool collision_ = false;
+  bool escaped_ = false;
+  float period_ = 0.0f;
+
+  /**
+   * @param steps_max Capacity of the worker's own buffer, 0 if it will be
+   *                  attached to the receiving orbit (c.f. OrbitWorker::attach)
+   */
+  OrbitWorker(int steps_max = 100000) : orbit_(steps_max){
+
+    cancel_ = false;
+
+    orbit_.progress_ = [this](int first, int count){
+      std::lock_guard<std::mutex> lock(mutex_);
+      ready_count_ = first + count;
+      return !cancel_;
+    };
+  }
+
+  ~OrbitWorker(){
+    stop();
+  }
+
+  /**
+   *
+   * OrbitWorker::attach
+   *
+   * Integrate into the receiving orbit's buffer instead of copying elements
+   * over in receive. The GUI thread only reads the elements it has received
+   * and the worker only writes past those.
+   *
+   * @param orbit
+   */
+  void attach(OrbitType &orbit){
+    stop();
+    orbit_.use_buffer(orbit.elements_);
+  }
+
+  /**
+   *
+   * OrbitWorker::start
+   *
+   * Stop whatever is running and start computing a new orbit
+   *
+   * @param settings Mode and tolerances are copied from here
+   * @param theta_launch [radians]
+   * @param v_launch [km/s]
+   */
+  void start(const OrbitType &settings, float theta_launch, float v_launch){
+
+    stop();
+
+    orbit_.copy_settings(settings);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ready_count_ = 0;
+      done_ = false;
+    }
+
+    cancel_ = false;
+    thread_ = std::thread(&OrbitWorker::run, this, theta_launch, v_launch);
+  }
+
+  /**
+   *
+   * OrbitWorker::stop
+   *
+   * Cancel the running calculation (if any) and wait for the thread. This
+   * returns quickly since the worker checks for cancellation every chunk.
+   */
+  void stop(){
+
+    cancel_ = true;
+
+    if(thread_.joinable()){
+      thread_.join();
+    }
+  }
+
+  /**
+   *
+   * OrbitWorker::receive
+   *
+   * Hand the elements computed since the last call to the receiving orbit
+   * (copying them unless attached) and copy the termination flags once the
+   * calculation is done.
+   *
+   * @param orbit Receiving orbit
+   * @return true if the calculation is done and all elements were received
+   */
+  bool receive(OrbitType &orbit){
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    int count = std::min(ready_count_, orbit.steps_max_);
+
+    if(orbit.elements_ != orbit_.elements_){
+      for(int i = orbit.element_count_; i < count; ++i){
+        orbit.set_element(i, orbit_.element(i));
+      }
+    }
+
+    orbit.element_count_ = count;
+
+    if(done_){
+      orbit.closed_ = closed_;
+      orbit.collision_ = collision_;
+      orbit.escaped_ = escaped_;
+      orbit.t_max_ = orbit.elements_->t(std::max(0, orbit.element_count_ - 1));
+      orbit.period_ = period_;
+    }
+
+    return done_;
+  }
+
+  /**
+   * OrbitWorker::run
+   *
+   * Thread body
+   */
+  void run(float theta_launch, float v_launch){
+
+    orbit_.calculate_orbit(theta_launch, v_launch);
+
+    // Whatever did not fill a whole chunk
+    if(!orbit_.cancelled_){
+      orbit_.report_progress(true);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    closed_ = orbit_.closed_;
+    collision_ = orbit_.collision_;
+    escaped_ = orbit_.escaped_;
+    period_ = orbit_.period_;
+    done_ = true;
+  }
+};
+
+#endif // KEPLER_ORBIT_WORKER_H
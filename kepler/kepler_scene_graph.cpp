@@ -11,6 +11,7 @@
 
 #include "kepler_scene_graph.h"
 
+#include <algorithm>
 #include <cmath>
 #include <ctime>
 #include <iostream>
@@ -32,11 +33,13 @@ using namespace std;
 // Modified version of this https://github.com/openscenegraph/osg/blob/master/examples/osgviewerQt/CMakeLists.txt
 KeplerScene::KeplerScene(QWidget *parent)
     : QOpenGLWidget(parent),
-      markers_(8096),
-      orbit_path_(8096),
+      orbit_worker_(0),
+      glyphs_(tex_unit_glyphs_),
+      markers_(orbit_.steps_max_ / steps_per_marker_ + 1),
+      nbody_sprites_(nbody_asteroid_count_ + 1),
       circle_(256),
-      sweeps_(tex_unit_sweeps_, 8096),
-      ruler_(tex_unit_ruler_){
+      sweeps_(&glyphs_, tex_unit_sweep_vertices_, orbit_.elements_->position_, orbit_.steps_max_ + 1),
+      ruler_(&glyphs_){
 
   setMouseTracking(true);
   //setFocusPolicy(Qt::ClickFocus);
@@ -62,6 +65,14 @@ KeplerScene::KeplerScene(QWidget *parent)
   theta_launch_ = 0.0;
   v_launch_ = 0.0;
 
+  // Closed form orbits, radial launches have no conic and fall back to the
+  // fixed step Integrator of KeplerOrbit
+  orbit_.analytic_ = true;
+  orbit_.adaptive_ = false;
+
+  // The worker integrates straight into orbit_'s elements
+  orbit_worker_.attach(orbit_);
+
   // Initialize Qt
   QVBoxLayout *layout = new QVBoxLayout();
   setLayout(layout);
@@ -94,7 +105,11 @@ void KeplerScene::initializeGL(){
 //  glEnable(GL_DEPTH_TEST);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+  // Camera uniforms shared by all the programs
+  frame_.init_resources();
+
   // Reference Ruler
+  glyphs_.init_resources();
   ruler_.init_resources();
 
   // Initialize the path program and array
@@ -127,6 +142,10 @@ void KeplerScene::initializeGL(){
   circle_.setup_array(pathProgram_.positionHandle_, pathProgram_.colorHandle_);
   circle_.draw_size = circle_.size;
 
+  const float circle_color[4] = {0.5f, 1.0f, 0.5f, 1.0f};
+  copy(circle_color, circle_color + 4, circle_.color_);
+  circle_.colorHandle_ = pathProgram_.colorHandle_;
+
   // The Velocity vector arrow
   arrow_.init_resources();
 
@@ -138,7 +157,9 @@ void KeplerScene::initializeGL(){
   sun_.init_resources();
   sun_.setup_array(planetProgram_.positionHandle_);
 
+  // One object block for the arrow tip and one for each end of the ruler
   handle_.radius = 0.25f;
+  handle_.object_.capacity_ = 3;
   handle_.init_resources();
   handle_.setup_array(planetProgram_.positionHandle_);
 
@@ -148,17 +169,52 @@ void KeplerScene::initializeGL(){
   planet_.init_resources();
   planet_.setup_array(planetProgram_.positionHandle_);
 
+  /**
+   * The orbit positions are uploaded once into orbit_vbo_ and the path,
+   * markers and sweeps all draw from there (slot 0 is the sweep center, the
+   * path and markers start at slot 1). The size is rounded up to a whole
+   * number of the sweeps' two vertex texels so the last vertex is reachable.
+   */
+  glGenBuffers(1, &orbit_vbo_);
+  glBindBuffer(GL_ARRAY_BUFFER, orbit_vbo_);
+  glBufferData(GL_ARRAY_BUFFER, 4 * ((orbit_.steps_max_ + 2) / 2) * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, 2 * sizeof(float), orbit_.elements_->position_);
+
   orbit_path_.init_resources();
-  orbit_path_.setup_array(pathProgram_.positionHandle_, pathProgram_.colorHandle_);
+  orbit_path_.setup_shared_array(orbit_vbo_, pathProgram_.positionHandle_, 2, 1);
+  orbit_path_.colorHandle_ = pathProgram_.colorHandle_;
 
-  // ... Markers
+  // ... Markers, the sizes and colors repeat so they are uploaded once
   markerProgram_.init_resources();
   markerProgram_.build();
   markers_.init_resources();
   markers_.setup_array(markerProgram_.positionHandle_, markerProgram_.sizeHandle_, markerProgram_.colorHandle_);
+  markers_.setup_shared_positions(orbit_vbo_, markerProgram_.positionHandle_, 2, 1, steps_per_marker_);
+
+  for(int i = 0; i < markers_.capacity_; ++i){
+
+    int color_ix = 0;
+    float radius = radius_marker_small_;
+
+    if(i % 5 == 0){
+      radius = radius_marker_big_;
+      color_ix = 1;
+    }
+
+    markers_.addPoint(0.0f, 0.0f, 0.0f, radius,
+                      C_markers[color_ix][0], C_markers[color_ix][1],
+                      C_markers[color_ix][2], C_markers[color_ix][3]);
+  }
+
+  markers_.upload();
+  markers_.clear();
+
+  // ... N-body mode bodies
+  nbody_sprites_.init_resources();
+  nbody_sprites_.setup_array(markerProgram_.positionHandle_, markerProgram_.sizeHandle_, markerProgram_.colorHandle_);
 
   // Initialize the sweeps
-  sweeps_.init_resources();
+  sweeps_.init_resources(orbit_vbo_);
 
   initialized_ = true;
 
@@ -174,8 +230,11 @@ void KeplerScene::initializeGL(){
  */
 void KeplerScene::cleanup(){
 
+  orbit_worker_.stop();
+
   arrow_.cleanup();
   ruler_.cleanup();
+  glyphs_.cleanup();
   circle_.cleanup();
   handle_.cleanup();
 
@@ -183,8 +242,13 @@ void KeplerScene::cleanup(){
   planet_.cleanup();
   sweeps_.cleanup();
   markers_.cleanup();
+  nbody_sprites_.cleanup();
+  orbit_path_.cleanup();
+
+  glDeleteBuffers(1, &orbit_vbo_);
 
   // Free the various programs
+  frame_.cleanup();
   markerProgram_.cleanup();
   pathProgram_.cleanup();
   planetProgram_.cleanup();
@@ -215,6 +279,26 @@ void KeplerScene::resizeGL(int w, int h){
     left *= aspect;
   }
   camera_.init_orthographic(w, h, left, top, near_, far_);
+
+  // Stop escaping orbits a little past the edge of the view, this changes
+  // where escaping orbits end so the cached ones are no longer valid
+  float view_bound = 1.1f * max(fabs(left), fabs(top));
+
+  if(view_bound != orbit_.view_bound_){
+    // The worker integrates against the bound it started with, stop it
+    // before it caches a stale orbit and compute the orbit again
+    bool streaming = orbit_streaming_;
+
+    orbit_worker_.stop();
+    orbit_streaming_ = false;
+
+    orbit_.view_bound_ = view_bound;
+    orbit_cache_.clear();
+
+    if(streaming){
+      runSimulation();
+    }
+  }
 #endif
 
   camera_.init_model_view();
@@ -239,12 +323,16 @@ void KeplerScene::newOrbit(){
 //  std::cout<<"KeplerScene::newOrbit"<<std::endl;
   animation_timer_.start();
 
+  orbit_worker_.stop();
+  orbit_streaming_ = false;
+
   valid_ = false;
   animation_ = false;
   orbit_complete_ = false;
 
   element_ix_ = 0;
   sweep_element_ix_ = 0;
+  t_animation_ = 0.0f;
 
   // Return planet to start position
   planet_.setPosition(defaultPosition_[0], defaultPosition_[1], 0);
@@ -259,6 +347,10 @@ void KeplerScene::newOrbit(){
   // Remove the orbit trail
   markers_.clear();
 
+  // And the N-body system
+  nbody_.clear();
+  nbody_sprites_.clear();
+
   // And clear the path
   orbit_path_.clear();
 
@@ -277,73 +369,54 @@ void KeplerScene::newOrbit(){
 /**
  * KeplerScene::runSimulation
  *
- *   Run the orbital simulation and construct the geometry that represents it
+ *   Start the orbital simulation. Orbits are computed by orbit_worker_ and
+ *   the geometry is built as the elements arrive (c.f. receiveOrbit) so the
+ *   animation starts right away.
  *
+ *   Orbits are cached by launch parameters, revisiting a launch restores the
+ *   orbit and geometry from the cache instead.
  *
  */
 void KeplerScene::runSimulation(){
 
   arrow_visible_ = false;
 
-  // Compute the orbit
-  orbit_.calculate_orbit(theta_launch_, v_launch_);
-#if 0
-  std::cout<<"KeplerScene::runSimulation: Computed Orbit"<<std::endl;
-  std::cout<<"KeplerScene::runSimulation: Closed orbit: "<<orbit_.closed_<<std::endl;
-  std::cout<<"KeplerScene::runSimulation: Max time is "<<orbit_.t_max_<<std::endl;
-#endif
+  long long key = orbit_cache_.key(theta_launch_, v_launch_);
+  const OrbitCache<KeplerOrbit>::Entry *cached = orbit_cache_.find(key);
+
+  // Drop whatever was still being computed
+  orbit_worker_.stop();
+  orbit_streaming_ = false;
 
   // Clear old data
   orbit_path_.size = 0;
   markers_.size = 0;
   sweeps_.clear();
 
-  for(int i = 0; i < orbit_.element_count_; ++i){
-
-    // Build the orbit path
-    if(!orbit_path_.addPoint(orbit_.elements_[i].x, orbit_.elements_[i].y, 0.0,
-                             orbit_.elements_[i].v_x, orbit_.elements_[i].v_y, 0.0)){
-      cerr << "KeplerScene::runSimulation : Out of orbital path capacity " << orbit_path_.capacity_ << endl;
-      break;
-    }
+  if(nbody_mode_){
+    startNBody();
+  }else if(cached){
+    restoreOrbit(*cached);
 
-    // Build the s_sweep data
-    if(!sweeps_.addPoint(orbit_.elements_[i].x, orbit_.elements_[i].y, 0.0)){
-      cerr << "KeplerScene::runSimulation : Out of sweep capacity " << sweeps_.capacity_ << endl;
-      break;
-    }
-
-    // Create the markers
-    if(i % steps_per_marker_ == 0){
-
-      int color_ix = 0;
-      float radius = radius_marker_small_;
-
-      if((markers_.size % 5 == 0)){
-        radius = radius_marker_big_;
-        color_ix = 1;
-      }
-
-      if(!markers_.addPoint(orbit_.elements_[i].x, orbit_.elements_[i].y, 0.0f, radius,
-                            C_markers[color_ix][0], C_markers[color_ix][1],
-                            C_markers[color_ix][2], C_markers[color_ix][3])){
-        cerr << "KeplerScene::runSimulation : Out of marker capacity " << markers_.capacity_ << endl;
-        break;
-      }
-    }
+    uploadElements(0, orbit_.element_count_);
+    updateGeometry();
+  }else{
+    orbit_.element_count_ = 0;
+    orbit_.closed_ = false;
+    orbit_.collision_ = false;
+    orbit_.escaped_ = false;
+
+    orbit_key_ = key;
+    orbit_streaming_ = true;
+    orbit_worker_.start(orbit_, theta_launch_, v_launch_);
   }
 
-  orbit_path_.upload();
-  markers_.upload();
-  sweeps_.buildUpload(orbit_.closed_);
-
-  glFlush();
-  glFinish();
-
 #if 0
   std::cout<<"!!! Total Markers "<<markers_.size<<std::endl;
   std::cout<<"!!! Orbit Size "<<orbit_path_.size<<std::endl;
   std::cout<<"!!! Orbit Element Count "<<orbit_.element_count_<<std::endl;
+  std::cout<<"!!! Orbit cache "<<orbit_cache_.hits_<<" hits, "<<orbit_cache_.misses_<<" misses, "
+           <<orbit_cache_.used_bytes_<<" bytes"<<std::endl;
 #endif
 
   valid_ = true;
@@ -356,6 +429,228 @@ void KeplerScene::runSimulation(){
   update();
 }
 
+/**
+ * KeplerScene::startNBody
+ *
+ *   Set up the N-body system: the planet with the launch velocity, a moon on
+ *   a circular orbit around it and an asteroid belt further out. orbit_ is
+ *   left empty so there is no path, markers or sweeps.
+ *
+ */
+void KeplerScene::startNBody(){
+
+  orbit_.element_count_ = 0;
+  orbit_.closed_ = false;
+  orbit_.collision_ = false;
+  orbit_.escaped_ = false;
+
+  orbit_path_.draw_size = 0;
+  markers_.draw_size = 0;
+
+  nbody_.clear();
+  nbody_.R_sun_sq_ = radius_sun_ * radius_sun_;
+
+  float v_x = v_launch_ * orbit_.velocity_scale_ * cos(theta_launch_);
+  float v_y = v_launch_ * orbit_.velocity_scale_ * sin(theta_launch_);
+
+  nbody_planet_id_ = nbody_.add_body(defaultPosition_[0], defaultPosition_[1], v_x, v_y, nbody_planet_mass_);
+
+  nbody_moon_id_ = nbody_.add_circular(defaultPosition_[0] + nbody_moon_distance_, defaultPosition_[1],
+                                       nbody_moon_mass_, nbody_planet_id_);
+
+  // Same belt every launch
+  nbody_.add_ring(nbody_asteroid_count_, nbody_belt_min_, nbody_belt_max_, nbody_asteroid_mass_);
+
+  updateNBody(0.0f);
+}
+
+/**
+ * KeplerScene::updateNBody
+ *
+ *   Advance the N-body system and move the planet and sprites to the new
+ *   positions
+ *
+ * @param dt [years]
+ */
+void KeplerScene::updateNBody(float dt){
+
+  if(dt > 0.0f){
+    // Steps no longer than an orbit element
+    nbody_.advance(dt, orbit_.dt_);
+  }
+
+  int planet = nbody_.find(nbody_planet_id_);
+
+  if(planet >= 0){
+    planet_.setPosition(nbody_.r_[2 * planet], nbody_.r_[2 * planet + 1], 0.0f);
+  }else{
+    // Fell into the sun
+    orbit_.collision_ = true;
+    planet_.setPosition(0.0f, 0.0f, -0.1f);
+  }
+
+  nbody_sprites_.clear();
+
+  for(int i = 0; i < nbody_.size(); ++i){
+
+    if(i == planet){
+      continue;
+    }
+
+    float x = nbody_.r_[2 * i];
+    float y = nbody_.r_[2 * i + 1];
+
+    if(nbody_.id_[i] == nbody_moon_id_){
+      nbody_sprites_.addPoint(x, y, 0.0f, radius_moon_, 0.8f, 0.8f, 0.8f, 1.0f);
+    }else{
+      nbody_sprites_.addPoint(x, y, 0.0f, radius_asteroid_, 0.6f, 0.5f, 0.4f, 1.0f);
+    }
+  }
+
+  nbody_sprites_.draw_size = nbody_sprites_.size;
+  uploads_.schedule(&nbody_sprites_);
+}
+
+/**
+ * KeplerScene::receiveOrbit
+ *
+ *   Pick up the elements computed by orbit_worker_ since the last frame and
+ *   upload just the new part. Once the orbit is complete the sweeps are
+ *   rebuilt for the final (closed or open) orbit and the result goes into
+ *   the cache.
+ *
+ */
+void KeplerScene::receiveOrbit(){
+
+  if(!orbit_streaming_){
+    return;
+  }
+
+  int first = orbit_.element_count_;
+
+  bool done = orbit_worker_.receive(orbit_);
+
+  if(!done && (orbit_.element_count_ == first)){
+    return;
+  }
+
+  uploadElements(first, orbit_.element_count_ - first);
+  updateGeometry();
+
+  if(done){
+    orbit_streaming_ = false;
+
+#if 0
+    std::cout<<"KeplerScene::receiveOrbit: Computed Orbit"<<std::endl;
+    std::cout<<"KeplerScene::receiveOrbit: Closed orbit: "<<orbit_.closed_<<std::endl;
+    std::cout<<"KeplerScene::receiveOrbit: Max time is "<<orbit_.t_max_<<std::endl;
+#endif
+
+    sweeps_.build(orbit_.closed_);
+    storeOrbit(orbit_key_);
+  }else{
+    sweeps_.build(false);
+  }
+}
+
+/**
+ * KeplerScene::uploadElements
+ *
+ *   Upload the positions of elements [first, first + count) to orbit_vbo_,
+ *   the path, markers and sweeps all draw from this one upload.
+ *
+ * @param first
+ * @param count
+ */
+void KeplerScene::uploadElements(int first, int count){
+
+  if(count <= 0){
+    return;
+  }
+
+  // Element i is in slot i + 1 (c.f. OrbitBuffer)
+  glBindBuffer(GL_ARRAY_BUFFER, orbit_vbo_);
+  glBufferSubData(GL_ARRAY_BUFFER, 2 * (first + 1) * sizeof(float), 2 * count * sizeof(float),
+                  orbit_.elements_->position_ + 2 * (first + 1));
+
+  check_GL_error("KeplerScene::uploadElements() exit");
+}
+
+/**
+ * KeplerScene::updateGeometry
+ *
+ *   Size the path, markers and sweeps to the elements of orbit_
+ */
+void KeplerScene::updateGeometry(){
+
+  orbit_path_.size = orbit_.element_count_;
+
+  // A marker every steps_per_marker_ elements starting at element 0
+  markers_.size = (orbit_.element_count_ + steps_per_marker_ - 1) / steps_per_marker_;
+
+  // Plus the center
+  sweeps_.setSize(orbit_.element_count_ + 1);
+}
+
+/**
+ * KeplerScene::storeOrbit
+ *
+ *   Copy the current orbit and its geometry into the cache
+ *
+ * @param key
+ */
+void KeplerScene::storeOrbit(long long key){
+
+  OrbitCache<KeplerOrbit>::Entry entry;
+
+  entry.key = key;
+
+  entry.elements_.resize(orbit_.element_count_);
+
+  for(int i = 0; i < orbit_.element_count_; ++i){
+    entry.elements_[i] = orbit_.element(i);
+  }
+
+  entry.closed_ = orbit_.closed_;
+  entry.collision_ = orbit_.collision_;
+  entry.escaped_ = orbit_.escaped_;
+  entry.t_max_ = orbit_.t_max_;
+  entry.period_ = orbit_.period_;
+
+  int loop_size = max(0, sweeps_.loop_size_);
+  entry.sweep_area_.assign(sweeps_.area_, sweeps_.area_ + loop_size);
+  entry.sweep_index_.assign(sweeps_.index_, sweeps_.index_ + 3 * loop_size);
+
+  orbit_cache_.insert(entry);
+}
+
+/**
+ * KeplerScene::restoreOrbit
+ *
+ *   Copy a cached orbit and its geometry back into the scene
+ *
+ * @param entry
+ */
+void KeplerScene::restoreOrbit(const OrbitCache<KeplerOrbit>::Entry &entry){
+
+  orbit_.element_count_ = min(int(entry.elements_.size()), orbit_.steps_max_);
+
+  for(int i = 0; i < orbit_.element_count_; ++i){
+    orbit_.set_element(i, entry.elements_[i]);
+  }
+
+  orbit_.closed_ = entry.closed_;
+  orbit_.collision_ = entry.collision_;
+  orbit_.escaped_ = entry.escaped_;
+  orbit_.t_max_ = entry.t_max_;
+  orbit_.period_ = entry.period_;
+
+  copy(entry.sweep_area_.begin(), entry.sweep_area_.end(), sweeps_.area_);
+  copy(entry.sweep_index_.begin(), entry.sweep_index_.end(), sweeps_.index_);
+  sweeps_.loop_size_ = int(entry.sweep_area_.size());
+  sweeps_.index_dirty_ = true;
+}
+
 /**
  *
  * This method fires every animation tick (16ms for 60fps) and updates
@@ -376,26 +671,45 @@ void KeplerScene::updateAnimation(){
   float delta_time = (T_cur - T_prev_);
   T_prev_ = T_cur;
 
-//  int ticks = delta_time / ms_per_tick;
-//  float excess = delta_time - ms_per_tick * ticks;
+  // The N-body system is stepped here at the same pace as the orbits, a
+  // stalled frame is not caught up all at once
+  if(nbody_mode_){
+    updateNBody(orbit_.dt_ * min(delta_time, 4.0f * ms_per_tick_) / ms_per_tick_);
+    update();
+    return;
+  }
 
   /**
    *
-   * Each timestep we click over a specific number of elements
+   * The animation covers one element (dt_) every ms_per_tick_, the time is
+   * kept as a float so that no progress is lost between frames and the
+   * planet is interpolated between elements.
    *
    */
-  int d_ix = int(delta_time / ms_per_tick_);
-
-  // Change planet position
-  planet_.setPosition(orbit_.elements_[element_ix_ + 1].x,
-                      orbit_.elements_[element_ix_ + 1].y,
-                      0.0f);
+  t_animation_ += orbit_.dt_ * delta_time / ms_per_tick_;
 
-  element_ix_ += d_ix;
+  int count = orbit_.element_count_;
+  float t_last = count > 0 ? orbit_.elements_->t(count - 1) : 0.0f;
 
-  if((orbit_.element_count_ > 0) && (element_ix_ >= orbit_.element_count_)){
+  if(orbit_streaming_){
+    // Wait at the end of what has been computed so far
+    t_animation_ = min(t_animation_, t_last);
+  }else if((count > 0) && (t_animation_ >= (orbit_.closed_ ? orbit_.period_ : t_last))){
     orbit_complete_ = true;
-    element_ix_ = element_ix_ % orbit_.element_count_;
+
+    // Closed orbits repeat, keep the clock small unless a sweep is counting from it
+    if(orbit_.closed_ && !sweep_running_){
+      t_animation_ = fmod(t_animation_, orbit_.period_);
+    }
+  }
+
+  // Change planet position
+  float position[2];
+  int element_ix = orbit_.time_interpolate(t_animation_, position);
+
+  if(element_ix >= 0){
+    element_ix_ = element_ix;
+    planet_.setPosition(position[0], position[1], 0.0f);
   }
 
   if(orbit_complete_){
@@ -411,17 +725,17 @@ void KeplerScene::updateAnimation(){
     }
 
   }else{
-    markers_.draw_size = element_ix_ / steps_per_marker_;
-    orbit_path_.draw_size = element_ix_;
+    markers_.draw_size = element_ix_ / steps_per_marker_ + 1;
+    orbit_path_.draw_size = element_ix_ + 1;
   }
 
   // If a s_sweep is currently running
   if(sweep_running_){
+    sweep_element_ix_ = sweep_start_ix_ + int((t_animation_ - t_sweep_start_) / orbit_.dt_);
+
     // End sweeps after about 1.5 orbits
     if(sweeps_.updateSweep(sweep_element_ix_) > 1.5 * orbit_.element_count_){
       sweep_running_ = false;
-    }else{
-      sweep_element_ix_ += d_ix;
     }
   }
 
@@ -438,106 +752,111 @@ void KeplerScene::paintGL(){
 
 //  std::cout<<"KeplerScene::paintGL"<<std::endl;
 
+  // Geometry for any orbit elements computed since the last frame
+  receiveOrbit();
+
+  uploads_.flush();
+
+  // The camera block shared by every program
+  frame_.update(camera_);
+  frame_.upload();
+
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 //  glEnable(GL_CULL_FACE);
 
-  // Draw
-
-  // ... paths
-  glUseProgram(pathProgram_.program_);
+  /**
+   * Queue this frame's draws. The lab is flat and is drawn in painter's order
+   * without depth testing, so everything goes in the queued order passes:
+   * the orbit and its decorations first, then the handles, the arrow, the
+   * bodies and the ruler on top.
+   */
+  queue_.clear();
 
-  // The Model View and Projection matrices. Each `node` has its own MV
-  // so we supply the p matrix separately... I guess. Can easily do it offline too.
-  glUniformMatrix4fv(pathProgram_.mvpHandle_, 1, GL_FALSE, camera_.mvp);
+  // ... paths, they share one program
+  msg::RenderState path_state;
+  path_state.pass = msg::PASS_BACKGROUND;
+  path_state.program = pathProgram_.program_;
 
-  // Orbit path
-  float orbit_color_[4] = {1.0f, 1.0f, 1.0f, 1.0f};
-  glUniform4fv(pathProgram_.colorHandle_, 1, orbit_color_);
-  orbit_path_.render(camera_);
+  path_state.vao = orbit_path_.vao;
+  queue_.push(&orbit_path_, camera_, path_state);
 
   // Reference Circle
   if(circle_visible_){
-    float circle_color_[4] = {0.5f, 1.0f, 0.5f, 1.0f};
-    glUniform4fv(pathProgram_.colorHandle_, 1, circle_color_);
-    circle_.render(camera_);
+    path_state.vao = circle_.vao;
+    queue_.push(&circle_, camera_, path_state);
   }
 
   // ... the Sweeps (own program)
-  sweeps_.render(camera_);
+  queue_.push(&sweeps_, camera_, msg::PASS_BACKGROUND);
 
   // ... the Markers
-  glUseProgram(markerProgram_.program_);
-  glUniformMatrix4fv(markerProgram_.mvpHandle_, 1, GL_FALSE, camera_.mvp);
-  markers_.render(camera_);
+  msg::RenderState marker_state;
+  marker_state.pass = msg::PASS_BACKGROUND;
+  marker_state.program = markerProgram_.program_;
+
+  marker_state.vao = markers_.vao;
+  queue_.push(&markers_, camera_, marker_state);
+
+  if(nbody_mode_){
+    marker_state.vao = nbody_sprites_.vao;
+    queue_.push(&nbody_sprites_, camera_, marker_state);
+  }
 
   /**
-   * Drag Markers
+   * Drag Markers, the blobs use the planet program
    */
-  if(arrow_visible_ || ruler_visible_){
-    glUseProgram(planetProgram_.program_);
-  }
+  msg::RenderState blob_state;
+  blob_state.pass = msg::PASS_OVERLAY;
+  blob_state.program = planetProgram_.program_;
+  blob_state.vao = handle_.vao;
+
+  const float blob_color[4] = {1.0f, 1.0, 1.0f, 0.5f};
 
   // For the arrow
   if(arrow_visible_){
     // HACK: Using the sun blob and planet program for the drag marker
-    float blob_color[4] = {1.0f, 1.0, 1.0f, 0.5f};
     float blob_offset[4] = {arrow_.x_tip_, arrow_.y_tip_, 0.0f, 0.0f};
     float blob_radius = 0.04f;
 
-    glUniform4fv(planetProgram_.colorHandle_, 1, blob_color);
-    glUniform3fv(planetProgram_.offsetHandle_, 1, blob_offset);
-    glUniform1f(planetProgram_.radiusHandle_, blob_radius);
-    handle_.render(camera_);
+    handle_.object_.update(0, blob_color, blob_offset, blob_radius);
+    queue_.push(&handle_slots_[0], camera_, blob_state);
   }
 
   // and for the ruler
   if(ruler_visible_){
+    handle_.object_.update(1, blob_color, &ruler_.handle_position[0][0], ruler_.handle_radius);
+    queue_.push(&handle_slots_[1], camera_, blob_state);
 
-    float blob_color[4] = {1.0f, 1.0, 1.0f, 0.5f};
-
-    glUniform4fv(planetProgram_.colorHandle_, 1, blob_color);
-    glUniform1f(planetProgram_.radiusHandle_, ruler_.handle_radius);
-
-    glUniform3fv(planetProgram_.offsetHandle_, 1, &ruler_.handle_position[0][0]);
-    handle_.render(camera_);
-
-    glUniform3fv(planetProgram_.offsetHandle_, 1, &ruler_.handle_position[1][0]);
-    handle_.render(camera_);
+    handle_.object_.update(2, blob_color, &ruler_.handle_position[1][0], ruler_.handle_radius);
+    queue_.push(&handle_slots_[2], camera_, blob_state);
   }
 
-  // Draw arrow
+  // Draw arrow (own program)
   if(arrow_visible_){
-    // Arrow has own program
-    arrow_.render(camera_);
+    queue_.push(&arrow_, camera_, msg::PASS_OVERLAY);
   }
 
-  // Draw the planet and the sun
-  glUseProgram(planetProgram_.program_);
-
-  // The Model View and Projection matrices. Each `node` has its own MV
-  // so we supply the p matrix separately... I guess. Can easily do it offline too.
-  glUniformMatrix4fv(planetProgram_.mvpHandle_, 1, GL_FALSE, camera_.mvp);
-//  glUniformMatrix4fv(planetProgram_.pHandle_, 1, GL_FALSE, camera_.p);
-
-  // ... Planet
+  // The planet and the sun
   float planet_color_[4] = {0.5f, 0.5f, 1.0f, 1.0f};
-  glUniform4fv(planetProgram_.colorHandle_, 1, planet_color_);
-  glUniform3fv(planetProgram_.offsetHandle_, 1, planet_.position);
-  glUniform1f(planetProgram_.radiusHandle_, planet_.radius);
-  planet_.render(camera_);
+  planet_.object_.update(0, planet_color_, planet_.position, planet_.radius);
+
+  blob_state.vao = planet_.vao;
+  queue_.push(&planet_slot_, camera_, blob_state);
 
-  // ... sun
   float sun_color_[4] = {1.0f, 1.0, 0.0f, 1.0f};
-  glUniform4fv(planetProgram_.colorHandle_, 1, sun_color_);
-  glUniform3fv(planetProgram_.offsetHandle_, 1, sun_.position);
-  glUniform1f(planetProgram_.radiusHandle_, sun_.radius);
-  sun_.render(camera_);
+  sun_.object_.update(0, sun_color_, sun_.position, sun_.radius);
+
+  blob_state.vao = sun_.vao;
+  queue_.push(&sun_slot_, camera_, blob_state);
 
   // Reference Ruler (has own program)
   if(ruler_visible_){
-    ruler_.render(camera_);
+    queue_.push(&ruler_, camera_, msg::PASS_OVERLAY);
   }
 
+  queue_.sort();
+  queue_.submit(&frame_);
+
   check_GL_error("KeplerScene::paintGL() exit");
 }
 
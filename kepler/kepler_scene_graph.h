@@ -21,6 +21,10 @@
 #include <memory>
 #include <vector>
 
+#include "kepler_nbody.h"
+#include "kepler_orbit.h"
+#include "kepler_orbit_cache.h"
+#include "kepler_orbit_worker.h"
 #include "scene_graph.h"
 
 #include <QImage>
@@ -33,273 +37,12 @@
 #define QT_NO_OPENGL_ES_2
 #include <QtWidgets/QOpenGLWidget>
 
-/**
- * Computes an orbital path around a central mass...
- */
-template <class T>
-struct Orbit{
-
-  // Distance before terminating
-  float dr_terminate_ = 0.0001f;
-
-  // Size of the sun
-  float R_sun_sq_ = 0.01f;
-
-  /*
-   * Orbit States
-   */
-  bool closed_ = false;
-  bool collision_ = false;
-
-  // Figuring out when the orbit actually closes is annoying because
-  // both CW and CCW should work and a few corner cases 90 degree.
-  // The method here checks distance to start to determine closure but
-  // only after particle has passed the Y=0 line. Before it used to
-  // compute the angle but that sort of fails for 90 degree orbits.
-  bool passed_zero_ = false;
-
-
-  /**
-   *  We are using units such that:
-   *    [L] = 1 AU
-   *    [M] = Solar Mass
-   *    [t] = 1 year
-   *
-   * then
-   *
-   *     G = 4 * pi * pi AU^3 yr^{-2} M^-1
-   *
-   * A perfectly circular orbit with R = 1 AU, centered on the Sun requires
-   *
-   *  v = sqrt(G)
-   *    = 2 * PI AU/yr
-   *    = 6.283185 AU/yr
-   *    = 29.80565 km/s
-   *
-   * but we want the circle velocity to be 30km/s so our kps_in_AU_year
-   * is slightly faked from
-   *
-   *  1 km/s = 0.210805 AU/year
-   *
-   */
-
-  // Gravitational Constant
-  T G_ = T(4 * M_PI * M_PI);
-
-  // fudged velocity conversion from km/s to AU/year ( / 30
-  T velocity_scale_ = T(2.0 * M_PI / 30.0);
-
-  // Simulation step size is 1 day
-  T dt_ = T(1.0 / 365.25);
-
-  struct OrbitPiece {
-
-    T t;
-    T x;
-    T y;
-
-    T theta;
-    T r;
-    T area;
-
-    T v_x;
-    T v_y;
-
-    void set(float t_in, float x_in, float y_in, float v_x_in, float v_y_in, float theta_in, float area_in){
-      t = t_in;
-      x = x_in;
-      y = y_in;
-      theta = theta_in;
-      r = sqrt(x * x + y * y);
-
-      v_x = v_x_in;
-      v_y = v_y_in;
-    }
-
-    std::ostream& operator<<(std::ostream& os){
-      os<<t<<" "<<x<<" "<<y<<" "<<theta<<" "<<v_x<<" "<<v_y<<" "<<" "<<r<<std::endl;
-      return os;
-    }
-  };
-
-  OrbitPiece *elements_;
-
-  int element_count_;
-
-  // These are set in the constructor!
-  int steps_max_ = 0;
-  int sub_steps_ = 0;
-
-  T t_ = T(0);
-  T t_max_ = T(0);
-
-  Orbit(int steps_max = 100000, int sub_steps = 10)
-      : steps_max_(steps_max), sub_steps_(sub_steps){
-
-    elements_ = new OrbitPiece[steps_max];
-
-  }
-
-  void calculate_force(const T r[], T a[]) {
-
-    T r_ab_dist = 0.0;
-    for (int i = 0; i < 2; ++i) {
-      r_ab_dist += pow(r[i], 2);
-    }
-
-    r_ab_dist = sqrt(r_ab_dist);
-
-    T scale = G_ / (r_ab_dist * r_ab_dist * r_ab_dist);
-
-    for (int i = 0; i < 2; ++i) {
-      a[i] = -r[i] * scale;
-    }
-  }
-
-  /**
-   *
-   * Orbit::calculate_orbit
-   *
-   *
-   * @param theta_launch_0 initial angle in radians
-   * @param v_0 [km/s]
-   *
-   * @return true if the orbit closes
-   */
-
-  void calculate_orbit(float theta_launch_0, float v_0) {
-
-    using namespace std;
-
-    const int nd = 2;
-
-    // Clear state
-    closed_ = false;
-    collision_ = false;
-    passed_zero_ = false;
-
-    T a[nd] = {0.0, 0.0};
-    T a_prev[nd] = {0.0, 0.0};
-    T v[nd] = {v_0 * velocity_scale_ * cos(theta_launch_0),
-               v_0 * velocity_scale_ * sin(theta_launch_0)};
-    T r[nd] = {0.0, 1.0};
-
-    element_count_ = 0;
-    t_ = T(0);
-
-    T dt_substep = dt_ / float(sub_steps_);
-
-#if 0
-    bool cw_direction = (theta_launch_0 <= 90) || (theta_launch_0 >= 270);
-
-    std::cout<<"Orbit::calculate_orbit: Launching with V_0 = "<<v_0
-             <<" and theta = "<<theta_launch_0
-             <<" clockwise "<<cw_direction
-             <<" dt_ "<<dt_
-             <<" dt_substep "<<dt_substep
-             << " sub_steps_ "<<sub_steps_
-             << " steps_max_ "<<steps_max_
-             <<std::endl;
-#endif
-
-    // The prev is used later...
-    calculate_force(r, a);
-
-    for (int step = 0; element_count_ < steps_max_; ++step) {
-
-      for(int sub_step = 0; sub_step < sub_steps_; ++sub_step){
-
-        T theta = atan2(r[1], r[0]);
-
-        elements_[element_count_].set(t_, r[0], r[1], theta, v[0], v[1], 0.0f);
-
-        // Integrate to new position
-        for (int i = 0; i < nd; ++i) {
-          a_prev[i] = a[i];
-          r[i] += v[i] * dt_substep + 0.5 * a[i] * dt_substep * dt_substep;
-        }
-
-        calculate_force(r, a);
-
-        for (int i = 0; i < nd; ++i) {
-          v[i] += 0.5f * (a[i] + a_prev[i]) * dt_substep;
-        }
-
-        t_ += dt_substep;
-      }
-
-      passed_zero_ = passed_zero_ || r[1] < 0.0f;
-
-      if(test_terminate(element_count_)){
-        // If the distance from the start is less than one step size then the orbit closes
-        break;
-      }
-      element_count_++;
-    }
-
-    t_max_ = elements_[element_count_ - 1].t;
-  }
-
-
-  /**
-   *
-   * Orbit::test_terminate
-   *
-   * Distance from start
-   * @param r
-   * @return true if the simulaton
-   */
-  bool test_terminate(const int element_ix){
-
-    float x = elements_[element_ix].x;
-    float y = elements_[element_ix].y;
-
-    // Check if we hit the earth
-    float dr_sq_center =  x * x + y * y;
-
-    // If planet impacted
-    collision_ = dr_sq_center < R_sun_sq_;
-
-    if(passed_zero_){
-      float dx = elements_[0].x - x;
-      float dy = elements_[0].y - y;
-      float dz = 0.0; //elements_[0].z - e.z;
-      float dr_sq = dx * dx + dy * dy + dz * dz;
-
-      // Check if we finished the orbit
-      closed_ = (dr_sq < dr_terminate_);
-    }
-
-    return collision_ || closed_;
-  }
-
-  /**
-   *
-   * @param t_target
-   * @param element_ix (output) the nearest element index
-   * @param return the element index
-   */
-  int time_interpolate(const float t_target, float* position){
-
-    int element_ix = 1;
-
-    for(int i = 0; i < element_count_; ++i){
-      if(t_target < elements_[i].t){
-        element_ix = i + 1;
-//        std::cout<<"time_interpolate: "<<i<<" target/element.t " <<t_target<<" : "<<elements_[i].t
-//                 <<" element_ix "<<element_ix<<std::endl;
-        break;
-      }
-    }
-
-    position[0] = elements_[element_ix].x;
-    position[1] = elements_[element_ix].y;
-
-    return element_ix;
-  }
-
-};
+// Orbits are sampled from the conic, the Integrator only runs for radial
+// launches. RK4 at 2 sub-steps per day is the fastest of the fixed step
+// policies and the most accurate (c.f. astrolabs_kepler_bench)
+typedef Orbit<float, RungeKutta4<float> > KeplerOrbit;
 
+typedef NBody<float, Yoshida4<float> > KeplerNBody;
 
 /**
  * Arrow shape
@@ -339,7 +82,14 @@ struct Arrow : public msg::Node {
   // Shaders
   const char *vertexShaderSource =
       "#version 330\n"
-          "uniform mat4 mvp_;\n"
+          "layout(std140) uniform FrameBlock {\n"
+          "  mat4 mvp_;\n"
+          "  mat4 mv_;\n"
+          "  mat4 p_;\n"
+          "  vec4 camera_eye_world_;\n"
+          "  vec4 camera_up_world_;\n"
+          "  vec4 camera_right_world_;\n"
+          "};\n"
           "uniform vec4 color_ = vec4(1.0, 1.0, 0.0, 0.5);\n"
           "uniform float theta_ = 0.0;\n"
           "uniform vec3 offset_ = vec3(0.0f, 1.0f, 0);\n"
@@ -379,8 +129,6 @@ struct Arrow : public msg::Node {
   GLuint positionHandle_;
 
   // Uniform handles
-  GLint mvpHandle_;
-
   GLint colorHandle_;
   GLint offsetHandle_;
   GLint thetaHandle_;
@@ -415,7 +163,6 @@ struct Arrow : public msg::Node {
     }
 
     positionHandle_ = glGetAttribLocation(program_, "position_");
-    mvpHandle_ = glGetUniformLocation(program_, "mvp_");
     colorHandle_ = glGetUniformLocation(program_, "color_");
     offsetHandle_ = glGetUniformLocation(program_, "offset_");
     thetaHandle_ = glGetUniformLocation(program_, "theta_");
@@ -659,7 +406,6 @@ struct Arrow : public msg::Node {
     // Draw
     glUseProgram(program_);
     glBindVertexArray(vao);
-    glUniformMatrix4fv(mvpHandle_, 1, GL_FALSE, camera_.mvp);
     glUniform1f(thetaHandle_, theta_);
     glUniform3fv(offsetHandle_, 1, position);
 
@@ -718,37 +464,45 @@ struct Ruler : public msg::FlatShape {
   GLuint positionHandle_;
 
   // Uniform handles
-  GLint mvpHandle_;
   GLint rHandle_;
 
   GLint colorHandle_;
   GLint offsetHandle_;
   GLint sizeHandle_;
-  GLint labelsHandle_;
 
-  // Size of the label texture
-  const static int max_label_w_ = 64;
-  const static int max_label_h_ = 64;
+  // Labels: 0-5 at the big ticks, 0.25, 0.50 and 0.75 between them and "AU"
+  const static int big_label_count_ = 6;
+  const static int small_label_count_ = 3;
+  const static int label_count_ = big_label_count_ * (small_label_count_ + 1) + 1;
+
+  // Size of the em square for the big and small labels in world units (at the default font size)
+  float label_size_big_ = 0.16f;
+  float label_size_small_ = 0.1f;
 
-  const static int max_labels_x_ = 7;
-  const static int max_labels_y_ = 2;
+  float C_label_[4] = {1.0f, 0.0f, 0.0f, 0.8f};
+
+  // Label positions relative to the center of the ruler (before rotation)
+  float label_local_[label_count_][2];
 
   // If this is 1.0 then front handle was hit if this is < -1.0 then rear handle was hit,
   // in the future this can be used to do some gradual rotation not on handles
   float handle_hit_ = 0.0f;
 
   /**
-   * Label Generator for the ruler
+   * Labels drawn from the shared glyph atlas
    */
-  msg::ImageAtlas atlas_;
+  msg::TextSet labels_;
 
 
   /**
    * Default constructor doesn't do much
+   *
+   * @param glyphs Glyph atlas for the labels
    */
-  Ruler(int tex_unit)
-      :  atlas_(tex_unit, max_label_w_, max_label_h_, max_labels_x_, max_labels_y_){
+  Ruler(msg::GlyphAtlas *glyphs)
+      :  labels_(glyphs, label_count_, 8){
 
+    generateLabels();
     reset();
   }
 
@@ -771,16 +525,14 @@ struct Ruler : public msg::FlatShape {
     }
 
     positionHandle_ = glGetAttribLocation(program_, "position");
-    mvpHandle_ = glGetUniformLocation(program_, "mvp_");
     rHandle_ = glGetUniformLocation(program_, "r_");
     colorHandle_ = glGetUniformLocation(program_, "color_");
     offsetHandle_ = glGetUniformLocation(program_, "offset_");
     sizeHandle_ = glGetUniformLocation(program_, "size_");
-    labelsHandle_ = glGetUniformLocation(program_, "labels_");
 
     setup_array(positionHandle_);
 
-    atlas_.init_resources();
+    labels_.init_resources();
     generateLabels();
 
     return check_GL_error("Ruler::build() exit");
@@ -801,83 +553,67 @@ struct Ruler : public msg::FlatShape {
    */
   void cleanup(){
     glDeleteProgram(program_);
+    labels_.cleanup();
   }
 
   /**
    *  Ruler::generate_labels
    *
+   *  Text, size and ruler coordinates of the labels, the world positions are
+   *  updated by Ruler::set_transform
+   *
    */
   void generateLabels(){
 
     using namespace std;
-    check_GL_error("RulerLabelAtlas::generate_labels() entry");
-
-    // Two sizes of labels
-    const static int label_count = max_labels_x_;
-    const static int small_label_count = 3;
-
-    const char *labels[] = {"0", "1", "2", "3", "4", "5", "AU",
-                            "0.25", "0.50", "0.75"};
-
-//    // Background color
-//    QColor C_background = Qt::yellow;
-//
-//    // The color of the border
-//    QColor C_padding = Qt::red;
-//
-    // Background color
-    QColor C_background = Qt::transparent;
-
-    // The color of the border
-    QColor C_padding = Qt::transparent;
 
-//    // The color of the
-//    QColor C_padding = Qt::transparent;
+    const char *small_labels[] = {"0.25", "0.50", "0.75"};
 
-    // Bind the texture
-    atlas_.bind();
+    const float size_big = label_size_big_ * font_size_large / default_font_size_;
+    const float size_small = label_size_small_ * font_size_small / default_font_sm_size_;
 
-    QImage image(max_label_w_, max_label_h_, QImage::Format_RGBA8888);
-    image.fill(0);
-    QPainter painter(&image);
+    // The big tick n is at x = n - 3 (c.f. ruler.vert)
+    const float x_0 = -3.0f;
 
-    painter.fillRect(image.rect(), C_padding);
-    QFont font_large = painter.font();
-    font_large.setPointSize(font_size_large);
-    font_large.setWeight(QFont::DemiBold);
-
-    QFont font_small = painter.font();
-    font_small.setPointSize(font_size_small);
-    font_small.setWeight(QFont::DemiBold);
-
-    // Draw large labels
-    for(int i = 0; i < label_count + small_label_count; ++i){
+    int ix = 0;
 
-      for(int x = 0; x < image.width(); ++x){
-        for(int y = 0; y < image.height(); ++y){
-          image.setPixel(x, y, qRgba(0, 0, 0, 0));
-        }
+    for(int n = 0; n < big_label_count_; ++n){
+
+      // Big label to the right of the tick in the bottom half
+      msg::TextSet::s_text &big = labels_.info_[ix];
+      big.text = QString::number(n);
+      big.size = size_big;
+      big.align = msg::TextSet::TEXT_LEFT;
+      label_local_[ix][0] = x_0 + n + 0.04f;
+      label_local_[ix][1] = -0.2f;
+      ++ix;
+
+      // Small labels under the quarter ticks
+      for(int i = 0; i < small_label_count_; ++i){
+        msg::TextSet::s_text &quarter = labels_.info_[ix];
+        quarter.text = small_labels[i];
+        quarter.size = size_small;
+        quarter.align = msg::TextSet::TEXT_CENTER;
+        label_local_[ix][0] = x_0 + n + 0.25f * (i + 1);
+        label_local_[ix][1] = 0.0f;
+        ++ix;
       }
+    }
 
-      painter.fillRect(QRect(1, 1, max_label_w_-1, max_label_h_-1), C_background);
-
-      // We use 2 different font sizes
-      painter.setFont( i < label_count ? font_large : font_small);
-
-      int align_flag = i < label_count ? Qt::AlignLeft : Qt::AlignCenter;
-
-      painter.drawText(QRect(1, 1, max_label_w_-1, max_label_h_-1),
-                       align_flag | Qt::AlignBaseline,
-                       labels[i]);
+    // Units after the 3
+    msg::TextSet::s_text &units = labels_.info_[ix];
+    units.text = "AU";
+    units.size = size_big;
+    units.align = msg::TextSet::TEXT_LEFT;
+    label_local_[ix][0] = x_0 + 3.3f;
+    label_local_[ix][1] = -0.2f;
 
-      // Upload the tile to the texture unit
-      atlas_.add_tile(image.bits());
+    for(int i = 0; i < label_count_; ++i){
+      std::copy(C_label_, C_label_ + 4, labels_.info_[i].color);
     }
 
-#if 0
-    atlas_.save_atlas("ruler_label_atlas.png");
-#endif
-    check_GL_error("RulerLabelAtlas::generate_labels() exit");
+    labels_.count_ = label_count_;
+    labels_.update();
   }
 
 
@@ -930,6 +666,18 @@ struct Ruler : public msg::FlatShape {
     handle_position[1][0] = position_[0] - handle_offset_x * r_mat_[0];
     handle_position[1][1] = position_[1] - handle_offset_x * r_mat_[1];
     handle_position[1][2] = 0.0f;
+
+    // Move the labels with the ruler
+    for(int i = 0; i < label_count_; ++i){
+      const float x_l = label_local_[i][0];
+      const float y_l = label_local_[i][1];
+
+      labels_.info_[i].position[0] = position_[0] + r_mat_[0] * x_l + r_mat_[4] * y_l;
+      labels_.info_[i].position[1] = position_[1] + r_mat_[1] * x_l + r_mat_[5] * y_l;
+      labels_.info_[i].rotation = angle_;
+    }
+
+    labels_.update();
   }
 
   /**
@@ -1103,20 +851,19 @@ struct Ruler : public msg::FlatShape {
     // Draw
     glUseProgram(program_);
 
-    // The Model View and Projection matrices. Each `node` has its own MV
-    // so we supply the p matrix separately... I guess. Can easily do it offline too.
-    glUniformMatrix4fv(mvpHandle_, 1, GL_FALSE, camera.mvp);
+    // The camera comes from the FrameBlock
     glUniformMatrix4fv(rHandle_, 1, GL_FALSE, r_mat_);
 
     glUniform3fv(offsetHandle_, 1, position_);
     glUniform2fv(sizeHandle_, 1, size_);
-    glUniform1i(labelsHandle_, atlas_.tex_unit_);
 
 //    float size[2] = {x_length_, y_length_};
 //    glUniform1f(angleHandle_, angle_);
     msg::FlatShape::bind();
     msg::FlatShape::render(camera);
 
+    labels_.render(camera);
+
     check_GL_error("Ruler::render() exit");
 
   }
@@ -1129,6 +876,12 @@ struct Ruler : public msg::FlatShape {
  * triangles covering the entire sweep are generated. Indices for covering the entire area twice
  * are also generated so we can render any sweeps through indices rather than uploading geometry.
  *
+ * All sweeps are drawn with one glMultiDrawElementsBaseVertex call. Sweep i gets base vertex
+ * i * capacity_ so the vertex shader can tell the sweeps apart (GL 3.3 has no gl_DrawID), the
+ * vertices are fetched from the orbit buffer through a buffer texture and the color and z offset
+ * of each sweep come from a uniform block. The buffer texture is RGBA32F with two vertices per
+ * texel, GL 3.3 only guarantees 65536 texels and the orbit can have 100000 vertices.
+ *
  */
 struct Sweeps : public msg::Node {
 
@@ -1137,31 +890,18 @@ struct Sweeps : public msg::Node {
    */
   const float sweep_alpha = 0.75f;
 
-  // Label size in world coordinates
-  const float label_scale = 1.5f;
-  const float label_height_ = 0.3f * label_scale;
-  const float label_width_ = 0.5f * label_scale;
+  // Size of the label em square in world coordinates (at the default font size)
+  const float label_size_ = 0.08f;
 
   float R_label_ = 1.50f;
 
-  int max_sweep_count_ = 32;
+  // Must match max_sweep_count in sweep.vert
+  const static int max_sweep_count_ = 256;
 
-  // Label size in pixels
-  const static int label_image_w_ = 256;
-  const static int label_image_h_ = 128;
-
-  // For drawing the main stuff
+  // Label font size, scales the labels relative to label_size_
   const int default_font_size_ = 20;
-
-  // For drawing the superscript
-  const int default_font_sm_size_ = 18;
-
-  // For drawing the main stuff
   int font_size_ = default_font_size_;
 
-  // For drawing the superscript
-  int font_sm_size_ = default_font_sm_size_;
-
   // Color catalog for sweeps
   const static int color_count_ = 15;
   const float colors[color_count_][4] = {{1.0f, 0.4f, 0.0f, sweep_alpha},
@@ -1188,13 +928,14 @@ struct Sweeps : public msg::Node {
 
   // Maximum number of elements
   int capacity_ = 0;
-  const static int stride_ = 3;
+  const static int stride_ = 2;
 
   // Number of used elements
   int size_ = 0;
 
-  // Vertices for the path
-  float *data_;
+  // Vertices, x, y pairs with the center of the sweeps first. These belong
+  // to the orbit (c.f. OrbitBuffer) and are also what the vertex buffer holds
+  const float *data_ = nullptr;
 
   // Accumulated area swept out by the path area_[0] = area from ix to ix+1;
   float *area_;
@@ -1202,29 +943,45 @@ struct Sweeps : public msg::Node {
   // We want to cover 2 full loops of sweeps so that we can start from anywhere
   unsigned int *index_;
 
-  // Geometry Vertex Array and Vertex Buffer
+  // Number of triangles in index_ and entries in area_ (c.f. Sweeps::build)
+  int loop_size_ = 0;
+
+  // Geometry Vertex Array, the vertices come from vertices_tex_ (c.f. Sweeps::init_resources)
   GLuint vao = 0;
-  GLuint vbo = 0;
+
+  // Index buffer, a copy of index_
+  GLuint ibo = 0;
+
+  // index_ has changed since it was uploaded
+  bool index_dirty_ = false;
+
+  // Indices in ibo as of the last upload, the draws never read past this
+  int index_count_ = 0;
+
+  // Buffer texture over the shared vertex buffer, two vertices per texel
+  GLuint vertices_tex_ = 0;
+  int tex_unit_vertices_ = 0;
+
+  // Uniform buffer with the color and z offset of every sweep (c.f. SweepBlock in sweep.vert)
+  GLuint ubo = 0;
+  const static int ubo_binding_ = 2;
+  const static int ubo_stride_ = 8;
 
   // Program handle
   GLuint program_;
 
-  // Position Attribute
-  GLuint positionHandle_;
-
   // Uniform handles
-  GLint mvHandle_;
-  GLint pHandle_;
+  GLint verticesHandle_;
+  GLint vertexCountHandle_;
 
-  GLint colorHandle_;
-  GLint offsetHandle_;
+  // Arguments for glMultiDrawElementsBaseVertex
+  GLsizei draw_count_[max_sweep_count_];
+  const GLvoid *draw_offset_[max_sweep_count_];
+  GLint draw_base_[max_sweep_count_];
 
   struct s_sweep {
 
-    // Index array pointer for start element
-    unsigned int *start = nullptr;
-
-    // Start element
+    // Start element in index_
     int start_ix;
 
 //    // Start and end angles (For label positioning)
@@ -1250,8 +1007,8 @@ struct Sweeps : public msg::Node {
 //    // Label
 //    float label_position[3] = {0.0f, 0.0f, 0.0f};
 
-    s_sweep(int start_ix, unsigned int *start, const float c[], float z_offset = 0.0f)
-        : start(start), start_ix(start_ix), z_offset(z_offset){
+    s_sweep(int start_ix, const float c[], float z_offset = 0.0f)
+        : start_ix(start_ix), z_offset(z_offset){
 
       for(int i = 0; i < 4; ++i){
         color[i] = c[i];
@@ -1263,40 +1020,35 @@ struct Sweeps : public msg::Node {
   std::vector <s_sweep> sweeps_list_;
 
   // Index of current sweep (last or after roll-over )
-  float sweep_ix_ = 0;
+  int sweep_ix_ = 0;
 
   // Number of sweeps sort of, it can be > sweeps_list_.size() since they roll over
   int sweep_count_ = 0;
 
-  // Texture atlas for sweep labels
-  msg::ImageAtlas labels_atlas_;
+  // Sweep labels, one string per sweep
+  msg::TextSet labels_;
 
-  // Billboard quads for the sweep labels
-  msg::BillboardSet labels_billboards_;
-
-  /**
-   * Qt Specific stuff
-   */
-  QColor C_background_ = QColor(80, 80, 80, 180);
-  QColor C_padding_ = Qt::transparent;
-  QImage label_image_;
+  float C_background_[4] = {80 / 255.0f, 80 / 255.0f, 80 / 255.0f, 180 / 255.0f};
 
 
   /**
    * Sweeps::Sweeps
    *
-   * @param tex_unit
-   * @param capacity
+   * @param glyphs Glyph atlas for the labels
+   * @param tex_unit_vertices For the vertices
+   * @param vertices Vertex positions (c.f. data_)
+   * @param capacity Number of vertices including the center
    */
-  Sweeps(int tex_unit, int capacity)
+  Sweeps(msg::GlyphAtlas *glyphs, int tex_unit_vertices, const float *vertices, int capacity)
       : capacity_(capacity),
-        labels_atlas_(tex_unit, label_image_w_, label_image_h_, max_sweep_count_),
-        labels_billboards_(max_sweep_count_){
+        data_(vertices),
+        tex_unit_vertices_(tex_unit_vertices),
+        labels_(glyphs, max_sweep_count_, 40){
 
-    labels_billboards_.quad_width_ = label_width_;
-    labels_billboards_.quad_height_ = label_height_;
+    for(int i = 0; i < max_sweep_count_; ++i){
+      std::copy(C_background_, C_background_ + 4, labels_.info_[i].background);
+    }
 
-    data_ = new float[stride_ * capacity_];
     area_ = new float[2 * capacity_];
     index_ = new unsigned int[6 * capacity_];
 
@@ -1304,7 +1056,6 @@ struct Sweeps : public msg::Node {
   }
 
   ~Sweeps(){
-    delete[] data_;
     delete[] area_;
     delete[] index_;
   };
@@ -1313,9 +1064,24 @@ struct Sweeps : public msg::Node {
    *
    * Sweeps::init_resources
    *
+   * Sweeps can use at most two vertices per buffer texture texel, capacity_
+   * is cut down to that on GPUs with small buffer textures.
+   *
+   * @param vertex_buffer GL buffer holding the vertices in data_, sized in
+   *                      whole texels (a multiple of 4 floats)
    * @return
    */
-  bool init_resources(){
+  bool init_resources(GLuint vertex_buffer){
+
+    GLint texels_max = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels_max);
+
+    if(capacity_ > 2 * texels_max){
+      std::cout << "Sweeps::init_resources GL_MAX_TEXTURE_BUFFER_SIZE " << texels_max
+                << ", sweeps limited to " << 2 * texels_max << " vertices" << std::endl;
+      capacity_ = 2 * texels_max;
+      size_ = std::min(size_, capacity_);
+    }
 
     program_ = glCreateProgram();
 
@@ -1324,37 +1090,37 @@ struct Sweeps : public msg::Node {
       return false;
     }
 
-    positionHandle_ = glGetAttribLocation(program_, "position");
+    verticesHandle_ = glGetUniformLocation(program_, "vertices_");
+    vertexCountHandle_ = glGetUniformLocation(program_, "vertex_count_");
 
-    mvHandle_ = glGetUniformLocation(program_, "mv_");
-    pHandle_ = glGetUniformLocation(program_, "p_");
-    colorHandle_ = glGetUniformLocation(program_, "color_");
-    offsetHandle_ = glGetUniformLocation(program_, "offset_");
+    glUniformBlockBinding(program_, glGetUniformBlockIndex(program_, "SweepBlock"), ubo_binding_);
 
     /**
-     * Sweep Geometry
+     * Sweep Geometry, no attributes, the vertex shader reads the vertices
+     * from the buffer texture
      */
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, stride_ * capacity_ * sizeof(float), nullptr, GL_STATIC_DRAW);
+    glGenBuffers(1, &ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * capacity_ * sizeof(unsigned int), nullptr, GL_DYNAMIC_DRAW);
 
-    glVertexAttribPointer(positionHandle_, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glEnableVertexAttribArray(positionHandle_);
+    glBindVertexArray(0);
+
+    glGenTextures(1, &vertices_tex_);
+    glActiveTexture(GL_TEXTURE0 + tex_unit_vertices_);
+    glBindTexture(GL_TEXTURE_BUFFER, vertices_tex_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, vertex_buffer);
+
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, ubo_stride_ * max_sweep_count_ * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
 
     /**
      * Labels
      */
-
-    label_image_ = QImage(label_image_w_, label_image_h_, QImage::Format_RGBA8888);
-
-    labels_atlas_.init_resources();
-
-    labels_billboards_.atlas_tex_unit_ = labels_atlas_.tex_unit_;
-    labels_billboards_.init_resources();
-    labels_billboards_.upload_billboards();
+    labels_.init_resources();
 
     return check_GL_error("Sweeps::init_resources() exit");
   }
@@ -1366,18 +1132,13 @@ struct Sweeps : public msg::Node {
    */
   void clear(){
 
-    // Add the center point
-    data_[0] = 0.0f;
-    data_[1] = 0.0f;
-    data_[2] = 0.0f;
-
+    // Just the center point
     size_ = 1;
 
     sweeps_list_.clear();
     sweep_ix_ = 0;
     sweep_count_ = 0;
-    labels_atlas_.count_ = 0;
-    labels_billboards_.count_ = 0;
+    labels_.count_ = 0;
   }
 
   /**
@@ -1385,56 +1146,35 @@ struct Sweeps : public msg::Node {
    */
   void cleanup(){
     glDeleteProgram(program_);
-    glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &ibo);
+    glDeleteBuffers(1, &ubo);
+    glDeleteTextures(1, &vertices_tex_);
+    labels_.cleanup();
   }
 
   /**
    *
-   * Sweeps::addPoint
-   *
+   * Sweeps::setSize
    *
+   * Use the first size vertices of data_ (including the center), e.g. as the
+   * orbit grows. The vertices are uploaded by whoever owns the buffer.
    *
-   * Add an orbit point.
-   * @param x
-   * @param y
-   * @param z
-   * @return
+   * @param size
    */
-  bool addPoint(float x, float y, float z){
-
-    using namespace std;
-
-#if 0
-    std::cout << " Sweep Vertices " << size_ << " - " << x << ", " << y << ", " << z << endl;
-#endif
-    int offset = stride_ * size_;
-
-    if(size_ >= capacity_ - 2){
-      cerr << "Sweep Vertices: Not enough space" << endl;
-      return false;
-    }
-
-    data_[offset] = x;
-    data_[offset + 1] = y;
-    data_[offset + 2] = z;
-    size_ += 1;
-
-    return true;
+  void setSize(int size){
+    size_ = std::min(size, capacity_);
   }
 
   /**
    *
-   * Sweeps::build_and_upload
-   *
-   * Call this after adding all the points for the sweeps it will :
+   * Sweeps::build
    *
-   *  - Build index table
-   *  - Compute sweep area
-   *  - Upload sweep geometry
+   * Build the index table and the area prefix sums from the points
    *
+   * @param closed
    */
-  void buildUpload(bool closed){
+  void build(bool closed){
 
     // First vertex is the center of the sweep.
     int vert_offset = 1;
@@ -1451,18 +1191,18 @@ struct Sweeps : public msg::Node {
 
     float area = 0.0f;
 
-    int loop_size = closed ? 2 * size_ : size_ - 3;
+    loop_size_ = closed ? 2 * size_ : size_ - 3;
 
-    for(int i = 0; i < loop_size; ++i) {
+    for(int i = 0; i < loop_size_; ++i) {
 
       int a = 0;
       int b = vert_offset;
       vert_offset = std::max(1, (vert_offset + 1) % size_);
       int c = vert_offset;
 
-      index_[ix++] = float(a);
-      index_[ix++] = float(b);
-      index_[ix++] = float(c);
+      index_[ix++] = a;
+      index_[ix++] = b;
+      index_[ix++] = c;
 
       if (i > 1) {
         if (i < size_ + 1) {
@@ -1484,13 +1224,8 @@ struct Sweeps : public msg::Node {
     std::cout<<"Sweeps::build_and_upload : Total Size "<<size_<<std::endl;
 #endif
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, stride_ * size_ * sizeof(float), data_);
-    check_GL_error("s_sweep::upload() - exit");
-
-    // We want the data transfered before we return from this to prevent stutters in the
-    // animation later (TODO: Check if this had any effect)
-    glFlush();
+    // Uploaded with the next frame (c.f. Sweeps::render)
+    index_dirty_ = true;
   }
 
   /**
@@ -1509,7 +1244,7 @@ struct Sweeps : public msg::Node {
     // three indices per triangle. use indexed arrays.
     int start_ix = 3 * orbit_point_ix;
 
-    s_sweep s = s_sweep(start_ix, &index_[start_ix], &colors[color_ix_last_][0]);
+    s_sweep s = s_sweep(start_ix, &colors[color_ix_last_][0]);
     sweep_count_ += 1;
 
     // If we are going
@@ -1518,27 +1253,30 @@ struct Sweeps : public msg::Node {
       sweeps_list_.push_back(s);
       sweep_ix_ = int(sweeps_list_.size() - 1);
     }else{
-      sweep_ix_ = sweep_count_ % max_sweep_count_;
+      sweep_ix_ = (sweep_count_ - 1) % max_sweep_count_;
       sweeps_list_.at(sweep_ix_) = s;
     }
 
-    // Init the texture coordinates
-    sweeps_list_[sweep_ix_].label_ix = labels_atlas_.add_tile();
-    writeLabel(sweeps_list_[sweep_ix_].label_ix, 0.0f, 0.0f, sweeps_list_[sweep_ix_].color);
+    // Color and z offset for the shader
+    float block[ubo_stride_] = {s.color[0], s.color[1], s.color[2], s.color[3], s.z_offset, 0.0f, 0.0f, 0.0f};
+
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, ubo_stride_ * sweep_ix_ * sizeof(float), sizeof(block), block);
 
-    labels_atlas_.get_tile_coordinates(sweep_ix_, labels_billboards_.info_[sweep_ix_].tex);
+    // One label per sweep slot
+    sweeps_list_[sweep_ix_].label_ix = sweep_ix_;
 
     color_ix_last_ = (color_ix_last_ + 1) % color_count_;
 
-    if(labels_billboards_.count_ < labels_billboards_.capacity_){
-      ++labels_billboards_.count_;
+    if(labels_.count_ < labels_.capacity_){
+      ++labels_.count_;
     }
 
-    labels_billboards_.info_[sweep_ix_].position[0] = R_label_ * label_x;
-    labels_billboards_.info_[sweep_ix_].position[1] = R_label_ * label_y;
+    labels_.info_[sweep_ix_].position[0] = R_label_ * label_x;
+    labels_.info_[sweep_ix_].position[1] = R_label_ * label_y;
+    labels_.info_[sweep_ix_].size = label_size_ * font_size_ / default_font_size_;
 
-    labels_billboards_.upload_billboards();
-    glFlush();
+    writeLabel(sweeps_list_[sweep_ix_].label_ix, 0.0f, 0.0f, sweeps_list_[sweep_ix_].color);
   }
 
   /**
@@ -1602,6 +1340,9 @@ struct Sweeps : public msg::Node {
    *
    * Sweeps::writeLabel
    *
+   * The names and the values are right aligned in their columns so the
+   * values line up as they change (c.f. TextSet)
+   *
    * @param label_ix
    * @param area
    * @param days
@@ -1609,136 +1350,116 @@ struct Sweeps : public msg::Node {
    */
   void writeLabel(int label_ix, float area, float days, const float color[]){
 
-    using namespace std;
+    std::copy(color, color + 4, labels_.info_[label_ix].color);
+
+    labels_.set_text(label_ix, QString::fromUtf8("A =\t%1\t AU\u00b2\nt =\t%2\t days")
+                                   .arg(area, 0, 'f', 2)
+                                   .arg(days, 0, 'f', 2));
+  }
+
+  /**
+   *
+   * Sweeps::render
+   *
+   */
+  void render(Camera <float> &camera_){
 
-    int x_padding = 10;
+    // Draw Sweep geometry
+    glUseProgram(program_);
+    glBindVertexArray(vao);
 
-    // Bind the texture
-    labels_atlas_.bind();
-    label_image_.fill(0);
+    if(index_dirty_){
+      index_count_ = 3 * std::max(0, loop_size_);
+      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, index_count_ * sizeof(unsigned int), index_);
+      index_dirty_ = false;
+    }
 
-    QPainter painter(&label_image_);
+    glActiveTexture(GL_TEXTURE0 + tex_unit_vertices_);
+    glBindTexture(GL_TEXTURE_BUFFER, vertices_tex_);
+    glUniform1i(verticesHandle_, tex_unit_vertices_);
+    glUniform1i(vertexCountHandle_, capacity_);
 
-    QPen pen(QColor(255 * color[0], 255 * color[1], 255 * color[2], 255 * color[3]));
+    glBindBufferBase(GL_UNIFORM_BUFFER, ubo_binding_, ubo);
 
-    painter.setPen(pen);
-    painter.fillRect(label_image_.rect(), C_padding_);
+    int draw_count = 0;
 
-    // Create fonts (TODO: Move out)
-    QFont font = painter.font();
-    font.setWeight(QFont::Bold);
-    font.setPointSize(font_size_);
-    QFontMetrics fm(font);
+    for(const s_sweep &s : sweeps_list_){
+      // The counts follow size_, an open orbit has fewer indices than the
+      // closed one a sweep may have started on
+      draw_count_[draw_count] = std::max(0, std::min(s.count, index_count_ - s.start_ix));
+      draw_offset_[draw_count] = (const GLvoid *) (s.start_ix * sizeof(unsigned int));
+      draw_base_[draw_count] = draw_count * capacity_;
+      ++draw_count;
+    }
+
+    if(draw_count > 0){
+      glMultiDrawElementsBaseVertex(GL_TRIANGLES, draw_count_, GL_UNSIGNED_INT, draw_offset_, draw_count, draw_base_);
+    }
 
-    QFont font_small = painter.font();
-    font_small.setPointSize(font_sm_size_);
-    font_small.setWeight(QFont::Bold);
-    QFontMetrics fm_small(font_small);
+#if 0
+    // Draw the entire sweep
+    glDrawElements(GL_TRIANGLES, 3 * loop_size_, GL_UNSIGNED_INT, nullptr);
+#endif
 
-    // We have to draw the t =, number and units separately to get the justifying correct.
-    const char *label_area = "A =";
-    const char *label_time = "t =";
+    // Draw the labels
+    labels_.render(camera_);
+    check_GL_error("Sweeps::render(Camera<float>& camera_) exit ");
+  }
 
-    const char *label_AU = " AU";
-    const char *label_days = " days";
-    const char *max_value = "9999.00";
+};
 
-    QString area_str = QString::number(area, 'f', 2);
-    QString days_str = QString::number(days, 'f', 2);
 
-    // Figure out column widths
-    int prefix_width = max(fm.width(label_area), fm.width(label_time));
-    int value_width = fm.width(max_value);
-    int suffix_width = max(fm.width(label_AU), fm.width(label_days));
+/**
+ * Path drawn in a single color with a msg::PathProgram, the color is set
+ * when the RenderQueue draws it
+ */
+struct ColoredPath : public msg::Path {
 
-    int text_height = fm.height();
+  float color_[4] = {1.0f, 1.0f, 1.0f, 1.0f};
 
-    // TODO: Add more "white-space" on the left and right of label
+  // Color uniform of the program in the path's RenderState
+  GLint colorHandle_ = -1;
 
-    int y_offset_1 = int(0.5f * fm_small.height() + x_padding);
-    int y_offset_2 = y_offset_1 + text_height;
+  ColoredPath(){
 
+  }
 
-    // Use the big font
-    painter.setFont(font);
+  ColoredPath(int capacity) : msg::Path(capacity){
 
-#if 0
-    //
-    painter.fillRect(QRect(x_padding, x_padding, prefix_width + value_width + suffix_width,
-                           y_offset_2 + text_height), C_background_);
-#else
-    painter.fillRect(QRect(0, 0, 2 * x_padding + prefix_width + value_width + suffix_width,
-                           y_offset_2 + text_height + x_padding), C_background_);
-#endif
-    // The Area
-    painter.drawText(QRect(x_padding, y_offset_1, prefix_width, text_height),
-                     Qt::AlignRight | Qt::AlignBaseline, label_area);
-    painter.drawText(QRect(x_padding + prefix_width, y_offset_1, value_width, text_height),
-                     Qt::AlignRight | Qt::AlignBaseline, area_str);
-    painter.drawText(QRect(x_padding + prefix_width + value_width, y_offset_1, value_width, text_height),
-                     Qt::AlignLeft | Qt::AlignBaseline, label_AU);
-
-    // The time
-    painter.drawText(QRect(x_padding, y_offset_2, prefix_width, text_height),
-                     Qt::AlignRight | Qt::AlignBaseline, label_time);
-    painter.drawText(QRect(x_padding + prefix_width, y_offset_2, value_width, text_height),
-                     Qt::AlignRight | Qt::AlignBaseline, days_str);
-    painter.drawText(QRect(x_padding + prefix_width + value_width, y_offset_2, value_width, text_height),
-                     Qt::AlignLeft | Qt::AlignBaseline, label_days);
-
-
-    // Superscript 2 for AU^2
-    painter.setFont(font_small);
-    painter.drawText(QRect(x_padding + prefix_width + value_width + fm.width(label_AU), x_padding,
-                           1.5f * fm_small.width("2"), fm_small.height()),
-                     Qt::AlignLeft | Qt::AlignBaseline, "2");
-
-    // Upload the texture
-    labels_atlas_.update_tile(label_ix, label_image_.bits());
+  }
 
-#if 0
-    image_.save("sweep_label.png");
-    labels_atlas_.save_atlas("sweep_label_atlas.png");
-#endif
-//    check_GL_error("SweepLabelAtlas::writeLabel() exit ");
+  virtual void draw(Camera<float> &camera){
+    glUniform4fv(colorHandle_, 1, color_);
+    msg::Path::render(camera);
   }
+};
 
-  /**
-   *
-   * Sweeps::render
-   *
-   */
-  void render(Camera <float> &camera_){
+/**
+ * One ObjectBlock slot of a Billboard, so the same billboard can be queued
+ * more than once (e.g. the three drag handles)
+ */
+struct BillboardSlot : public msg::Node {
 
-    // Draw Sweep geometry
-    glUseProgram(program_);
-    glBindVertexArray(vao);
+  msg::Billboard *billboard_;
+  int slot_;
 
-    // TODO: Cleanup
-    glUniformMatrix4fv(mvHandle_, 1, GL_FALSE, camera_.mv);
-    glUniformMatrix4fv(pHandle_, 1, GL_FALSE, camera_.p);
+  BillboardSlot(msg::Billboard *billboard, int slot) : billboard_(billboard), slot_(slot){
 
-    int i = 0;
+  }
 
-    for(const s_sweep &s : sweeps_list_){
-      glUniform4fv(colorHandle_, 1, s.color);
-      glDrawElements(GL_TRIANGLES, s.count, GL_UNSIGNED_INT, s.start);
-      ++i;
-    }
+  virtual void cleanup(){
 
-#if 0
-    // Draw the entire sweep
-    float color[4] = {1.0f, 1.0f, 0.0f, 1.0f};
-    glUniform4fv(colorHandle_, 1, color);
-    glDrawElements(GL_TRIANGLES, capacity_, GL_UNSIGNED_INT, index_);
-#endif
+  }
 
-    // Draw the labels
-    labels_atlas_.bind();
-    labels_billboards_.render(camera_);
-    check_GL_error("Sweeps::render(Camera<float>& camera_) exit ");
+  virtual void render(Camera<float> &camera){
+    glBindVertexArray(billboard_->vao);
+    draw(camera);
   }
 
+  virtual void draw(Camera<float> &camera){
+    billboard_->object_.bind(slot_);
+    billboard_->draw(camera);
+  }
 };
 
 
@@ -1764,7 +1485,6 @@ public:
     ruler_.font_size_small = int(ruler_font_scale * ruler_.default_font_sm_size_);
 
     sweeps_.font_size_ = int(sweep_font_scale * sweeps_.default_font_size_);
-    sweeps_.font_sm_size_ = int(sweep_font_scale * sweeps_.default_font_sm_size_);
   }
 
   void initializeGL();
@@ -1832,11 +1552,13 @@ public:
   void startSweep(){
 
     sweep_element_ix_ = element_ix_;
+    sweep_start_ix_ = element_ix_;
+    t_sweep_start_ = t_animation_;
 
     // Create a new s_sweep starting from this element
     sweeps_.addSweep(sweep_element_ix_,
-                     orbit_.elements_[element_ix_ + 1].x,
-                     orbit_.elements_[element_ix_ + 1].y);
+                     orbit_.elements_->x(element_ix_ + 1),
+                     orbit_.elements_->y(element_ix_ + 1));
     sweep_running_ = true;
   }
 
@@ -1855,6 +1577,22 @@ public:
     return sweeps_.sweep_count_ < sweeps_.max_sweep_count_;
   }
 
+  /**
+   *
+   * In N-body mode the launched planet shares the system with a moon and an
+   * asteroid belt that all pull on each other. The system is stepped every
+   * frame instead of being precomputed, so there is no path or sweeps.
+   *
+   * @param enabled Takes effect with the next launch
+   */
+  void setNBodyMode(bool enabled){
+    nbody_mode_ = enabled;
+  }
+
+  bool isNBodyMode(){
+    return nbody_mode_;
+  }
+
   void showCircle(bool visible){
     circle_visible_ = visible;
     update();
@@ -2002,9 +1740,16 @@ protected:
   // Current element on path
   int element_ix_;
 
+  // Time along the orbit [years], the planet is interpolated to this time
+  float t_animation_ = 0.0f;
+
   // The element_ix for sweeps
   int sweep_element_ix_;
 
+  // Where the running sweep started
+  int sweep_start_ix_ = 0;
+  float t_sweep_start_ = 0.0f;
+
   float position_[2];
 
   /**
@@ -2026,8 +1771,8 @@ protected:
   /**
    * Map out the texture units
    */
-  const static int tex_unit_ruler_ = 0;
-  const static int tex_unit_sweeps_ = 1;
+  const static int tex_unit_glyphs_ = 0;
+  const static int tex_unit_sweep_vertices_ = 2;
 
   /**
    * Internal State
@@ -2036,13 +1781,75 @@ protected:
   // The camera
   Camera<float> camera_;
 
-  // The simulation
-  Orbit<float> orbit_;
+  // The simulation, its element positions are the vertices of the path,
+  // markers and sweeps (c.f. orbit_vbo_)
+  KeplerOrbit orbit_;
+
+  // GL copy of orbit_.elements_->position_
+  GLuint orbit_vbo_ = 0;
+
+  // Previously computed orbits and their geometry
+  OrbitCache<KeplerOrbit> orbit_cache_;
+
+  // Computes orbits off the GUI thread, orbit_ receives the elements
+  OrbitWorker<KeplerOrbit> orbit_worker_;
+
+  // Elements are still coming in from orbit_worker_
+  bool orbit_streaming_ = false;
+
+  // Cache key of the orbit being streamed
+  long long orbit_key_ = 0;
+
+  /**
+   * N-body mode
+   */
+  bool nbody_mode_ = false;
+
+  KeplerNBody nbody_;
+
+  // Ids of the launched planet and its moon in nbody_
+  int nbody_planet_id_ = -1;
+  int nbody_moon_id_ = -1;
+
+  // Asteroids in the belt and the masses [solar masses]. The planet is a few
+  // Jupiters so the moon sits well inside its Hill sphere (~0.1 AU at 1 AU)
+  const static int nbody_asteroid_count_ = 1000;
+  float nbody_planet_mass_ = 5e-3f;
+  float nbody_moon_mass_ = 1e-5f;
+  float nbody_asteroid_mass_ = 1e-9f;
+
+  // Distance from the moon to the planet [AU]
+  float nbody_moon_distance_ = 0.05f;
+
+  // Belt between these radii [AU]
+  float nbody_belt_min_ = 1.6f;
+  float nbody_belt_max_ = 3.2f;
+
+  // Sprite sizes [pixels]
+  float radius_moon_ = 8.0f;
+  float radius_asteroid_ = 3.0f;
+
+  void startNBody();
+
+  void updateNBody(float dt);
+
+  void receiveOrbit();
+
+  void uploadElements(int first, int count);
+
+  void updateGeometry();
+
+  void storeOrbit(long long key);
+
+  void restoreOrbit(const OrbitCache<KeplerOrbit>::Entry &entry);
 
   /**
    * Scene Graph
    */
 
+  // SDF glyphs for the sweep and ruler labels
+  msg::GlyphAtlas glyphs_;
+
   // The sun
   msg::Billboard sun_;
 
@@ -2062,15 +1869,32 @@ protected:
   msg::Sprites markers_;
   msg::SpriteProgram markerProgram_;
 
+  // The bodies of nbody_ other than the planet (same program as the markers)
+  msg::Sprites nbody_sprites_;
+
   // This is the white line made by the orbit
-  msg::Path orbit_path_;
+  ColoredPath orbit_path_;
 
   // This is the reference circle
-  msg::Path circle_;
+  ColoredPath circle_;
 
   // Program for drawing msg::Paths
   msg::PathProgram pathProgram_;
 
+  // Nodes changed since the last frame, uploaded at the top of paintGL
+  msg::UploadScheduler uploads_;
+
+  // Camera block bound once per frame
+  msg::FrameUniforms frame_;
+
+  // The draws of a frame (c.f. KeplerScene::paintGL)
+  msg::RenderQueue queue_;
+
+  // The planet, the sun and the arrow and ruler handles as queued draws
+  BillboardSlot planet_slot_ = BillboardSlot(&planet_, 0);
+  BillboardSlot sun_slot_ = BillboardSlot(&sun_, 0);
+  BillboardSlot handle_slots_[3] = {BillboardSlot(&handle_, 0), BillboardSlot(&handle_, 1), BillboardSlot(&handle_, 2)};
+
   // Sweep macro-node (contains own programs)
   Sweeps sweeps_;
 